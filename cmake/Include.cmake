@@ -9,3 +9,18 @@ include_directories(${Boost_INCLUDE_DIRS})
 include_directories(${APR_INCLUDE_DIR})
 include_directories(${APACHE_INCLUDE_DIR})
 include_directories(${CURL_INCLUDE_DIR})
+
+# Optional regex engines, selected with DupRegexEngine
+find_package(PCRE2 QUIET)
+find_package(RE2 QUIET)
+set(REGEX_LIBRARIES )
+if(PCRE2_FOUND)
+	add_definitions(-DHAVE_PCRE2)
+	include_directories(${PCRE2_INCLUDE_DIR})
+	set(REGEX_LIBRARIES ${REGEX_LIBRARIES} ${PCRE2_LIBRARIES})
+endif()
+if(RE2_FOUND)
+	add_definitions(-DHAVE_RE2)
+	include_directories(${RE2_INCLUDE_DIR})
+	set(REGEX_LIBRARIES ${REGEX_LIBRARIES} ${RE2_LIBRARIES})
+endif()
@@ -0,0 +1,19 @@
+# Defines
+# PCRE2_FOUND
+# PCRE2_INCLUDE_DIR
+# PCRE2_LIBRARIES
+
+find_path(PCRE2_INCLUDE_DIR NAMES pcre2.h DOC "Directory containing pcre2.h")
+
+find_library(PCRE2_LIBRARY NAMES pcre2-8 DOC "Path to the 8 bit pcre2 library")
+
+# handle the QUIETLY and REQUIRED arguments and set PCRE2_FOUND to TRUE if
+# all listed variables are TRUE
+include(FindPackageHandleStandardArgs)
+find_package_handle_standard_args(PCRE2 DEFAULT_MSG PCRE2_LIBRARY PCRE2_INCLUDE_DIR)
+
+if(PCRE2_FOUND)
+	set(PCRE2_LIBRARIES ${PCRE2_LIBRARY})
+else(PCRE2_FOUND)
+	set(PCRE2_LIBRARIES )
+endif(PCRE2_FOUND)
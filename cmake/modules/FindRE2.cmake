@@ -0,0 +1,19 @@
+# Defines
+# RE2_FOUND
+# RE2_INCLUDE_DIR
+# RE2_LIBRARIES
+
+find_path(RE2_INCLUDE_DIR NAMES re2/re2.h DOC "Directory containing re2/re2.h")
+
+find_library(RE2_LIBRARY NAMES re2 DOC "Path to the re2 library")
+
+# handle the QUIETLY and REQUIRED arguments and set RE2_FOUND to TRUE if
+# all listed variables are TRUE
+include(FindPackageHandleStandardArgs)
+find_package_handle_standard_args(RE2 DEFAULT_MSG RE2_LIBRARY RE2_INCLUDE_DIR)
+
+if(RE2_FOUND)
+	set(RE2_LIBRARIES ${RE2_LIBRARY})
+else(RE2_FOUND)
+	set(RE2_LIBRARIES )
+endif(RE2_FOUND)
@@ -0,0 +1,85 @@
+/*
+* mod_dup - duplicates apache requests
+*
+* Copyright (C) 2013 Orange
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#pragma once
+
+#include <boost/utility/string_ref.hpp>
+#include <cstring>
+#include <string>
+
+namespace DupModule {
+
+/**
+ * @brief A parameter of a query string or of an url encoded body, pointing into it
+ */
+struct tArgView {
+	/** @brief The key, case as in the text */
+	boost::string_ref mKey;
+	/** @brief The value, still url encoded. Empty if the parameter has no '=' */
+	boost::string_ref mValue;
+	/** @brief The whole parameter, key=value */
+	boost::string_ref mParam;
+};
+
+/**
+ * @brief Iterates over the parameters of a query string or of an url encoded body without copying nor decoding them.
+ * Empty parameters are skipped, like boost::tokenizer did.
+ * The text must outlive the parser and the views it returns.
+ */
+class ArgsParser
+{
+private:
+	const char *mPos;
+	const char *mEnd;
+
+public:
+	explicit ArgsParser(const std::string &pArgs)
+		: mPos(pArgs.data()), mEnd(pArgs.data() + pArgs.size()) {}
+
+	/**
+	 * @brief Get the next parameter
+	 * @param pArg receives it
+	 * @return false if there is none left
+	 */
+	bool
+	next(tArgView &pArg) {
+		while (mPos != mEnd && *mPos == '&') {
+			++mPos;
+		}
+		if (mPos == mEnd) {
+			return false;
+		}
+		const char *lEnd = static_cast<const char *>(memchr(mPos, '&', mEnd - mPos));
+		if (!lEnd) {
+			lEnd = mEnd;
+		}
+		const char *lEqual = static_cast<const char *>(memchr(mPos, '=', lEnd - mPos));
+		pArg.mParam = boost::string_ref(mPos, lEnd - mPos);
+		if (lEqual) {
+			pArg.mKey = boost::string_ref(mPos, lEqual - mPos);
+			pArg.mValue = boost::string_ref(lEqual + 1, lEnd - lEqual - 1);
+		} else {
+			pArg.mKey = pArg.mParam;
+			pArg.mValue = boost::string_ref();
+		}
+		mPos = lEnd;
+		return true;
+	}
+};
+
+}
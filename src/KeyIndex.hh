@@ -0,0 +1,138 @@
+/*
+* mod_dup - duplicates apache requests
+*
+* Copyright (C) 2013 Orange
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#pragma once
+
+#include <boost/utility/string_ref.hpp>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace DupModule {
+
+/**
+ * @brief A flat open addressing hash table from upper case keys to values, looked up with keys of any case
+ * which are hashed and compared in place, without copy.
+ * Built at configuration time, it is then only read by the worker threads.
+ */
+template <class Value>
+class KeyIndex
+{
+private:
+	/** @brief A slot of the table: the hash of a key and the position of its entry plus one, 0 if free */
+	struct tSlot {
+		size_t mHash;
+		size_t mEntry;
+	};
+
+	/** @brief The keys and their values, in insertion order */
+	std::vector<std::pair<std::string, Value> > mEntries;
+	/** @brief The slots, a power of 2 of them, at most half used so that probe sequences stay short */
+	std::vector<tSlot> mSlots;
+
+	static char
+	upper(char pChar) {
+		return pChar >= 'a' && pChar <= 'z' ? pChar - ('a' - 'A') : pChar;
+	}
+
+	void
+	place(size_t pHash, size_t pEntry) {
+		size_t lMask = mSlots.size() - 1;
+		size_t i = pHash & lMask;
+		while (mSlots[i].mEntry) {
+			i = (i + 1) & lMask;
+		}
+		mSlots[i].mHash = pHash;
+		mSlots[i].mEntry = pEntry + 1;
+	}
+
+public:
+	/**
+	 * @brief Hash a key as if it were upper cased (FNV-1a)
+	 */
+	static size_t
+	hash(boost::string_ref pKey) {
+		size_t lHash = 14695981039346656037ULL;
+		for (boost::string_ref::const_iterator it = pKey.begin(); it != pKey.end(); ++it) {
+			lHash ^= static_cast<unsigned char>(upper(*it));
+			lHash *= 1099511628211ULL;
+		}
+		return lHash;
+	}
+
+	/**
+	 * @brief Add a key, which must not be in the index already
+	 * @param pKey the key, upper case
+	 * @param pValue its value
+	 */
+	void
+	insert(const std::string &pKey, const Value &pValue) {
+		mEntries.push_back(std::make_pair(pKey, pValue));
+		if (2 * mEntries.size() > mSlots.size()) {
+			// Grown, then filled again
+			mSlots.assign(mSlots.empty() ? 16 : 2 * mSlots.size(), tSlot());
+			for (size_t e = 0; e < mEntries.size(); ++e) {
+				place(hash(mEntries[e].first), e);
+			}
+		} else {
+			place(hash(pKey), mEntries.size() - 1);
+		}
+	}
+
+	/**
+	 * @brief Returns the value of a key, compared case insensitively, NULL if it is not in the index
+	 */
+	const Value *
+	find(boost::string_ref pKey) const {
+		if (mSlots.empty()) {
+			return NULL;
+		}
+		size_t lHash = hash(pKey);
+		size_t lMask = mSlots.size() - 1;
+		for (size_t i = lHash & lMask; mSlots[i].mEntry; i = (i + 1) & lMask) {
+			if (mSlots[i].mHash != lHash) {
+				continue;
+			}
+			const std::pair<std::string, Value> &lEntry = mEntries[mSlots[i].mEntry - 1];
+			if (lEntry.first.size() != pKey.size()) {
+				continue;
+			}
+			size_t j = 0;
+			while (j < pKey.size() && upper(pKey[j]) == lEntry.first[j]) {
+				++j;
+			}
+			if (j == pKey.size()) {
+				return &lEntry.second;
+			}
+		}
+		return NULL;
+	}
+
+	void
+	clear() {
+		mEntries.clear();
+		mSlots.clear();
+	}
+
+	bool
+	empty() const {
+		return mEntries.empty();
+	}
+};
+
+}
@@ -0,0 +1,167 @@
+/*
+* mod_dup - duplicates apache requests
+*
+* Copyright (C) 2013 Orange
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <utility>
+
+namespace DupModule {
+
+/**
+ * @brief A bounded multi-producer multi-consumer lock-free ring buffer.
+ * Each cell carries a sequence number telling producers and consumers whether it is free or filled
+ * for the current lap, so that a push or a pop only costs one compare-and-swap on the shared position.
+ * The capacity is rounded up to the next power of two. push and pop never block: they return false
+ * when the ring is full or empty and leave the waiting policy to the caller.
+ * T must be default constructible and assignable.
+ */
+template <typename T>
+class LockFreeRing
+{
+private:
+	/** @brief A slot of the ring */
+	struct tCell {
+		/** @brief Position this cell is ready for: pos when free, pos + 1 when filled */
+		size_t mSequence;
+		/** @brief The stored item */
+		T mData;
+	};
+
+	/** @brief Avoid false sharing between the fields written by producers and consumers */
+	static const size_t mCacheLine = 64;
+
+	/** @brief The cells of the ring */
+	tCell *mCells;
+	/** @brief Capacity - 1, capacity being a power of two */
+	size_t mMask;
+	char mPad0[mCacheLine];
+	/** @brief Next position to be written by a producer */
+	size_t mEnqueuePos;
+	char mPad1[mCacheLine];
+	/** @brief Next position to be read by a consumer */
+	size_t mDequeuePos;
+	char mPad2[mCacheLine];
+
+	LockFreeRing(const LockFreeRing &);
+	LockFreeRing &operator=(const LockFreeRing &);
+
+public:
+	/**
+	 * @brief Constructs an empty ring with no capacity. Call init before use.
+	 */
+	LockFreeRing() : mCells(NULL), mMask(0), mEnqueuePos(0), mDequeuePos(0) {}
+
+	~LockFreeRing() {
+		delete[] mCells;
+	}
+
+	/**
+	 * @brief Allocate the cells. Not thread safe: must be called before the ring is shared.
+	 * @param pCapacity the minimal number of items the ring can hold
+	 */
+	void init(size_t pCapacity) {
+		size_t lCapacity = 2;
+		while (lCapacity < pCapacity) {
+			lCapacity <<= 1;
+		}
+		delete[] mCells;
+		mCells = new tCell[lCapacity];
+		for (size_t i = 0; i < lCapacity; ++i) {
+			mCells[i].mSequence = i;
+		}
+		mMask = lCapacity - 1;
+		mEnqueuePos = mDequeuePos = 0;
+	}
+
+	/**
+	 * @brief Returns the number of items the ring can hold
+	 */
+	size_t capacity() const {
+		return mCells ? mMask + 1 : 0;
+	}
+
+	/**
+	 * @brief Adds an item at the back of the ring
+	 * @param pObject the item to add, moved from if it is an rvalue
+	 * @return false if the ring is full, in which case nothing was added
+	 */
+	template <typename U>
+	bool push(U &&pObject) {
+		tCell *lCell;
+		size_t lPos = __atomic_load_n(&mEnqueuePos, __ATOMIC_RELAXED);
+		for (;;) {
+			lCell = &mCells[lPos & mMask];
+			size_t lSeq = __atomic_load_n(&lCell->mSequence, __ATOMIC_ACQUIRE);
+			ptrdiff_t lDiff = static_cast<ptrdiff_t>(lSeq) - static_cast<ptrdiff_t>(lPos);
+			if (lDiff == 0) {
+				if (__atomic_compare_exchange_n(&mEnqueuePos, &lPos, lPos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+					break;
+				}
+			} else if (lDiff < 0) {
+				// The cell still holds the item of the previous lap
+				return false;
+			} else {
+				lPos = __atomic_load_n(&mEnqueuePos, __ATOMIC_RELAXED);
+			}
+		}
+		lCell->mData = std::forward<U>(pObject);
+		__atomic_store_n(&lCell->mSequence, lPos + 1, __ATOMIC_RELEASE);
+		return true;
+	}
+
+	/**
+	 * @brief Removes the item at the front of the ring
+	 * @param pObject receives the item
+	 * @return false if the ring is empty, in which case pObject is untouched
+	 */
+	bool pop(T &pObject) {
+		tCell *lCell;
+		size_t lPos = __atomic_load_n(&mDequeuePos, __ATOMIC_RELAXED);
+		for (;;) {
+			lCell = &mCells[lPos & mMask];
+			size_t lSeq = __atomic_load_n(&lCell->mSequence, __ATOMIC_ACQUIRE);
+			ptrdiff_t lDiff = static_cast<ptrdiff_t>(lSeq) - static_cast<ptrdiff_t>(lPos + 1);
+			if (lDiff == 0) {
+				if (__atomic_compare_exchange_n(&mDequeuePos, &lPos, lPos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+					break;
+				}
+			} else if (lDiff < 0) {
+				// Nothing published in this cell yet
+				return false;
+			} else {
+				lPos = __atomic_load_n(&mDequeuePos, __ATOMIC_RELAXED);
+			}
+		}
+		pObject = std::move(lCell->mData);
+		__atomic_store_n(&lCell->mSequence, lPos + mMask + 1, __ATOMIC_RELEASE);
+		return true;
+	}
+
+	/**
+	 * @brief Returns an approximation of the number of items in the ring
+	 * @return the size, exact when no push or pop is in progress
+	 */
+	size_t size() const {
+		size_t lDequeuePos = __atomic_load_n(&mDequeuePos, __ATOMIC_ACQUIRE);
+		size_t lEnqueuePos = __atomic_load_n(&mEnqueuePos, __ATOMIC_ACQUIRE);
+		return lEnqueuePos > lDequeuePos ? lEnqueuePos - lDequeuePos : 0;
+	}
+};
+
+}
@@ -23,21 +23,76 @@
 #include <boost/thread.hpp>
 
 #include "Log.hh"
+#include "LockFreeRing.hh"
 
 namespace DupModule {
 
+/**
+ * @brief The storage used by a MultiThreadQueue
+ */
+enum eQueueBackend {
+	/** A std::deque protected by a mutex */
+	LOCKED_DEQUE,
+	/** A bounded lock-free ring, producers never take a lock */
+	LOCK_FREE_RING,
+};
+
+/**
+ * @brief What a MultiThreadQueue with a memory budget drops when it fills up
+ */
+enum eAdmissionPolicy {
+	/** Drop incoming items only once the budget is exhausted */
+	DROP_WHEN_FULL,
+	/** Past half the budget, also drop incoming items larger than an eighth of the remaining room */
+	DROP_LARGE_FIRST,
+};
+
+/**
+ * @brief Returns the number of bytes an item holds, used to enforce the memory budget of a MultiThreadQueue.
+ * Overload it in the namespace of an item type which owns memory outside of itself.
+ */
+template <typename T>
+size_t queueItemSize(const T &) {
+	return sizeof(T);
+}
+
+/**
+ * @brief Returns true if an item is the poison pill of the consumers, which MultiThreadQueue::clear does not count as dropped.
+ * Overload it in the namespace of an item type without operator==.
+ */
+template <typename T>
+bool isQueueItemPoison(const T &pItem, const T &pPoison) {
+	return pItem == pPoison;
+}
+
 /**
  * @brief A thread safe (using boost::mutex and boost::condition_variable) wrapper around a std::deque.
  * It exposes the typical FIFO methods pop and push as well as push_front which makes it possible to add a prioritized item to the front of the queue.
  * It also keeps track of 3 counters for the number of pushed, popped and dropped items. getCounters will return those values and reset them.
  * The class gets the queue item type as its template argument. This makes it independent of any business needs and therefore more easily reusable.
+ * With the LOCK_FREE_RING backend, items go through a LockFreeRing instead: push takes no lock and only wakes a consumer if one is parked.
+ * Prioritized items are then kept in a separate, seldom used, locked lane which consumers check first.
+ * Besides the number of items, the queue can be bounded by the bytes its items hold (see queueItemSize).
  */
 template <typename T>
 class MultiThreadQueue
 {
 private:
+	/** @brief Capacity of the ring when no drop size is set */
+	static const size_t mDefaultRingCapacity = 65536;
+	/** @brief Number of times a consumer retries an empty ring before parking */
+	static const unsigned mSpinCount = 64;
+
+	/** @brief The storage currently in use */
+	eQueueBackend mBackend;
 	/** @brief The underlying queue holding the itms */
 	std::deque<T> mQueue;
+	/** @brief The ring holding the items with the LOCK_FREE_RING backend */
+	LockFreeRing<T> mRing;
+	/** @brief Number of prioritized items waiting in mQueue with the LOCK_FREE_RING backend */
+	size_t mPriorityCount;
+	/** @brief Number of consumers parked on mAvailableCondition with the LOCK_FREE_RING backend */
+	unsigned mWaiting;
 	/** @brief The mutex used to ensure thread safety */
 	boost::mutex mMutex;
 	/** @brief Used to make pull-clients wait and wake them up when necessary */
@@ -50,69 +105,403 @@ private:
 	unsigned mDropCount;
 	/** @brief Maximum number of items to be queued after which any new ones should get dropped */
 	size_t mDropSize;
+	/** @brief Bytes held by the queued items */
+	size_t mQueuedBytes;
+	/** @brief Bytes held by the items dropped since last call to getByteCounters */
+	size_t mDroppedBytes;
+	/** @brief Maximum number of bytes held by the queued items, 0 if unbounded */
+	size_t mMemoryBudget;
+	/** @brief What to drop when the budget runs out */
+	eAdmissionPolicy mAdmissionPolicy;
 
-public:
 	/**
-	 * @brief Constructs a MultiThreadQueue
+	 * @brief Account for the bytes of an incoming item, unless it does not fit in the memory budget
+	 * @param pSize the bytes held by the item
+	 * @return true if the item can be queued, false if it must be dropped
 	 */
-	MultiThreadQueue() : mInCount(0), mOutCount(0), mDropCount(0), mDropSize(0) {}
+	bool admit(size_t pSize) {
+		size_t lQueued = __sync_add_and_fetch(&mQueuedBytes, pSize);
+		if (mMemoryBudget) {
+			bool lDrop = lQueued > mMemoryBudget;
+			if (!lDrop && mAdmissionPolicy == DROP_LARGE_FIRST) {
+				size_t lBefore = lQueued - pSize;
+				lDrop = lBefore > mMemoryBudget / 2 && pSize > (mMemoryBudget - lBefore) / 8;
+			}
+			if (lDrop) {
+				__sync_fetch_and_sub(&mQueuedBytes, pSize);
+				drop(pSize);
+				return false;
+			}
+		}
+		return true;
+	}
 
 	/**
-	 * @brief Adds the given object to the back of the queue so it will be the last one to be pulled
-	 * @param object The object to be inserted
+	 * @brief Account for a dropped item
+	 * @param pSize the bytes held by the item
+	 */
+	void drop(size_t pSize) {
+		__sync_fetch_and_add(&mDropCount, 1);
+		__sync_fetch_and_add(&mDroppedBytes, pSize);
+	}
+
+	/**
+	 * @brief Account for an item leaving the queue
+	 * @param pObject the item
+	 */
+	void release(const T &pObject) {
+		__sync_fetch_and_sub(&mQueuedBytes, queueItemSize(pObject));
+	}
+
+	/**
+	 * @brief Wake up a parked consumer, if any, after an item was published in the ring
 	 */
-	void push(const T object)
+	void wakeRingConsumer() {
+		// Pairs with the increment of mWaiting in popRing: either the consumer sees our item or we see it waiting
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&mWaiting, __ATOMIC_RELAXED)) {
+			boost::lock_guard<boost::mutex> lLock(mMutex);
+			mAvailableCondition.notify_one();
+		}
+	}
+
+	/**
+	 * @brief Takes a prioritized item if there is one
+	 * @param pObject receives the item
+	 * @return true if an item was taken
+	 */
+	bool popPriority(T &pObject) {
+		if (!__atomic_load_n(&mPriorityCount, __ATOMIC_ACQUIRE)) {
+			return false;
+		}
+		boost::lock_guard<boost::mutex> lLock(mMutex);
+		if (mQueue.empty()) {
+			return false;
+		}
+		pObject = std::move(mQueue.front());
+		mQueue.pop_front();
+		__sync_fetch_and_sub(&mPriorityCount, 1);
+		release(pObject);
+		return true;
+	}
+
+	/**
+	 * @brief pop implementation of the LOCK_FREE_RING backend
+	 */
+	T popRing() {
+		T lObject;
+		for (;;) {
+			for (unsigned i = 0; i < mSpinCount; ++i) {
+				if (popPriority(lObject)) {
+					__sync_fetch_and_add(&mOutCount, 1);
+					return lObject;
+				}
+				if (mRing.pop(lObject)) {
+					release(lObject);
+					__sync_fetch_and_add(&mOutCount, 1);
+					return lObject;
+				}
+			}
+			// Nothing came while spinning, park until a producer signals us
+			boost::unique_lock<boost::mutex> lLock(mMutex);
+			__atomic_add_fetch(&mWaiting, 1, __ATOMIC_SEQ_CST);
+			if (!mRing.size() && mQueue.empty()) {
+				mAvailableCondition.wait(lLock);
+			}
+			__atomic_sub_fetch(&mWaiting, 1, __ATOMIC_SEQ_CST);
+		}
+	}
+
+	/**
+	 * @brief push implementation, the object is moved into the queue if it is an rvalue
+	 */
+	template <typename U>
+	void doPush(U &&object)
 	{
+		size_t lSize = queueItemSize(object);
+		if (mBackend == LOCK_FREE_RING) {
+			if (mDropSize > 0 && size() >= mDropSize) {
+				drop(lSize);
+			} else if (admit(lSize)) {
+				if (!mRing.push(std::forward<U>(object))) {
+					__sync_fetch_and_sub(&mQueuedBytes, lSize);
+					drop(lSize);
+					return;
+				}
+				__sync_fetch_and_add(&mInCount, 1);
+				wakeRingConsumer();
+			}
+			return;
+		}
 		{
 			boost::lock_guard<boost::mutex> lLock(mMutex);
 			if (mDropSize > 0 && mQueue.size() >= mDropSize) {
-				mDropCount++;
+				drop(lSize);
+			} else if (!admit(lSize)) {
+				return;
 			} else {
-				mQueue.push_back(object);
-				mInCount++;
+				mQueue.push_back(std::forward<U>(object));
+				__sync_fetch_and_add(&mInCount, 1);
 			}
 		}
 		mAvailableCondition.notify_one();
 	}
 
 	/**
-	 * @brief Adds the given object to the front of the queue so it will be the next one to be pulled
-	 * @param object The object to be inserted
+	 * @brief push_front implementation, the object is moved into the queue if it is an rvalue
 	 */
-	void push_front(const T object)
+	template <typename U>
+	void doPushFront(U &&object)
 	{
+		// Prioritized items bypass the memory budget, but their bytes are accounted for
+		__sync_fetch_and_add(&mQueuedBytes, queueItemSize(object));
+		if (mBackend == LOCK_FREE_RING) {
+			T lDropped;
+			if (mDropSize > 0 && size() >= mDropSize && mRing.pop(lDropped)) {
+				release(lDropped);
+				drop(queueItemSize(lDropped));
+			}
+			{
+				boost::lock_guard<boost::mutex> lLock(mMutex);
+				mQueue.push_front(std::forward<U>(object));
+				__sync_fetch_and_add(&mPriorityCount, 1);
+			}
+			wakeRingConsumer();
+			return;
+		}
 		{
 			boost::lock_guard<boost::mutex> lLock(mMutex);
 			if (mDropSize > 0 && mQueue.size() >= mDropSize) {
-				mDropCount++;
+				release(mQueue.back());
+				drop(queueItemSize(mQueue.back()));
 				mQueue.pop_back();
 			}
-			mQueue.push_front(object);
+			mQueue.push_front(std::forward<U>(object));
 		}
 		mAvailableCondition.notify_one();
 	}
 
+public:
+	/**
+	 * @brief Constructs a MultiThreadQueue
+	 */
+	MultiThreadQueue() : mBackend(LOCKED_DEQUE), mPriorityCount(0), mWaiting(0), mInCount(0), mOutCount(0), mDropCount(0), mDropSize(0),
+	                     mQueuedBytes(0), mDroppedBytes(0), mMemoryBudget(0), mAdmissionPolicy(DROP_WHEN_FULL) {}
+
+	/**
+	 * @brief Selects the storage of the queue. Not thread safe: must be called before the queue is shared.
+	 * Items already queued are kept. The ring is sized after the drop size, so set it first.
+	 * @param pBackend the storage to use
+	 */
+	void setBackend(eQueueBackend pBackend) {
+		if (pBackend == mBackend) {
+			return;
+		}
+		if (pBackend == LOCK_FREE_RING) {
+			std::deque<T> lQueued;
+			lQueued.swap(mQueue);
+			mRing.init(mDropSize > 0 ? mDropSize : mDefaultRingCapacity);
+			mBackend = pBackend;
+			BOOST_FOREACH(T &lObject, lQueued) {
+				size_t lSize = queueItemSize(lObject);
+				if (!mRing.push(std::move(lObject))) {
+					mQueuedBytes -= lSize;
+					drop(lSize);
+				}
+			}
+		} else {
+			mBackend = pBackend;
+			T lObject;
+			while (mRing.pop(lObject)) {
+				mQueue.push_back(std::move(lObject));
+			}
+			mPriorityCount = 0;
+		}
+	}
+
+	/**
+	 * @brief Returns the storage currently used by the queue
+	 */
+	eQueueBackend getBackend() const {
+		return mBackend;
+	}
+
+	/**
+	 * @brief Adds the given object to the back of the queue so it will be the last one to be pulled
+	 * @param object The object to be inserted
+	 */
+	void push(const T &object)
+	{
+		doPush(object);
+	}
+
+	/**
+	 * @brief Moves the given object to the back of the queue so it will be the last one to be pulled
+	 * @param object The object to be inserted, left empty
+	 */
+	void push(T &&object)
+	{
+		doPush(std::move(object));
+	}
+
+	/**
+	 * @brief Adds the given object to the front of the queue so it will be the next one to be pulled
+	 * With the LOCK_FREE_RING backend, a full queue makes room by dropping its oldest item instead of its newest one.
+	 * @param object The object to be inserted
+	 */
+	void push_front(const T &object)
+	{
+		doPushFront(object);
+	}
+
+	/**
+	 * @brief Moves the given object to the front of the queue so it will be the next one to be pulled
+	 * @param object The object to be inserted, left empty
+	 */
+	void push_front(T &&object)
+	{
+		doPushFront(std::move(object));
+	}
+
+	/**
+	 * @brief Adds the given object to the back of the queue, whatever its drop size and memory budget
+	 * With the LOCK_FREE_RING backend, waits for the consumers to make room if the ring is full.
+	 * @param object The object to be inserted
+	 */
+	void pushUnbounded(const T &object)
+	{
+		__sync_fetch_and_add(&mQueuedBytes, queueItemSize(object));
+		if (mBackend == LOCK_FREE_RING) {
+			while (!mRing.push(object)) {
+				boost::this_thread::yield();
+			}
+			wakeRingConsumer();
+			return;
+		}
+		{
+			boost::lock_guard<boost::mutex> lLock(mMutex);
+			mQueue.push_back(object);
+		}
+		mAvailableCondition.notify_one();
+	}
+
+	/**
+	 * @brief Adds the given object to the back of the queue, whatever its drop size and memory budget
+	 * With the LOCK_FREE_RING backend, waits for the consumers to make room if the ring is full, until a deadline.
+	 * @param object The object to be inserted
+	 * @param pDeadline when to give up waiting
+	 * @return false if the ring stayed full until the deadline, in which case the object is not queued
+	 */
+	bool pushUnbounded(const T &object, const boost::system_time &pDeadline)
+	{
+		if (mBackend != LOCK_FREE_RING) {
+			pushUnbounded(object);
+			return true;
+		}
+		while (!mRing.push(object)) {
+			if (boost::get_system_time() >= pDeadline) {
+				return false;
+			}
+			boost::this_thread::yield();
+		}
+		__sync_fetch_and_add(&mQueuedBytes, queueItemSize(object));
+		wakeRingConsumer();
+		return true;
+	}
+
+	/**
+	 * @brief Drops every queued object, accounting for them in the drop counters
+	 * @return the number of dropped objects
+	 */
+	size_t clear()
+	{
+		size_t lDropped = 0;
+		T lObject;
+		while (tryPop(lObject)) {
+			__sync_fetch_and_sub(&mOutCount, 1);
+			drop(queueItemSize(lObject));
+			++lDropped;
+		}
+		return lDropped;
+	}
+
+	/**
+	 * @brief Drops every queued object. The poison pills are discarded, the others accounted for in the drop counters
+	 * @param pPoison the poison pill
+	 * @return the number of dropped objects, the poison pills excluded
+	 */
+	size_t clear(const T &pPoison)
+	{
+		size_t lDropped = 0;
+		T lObject;
+		while (tryPop(lObject)) {
+			__sync_fetch_and_sub(&mOutCount, 1);
+			if (!isQueueItemPoison(lObject, pPoison)) {
+				drop(queueItemSize(lObject));
+				++lDropped;
+			}
+		}
+		return lDropped;
+	}
+
 	/**
 	 * @brief Remove and return the first object in the queue. Blocks until something is available.
-	 * @return the object
+	 * @return the object, moved out of the queue
 	 */
-	const T pop()
+	T pop()
 	{
+		if (mBackend == LOCK_FREE_RING) {
+			return popRing();
+		}
 		boost::unique_lock<boost::mutex> lLock(mMutex);
 		while (mQueue.empty()) {
 			mAvailableCondition.wait(lLock);
 		}
-		T lObject = mQueue.front();
+		T lObject(std::move(mQueue.front()));
 		mQueue.pop_front();
-		mOutCount++;
+		release(lObject);
+		__sync_fetch_and_add(&mOutCount, 1);
 		return lObject;
 	}
 
+	/**
+	 * @brief Remove the first object in the queue if there is one. Never blocks.
+	 * @param pObject receives the object, moved out of the queue
+	 * @return true if an object was removed, false if the queue was empty
+	 */
+	bool tryPop(T &pObject)
+	{
+		if (mBackend == LOCK_FREE_RING) {
+			if (popPriority(pObject)) {
+				__sync_fetch_and_add(&mOutCount, 1);
+				return true;
+			}
+			if (mRing.pop(pObject)) {
+				release(pObject);
+				__sync_fetch_and_add(&mOutCount, 1);
+				return true;
+			}
+			return false;
+		}
+		boost::lock_guard<boost::mutex> lLock(mMutex);
+		if (mQueue.empty()) {
+			return false;
+		}
+		pObject = std::move(mQueue.front());
+		mQueue.pop_front();
+		release(pObject);
+		__sync_fetch_and_add(&mOutCount, 1);
+		return true;
+	}
+
 	/**
 	 * @brief Returns the size of the queue
 	 * @return the size of the queue
 	 */
 	size_t size() {
+		if (mBackend == LOCK_FREE_RING) {
+			return mRing.size() + __atomic_load_n(&mPriorityCount, __ATOMIC_RELAXED);
+		}
 		return mQueue.size();
 	}
 
@@ -124,6 +513,26 @@ public:
 		mDropSize = pDropSize;
 	}
 
+	/**
+	 * @brief Bounds the bytes held by the queued items. Beyond this budget, pushed elements will not be inserted anymore
+	 * @param pMemoryBudget the maximum number of bytes, 0 means there's no maximum
+	 * @param pPolicy what to drop when the budget runs out
+	 */
+	void setMemoryBudget(size_t pMemoryBudget, eAdmissionPolicy pPolicy = DROP_WHEN_FULL) {
+		mMemoryBudget = pMemoryBudget;
+		mAdmissionPolicy = pPolicy;
+	}
+
+	/**
+	 * @brief Gets the byte counters. Then resets the dropped bytes.
+	 * @param pQueuedBytes the bytes currently held by the queued items
+	 * @param pDroppedBytes the bytes held by the items dropped since last call
+	 */
+	void getByteCounters(size_t &pQueuedBytes, size_t &pDroppedBytes) {
+		pQueuedBytes = __atomic_load_n(&mQueuedBytes, __ATOMIC_RELAXED);
+		pDroppedBytes = __sync_fetch_and_and(&mDroppedBytes, 0);
+	}
+
 	/**
 	 * @brief Gets various counters. Then resets all counters.
 	 * @param pInCount the number of elements pushed since last call
@@ -131,10 +540,10 @@ public:
 	 * @param pDropCount the number of elements dropped since last call
 	 */
 	void getCounters(unsigned &pInCount, unsigned &pOutCount, unsigned &pDropCount) {
-		pInCount = mInCount;
-		pOutCount = mOutCount;
-		pDropCount = mDropCount;
-		mInCount = mOutCount = mDropCount = 0;
+		// Atomic read + reset
+		pInCount = __sync_fetch_and_and(&mInCount, 0);
+		pOutCount = __sync_fetch_and_and(&mOutCount, 0);
+		pDropCount = __sync_fetch_and_and(&mDropCount, 0);
 	}
 };
 
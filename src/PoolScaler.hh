@@ -0,0 +1,247 @@
+/*
+* mod_dup - duplicates apache requests
+*
+* Copyright (C) 2013 Orange
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#pragma once
+
+#include <cstddef>
+
+namespace DupModule {
+
+/**
+ * @brief How a PoolScaler sizes the pool
+ */
+enum eScalingPolicy {
+	/** From the number of queued items per thread only */
+	QUEUE_SCALING,
+	/** From the observed load of the workers, the queue still triggering immediate growth */
+	ADAPTIVE_SCALING,
+};
+
+/**
+ * @brief Decides how many threads a pool should add or remove, depending on the amount of queued items.
+ * The pool grows at once to as many threads as needed to bring the queued items per thread under the maximum.
+ * It shrinks one thread at a time, and only once the queue stayed under the minimum for a while, so that a short lull does not
+ * kill threads which the next burst needs.
+ * With ADAPTIVE_SCALING, the caller also reports the cumulated time the workers spent busy. By Little's law, its growth rate is
+ * the average number of busy workers, which the pool is sized after, with some headroom. When that target falls under the
+ * number of threads, the pool sheds half of the surplus per shrink interval instead of one thread.
+ * So a slow destination gets more threads before the queue fills up, and a fast one releases the threads it does not need.
+ * In both cases the pool stays within its minimum and maximum number of threads.
+ * It holds no thread and reads no clock: the time is given by the caller, which makes it testable with a simulated clock.
+ */
+class PoolScaler
+{
+private:
+	/** @brief The minimum number of threads */
+	size_t mMinThreads;
+	/** @brief The maximum number of threads */
+	size_t mMaxThreads;
+	/** @brief The minimum number of queued items per thread */
+	size_t mMinQueued;
+	/** @brief The maximum number of queued items per thread */
+	size_t mMaxQueued;
+	/** @brief The time in micro sec the queue must stay under the minimum before a thread is removed */
+	unsigned long long mShrinkDelay;
+	/** @brief The minimum time in micro sec between two thread removals */
+	unsigned long long mShrinkInterval;
+	/** @brief True if the queue is under the minimum since mBelowSince */
+	bool mBelow;
+	/** @brief The time the queue went under the minimum */
+	unsigned long long mBelowSince;
+	/** @brief The time of the last thread removal */
+	unsigned long long mLastShrink;
+	/** @brief How the pool is sized */
+	eScalingPolicy mPolicy;
+	/** @brief Minimum time in micro sec between two load samples */
+	unsigned long long mSamplePeriod;
+	/** @brief The time of the last load sample, 0 before the first one */
+	unsigned long long mLastSample;
+	/** @brief The busy time reported at the last load sample */
+	unsigned long long mLastBusyTime;
+	/** @brief Smoothed average number of busy workers, negative before the first estimate */
+	double mLoad;
+
+	/**
+	 * @brief Update the load estimate with a new busy time report
+	 */
+	void sample(unsigned long long pNow, unsigned long long pBusyTime) {
+		if (!mLastSample) {
+			mLastSample = pNow ? pNow : 1;
+			mLastBusyTime = pBusyTime;
+			return;
+		}
+		if (pNow - mLastSample < mSamplePeriod) {
+			return;
+		}
+		double lBusy = static_cast<double>(pBusyTime - mLastBusyTime) / (pNow - mLastSample);
+		// Exponential smoothing: reacts within a few samples without following every jitter
+		mLoad = mLoad < 0 ? lBusy : mLoad + 0.5 * (lBusy - mLoad);
+		mLastSample = pNow;
+		mLastBusyTime = pBusyTime;
+	}
+
+	/**
+	 * @brief Returns the number of threads needed for the estimated load, within the bounds
+	 */
+	size_t loadTarget() const {
+		// Keep the workers busy 80% of their time at most
+		size_t lTarget = static_cast<size_t>(mLoad / 0.8) + 1;
+		if (lTarget < mMinThreads) {
+			return mMinThreads;
+		}
+		return lTarget > mMaxThreads ? mMaxThreads : lTarget;
+	}
+
+public:
+	/**
+	 * @brief Constructs a PoolScaler with the default limits of ThreadPool
+	 */
+	PoolScaler() : mMinThreads(1), mMaxThreads(10), mMinQueued(1), mMaxQueued(10),
+	               mShrinkDelay(200000), mShrinkInterval(100000),
+	               mBelow(false), mBelowSince(0), mLastShrink(0),
+	               mPolicy(QUEUE_SCALING), mSamplePeriod(100000), mLastSample(0), mLastBusyTime(0), mLoad(-1) {}
+
+	/**
+	 * @brief Set how the pool is sized
+	 */
+	void setPolicy(eScalingPolicy pPolicy) {
+		mPolicy = pPolicy;
+	}
+
+	/**
+	 * @brief Returns the smoothed average number of busy workers, negative if not estimated yet
+	 */
+	double getLoad() const {
+		return mLoad;
+	}
+
+	/**
+	 * @brief Set the minimum and maximum number of threads
+	 */
+	void setThreads(size_t pMinThreads, size_t pMaxThreads) {
+		mMinThreads = pMinThreads;
+		mMaxThreads = pMaxThreads;
+	}
+
+	/**
+	 * @brief Set the minimum and maximum number of queued items per thread
+	 */
+	void setQueue(size_t pMinQueued, size_t pMaxQueued) {
+		mMinQueued = pMinQueued;
+		mMaxQueued = pMaxQueued;
+	}
+
+	/**
+	 * @brief Set the hysteresis of the shrinking
+	 * @param pShrinkDelay the time in micro sec the queue must stay under the minimum before a thread is removed
+	 * @param pShrinkInterval the minimum time in micro sec between two thread removals
+	 */
+	void setShrink(unsigned long long pShrinkDelay, unsigned long long pShrinkInterval) {
+		mShrinkDelay = pShrinkDelay;
+		mShrinkInterval = pShrinkInterval;
+	}
+
+	/**
+	 * @brief Returns the number of items above which the pool should grow
+	 * @param pThreads the number of running threads
+	 */
+	size_t growThreshold(size_t pThreads) const {
+		return mMaxQueued * pThreads;
+	}
+
+	/**
+	 * @brief Decide what the pool should do now
+	 * @param pNow the current time in micro sec
+	 * @param pQueued the number of queued items
+	 * @param pThreads the number of threads, including the ones being killed
+	 * @param pBeingKilled the number of threads which were sent a poison pill and have not exited yet
+	 * @param pBusyTime the time in micro sec the workers spent busy since the start, ADAPTIVE_SCALING only
+	 * @return the number of threads to add if positive, to remove if negative
+	 */
+	int decide(unsigned long long pNow, size_t pQueued, size_t pThreads, size_t pBeingKilled, unsigned long long pBusyTime = 0) {
+		size_t lAlive = pThreads - pBeingKilled;
+		if (mPolicy == ADAPTIVE_SCALING) {
+			sample(pNow, pBusyTime);
+		}
+		if (pQueued > mMaxQueued * lAlive) {
+			mBelow = false;
+			if (pThreads >= mMaxThreads) {
+				return 0;
+			}
+			// Enough threads for the items queued right now
+			size_t lNeeded = mMaxQueued ? (pQueued + mMaxQueued - 1) / mMaxQueued : mMaxThreads;
+			if (mPolicy == ADAPTIVE_SCALING && mLoad >= 0 && loadTarget() > lNeeded) {
+				lNeeded = loadTarget();
+			}
+			if (lNeeded > mMaxThreads) {
+				lNeeded = mMaxThreads;
+			}
+			if (lNeeded <= lAlive) {
+				return 0;
+			}
+			// Threads being killed still count against the maximum
+			size_t lAdd = lNeeded - lAlive;
+			return static_cast<int>(lAdd < mMaxThreads - pThreads ? lAdd : mMaxThreads - pThreads);
+		}
+		if (mPolicy == ADAPTIVE_SCALING && mLoad >= 0) {
+			return adapt(pNow, pThreads, lAlive);
+		}
+		if (!lAlive || pQueued >= mMinQueued * lAlive) {
+			mBelow = false;
+			return 0;
+		}
+		if (!mBelow) {
+			mBelow = true;
+			mBelowSince = pNow;
+		}
+		if (lAlive > mMinThreads && pNow - mBelowSince >= mShrinkDelay && pNow - mLastShrink >= mShrinkInterval) {
+			mLastShrink = pNow;
+			return -1;
+		}
+		return 0;
+	}
+
+private:
+	/**
+	 * @brief ADAPTIVE_SCALING decision when the queue does not require immediate growth
+	 */
+	int adapt(unsigned long long pNow, size_t pThreads, size_t pAlive) {
+		size_t lTarget = loadTarget();
+		if (lTarget > pAlive) {
+			mBelow = false;
+			size_t lAdd = lTarget - pAlive;
+			return static_cast<int>(lAdd < mMaxThreads - pThreads ? lAdd : mMaxThreads - pThreads);
+		}
+		if (lTarget == pAlive) {
+			mBelow = false;
+			return 0;
+		}
+		if (!mBelow) {
+			mBelow = true;
+			mBelowSince = pNow;
+		}
+		if (pNow - mBelowSince >= mShrinkDelay && pNow - mLastShrink >= mShrinkInterval) {
+			mLastShrink = pNow;
+			size_t lSurplus = pAlive - lTarget;
+			return -static_cast<int>(lSurplus > 1 ? lSurplus / 2 : 1);
+		}
+		return 0;
+	}
+};
+
+}
@@ -0,0 +1,539 @@
+/*
+* mod_dup - duplicates apache requests
+*
+* Copyright (C) 2013 Orange
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include <algorithm>
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Prefilter.hh"
+
+namespace DupModule {
+
+/** @brief Literals shorter than this are too common for the prefilter to reject much */
+static const size_t MIN_LITERAL_SIZE = 2;
+
+/** @brief Beyond this number of literals, searching them all costs about as much as the regex */
+static const size_t MAX_LITERAL_COUNT = 8;
+
+typedef std::vector<std::string> tLiterals;
+
+/**
+ * @brief A recursive descent over a perl regular expression, only keeping its required literals.
+ * Whatever is not a literal character or a group only ends the current run of literal characters,
+ * so that a literal is never required where the expression could match without it.
+ */
+class LiteralParser
+{
+private:
+	const std::string &mPattern;
+	size_t mPos;
+	/** @brief Set on any construct not understood, the expression then has no literal */
+	bool mFailed;
+
+	/** @brief What an atom of the expression is */
+	enum eAtom {
+		/** A literal character */
+		LITERAL_ATOM,
+		/** A group, one of whose literals is required */
+		GROUP_ATOM,
+		/** Anything else: classes, anchors, back references... */
+		OTHER_ATOM,
+		/** Nothing, like a comment or an inline modifier */
+		NO_ATOM,
+	};
+
+	bool
+	atEnd() const {
+		return mPos >= mPattern.size();
+	}
+
+	char
+	peek() const {
+		return mPattern[mPos];
+	}
+
+	/**
+	 * @brief Returns true if a set of literals is more selective than another: its shortest literal is longer, or it has fewer
+	 */
+	static bool
+	better(const tLiterals &pCandidate, const tLiterals &pBest) {
+		size_t lCandidateMin = std::string::npos, lBestMin = std::string::npos;
+		for (tLiterals::const_iterator it = pCandidate.begin(); it != pCandidate.end(); ++it) {
+			lCandidateMin = std::min(lCandidateMin, it->size());
+		}
+		// An empty literal is always there
+		if (pCandidate.empty() || lCandidateMin == 0) {
+			return false;
+		}
+		if (pBest.empty()) {
+			return true;
+		}
+		for (tLiterals::const_iterator it = pBest.begin(); it != pBest.end(); ++it) {
+			lBestMin = std::min(lBestMin, it->size());
+		}
+		return lCandidateMin > lBestMin || (lCandidateMin == lBestMin && pCandidate.size() < pBest.size());
+	}
+
+	/**
+	 * @brief Skip up to a closing character
+	 */
+	void
+	skipTo(char pClosing) {
+		size_t lEnd = mPattern.find(pClosing, mPos);
+		if (lEnd == std::string::npos) {
+			mFailed = true;
+			mPos = mPattern.size();
+		} else {
+			mPos = lEnd + 1;
+		}
+	}
+
+	/**
+	 * @brief Skip a character class, the opening bracket already consumed
+	 */
+	void
+	skipClass() {
+		if (!atEnd() && peek() == '^') {
+			++mPos;
+		}
+		// A ] right after the opening bracket is part of the class
+		if (!atEnd() && peek() == ']') {
+			++mPos;
+		}
+		while (!atEnd() && peek() != ']') {
+			if (peek() == '\\') {
+				++mPos;
+			} else if (peek() == '[' && mPos + 1 < mPattern.size() && strchr(":.=", mPattern[mPos + 1])) {
+				// [:alpha:] and the like
+				char lDelimiter = mPattern[mPos + 1];
+				size_t lEnd = mPattern.find(std::string(1, lDelimiter) + "]", mPos + 2);
+				if (lEnd == std::string::npos) {
+					mFailed = true;
+					break;
+				}
+				mPos = lEnd + 1;
+			}
+			++mPos;
+		}
+		if (atEnd()) {
+			mFailed = true;
+		} else {
+			++mPos;
+		}
+	}
+
+	/**
+	 * @brief Parse an escape sequence, the backslash already consumed
+	 * @param pChar receives the character if it is a literal one
+	 */
+	eAtom
+	parseEscape(char &pChar) {
+		if (atEnd()) {
+			mFailed = true;
+			return OTHER_ATOM;
+		}
+		char lChar = mPattern[mPos++];
+		switch (lChar) {
+		case 'n': pChar = '\n'; return LITERAL_ATOM;
+		case 'r': pChar = '\r'; return LITERAL_ATOM;
+		case 't': pChar = '\t'; return LITERAL_ATOM;
+		case 'f': pChar = '\f'; return LITERAL_ATOM;
+		case 'e': pChar = '\x1b'; return LITERAL_ATOM;
+		case 'a': pChar = '\a'; return LITERAL_ATOM;
+		case 'x': case 'p': case 'P': case 'N': case 'o':
+			// Argument in braces, or the following characters
+			if (!atEnd() && peek() == '{') {
+				skipTo('}');
+			} else if (lChar == 'x') {
+				for (int i = 0; i < 2 && !atEnd() && isxdigit(peek()); ++i) {
+					++mPos;
+				}
+			} else if (lChar != 'N' && !atEnd()) {
+				++mPos;
+			}
+			return OTHER_ATOM;
+		case 'c':
+			if (!atEnd()) {
+				++mPos;
+			}
+			return OTHER_ATOM;
+		case '0': case '1': case '2': case '3': case '4': case '5': case '6': case '7': case '8': case '9':
+			// An octal character code or a back reference, depending on the engine and the groups: the digits
+			// which follow are part of it, or not required
+			while (!atEnd() && isdigit(peek())) {
+				++mPos;
+			}
+			return OTHER_ATOM;
+		case 'g': case 'k':
+			if (!atEnd() && peek() == '{') {
+				skipTo('}');
+			} else if (!atEnd() && peek() == '<') {
+				skipTo('>');
+			} else if (!atEnd() && peek() == '\'') {
+				++mPos;
+				skipTo('\'');
+			} else {
+				while (!atEnd() && (isdigit(peek()) || peek() == '-')) {
+					++mPos;
+				}
+			}
+			return OTHER_ATOM;
+		case 'Q':
+			mFailed = true;
+			return OTHER_ATOM;
+		default:
+			if (isalnum(lChar) || strchr("<>`'", lChar)) {
+				// Classes and anchors, the word and buffer ones of boost too
+				return OTHER_ATOM;
+			}
+			pChar = lChar;
+			return LITERAL_ATOM;
+		}
+	}
+
+	/**
+	 * @brief Parse a group, the opening parenthesis already consumed
+	 * @param pLiterals receives the required literals of the group
+	 * @param pExact set to true if the group only matches its literals
+	 */
+	eAtom
+	parseGroup(tLiterals &pLiterals, bool &pExact) {
+		bool lLookAround = false;
+		if (!atEnd() && peek() == '?') {
+			++mPos;
+			if (atEnd()) {
+				mFailed = true;
+				return OTHER_ATOM;
+			}
+			char lKind = mPattern[mPos++];
+			if (lKind == '#') {
+				skipTo(')');
+				return NO_ATOM;
+			} else if (lKind == '=' || lKind == '!') {
+				lLookAround = true;
+			} else if (lKind == '<' && !atEnd() && (peek() == '=' || peek() == '!')) {
+				++mPos;
+				lLookAround = true;
+			} else if (lKind == '<' || (lKind == 'P' && !atEnd() && peek() == '<')) {
+				// Named group
+				skipTo('>');
+			} else if (lKind == '\'') {
+				skipTo('\'');
+			} else if (lKind != ':' && lKind != '>' && lKind != '|') {
+				// Inline modifiers, the case insensitive and extended ones changing what is literal
+				--mPos;
+				while (!atEnd() && (isalpha(peek()) || peek() == '-')) {
+					if (peek() == 'i' || peek() == 'x') {
+						mFailed = true;
+					}
+					++mPos;
+				}
+				if (atEnd() || (peek() != ')' && peek() != ':')) {
+					mFailed = true;
+					return OTHER_ATOM;
+				}
+				if (mPattern[mPos++] == ')') {
+					return NO_ATOM;
+				}
+			}
+		}
+		tLiterals lLiterals = parseAlternation(pExact);
+		if (atEnd() || peek() != ')') {
+			mFailed = true;
+			return OTHER_ATOM;
+		}
+		++mPos;
+		if (lLookAround) {
+			return OTHER_ATOM;
+		}
+		pLiterals.swap(lLiterals);
+		return GROUP_ATOM;
+	}
+
+	/**
+	 * @brief Parse the quantifier following an atom, if any
+	 * @return the minimum number of repetitions, 1 without quantifier
+	 */
+	unsigned
+	parseQuantifier(bool &pQuantified) {
+		pQuantified = false;
+		if (atEnd()) {
+			return 1;
+		}
+		unsigned lMin = 1;
+		char lChar = peek();
+		if (lChar == '*' || lChar == '?') {
+			lMin = 0;
+			++mPos;
+		} else if (lChar == '+') {
+			++mPos;
+		} else if (lChar == '{' && mPos + 1 < mPattern.size() && isdigit(mPattern[mPos + 1])) {
+			lMin = atoi(mPattern.c_str() + mPos + 1);
+			skipTo('}');
+		} else {
+			return 1;
+		}
+		pQuantified = true;
+		// Lazy and possessive quantifiers
+		if (!atEnd() && (peek() == '?' || peek() == '+')) {
+			++mPos;
+		}
+		return lMin;
+	}
+
+	/**
+	 * @brief Append each of some literals to each of the current ones
+	 * @return false if there would be too many literals
+	 */
+	static bool
+	concatenate(tLiterals &pCurrent, const tLiterals &pNext) {
+		if (pCurrent.size() * pNext.size() > MAX_LITERAL_COUNT) {
+			return false;
+		}
+		tLiterals lResult;
+		for (tLiterals::const_iterator it = pCurrent.begin(); it != pCurrent.end(); ++it) {
+			for (tLiterals::const_iterator lNext = pNext.begin(); lNext != pNext.end(); ++lNext) {
+				lResult.push_back(*it + *lNext);
+			}
+		}
+		pCurrent.swap(lResult);
+		return true;
+	}
+
+	/**
+	 * @brief Keep the current literals if they are the best so far, and start new ones
+	 */
+	static void
+	flush(tLiterals &pCurrent, tLiterals &pBest) {
+		if (better(pCurrent, pBest)) {
+			pBest.swap(pCurrent);
+		}
+		pCurrent.assign(1, std::string());
+	}
+
+	/**
+	 * @brief Parse a sequence of atoms, up to the end of the branch.
+	 * The literal characters and exact groups in a row make the current literals, which anything else ends.
+	 * @param pExact set to true if the sequence only matches its literals
+	 * @return the most selective literals required in the sequence
+	 */
+	tLiterals
+	parseSequence(bool &pExact) {
+		tLiterals lCurrent(1, std::string());
+		tLiterals lBest;
+		pExact = true;
+		while (!atEnd() && !mFailed && peek() != '|' && peek() != ')') {
+			char lChar = mPattern[mPos++];
+			char lLiteral = lChar;
+			tLiterals lGroup;
+			bool lGroupExact = false;
+			eAtom lAtom = LITERAL_ATOM;
+			switch (lChar) {
+			case '\\':
+				lAtom = parseEscape(lLiteral);
+				break;
+			case '(':
+				lAtom = parseGroup(lGroup, lGroupExact);
+				break;
+			case '[':
+				skipClass();
+				lAtom = OTHER_ATOM;
+				break;
+			case '.': case '^': case '$':
+				lAtom = OTHER_ATOM;
+				break;
+			case '*': case '+': case '?': case '{':
+				// A quantifier without atom
+				mFailed = true;
+				break;
+			}
+			if (lAtom == NO_ATOM) {
+				continue;
+			}
+			if (lAtom == LITERAL_ATOM) {
+				lGroup.assign(1, std::string(1, lLiteral));
+				lGroupExact = true;
+			}
+			bool lQuantified;
+			unsigned lMin = parseQuantifier(lQuantified);
+			if (lAtom != OTHER_ATOM && lGroupExact && !lQuantified) {
+				if (!concatenate(lCurrent, lGroup)) {
+					flush(lCurrent, lBest);
+					lCurrent.swap(lGroup);
+					pExact = false;
+				}
+				continue;
+			}
+			pExact = false;
+			if (lAtom != OTHER_ATOM && lGroupExact && lMin > 0) {
+				// Repeated, it is followed by anything: it ends the current literals
+				if (!concatenate(lCurrent, lGroup)) {
+					flush(lCurrent, lBest);
+					lCurrent.swap(lGroup);
+				}
+			}
+			flush(lCurrent, lBest);
+			if (lAtom == GROUP_ATOM && !lGroupExact && lMin > 0 && better(lGroup, lBest)) {
+				lBest.swap(lGroup);
+			}
+		}
+		if (pExact) {
+			return lCurrent;
+		}
+		flush(lCurrent, lBest);
+		return lBest;
+	}
+
+	/**
+	 * @brief Parse branches separated with |, up to the end of the group
+	 * @param pExact set to true if all the branches only match their literals
+	 * @return the literals of all the branches, empty if one branch has none
+	 */
+	tLiterals
+	parseAlternation(bool &pExact) {
+		tLiterals lLiterals = parseSequence(pExact);
+		bool lAllBranches = !lLiterals.empty();
+		while (!atEnd() && !mFailed && peek() == '|') {
+			++mPos;
+			bool lExact;
+			tLiterals lBranch = parseSequence(lExact);
+			pExact &= lExact;
+			lAllBranches &= !lBranch.empty();
+			lLiterals.insert(lLiterals.end(), lBranch.begin(), lBranch.end());
+		}
+		if (!lAllBranches) {
+			pExact = false;
+			return tLiterals();
+		}
+		return lLiterals;
+	}
+
+public:
+	explicit LiteralParser(const std::string &pPattern)
+		: mPattern(pPattern), mPos(0), mFailed(false) {}
+
+	tLiterals
+	parse() {
+		bool lExact;
+		tLiterals lLiterals = parseAlternation(lExact);
+		if (mFailed || !atEnd()) {
+			return tLiterals();
+		}
+		return lLiterals;
+	}
+};
+
+std::vector<std::string>
+extractLiterals(const std::string &pPattern) {
+	tLiterals lLiterals = LiteralParser(pPattern).parse();
+	std::sort(lLiterals.begin(), lLiterals.end());
+	lLiterals.erase(std::unique(lLiterals.begin(), lLiterals.end()), lLiterals.end());
+	if (lLiterals.size() > MAX_LITERAL_COUNT) {
+		return tLiterals();
+	}
+	for (tLiterals::const_iterator it = lLiterals.begin(); it != lLiterals.end(); ++it) {
+		if (it->size() < MIN_LITERAL_SIZE) {
+			return tLiterals();
+		}
+	}
+	return lLiterals;
+}
+
+/**
+ * @brief Returns how rare a byte is in the requests: the common letters and punctuation of forms and XML are the worst
+ */
+static int
+rarity(unsigned char pChar) {
+	if (strchr(" etaoinsrhl<>=/\"&", pChar)) {
+		return 0;
+	}
+	if (islower(pChar)) {
+		return 1;
+	}
+	if (isdigit(pChar)) {
+		return 2;
+	}
+	return 3;
+}
+
+Prefilter::Prefilter(const std::vector<std::string> &pLiterals)
+	: mChecked(0), mRejected(0) {
+	for (std::vector<std::string>::const_iterator it = pLiterals.begin(); it != pLiterals.end(); ++it) {
+		tLiteral lLiteral;
+		lLiteral.mText = *it;
+		lLiteral.mRareOffset = 0;
+		for (size_t i = 1; i < it->size(); ++i) {
+			if (rarity((*it)[i]) > rarity((*it)[lLiteral.mRareOffset])) {
+				lLiteral.mRareOffset = i;
+			}
+		}
+		mLiterals.push_back(lLiteral);
+	}
+}
+
+Prefilter *
+Prefilter::create(const std::string &pPattern) {
+	std::vector<std::string> lLiterals = extractLiterals(pPattern);
+	return lLiterals.empty() ? NULL : new Prefilter(lLiterals);
+}
+
+bool
+Prefilter::mayMatch(const char *pBegin, const char *pEnd) const {
+	__sync_fetch_and_add(&mChecked, 1);
+	for (std::vector<tLiteral>::const_iterator it = mLiterals.begin(); it != mLiterals.end(); ++it) {
+		size_t lSize = it->mText.size();
+		if (static_cast<size_t>(pEnd - pBegin) < lSize) {
+			continue;
+		}
+		// The rare byte can only be found where the whole literal fits
+		const char *lFrom = pBegin + it->mRareOffset;
+		const char *lTo = pEnd - (lSize - it->mRareOffset - 1);
+		char lRare = it->mText[it->mRareOffset];
+		while (lFrom < lTo) {
+			const char *lFound = static_cast<const char *>(memchr(lFrom, lRare, lTo - lFrom));
+			if (!lFound) {
+				break;
+			}
+			if (!memcmp(lFound - it->mRareOffset, it->mText.data(), lSize)) {
+				return true;
+			}
+			lFrom = lFound + 1;
+		}
+	}
+	__sync_fetch_and_add(&mRejected, 1);
+	return false;
+}
+
+std::vector<std::string>
+Prefilter::getLiterals() const {
+	std::vector<std::string> lLiterals;
+	for (std::vector<tLiteral>::const_iterator it = mLiterals.begin(); it != mLiterals.end(); ++it) {
+		lLiterals.push_back(it->mText);
+	}
+	return lLiterals;
+}
+
+void
+Prefilter::getCounters(unsigned long &pChecked, unsigned long &pRejected) {
+	// Atomic read + reset
+	pChecked = __sync_fetch_and_and(&mChecked, 0);
+	pRejected = __sync_fetch_and_and(&mRejected, 0);
+}
+
+}
@@ -0,0 +1,102 @@
+/*
+* mod_dup - duplicates apache requests
+*
+* Copyright (C) 2013 Orange
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace DupModule {
+
+/**
+ * @brief Find the literals one of which is in any text a regular expression matches.
+ * Only the plain constructs are understood: a pattern using an unknown one, or the case insensitive
+ * and extended modes, gets no literal. Literals too short or too many to save time are not returned either.
+ * @param pPattern the regular expression, perl syntax
+ * @return the literals, empty if the expression has no useful required literal
+ */
+std::vector<std::string>
+extractLiterals(const std::string &pPattern);
+
+/**
+ * @brief Searches the required literals of a regular expression before it, to skip the regex search of the texts without them.
+ * Each literal is found by looking for its rarest byte with memchr, which glibc vectorizes, then comparing it whole.
+ * Shared by the worker threads, it counts the checks and rejections atomically.
+ */
+class Prefilter
+{
+private:
+	/** @brief A literal and the byte it is searched by */
+	struct tLiteral {
+		std::string mText;
+		/** @brief The position of the rarest byte in the literal */
+		size_t mRareOffset;
+	};
+
+	std::vector<tLiteral> mLiterals;
+	/** @brief The number of texts checked since the last call to getCounters */
+	mutable volatile unsigned long mChecked;
+	/** @brief The number of texts which did not have any literal since the last call to getCounters */
+	mutable volatile unsigned long mRejected;
+
+	Prefilter(const Prefilter &);
+	Prefilter &operator=(const Prefilter &);
+
+public:
+	/**
+	 * @brief Constructs a prefilter looking for any of some literals
+	 * @param pLiterals the literals, none of them empty
+	 */
+	explicit Prefilter(const std::vector<std::string> &pLiterals);
+
+	/**
+	 * @brief Build the prefilter of a regular expression
+	 * @param pPattern the regular expression
+	 * @return the prefilter to delete by the caller, NULL if the expression has no useful required literal
+	 */
+	static Prefilter *
+	create(const std::string &pPattern);
+
+	/**
+	 * @brief Returns false if the text cannot match the expression, none of its literals being there
+	 */
+	bool
+	mayMatch(const char *pBegin, const char *pEnd) const;
+
+	bool
+	mayMatch(const std::string &pText) const {
+		return mayMatch(pText.data(), pText.data() + pText.size());
+	}
+
+	/**
+	 * @brief Returns the literals searched
+	 */
+	std::vector<std::string>
+	getLiterals() const;
+
+	/**
+	 * @brief Get the number of texts checked and rejected since the last call, then reset them
+	 * @param pChecked receives the number of texts checked
+	 * @param pRejected receives the number of texts without any literal, for which the regex search was skipped
+	 */
+	void
+	getCounters(unsigned long &pChecked, unsigned long &pRejected);
+};
+
+}
@@ -0,0 +1,142 @@
+/*
+* mod_dup - duplicates apache requests
+*
+* Copyright (C) 2013 Orange
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include <string.h>
+#include <time.h>
+
+#include "RateLimiter.hh"
+
+namespace DupModule {
+
+RateLimiter::RateLimiter() : mGlobal(NO_LIMIT), mShm(NULL), mBuckets(NULL) {}
+
+size_t
+RateLimiter::setLimit(size_t pIndex, double pRate, unsigned pBurst) {
+	tLimit lLimit;
+	lLimit.mInterval = static_cast<unsigned long long>(1e9 / pRate);
+	lLimit.mTolerance = lLimit.mInterval * (pBurst ? pBurst - 1 : 0);
+	if (pIndex == NO_LIMIT) {
+		mLimits.push_back(lLimit);
+		return mLimits.size() - 1;
+	}
+	mLimits[pIndex] = lLimit;
+	return pIndex;
+}
+
+void
+RateLimiter::setGlobalLimit(double pRate, unsigned pBurst) {
+	mGlobal = setLimit(mGlobal, pRate, pBurst);
+}
+
+void
+RateLimiter::setLimit(const std::string &pPath, double pRate, unsigned pBurst) {
+	std::map<std::string, size_t>::iterator lIt = mLocations.find(pPath);
+	mLocations[pPath] = setLimit(lIt == mLocations.end() ? NO_LIMIT : lIt->second, pRate, pBurst);
+}
+
+apr_status_t
+RateLimiter::create(apr_pool_t *pPool) {
+	if (mLimits.empty()) {
+		return APR_SUCCESS;
+	}
+	// One more bucket than needed, to align them whatever the alignment of the segment
+	apr_status_t lStatus = apr_shm_create(&mShm, (mLimits.size() + 1) * sizeof(tBucket), NULL, pPool);
+	if (lStatus != APR_SUCCESS) {
+		return lStatus;
+	}
+	size_t lBase = reinterpret_cast<size_t>(apr_shm_baseaddr_get(mShm));
+	mBuckets = reinterpret_cast<tBucket *>((lBase + sizeof(tBucket) - 1) / sizeof(tBucket) * sizeof(tBucket));
+	memset(mBuckets, 0, mLimits.size() * sizeof(tBucket));
+	return APR_SUCCESS;
+}
+
+bool
+RateLimiter::take(size_t pIndex, unsigned long long pNow) {
+	const tLimit &lLimit = mLimits[pIndex];
+	tBucket &lBucket = mBuckets[pIndex];
+	for (;;) {
+		unsigned long long lTat = lBucket.mTat;
+		unsigned long long lStart = lTat > pNow ? lTat : pNow;
+		if (lStart - pNow > lLimit.mTolerance) {
+			__sync_fetch_and_add(&lBucket.mRejected, 1);
+			return false;
+		}
+		if (__sync_bool_compare_and_swap(&lBucket.mTat, lTat, lStart + lLimit.mInterval)) {
+			return true;
+		}
+	}
+}
+
+void
+RateLimiter::giveBack(size_t pIndex) {
+	__sync_fetch_and_sub(&mBuckets[pIndex].mTat, mLimits[pIndex].mInterval);
+}
+
+bool
+RateLimiter::allow(const std::string &pPath, unsigned long long pNow) {
+	if (!mBuckets) {
+		return true;
+	}
+	std::map<std::string, size_t>::const_iterator lIt = mLocations.find(pPath);
+	if (lIt != mLocations.end() && !take(lIt->second, pNow)) {
+		return false;
+	}
+	if (mGlobal != NO_LIMIT && !take(mGlobal, pNow)) {
+		// Not sent, so it does not count against its location
+		if (lIt != mLocations.end()) {
+			giveBack(lIt->second);
+		}
+		return false;
+	}
+	return true;
+}
+
+bool
+RateLimiter::allow(const std::string &pPath) {
+	if (!mBuckets) {
+		return true;
+	}
+	struct timespec lNow;
+	clock_gettime(CLOCK_MONOTONIC, &lNow);
+	return allow(pPath, static_cast<unsigned long long>(lNow.tv_sec) * 1000000000ULL + lNow.tv_nsec);
+}
+
+void
+RateLimiter::giveBack(const std::string &pPath) {
+	if (!mBuckets) {
+		return;
+	}
+	std::map<std::string, size_t>::const_iterator lIt = mLocations.find(pPath);
+	if (lIt != mLocations.end()) {
+		giveBack(lIt->second);
+	}
+	if (mGlobal != NO_LIMIT) {
+		giveBack(mGlobal);
+	}
+}
+
+unsigned long long
+RateLimiter::getRejectedCount() const {
+	unsigned long long lRejected = 0;
+	for (size_t i = 0; mBuckets && i < mLimits.size(); ++i) {
+		lRejected += mBuckets[i].mRejected;
+	}
+	return lRejected;
+}
+
+}
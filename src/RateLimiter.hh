@@ -0,0 +1,148 @@
+/*
+* mod_dup - duplicates apache requests
+*
+* Copyright (C) 2013 Orange
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#pragma once
+
+#include <apr_pools.h>
+#include <apr_shm.h>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace DupModule {
+
+/**
+ * @brief Limits the rate of the duplicated requests, globally and per location, across all the processes.
+ * Each limit is a token bucket implemented as a generic cell rate algorithm: its whole state is the theoretical arrival time
+ * of the next request, kept in shared memory and updated with a compare and swap, so that no lock is ever taken.
+ * The limits are set while reading the configuration, create then allocates their state. The processes forked afterwards share it.
+ */
+class RateLimiter
+{
+private:
+	/** @brief A limit, as configured */
+	struct tLimit {
+		/** @brief Time in ns between two requests at the configured rate */
+		unsigned long long mInterval;
+		/** @brief How far in ns the theoretical arrival time may run ahead of the clock, which allows the burst */
+		unsigned long long mTolerance;
+	};
+
+	/** @brief The state of a limit, in the shared memory */
+	struct tBucket {
+		/** @brief Theoretical arrival time in ns of the next request */
+		volatile unsigned long long mTat;
+		/** @brief Number of requests rejected since the start */
+		volatile unsigned long long mRejected;
+	} __attribute__((aligned(64)));
+
+	/** @brief Value of mGlobal when there is no global limit */
+	static const size_t NO_LIMIT = static_cast<size_t>(-1);
+
+	/** @brief The limits, indexed like the buckets */
+	std::vector<tLimit> mLimits;
+	/** @brief Index of the limit of each location */
+	std::map<std::string, size_t> mLocations;
+	/** @brief Index of the global limit, NO_LIMIT if none */
+	size_t mGlobal;
+	/** @brief The shared memory segment */
+	apr_shm_t *mShm;
+	/** @brief The buckets, NULL before create */
+	tBucket *mBuckets;
+
+	/**
+	 * @brief Add a limit or replace one
+	 * @return its index
+	 */
+	size_t setLimit(size_t pIndex, double pRate, unsigned pBurst);
+
+	/**
+	 * @brief Take a token from a bucket
+	 * @return false if it has none left
+	 */
+	bool take(size_t pIndex, unsigned long long pNow);
+
+	/**
+	 * @brief Give back a token taken from a bucket
+	 */
+	void giveBack(size_t pIndex);
+
+	RateLimiter(const RateLimiter &);
+	RateLimiter &operator=(const RateLimiter &);
+
+public:
+	/**
+	 * @brief Constructs a RateLimiter without any limit
+	 */
+	RateLimiter();
+
+	/**
+	 * @brief Limit the rate of all the duplicated requests
+	 * @param pRate the maximum rate in requests per second
+	 * @param pBurst the number of requests accepted at once after a pause
+	 */
+	void
+	setGlobalLimit(double pRate, unsigned pBurst);
+
+	/**
+	 * @brief Limit the rate of the requests duplicated from a location
+	 * @param pPath the location
+	 * @param pRate the maximum rate in requests per second
+	 * @param pBurst the number of requests accepted at once after a pause
+	 */
+	void
+	setLimit(const std::string &pPath, double pRate, unsigned pBurst);
+
+	/**
+	 * @brief Allocate the state of the limits. Does nothing without limits.
+	 * @param pPool the pool the shared memory is released with
+	 * @return APR_SUCCESS, or the error of apr_shm_create
+	 */
+	apr_status_t
+	create(apr_pool_t *pPool);
+
+	/**
+	 * @brief Returns true if the limits of a location and the global one let one more request through, and count it
+	 * @param pPath the location of the request
+	 * @param pNow the time in ns on a clock shared by all the processes
+	 */
+	bool
+	allow(const std::string &pPath, unsigned long long pNow);
+
+	/**
+	 * @brief Same as above, at the current time of the monotonic clock
+	 */
+	bool
+	allow(const std::string &pPath);
+
+	/**
+	 * @brief Give back the tokens a request allowed through took from the limits of its location and the global one,
+	 * when it ends up not duplicated
+	 * @param pPath the location of the request
+	 */
+	void
+	giveBack(const std::string &pPath);
+
+	/**
+	 * @brief Returns the number of requests rejected by all the processes since the start
+	 */
+	unsigned long long
+	getRejectedCount() const;
+};
+
+}
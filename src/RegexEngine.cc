@@ -0,0 +1,478 @@
+/*
+* mod_dup - duplicates apache requests
+*
+* Copyright (C) 2013 Orange
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include <boost/regex.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <ctype.h>
+#include <iterator>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_PCRE2
+#define PCRE2_CODE_UNIT_WIDTH 8
+#include <pcre2.h>
+#endif
+
+#ifdef HAVE_RE2
+#include <re2/re2.h>
+#endif
+
+#include "RegexEngine.hh"
+
+namespace DupModule {
+
+tReplacement::tReplacement(const std::string &pFormat, eRegexEngine pEngine)
+	: mFormat(pFormat) {
+	if (pEngine == BOOST_ENGINE) {
+		// Formatted by boost::regex_replace itself
+		return;
+	}
+	std::string lLiteral;
+	for (size_t i = 0; i < pFormat.size(); ++i) {
+		char lChar = pFormat[i];
+		int lGroup = -1;
+		if (lChar == '$' && i + 1 < pFormat.size()) {
+			char lNext = pFormat[i + 1];
+			if (lNext == '$') {
+				lLiteral += '$';
+				++i;
+			} else if (lNext == '&') {
+				lGroup = 0;
+				++i;
+			} else if (isdigit(lNext)) {
+				for (lGroup = 0; i + 1 < pFormat.size() && isdigit(pFormat[i + 1]); ++i) {
+					lGroup = lGroup * 10 + pFormat[i + 1] - '0';
+				}
+			} else if (lNext == '{') {
+				size_t lEnd = pFormat.find('}', i + 2);
+				if (lEnd == std::string::npos || lEnd == i + 2 ||
+				    pFormat.find_first_not_of("0123456789", i + 2) < lEnd) {
+					throw RegexError("Only numbered groups can be referenced with ${...} by this regex engine");
+				}
+				lGroup = atoi(pFormat.c_str() + i + 2);
+				i = lEnd;
+			} else if (strchr("`'+^", lNext)) {
+				throw RegexError(std::string("$") + lNext + " in a replacement needs the boost regex engine");
+			} else {
+				lLiteral += '$';
+			}
+		} else if (lChar == '\\' && i + 1 < pFormat.size()) {
+			char lNext = pFormat[++i];
+			if (isdigit(lNext)) {
+				lGroup = lNext - '0';
+			} else if (lNext == 'n') {
+				lLiteral += '\n';
+			} else if (lNext == 'r') {
+				lLiteral += '\r';
+			} else if (lNext == 't') {
+				lLiteral += '\t';
+			} else if (isalpha(lNext)) {
+				throw RegexError(std::string("\\") + lNext + " in a replacement needs the boost regex engine");
+			} else {
+				lLiteral += lNext;
+			}
+		} else if (lChar == '(' || lChar == ')' || lChar == '?') {
+			// boost would take them as a conditional or a grouping, and not output them
+			throw RegexError("Conditional replacements need the boost regex engine, escape ( ) and ? to output them");
+		} else {
+			lLiteral += lChar;
+		}
+		if (lGroup >= 0) {
+			if (!lLiteral.empty()) {
+				mParts.push_back(std::make_pair(lLiteral, -1));
+				lLiteral.clear();
+			}
+			mParts.push_back(std::make_pair(std::string(), lGroup));
+		}
+	}
+	if (!lLiteral.empty()) {
+		mParts.push_back(std::make_pair(lLiteral, -1));
+	}
+}
+
+/**
+ * @brief Append a replacement to a text
+ * @param pOut the text
+ * @param pReplacement the replacement
+ * @param pGroups the beginning and end of each group of the match, NULL for the groups which did not participate
+ * @param pGroupCount the number of groups, the whole match included
+ */
+static void
+appendReplacement(std::string &pOut, const tReplacement &pReplacement, const char * const *pGroups, int pGroupCount) {
+	for (std::vector<std::pair<std::string, int> >::const_iterator it = pReplacement.mParts.begin(); it != pReplacement.mParts.end(); ++it) {
+		if (it->second < 0) {
+			pOut += it->first;
+		} else if (it->second < pGroupCount && pGroups[2 * it->second]) {
+			pOut.append(pGroups[2 * it->second], pGroups[2 * it->second + 1]);
+		}
+	}
+}
+
+/**
+ * @brief Reject the constructs which boost::regex would understand but the other engines would take differently
+ * @param pPattern the expression
+ */
+static void
+checkBoostOnlyEscapes(const std::string &pPattern) {
+	bool lInClass = false;
+	for (size_t i = 0; i < pPattern.size(); ++i) {
+		if (pPattern[i] == '\\' && i + 1 < pPattern.size()) {
+			char lNext = pPattern[++i];
+			if (!lInClass && strchr("<>`'", lNext)) {
+				throw RegexError(std::string("\\") + lNext + " needs the boost regex engine, use \\b, \\A or \\z");
+			}
+		} else if (pPattern[i] == '[' && !lInClass) {
+			lInClass = true;
+			// A ] right after the opening bracket is part of the class
+			if (i + 1 < pPattern.size() && pPattern[i + 1] == '^') {
+				++i;
+			}
+			if (i + 1 < pPattern.size() && pPattern[i + 1] == ']') {
+				++i;
+			}
+		} else if (pPattern[i] == ']') {
+			lInClass = false;
+		}
+	}
+}
+
+/**
+ * @brief A pointer into a text which counts the characters boost::regex reads through it,
+ * and throws once a search has read as many as its budget.
+ * Its copies share the count, that of the search.
+ */
+class BudgetIterator
+{
+public:
+	typedef std::random_access_iterator_tag iterator_category;
+	typedef char value_type;
+	typedef std::ptrdiff_t difference_type;
+	typedef const char *pointer;
+	typedef const char &reference;
+
+	/** @brief The steps left to a search, shared by its iterators */
+	struct tBudget {
+		unsigned long mLeft;
+		const std::string *mPattern;
+	};
+
+	BudgetIterator() : mPos(NULL), mBudget(NULL) {}
+	BudgetIterator(const char *pPos, tBudget *pBudget) : mPos(pPos), mBudget(pBudget) {}
+
+	const char *base() const { return mPos; }
+
+	reference operator*() const {
+		if (!mBudget->mLeft--) {
+			throw RegexBudgetExceeded(*mBudget->mPattern);
+		}
+		return *mPos;
+	}
+	pointer operator->() const { return &**this; }
+	reference operator[](difference_type n) const { return *(*this + n); }
+
+	BudgetIterator &operator++() { ++mPos; return *this; }
+	BudgetIterator operator++(int) { BudgetIterator lOld(*this); ++mPos; return lOld; }
+	BudgetIterator &operator--() { --mPos; return *this; }
+	BudgetIterator operator--(int) { BudgetIterator lOld(*this); --mPos; return lOld; }
+	BudgetIterator &operator+=(difference_type n) { mPos += n; return *this; }
+	BudgetIterator &operator-=(difference_type n) { mPos -= n; return *this; }
+	BudgetIterator operator+(difference_type n) const { return BudgetIterator(mPos + n, mBudget); }
+	BudgetIterator operator-(difference_type n) const { return BudgetIterator(mPos - n, mBudget); }
+	difference_type operator-(const BudgetIterator &pOther) const { return mPos - pOther.mPos; }
+
+	bool operator==(const BudgetIterator &pOther) const { return mPos == pOther.mPos; }
+	bool operator!=(const BudgetIterator &pOther) const { return mPos != pOther.mPos; }
+	bool operator<(const BudgetIterator &pOther) const { return mPos < pOther.mPos; }
+	bool operator>(const BudgetIterator &pOther) const { return mPos > pOther.mPos; }
+	bool operator<=(const BudgetIterator &pOther) const { return mPos <= pOther.mPos; }
+	bool operator>=(const BudgetIterator &pOther) const { return mPos >= pOther.mPos; }
+
+private:
+	const char *mPos;
+	tBudget *mBudget;
+};
+
+class BoostRegex : public IRegex
+{
+private:
+	boost::regex mRegex;
+	std::string mPattern;
+	unsigned long mBudget;
+
+public:
+	BoostRegex(const std::string &pPattern, unsigned long pBudget)
+		: mPattern(pPattern), mBudget(pBudget) {
+		try {
+			mRegex.assign(pPattern);
+		} catch (const boost::bad_expression &e) {
+			throw RegexError(e.what());
+		}
+	}
+
+	bool search(const char *pBegin, const char *pEnd) const {
+		try {
+			if (!mBudget) {
+				return boost::regex_search(pBegin, pEnd, mRegex);
+			}
+			BudgetIterator::tBudget lBudget = {mBudget, &mPattern};
+			return boost::regex_search(BudgetIterator(pBegin, &lBudget), BudgetIterator(pEnd, &lBudget), mRegex);
+		} catch (const std::runtime_error &) {
+			// Ours, or boost giving up on a too complex search
+			throw RegexBudgetExceeded(mPattern);
+		}
+	}
+
+	std::string replace(const std::string &pText, const tReplacement &pReplacement) const {
+		try {
+			if (!mBudget) {
+				return boost::regex_replace(pText, mRegex, pReplacement.mFormat, boost::match_default | boost::format_all);
+			}
+			BudgetIterator::tBudget lBudget = {mBudget, &mPattern};
+			std::string lResult;
+			boost::regex_replace(std::back_inserter(lResult), BudgetIterator(pText.data(), &lBudget),
+			                     BudgetIterator(pText.data() + pText.size(), &lBudget), mRegex, pReplacement.mFormat,
+			                     boost::match_default | boost::format_all);
+			return lResult;
+		} catch (const std::runtime_error &) {
+			throw RegexBudgetExceeded(mPattern);
+		}
+	}
+
+	const std::string &pattern() const {
+		return mPattern;
+	}
+};
+
+#ifdef HAVE_PCRE2
+class Pcre2Regex : public IRegex
+{
+private:
+	pcre2_code *mCode;
+	/** @brief Holds the budget, NULL without */
+	pcre2_match_context *mContext;
+	std::string mPattern;
+
+	Pcre2Regex(const Pcre2Regex &);
+	Pcre2Regex &operator=(const Pcre2Regex &);
+
+public:
+	Pcre2Regex(const std::string &pPattern, unsigned long pBudget)
+		: mContext(NULL), mPattern(pPattern) {
+		checkBoostOnlyEscapes(pPattern);
+		int lError;
+		PCRE2_SIZE lOffset;
+		mCode = pcre2_compile(reinterpret_cast<PCRE2_SPTR>(pPattern.data()), pPattern.size(),
+		                      PCRE2_MULTILINE | PCRE2_DOTALL, &lError, &lOffset, NULL);
+		if (!mCode) {
+			PCRE2_UCHAR lMessage[256];
+			pcre2_get_error_message(lError, lMessage, sizeof(lMessage));
+			throw RegexError(reinterpret_cast<const char *>(lMessage));
+		}
+		// The interpreter is used if the JIT is not supported on this platform
+		pcre2_jit_compile(mCode, PCRE2_JIT_COMPLETE);
+		if (pBudget) {
+			mContext = pcre2_match_context_create(NULL);
+			pcre2_set_match_limit(mContext, pBudget);
+		}
+	}
+
+	~Pcre2Regex() {
+		pcre2_match_context_free(mContext);
+		pcre2_code_free(mCode);
+	}
+
+	/**
+	 * @brief Returns the result of pcre2_match, throwing if it ran out of budget or stack
+	 */
+	int match(const char *pText, size_t pSize, size_t pStart, pcre2_match_data *pMatch) const {
+		int lResult = pcre2_match(mCode, reinterpret_cast<PCRE2_SPTR>(pText), pSize, pStart, 0, pMatch, mContext);
+		if (lResult < PCRE2_ERROR_NOMATCH) {
+			pcre2_match_data_free(pMatch);
+			throw RegexBudgetExceeded(mPattern);
+		}
+		return lResult;
+	}
+
+	bool search(const char *pBegin, const char *pEnd) const {
+		pcre2_match_data *lMatch = pcre2_match_data_create(1, NULL);
+		int lResult = match(pBegin, pEnd - pBegin, 0, lMatch);
+		pcre2_match_data_free(lMatch);
+		return lResult >= 0;
+	}
+
+	std::string replace(const std::string &pText, const tReplacement &pReplacement) const {
+		pcre2_match_data *lMatch = pcre2_match_data_create_from_pattern(mCode, NULL);
+		PCRE2_SIZE *lVector = pcre2_get_ovector_pointer(lMatch);
+		std::vector<const char *> lGroups;
+		std::string lResult;
+		const char *lText = pText.data();
+		size_t lDone = 0, lStart = 0;
+		int lCount;
+		while (lStart <= pText.size() &&
+		       (lCount = match(lText, pText.size(), lStart, lMatch)) > 0) {
+			lGroups.assign(2 * lCount, NULL);
+			for (int i = 0; i < lCount; ++i) {
+				if (lVector[2 * i] != PCRE2_UNSET) {
+					lGroups[2 * i] = lText + lVector[2 * i];
+					lGroups[2 * i + 1] = lText + lVector[2 * i + 1];
+				}
+			}
+			lResult.append(lText + lDone, lVector[0] - lDone);
+			appendReplacement(lResult, pReplacement, &lGroups[0], lCount);
+			lDone = lStart = lVector[1];
+			if (lVector[0] == lVector[1]) {
+				// Step over the empty match
+				if (lStart < pText.size()) {
+					lResult += pText[lStart];
+				}
+				lDone = ++lStart;
+			}
+		}
+		if (lDone < pText.size()) {
+			lResult.append(lText + lDone, pText.size() - lDone);
+		}
+		pcre2_match_data_free(lMatch);
+		return lResult;
+	}
+
+	const std::string &pattern() const {
+		return mPattern;
+	}
+};
+#endif
+
+#ifdef HAVE_RE2
+class Re2Regex : public IRegex
+{
+private:
+	boost::scoped_ptr<re2::RE2> mRegex;
+	std::string mPattern;
+
+	static re2::RE2::Options
+	options() {
+		re2::RE2::Options lOptions;
+		lOptions.set_encoding(re2::RE2::Options::EncodingLatin1);
+		lOptions.set_dot_nl(true);
+		lOptions.set_log_errors(false);
+		return lOptions;
+	}
+
+public:
+	explicit Re2Regex(const std::string &pPattern)
+		: mPattern(pPattern) {
+		checkBoostOnlyEscapes(pPattern);
+		// (?m) as boost matches ^ and $ at the line breaks
+		mRegex.reset(new re2::RE2("(?m)" + pPattern, options()));
+		if (!mRegex->ok()) {
+			throw RegexError(mRegex->error());
+		}
+	}
+
+	bool search(const char *pBegin, const char *pEnd) const {
+		return re2::RE2::PartialMatch(re2::StringPiece(pBegin, pEnd - pBegin), *mRegex);
+	}
+
+	std::string replace(const std::string &pText, const tReplacement &pReplacement) const {
+		int lCount = mRegex->NumberOfCapturingGroups() + 1;
+		std::vector<re2::StringPiece> lMatch(lCount);
+		std::vector<const char *> lGroups(2 * lCount);
+		re2::StringPiece lText(pText);
+		std::string lResult;
+		size_t lDone = 0, lStart = 0;
+		while (lStart <= pText.size() &&
+		       mRegex->Match(lText, lStart, pText.size(), re2::RE2::UNANCHORED, &lMatch[0], lCount)) {
+			for (int i = 0; i < lCount; ++i) {
+				lGroups[2 * i] = lMatch[i].data();
+				lGroups[2 * i + 1] = lMatch[i].data() + lMatch[i].size();
+			}
+			size_t lBegin = lMatch[0].data() - pText.data();
+			size_t lEnd = lBegin + lMatch[0].size();
+			lResult.append(pText, lDone, lBegin - lDone);
+			appendReplacement(lResult, pReplacement, &lGroups[0], lCount);
+			lDone = lStart = lEnd;
+			if (lBegin == lEnd) {
+				// Step over the empty match
+				if (lStart < pText.size()) {
+					lResult += pText[lStart];
+				}
+				lDone = ++lStart;
+			}
+		}
+		if (lDone < pText.size()) {
+			lResult.append(pText, lDone, std::string::npos);
+		}
+		return lResult;
+	}
+
+	const std::string &pattern() const {
+		return mPattern;
+	}
+};
+#endif
+
+bool
+getRegexEngine(const std::string &pName, eRegexEngine &pEngine) {
+	if (pName == "boost") {
+		pEngine = BOOST_ENGINE;
+	} else if (pName == "pcre2") {
+		pEngine = PCRE2_ENGINE;
+	} else if (pName == "re2") {
+		pEngine = RE2_ENGINE;
+	} else {
+		return false;
+	}
+	return true;
+}
+
+bool
+isRegexEngineAvailable(eRegexEngine pEngine) {
+	switch (pEngine) {
+#ifdef HAVE_PCRE2
+	case PCRE2_ENGINE:
+		return true;
+#endif
+#ifdef HAVE_RE2
+	case RE2_ENGINE:
+		return true;
+#endif
+	case BOOST_ENGINE:
+		return true;
+	default:
+		return false;
+	}
+}
+
+const IRegex *
+compileRegex(const std::string &pPattern, eRegexEngine pEngine, unsigned long pBudget) {
+	switch (pEngine) {
+#ifdef HAVE_PCRE2
+	case PCRE2_ENGINE:
+		return new Pcre2Regex(pPattern, pBudget);
+#endif
+#ifdef HAVE_RE2
+	case RE2_ENGINE:
+		return new Re2Regex(pPattern);
+#endif
+	case BOOST_ENGINE:
+		return new BoostRegex(pPattern, pBudget);
+	default:
+		throw RegexError("mod_dup was built without this regex engine");
+	}
+}
+
+}
@@ -0,0 +1,154 @@
+/*
+* mod_dup - duplicates apache requests
+*
+* Copyright (C) 2013 Orange
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#pragma once
+
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace DupModule {
+
+/**
+ * @brief The regular expression libraries the filters and substitutions can be compiled with
+ */
+enum eRegexEngine {
+	/** boost::regex, backtracking, always available */
+	BOOST_ENGINE = 0,
+	/** PCRE2 with its JIT compiler, if built with HAVE_PCRE2 */
+	PCRE2_ENGINE,
+	/** RE2, linear time but without back references nor lookarounds, if built with HAVE_RE2 */
+	RE2_ENGINE,
+};
+
+/**
+ * @brief Thrown when an expression is invalid, or uses a feature its engine lacks
+ */
+class RegexError : public std::runtime_error
+{
+public:
+	explicit RegexError(const std::string &pWhat) : std::runtime_error(pWhat) {}
+};
+
+/**
+ * @brief Thrown when a search or a replacement exceeds the budget of its expression
+ */
+class RegexBudgetExceeded : public RegexError
+{
+private:
+	std::string mPattern;
+
+public:
+	explicit RegexBudgetExceeded(const std::string &pPattern)
+		: RegexError("Regex budget exceeded by " + pPattern), mPattern(pPattern) {}
+
+	~RegexBudgetExceeded() throw() {}
+
+	/**
+	 * @brief Returns the expression which exceeded its budget
+	 */
+	const std::string &
+	pattern() const {
+		return mPattern;
+	}
+};
+
+/**
+ * @brief A replacement of a substitution, checked and split once at configuration time.
+ * boost gets the format string as it is ($n, \n, $&, conditionals...).
+ * The other engines only support the group references ($n, ${n}, \n and $&) and the escapes,
+ * any other format feature is rejected rather than silently output differently.
+ */
+struct tReplacement {
+	/**
+	 * @brief Parse a replacement for an engine
+	 * @param pFormat the replacement, as given in the configuration
+	 * @param pEngine the engine the substitution is compiled with
+	 * @throw RegexError if the engine does not support a feature of the replacement
+	 */
+	tReplacement(const std::string &pFormat, eRegexEngine pEngine);
+
+	/** @brief The replacement as given in the configuration */
+	std::string mFormat;
+	/** @brief Its parts for the engines other than boost: a literal text, or the number of a group with an empty text */
+	std::vector<std::pair<std::string, int> > mParts;
+};
+
+/**
+ * @brief A compiled regular expression. Immutable, it is shared by the worker threads without locking.
+ * All the engines search with the semantics of boost::regex: ^ and $ also match at the line breaks, and . matches them.
+ * Searches and replacements throw RegexBudgetExceeded when they exceed the budget of the expression,
+ * or the complexity bounds of the engine itself.
+ */
+class IRegex
+{
+public:
+	virtual ~IRegex() {}
+
+	/**
+	 * @brief Returns true if the expression matches anywhere in the text
+	 */
+	virtual bool search(const char *pBegin, const char *pEnd) const = 0;
+
+	bool search(const std::string &pText) const {
+		return search(pText.data(), pText.data() + pText.size());
+	}
+
+	/**
+	 * @brief Replace all the matches of the expression in a text
+	 * @param pText the text
+	 * @param pReplacement the replacement, parsed for the engine of the expression
+	 * @return the text with the matches replaced
+	 */
+	virtual std::string replace(const std::string &pText, const tReplacement &pReplacement) const = 0;
+
+	/**
+	 * @brief Returns the expression as given in the configuration
+	 */
+	virtual const std::string &pattern() const = 0;
+};
+
+/**
+ * @brief Parse the name of a regex engine: boost, pcre2 or re2
+ * @param pName the name
+ * @param pEngine receives the engine
+ * @return false if the name is unknown
+ */
+bool
+getRegexEngine(const std::string &pName, eRegexEngine &pEngine);
+
+/**
+ * @brief Returns true if mod_dup was built with the library of an engine
+ */
+bool
+isRegexEngineAvailable(eRegexEngine pEngine);
+
+/**
+ * @brief Compile an expression
+ * @param pPattern the expression
+ * @param pEngine the engine to compile it with, which must be available
+ * @param pBudget the number of steps each search or replacement may take, 0 for no limit.
+ * A step is a character read by boost, a backtracking point of pcre2. re2 never backtracks and has no budget.
+ * @return the compiled expression, to delete by the caller
+ * @throw RegexError if the expression is invalid, or uses a feature the engine lacks
+ */
+const IRegex *
+compileRegex(const std::string &pPattern, eRegexEngine pEngine, unsigned long pBudget = 0);
+
+}
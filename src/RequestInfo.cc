@@ -16,6 +16,8 @@
 * limitations under the License.
 */
 
+#include <string.h>
+
 #include "RequestInfo.hh"
 
 namespace DupModule {
@@ -30,24 +32,94 @@ namespace DupModule {
 		mPoison(false),
 		mConfPath(pConfPath),
 		mPath(pPath),
-		mArgs(pArgs){
+		mArgs(pArgs),
+		mStatus(0),
+		mDuration(0),
+		mFiltered(false) {
         if (pBody)
             mBody = *pBody;
 }
 
+/**
+ * @brief Constructs the object, taking over the body without copying it.
+ * @param pConfPath The location (in the conf) which matched this query
+ * @param pPath The path part of the request
+ * @param pArgs The parameters part of the query (without leading ?)
+ * @param pBody The body part of the query, left empty
+ */
+RequestInfo::RequestInfo(const std::string &pConfPath, const std::string &pPath, const std::string &pArgs, std::string &&pBody) :
+		mPoison(false),
+		mConfPath(pConfPath),
+		mPath(pPath),
+		mArgs(pArgs),
+		mBody(std::move(pBody)),
+		mStatus(0),
+		mDuration(0),
+		mFiltered(false) {
+}
+
 /**
  * @brief Constructs a poisonous object causing the processor to stop when read
  */
 RequestInfo::RequestInfo() :
-		mPoison(true) {}
+		mPoison(true),
+		mStatus(0),
+		mDuration(0),
+		mFiltered(false) {}
 
 /**
  * @brief Returns wether the the request is poisonous
  * @return true if poisonous, false otherwhise
  */
 bool
-RequestInfo::isPoison() {
+RequestInfo::isPoison() const {
 	return mPoison;
 }
 
+void
+RequestInfo::serialize(tSerializedHeader &pHeader, struct iovec pParts[SERIALIZED_PARTS]) const {
+	pHeader.mConfPathSize = mConfPath.size();
+	pHeader.mPathSize = mPath.size();
+	pHeader.mArgsSize = mArgs.size();
+	pHeader.mBodySize = mBody.size();
+	pHeader.mStatus = mStatus;
+	pHeader.mFiltered = mFiltered;
+	pHeader.mDuration = mDuration;
+	pParts[0].iov_base = &pHeader;
+	pParts[0].iov_len = sizeof(pHeader);
+	pParts[1].iov_base = const_cast<char *>(mConfPath.data());
+	pParts[1].iov_len = mConfPath.size();
+	pParts[2].iov_base = const_cast<char *>(mPath.data());
+	pParts[2].iov_len = mPath.size();
+	pParts[3].iov_base = const_cast<char *>(mArgs.data());
+	pParts[3].iov_len = mArgs.size();
+	pParts[4].iov_base = const_cast<char *>(mBody.data());
+	pParts[4].iov_len = mBody.size();
+}
+
+bool
+RequestInfo::deserialize(const char *pData, size_t pSize) {
+	tSerializedHeader lHeader;
+	if (pSize < sizeof(lHeader)) {
+		return false;
+	}
+	memcpy(&lHeader, pData, sizeof(lHeader));
+	if (pSize != sizeof(lHeader) + static_cast<size_t>(lHeader.mConfPathSize) + lHeader.mPathSize + lHeader.mArgsSize + lHeader.mBodySize) {
+		return false;
+	}
+	const char *lPos = pData + sizeof(lHeader);
+	mConfPath.assign(lPos, lHeader.mConfPathSize);
+	lPos += lHeader.mConfPathSize;
+	mPath.assign(lPos, lHeader.mPathSize);
+	lPos += lHeader.mPathSize;
+	mArgs.assign(lPos, lHeader.mArgsSize);
+	lPos += lHeader.mArgsSize;
+	mBody.assign(lPos, lHeader.mBodySize);
+	mStatus = lHeader.mStatus;
+	mDuration = lHeader.mDuration;
+	mFiltered = lHeader.mFiltered != 0;
+	mPoison = false;
+	return true;
+}
+
 }
@@ -19,10 +19,28 @@
 #pragma once
 
 #include <string>
+#include <stdint.h>
+#include <sys/uio.h>
 
 namespace DupModule {
 
 
+    /**
+     * @brief Fixed size part of the serialized form of a RequestInfo, followed by its strings
+     */
+    struct tSerializedHeader {
+        uint32_t mConfPathSize;
+        uint32_t mPathSize;
+        uint32_t mArgsSize;
+        uint32_t mBodySize;
+        int32_t mStatus;
+        int32_t mFiltered;
+        int64_t mDuration;
+    };
+
+    /** @brief Number of parts of the serialized form of a RequestInfo */
+    static const size_t SERIALIZED_PARTS = 5;
+
     /**
      * @brief Contains information about the incoming request.
      */
@@ -40,6 +58,12 @@ namespace DupModule {
 	std::string mArgs;
 	/** @brief The body part of the query */
 	std::string mBody;
+	/** @brief The status of the original response, 0 if it is not forwarded */
+	int mStatus;
+	/** @brief The time the original request took in micro sec, meaningful only if mStatus is set */
+	long long mDuration;
+	/** @brief True if its arguments alone already matched the filters of its location, which are then not applied again */
+	bool mFiltered;
 
 	/**
 	 * @brief Constructs the object using the three strings.
@@ -49,6 +73,15 @@ namespace DupModule {
 	 */
         RequestInfo(const std::string &pConfPath, const std::string &pPath, const std::string &pArgs, const std::string *body = 0);
 
+	/**
+	 * @brief Constructs the object, taking over the body without copying it.
+	 * @param pConfPath The location (in the conf) which matched this query
+	 * @param pPath The path part of the request
+	 * @param pArgs The parameters part of the query (without leading ?)
+	 * @param pBody The body part of the query, left empty
+	 */
+        RequestInfo(const std::string &pConfPath, const std::string &pPath, const std::string &pArgs, std::string &&pBody);
+
 	/**
 	 * @brief Constructs a poisonous object causing the processor to stop when read
 	 */
@@ -59,12 +92,45 @@ namespace DupModule {
          */
         bool hasBody() const;
 
+	/**
+	 * @brief Describes the serialized form of the request, without copying anything
+	 * @param pHeader receives the fixed size part, must outlive pParts
+	 * @param pParts receives the SERIALIZED_PARTS parts to be written one after the other
+	 */
+	void serialize(tSerializedHeader &pHeader, struct iovec pParts[SERIALIZED_PARTS]) const;
+
+	/**
+	 * @brief Rebuilds a request from its serialized form
+	 * @param pData the serialized request
+	 * @param pSize its size
+	 * @return false if the data is not a serialized request, in which case the object is untouched
+	 */
+	bool deserialize(const char *pData, size_t pSize);
+
 	/**
 	 * @brief Returns wether the the request is poisonous
 	 * @return true if poisonous, false otherwhise
 	 */
-	bool isPoison();
+	bool isPoison() const;
     };
 
+    /**
+     * @brief Returns the number of bytes a request holds while it is queued
+     * @param pRequest the request
+     * @return the size of the object and of its strings
+     */
+    inline size_t
+    queueItemSize(const RequestInfo &pRequest) {
+        return sizeof(pRequest) + pRequest.mConfPath.size() + pRequest.mPath.size() + pRequest.mArgs.size() + pRequest.mBody.size();
+    }
+
+    /**
+     * @brief Returns true if a request is a poison pill, whatever the pill it is compared with
+     */
+    inline bool
+    isQueueItemPoison(const RequestInfo &pRequest, const RequestInfo &) {
+        return pRequest.isPoison();
+    }
+
     static const RequestInfo POISON_REQUEST;
 }
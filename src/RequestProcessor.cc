@@ -20,16 +20,30 @@
 #include <curl/curl.h>
 #include <boost/tokenizer.hpp>
 #include <boost/algorithm/string.hpp>
-#include <boost/algorithm/string/join.hpp>
 #include <boost/lexical_cast.hpp>
+#include <ctype.h>
 #include <httpd.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
 
 #include "RequestProcessor.hh"
+#include "ArgsParser.hh"
 
 namespace DupModule {
 
 const char * gUserAgent = "mod-dup";
 
+/**
+ * @brief Returns a monotonic time in micro sec
+ */
+static unsigned long long
+monotonicTime() {
+    struct timespec lNow;
+    clock_gettime(CLOCK_MONOTONIC, &lNow);
+    return static_cast<unsigned long long>(lNow.tv_sec) * 1000000 + lNow.tv_nsec / 1000;
+}
+
 /**
  * @brief Set the destination server and port
  * @param pDestination the destination in &lt;host>[:&lt;port>] format
@@ -59,9 +73,10 @@ RequestInfo::hasBody() const {
  */
 const unsigned int
 RequestProcessor::getTimeoutCount() {
-	// Atomic read + reset
-	// Works because mTimeoutCount & 0 == 0
-	unsigned int lTimeoutCount = __sync_fetch_and_and(&mTimeoutCount, 0);
+	// Only the stats thread reads it, the total is never reset
+	unsigned long long lTotal = __atomic_load_n(&mTimeoutCount, __ATOMIC_RELAXED);
+	unsigned int lTimeoutCount = lTotal - mTimeoutReported;
+	mTimeoutReported = lTotal;
 	if (lTimeoutCount > 0) {
 		Log::warn(303, "%u requests timed out during last cycle!", lTimeoutCount);
 	}
@@ -74,12 +89,23 @@ RequestProcessor::getTimeoutCount() {
  */
 const unsigned int
 RequestProcessor::getDuplicatedCount() {
-    // Atomic read + reset
-    // Works because mDuplicatedCount & 0 == 0
-    unsigned int lCount = __sync_fetch_and_and(&mDuplicatedCount, 0);
+    // Only the stats thread reads it, the total is never reset
+    unsigned long long lTotal = __atomic_load_n(&mDuplicatedCount, __ATOMIC_RELAXED);
+    unsigned int lCount = lTotal - mDuplicatedReported;
+    mDuplicatedReported = lTotal;
     return lCount;
 }
 
+unsigned long long
+RequestProcessor::getTimeoutTotal() const {
+    return __atomic_load_n(&mTimeoutCount, __ATOMIC_RELAXED);
+}
+
+unsigned long long
+RequestProcessor::getDuplicatedTotal() const {
+    return __atomic_load_n(&mDuplicatedCount, __ATOMIC_RELAXED);
+}
+
 /**
  * @brief Add a filter for all requests on a given path
  * @param pPath the path of the request
@@ -89,13 +115,160 @@ RequestProcessor::getDuplicatedCount() {
 void
 RequestProcessor::addFilter(const std::string &pPath, const std::string &pField, const std::string &pFilter, tFilterBase::eFilterScope scope) {
 
-    mCommands[pPath].mFilters.insert(std::pair<std::string, tFilter>(boost::to_upper_copy(pField),
-                                                                     tFilter(pFilter, scope)));
+    tRequestProcessorCommands &lCommands = mCommands[pPath];
+    lCommands.mFilters.insert(std::pair<std::string, tFilter>(boost::to_upper_copy(pField),
+                                                              tFilter(pFilter, scope, mRegexEngine, mRegexBudget)));
+    lCommands.mHasHeaderKeyFilters |= bool(scope & tFilterBase::HEADER);
+    lCommands.mHasBodyKeyFilters |= bool(scope & tFilterBase::BODY);
+    indexKeys(lCommands);
 }
 
 void
 RequestProcessor::addRawFilter(const std::string &pPath, const std::string &pFilter, tFilterBase::eFilterScope scope) {
-    mCommands[pPath].mRawFilters.push_back(tFilter(pFilter, scope));
+    tRequestProcessorCommands &lCommands = mCommands[pPath];
+    lCommands.mRawFilters.push_back(tFilter(pFilter, scope, mRegexEngine, mRegexBudget));
+    lCommands.mHasBodyRawFilters |= bool(scope & tFilterBase::BODY);
+    compileRawFilters(lCommands, mRegexEngine, mRegexBudget);
+}
+
+/**
+ * @brief Returns true if a regular expression depends on its own groups or layout, which an alternation with others would change:
+ * back references, recursions and subroutine calls, conditionals and named groups refer to groups which would be renumbered,
+ * or clash with those of the others, and a comment of the extended mode would swallow the end of the group it is wrapped in.
+ * Errs on the side of searching an expression on its own.
+ * @param pRegex the regular expression
+ */
+static bool
+needsOwnSearch(const std::string &pRegex) {
+    for (size_t i = 0; i + 2 < pRegex.size(); ++i) {
+        if (pRegex[i] == '\\') {
+            char lNext = pRegex[i + 1];
+            if ((lNext >= '1' && lNext <= '9') || lNext == 'g' || lNext == 'k') {
+                return true;
+            }
+            ++i;
+            continue;
+        }
+        if (pRegex[i] != '(' || pRegex[i + 1] != '?') {
+            continue;
+        }
+        char lKind = pRegex[i + 2];
+        char lAfter = i + 3 < pRegex.size() ? pRegex[i + 3] : 0;
+        // Recursions, subroutine calls and conditionals: (?1), (?+1), (?-1), (?R), (?&name), (?(...)
+        if (isdigit(lKind) || lKind == '+' || (lKind == '-' && isdigit(lAfter)) || lKind == 'R' || lKind == '&' || lKind == '(') {
+            return true;
+        }
+        // Named groups and references to them: (?<name>, (?'name', (?P<name>, (?P=name), (?P>name), but not the lookbehinds
+        if (lKind == 'P' || lKind == '\'' || (lKind == '<' && lAfter != '=' && lAfter != '!')) {
+            return true;
+        }
+        // Inline modifiers switching the extended mode
+        for (size_t j = i + 2; j < pRegex.size() && (isalpha(pRegex[j]) || pRegex[j] == '-'); ++j) {
+            if (pRegex[j] == 'x') {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Combine the raw filters of a scope into one alternation
+ * @param pRawFilters the raw filters
+ * @param pScope the scope
+ * @param pEngine the engine to compile the alternation with
+ * @param pBudget the budget of the alternation
+ * @param pMatcher receives the alternation, NULL if no filter applies on the scope
+ * @param pMembers receives the filters in the alternation
+ * @param pPrefilters receives the prefilters of the filters in the alternation, none if one of them has none
+ * @param pSeparate receives the filters which cannot be combined
+ */
+static void
+combineRawFilters(const std::list<tFilter> &pRawFilters, tFilterBase::eFilterScope pScope, eRegexEngine pEngine, unsigned long pBudget,
+                  boost::shared_ptr<const IRegex> &pMatcher, std::vector<tFilter> &pMembers,
+                  std::vector<boost::shared_ptr<Prefilter> > &pPrefilters, std::list<tFilter> &pSeparate) {
+    std::string lAlternation;
+    bool lAllPrefiltered = true;
+    pMembers.clear();
+    pPrefilters.clear();
+    BOOST_FOREACH (const tFilter &lRaw, pRawFilters) {
+        if (!(lRaw.mScope & pScope)) {
+            continue;
+        }
+        if (needsOwnSearch(lRaw.mRegex->pattern())) {
+            // Searched on its own, once even if it applies on both scopes
+            if (pScope == tFilterBase::HEADER || !(lRaw.mScope & tFilterBase::HEADER)) {
+                pSeparate.push_back(lRaw);
+            }
+            continue;
+        }
+        if (!lAlternation.empty()) {
+            lAlternation += '|';
+        }
+        // A group of its own, so that its alternations and inline modifiers stay local
+        lAlternation += "(?:" + lRaw.mRegex->pattern() + ")";
+        lAllPrefiltered &= bool(lRaw.mPrefilter);
+        pPrefilters.push_back(lRaw.mPrefilter);
+        pMembers.push_back(lRaw);
+    }
+    if (pMembers.size() == 1) {
+        // A lone filter is searched with its own expression
+        pMatcher = pMembers.front().mRegex;
+    } else {
+        pMatcher.reset(lAlternation.empty() ? NULL : compileRegex(lAlternation, pEngine, pBudget));
+    }
+    if (!lAllPrefiltered) {
+        pPrefilters.clear();
+    }
+}
+
+void
+RequestProcessor::compileRawFilters(tRequestProcessorCommands &pCommands, eRegexEngine pEngine, unsigned long pBudget) {
+    pCommands.mSeparateRawFilters.clear();
+    combineRawFilters(pCommands.mRawFilters, tFilterBase::HEADER, pEngine, pBudget, pCommands.mHeaderRawMatcher,
+                      pCommands.mHeaderRawMembers, pCommands.mHeaderRawPrefilters, pCommands.mSeparateRawFilters);
+    combineRawFilters(pCommands.mRawFilters, tFilterBase::BODY, pEngine, pBudget, pCommands.mBodyRawMatcher,
+                      pCommands.mBodyRawMembers, pCommands.mBodyRawPrefilters, pCommands.mSeparateRawFilters);
+}
+
+/**
+ * @brief Search the alternation of the raw filters of a scope.
+ * If it exceeds its budget, its filters are searched one by one, each within its own budget:
+ * the others can still match, and the one exceeding it is reported rather than the alternation.
+ * @param pMatcher the alternation
+ * @param pMembers the filters in it
+ * @param pText the text to search
+ * @return true if one of the filters matches
+ * @throw RegexBudgetExceeded of the first filter exceeding its budget, if none matches
+ */
+static bool
+searchRawFilters(const IRegex &pMatcher, const std::vector<tFilter> &pMembers, const std::string &pText) {
+    try {
+        return pMatcher.search(pText);
+    } catch (const RegexBudgetExceeded &) {
+        if (pMembers.size() < 2) {
+            throw;
+        }
+    }
+    std::string lExceeded;
+    BOOST_FOREACH (const tFilter &lRaw, pMembers) {
+        if (lRaw.mPrefilter && !lRaw.mPrefilter->mayMatch(pText)) {
+            continue;
+        }
+        try {
+            if (lRaw.mRegex->search(pText)) {
+                return true;
+            }
+        } catch (const RegexBudgetExceeded &e) {
+            if (lExceeded.empty()) {
+                lExceeded = e.pattern();
+            }
+        }
+    }
+    if (!lExceeded.empty()) {
+        throw RegexBudgetExceeded(lExceeded);
+    }
+    return false;
 }
 
 /**
@@ -108,12 +281,47 @@ RequestProcessor::addRawFilter(const std::string &pPath, const std::string &pFil
 void
 RequestProcessor::addSubstitution(const std::string &pPath, const std::string &pField, const std::string &pMatch,
                                   const std::string &pReplace, tFilterBase::eFilterScope scope) {
-    mCommands[pPath].mSubstitutions[boost::to_upper_copy(pField)].push_back(tSubstitute(pMatch, pReplace, scope));
+    tRequestProcessorCommands &lCommands = mCommands[pPath];
+    lCommands.mSubstitutions[boost::to_upper_copy(pField)].push_back(tSubstitute(pMatch, pReplace, scope, mRegexEngine, mRegexBudget));
+    lCommands.mHasHeaderSubstitutions |= bool(scope & tFilterBase::HEADER);
+    lCommands.mHasBodySubstitutions |= bool(scope & tFilterBase::BODY);
+    indexKeys(lCommands);
+}
+
+void
+RequestProcessor::indexKeys(tRequestProcessorCommands &pCommands) {
+    // Copies sharing the compiled expressions and the prefilters of the maps
+    pCommands.mFilterIndex.clear();
+    for (std::multimap<std::string, tFilter>::const_iterator it = pCommands.mFilters.begin(); it != pCommands.mFilters.end(); ) {
+        std::multimap<std::string, tFilter>::const_iterator lEnd = pCommands.mFilters.upper_bound(it->first);
+        std::vector<tFilter> lFilters;
+        for (std::multimap<std::string, tFilter>::const_iterator f = it; f != lEnd; ++f) {
+            lFilters.push_back(f->second);
+        }
+        pCommands.mFilterIndex.insert(it->first, lFilters);
+        it = lEnd;
+    }
+    pCommands.mSubstitutionIndex.clear();
+    for (tFieldSubstitutionMap::const_iterator it = pCommands.mSubstitutions.begin(); it != pCommands.mSubstitutions.end(); ++it) {
+        pCommands.mSubstitutionIndex.insert(it->first, it->second);
+    }
 }
 
 void
 RequestProcessor::addRawSubstitution(const std::string &pPath, const std::string &pRegex, const std::string &pReplace, tFilterBase::eFilterScope pScope){
-    mCommands[pPath].mRawSubstitutions.push_back(tSubstitute(pRegex, pReplace, pScope));
+    mCommands[pPath].mRawSubstitutions.push_back(tSubstitute(pRegex, pReplace, pScope, mRegexEngine, mRegexBudget));
+}
+
+/**
+ * @brief Decode a value into a buffer
+ * @param pValue the value, url encoded
+ * @param pOut receives it decoded, its capacity being reused
+ */
+template <class Codec>
+static void
+decodeValue(boost::string_ref pValue, std::string &pOut) {
+    pOut.resize(pValue.size());
+    pOut.resize(Codec::decode(pValue.data(), pValue.size(), &pOut[0]));
 }
 
 /**
@@ -134,24 +342,45 @@ RequestProcessor::parseArgs(std::list<tKeyVal> &pParsedArgs, const std::string &
         } else {
             std::string lKey = lToken.substr(0, lEqualPos);
             boost::to_upper(lKey);
-            std::string lVal = mUrlCodec->decode(lToken.substr(lEqualPos+1, std::string::npos));
+            boost::string_ref lEncoded(lToken.data() + lEqualPos + 1, lToken.size() - lEqualPos - 1);
+            std::string lVal;
+            if (mUrlCodec == APACHE_URL_CODEC) {
+                decodeValue<ApacheUrlCodec>(lEncoded, lVal);
+            } else {
+                decodeValue<DefaultUrlCodec>(lEncoded, lVal);
+            }
             pParsedArgs.push_back(tKeyVal(lKey, lVal));
         }
     }
 }
 
+template <class Codec>
 bool
-RequestProcessor::keyFilterMatch(std::multimap<std::string, tFilter> &pFilters, std::list<tKeyVal> &pParsedArgs, tFilterBase::eFilterScope scope){
+RequestProcessor::keyFilterMatch(const tFilterIndex &pFilters, const std::string &pArgs, tFilterBase::eFilterScope scope){
+    ArgsParser lParser(pArgs);
+    tArgView lArg;
+    std::string lVal;
     // Key filter matching
-    BOOST_FOREACH (const tKeyVal lKeyVal, pParsedArgs) {
+    while (lParser.next(lArg)) {
         // Key Iteration
-        std::pair<std::multimap<std::string, tFilter>::iterator,
-                  std::multimap<std::string, tFilter>::iterator> lFilterIter = pFilters.equal_range(lKeyVal.first);
+        const std::vector<tFilter> *lFilters = pFilters.find(lArg.mKey);
+        if (!lFilters) {
+            continue;
+        }
+        // Decoded only if a filter looks at it
+        bool lDecoded = false;
         // FilterIteration
-        for (std::multimap<std::string, tFilter>::iterator it = lFilterIter.first; it != lFilterIter.second; ++it) {
-            if ((it->second.mScope & scope) &&                                  // Scope check
-                boost::regex_search(lKeyVal.second, it->second.mRegex)) {        // Regex match
-                Log::debug("Key filter matched: %s | %s", lKeyVal.second.c_str(), it->second.mRegex.str().c_str());
+        BOOST_FOREACH (const tFilter &lFilter, *lFilters) {
+            if (!(lFilter.mScope & scope)) {                                     // Scope check
+                continue;
+            }
+            if (!lDecoded) {
+                decodeValue<Codec>(lArg.mValue, lVal);
+                lDecoded = true;
+            }
+            if ((!lFilter.mPrefilter || lFilter.mPrefilter->mayMatch(lVal)) &&  // Literals check
+                lFilter.mRegex->search(lVal)) {                                  // Regex match
+                Log::debug("Key filter matched: %s | %s", lVal.c_str(), lFilter.mRegex->pattern().c_str());
                 return true;
             }
         }
@@ -159,60 +388,73 @@ RequestProcessor::keyFilterMatch(std::multimap<std::string, tFilter> &pFilters,
     return false;
 }
 
+/**
+ * @brief Returns false if none of the filters combined in an alternation can match a text, their literals being absent
+ * @param pPrefilters the prefilters of the filters, none to always search the alternation
+ * @param pText the text
+ */
+static bool
+anyMayMatch(const std::vector<boost::shared_ptr<Prefilter> > &pPrefilters, const std::string &pText) {
+    BOOST_FOREACH (const boost::shared_ptr<Prefilter> &lPrefilter, pPrefilters) {
+        if (lPrefilter->mayMatch(pText)) {
+            return true;
+        }
+    }
+    return pPrefilters.empty();
+}
+
 /**
  * @brief Returns wether or not the arguments match any of the filters
- * @param pParsedArgs the list with the argument key value pairs
- * @param pFilters the filters which should be applied
+ * @param pRequest the request
+ * @param pCommands the filters which should be applied
  * @return true if there are no filters or at least one filter matches, false otherwhise
  */
+template <class Codec>
 bool
-RequestProcessor::argsMatchFilter(RequestInfo &pRequest, tRequestProcessorCommands &pCommands, std::list<tKeyVal> &pHeaderParsedArgs) {
+RequestProcessor::argsMatchFilter(RequestInfo &pRequest, const tRequestProcessorCommands &pCommands) {
 
-    std::multimap<std::string, tFilter> &pFilters = pCommands.mFilters;
-    std::list<tFilter> &pRawFilters = pCommands.mRawFilters;
+    const tFilterIndex &pFilters = pCommands.mFilterIndex;
+    const std::list<tFilter> &pRawFilters = pCommands.mRawFilters;
 
     // If no filter is defined, we accept all queries
     if (pFilters.empty() && pRawFilters.empty()) {
         return true;
     }
 
-    // Key filter type detection
-    bool keyFilterOnHeader = false;
-    bool keyFilterOnBody = false;
-    typedef std::pair<const std::string, tFilter> value_type;
-    BOOST_FOREACH(value_type &f, pFilters) {
-        if (f.second.mScope & tFilterBase::BODY)
-            keyFilterOnBody = true;
-        if (f.second.mScope & tFilterBase::HEADER)
-            keyFilterOnHeader = true;
-     }
-
     // Key filters on header
-    if (keyFilterOnHeader && keyFilterMatch(pFilters, pHeaderParsedArgs, tFilterBase::HEADER)){
+    if (pCommands.mHasHeaderKeyFilters && keyFilterMatch<Codec>(pFilters, pRequest.mArgs, tFilterBase::HEADER)){
         return true;
     }
 
     // Key filters on body
-    if (keyFilterOnBody){
-        std::list<tKeyVal> lParsedArgs;
-        parseArgs(lParsedArgs, pRequest.mBody);
-        if (keyFilterMatch(pFilters, lParsedArgs, tFilterBase::BODY))
-            return true;
+    if (pCommands.mHasBodyKeyFilters && keyFilterMatch<Codec>(pFilters, pRequest.mBody, tFilterBase::BODY)){
+        return true;
     }
 
-    // Raw filters matching
-    BOOST_FOREACH (tFilter &raw, pCommands.mRawFilters) {
+    // Raw filters matching: one pass over each part for all the filters, unless none of their literals is there ...
+    if (pCommands.mHeaderRawMatcher && anyMayMatch(pCommands.mHeaderRawPrefilters, pRequest.mArgs) &&
+        searchRawFilters(*pCommands.mHeaderRawMatcher, pCommands.mHeaderRawMembers, pRequest.mArgs)) {
+        Log::debug("Raw filter (HEADER) matched: %s", pRequest.mArgs.c_str());
+        return true;
+    }
+    if (pCommands.mBodyRawMatcher && anyMayMatch(pCommands.mBodyRawPrefilters, pRequest.mBody) &&
+        searchRawFilters(*pCommands.mBodyRawMatcher, pCommands.mBodyRawMembers, pRequest.mBody)) {
+        Log::debug("Raw filter (BODY) matched: %s", pRequest.mBody.c_str());
+        return true;
+    }
+    // ... but the ones depending on their own groups or layout
+    BOOST_FOREACH (const tFilter &raw, pCommands.mSeparateRawFilters) {
         // Header application
         if (raw.mScope & tFilterBase::HEADER) {
-            if (boost::regex_search(pRequest.mArgs, raw.mRegex)) {
-                Log::debug("Raw filter (HEADER) matched: %s | %s", pRequest.mArgs.c_str(), raw.mRegex.str().c_str());
+            if ((!raw.mPrefilter || raw.mPrefilter->mayMatch(pRequest.mArgs)) && raw.mRegex->search(pRequest.mArgs)) {
+                Log::debug("Raw filter (HEADER) matched: %s | %s", pRequest.mArgs.c_str(), raw.mRegex->pattern().c_str());
                 return true;
             }
         }
         // Body application
         if (raw.mScope & tFilterBase::BODY) {
-            if (boost::regex_search(pRequest.mBody, raw.mRegex)) {
-                Log::debug("Raw filter (BODY) matched: %s | %s", pRequest.mBody.c_str(), raw.mRegex.str().c_str());
+            if ((!raw.mPrefilter || raw.mPrefilter->mayMatch(pRequest.mBody)) && raw.mRegex->search(pRequest.mBody)) {
+                Log::debug("Raw filter (BODY) matched: %s | %s", pRequest.mBody.c_str(), raw.mRegex->pattern().c_str());
                 return true;
             }
         }
@@ -220,97 +462,131 @@ RequestProcessor::argsMatchFilter(RequestInfo &pRequest, tRequestProcessorComman
     return false;
 }
 
+template <class Codec>
 bool
-RequestProcessor::keySubstitute(tFieldSubstitutionMap &pSubs,
-                                std::list<tKeyVal> &pParsedArgs,
+RequestProcessor::keySubstitute(const tSubstitutionIndex &pSubs,
+                                const std::string &pArgs,
                                 tFilterBase::eFilterScope scope,
                                 std::string &result){
-    apr_pool_t *lPool = NULL;
-    apr_pool_create(&lPool, 0);
-
-    std::list<std::string> lNewArgs;
-    bool lDidSubstitute = false;
+    // Built on the first substitution: the arguments before it and those left untouched are copied as they are
+    std::string lOut;
+    const char *lCopied = pArgs.data();
+    ArgsParser lParser(pArgs);
+    tArgView lArg;
+    std::string lVal;
 
     // Run through the keys
-    BOOST_FOREACH (const tKeyVal lKeyVal, pParsedArgs) {
-        std::map<std::string, std::list<tSubstitute> >::iterator lSubstIter = pSubs.find(lKeyVal.first);
-        std::string lVal = lKeyVal.second;
-
+    while (lParser.next(lArg)) {
+        const std::list<tSubstitute> *lSubsts = pSubs.find(lArg.mKey);
         // Key found in the subs?
-        if (lSubstIter != pSubs.end()) {
-            BOOST_FOREACH(const tSubstitute &lSubst, lSubstIter->second) {
-                Log::debug("Key substitute: %d | lVal:%s | lSubst:%s | Rep:%s", (int) lSubst.mScope, lVal.c_str(),
-                           lSubst.mRegex.str().c_str(), lSubst.mReplacement.c_str());
-                if (!(scope & lSubst.mScope))
-                    continue;
-
-                lVal = boost::regex_replace(lVal, lSubst.mRegex, lSubst.mReplacement, boost::match_default | boost::format_all);
+        if (!lSubsts) {
+            continue;
+        }
+        bool lDidSubstitute = false;
+        BOOST_FOREACH(const tSubstitute &lSubst, *lSubsts) {
+            if (!(scope & lSubst.mScope))
+                continue;
+            if (!lDidSubstitute) {
+                decodeValue<Codec>(lArg.mValue, lVal);
                 lDidSubstitute = true;
-                Log::debug("Key substitute res: lVal:%s ", lVal.c_str());
-
             }
+            Log::debug("Key substitute: %d | lVal:%s | lSubst:%s | Rep:%s", (int) lSubst.mScope, lVal.c_str(),
+                       lSubst.mRegex->pattern().c_str(), lSubst.mReplacement.mFormat.c_str());
+            lVal = lSubst.mRegex->replace(lVal, lSubst.mReplacement);
+            Log::debug("Key substitute res: lVal:%s ", lVal.c_str());
         }
-        if (lVal.empty()) {
-            lNewArgs.push_back(lKeyVal.first);
-        } else {
-            lNewArgs.push_back(lKeyVal.first + "=" + mUrlCodec->encode(lPool, lVal));
+        if (!lDidSubstitute) {
+            continue;
+        }
+        if (lOut.empty()) {
+            lOut.reserve(pArgs.size() + 3 * lVal.size());
         }
+        lOut.append(lCopied, lArg.mParam.data());
+        lOut.append(lArg.mKey.data(), lArg.mKey.size());
+        if (!lVal.empty()) {
+            // Encoded in place, at the end of the buffer
+            lOut += '=';
+            size_t lPos = lOut.size();
+            lOut.resize(lPos + 3 * lVal.size());
+            lOut.resize(lPos + Codec::encode(lVal.data(), lVal.size(), &lOut[lPos]));
+        }
+        lCopied = lArg.mParam.data() + lArg.mParam.size();
     }
-    if (lDidSubstitute) {
-        result = boost::algorithm::join(lNewArgs, "&");
+    if (lCopied == pArgs.data()) {
+        return false;
     }
-    apr_pool_destroy(lPool);
-    return lDidSubstitute;
+    lOut.append(lCopied, pArgs.data() + pArgs.size());
+    result.swap(lOut);
+    return true;
 }
 
+template <class Codec>
 bool
-RequestProcessor::substituteRequest(RequestInfo &pRequest, tRequestProcessorCommands &pCommands, std::list<tKeyVal> &pHeaderParsedArgs) {
+RequestProcessor::substituteRequest(RequestInfo &pRequest, const tRequestProcessorCommands &pCommands) {
     // Ideally we would use the pool from the apache request, but it's used in another thread
 
-    bool keySubOnBody = false, keySubOnHeader = false;
-
-    // Detect the presence of the different key filters
-    typedef std::pair<const std::string, std::list<tSubstitute> > value_type;
-    BOOST_FOREACH(value_type &f, pCommands.mSubstitutions) {
-        BOOST_FOREACH(tSubstitute &s, f.second) {
-            if (s.mScope & tFilterBase::BODY)
-                keySubOnBody = true;
-            if (s.mScope & tFilterBase::HEADER)
-                keySubOnHeader = true;
-        }
-     }
-
     bool lDidSubstitute = false;
     // Perform the key substitutions
-    if (keySubOnHeader) {
+    if (pCommands.mHasHeaderSubstitutions) {
         // On the header
-        lDidSubstitute = keySubstitute(pCommands.mSubstitutions,
-                                       pHeaderParsedArgs,
+        lDidSubstitute = keySubstitute<Codec>(pCommands.mSubstitutionIndex,
+                                       pRequest.mArgs,
                                        tFilterBase::HEADER,
                                        pRequest.mArgs);
     }
-    if (keySubOnBody) {
+    if (pCommands.mHasBodySubstitutions) {
         // On the body
-        std::list<tKeyVal> lParsedArgs;
-        parseArgs(lParsedArgs, pRequest.mBody);
-        lDidSubstitute |= keySubstitute(pCommands.mSubstitutions,
-                                       lParsedArgs,
+        lDidSubstitute |= keySubstitute<Codec>(pCommands.mSubstitutionIndex,
+                                       pRequest.mBody,
                                        tFilterBase::BODY,
                                        pRequest.mBody);
     }
     // Run the raw substitutions
-    BOOST_FOREACH(tSubstitute &s, pCommands.mRawSubstitutions) {
+    BOOST_FOREACH(const tSubstitute &s, pCommands.mRawSubstitutions) {
         if (s.mScope & tFilterBase::BODY) {
-            pRequest.mBody = boost::regex_replace(pRequest.mBody, s.mRegex, s.mReplacement, boost::match_default | boost::format_all);
+            pRequest.mBody = s.mRegex->replace(pRequest.mBody, s.mReplacement);
         }
         if (s.mScope & tFilterBase::HEADER) {
-            pRequest.mArgs = boost::regex_replace(pRequest.mArgs, s.mRegex, s.mReplacement, boost::match_default | boost::format_all);
+            pRequest.mArgs = s.mRegex->replace(pRequest.mArgs, s.mReplacement);
         }
         lDidSubstitute = true;
     }
     return lDidSubstitute;
 }
 
+/**
+ * @brief Tell from the query string alone whether a request may match the filters of its location
+ * @param pConfPath the path of the configuration which is applied
+ * @param pArgs the query string
+ * @return HEADER_NO_MATCH if no filter can match, HEADER_MATCH if one does, HEADER_MAY_MATCH if a body filter could
+ */
+eHeaderMatch
+RequestProcessor::headerMayMatch(const std::string &pConfPath, const std::string &pArgs) {
+    std::map<std::string, tRequestProcessorCommands>::const_iterator it = mCommands.find(pConfPath);
+    if (it == mCommands.end()) {
+        return HEADER_MATCH;
+    }
+    const tRequestProcessorCommands &lCommands = it->second;
+    // A body filter could still match
+    if (lCommands.mHasBodyKeyFilters || lCommands.mHasBodyRawFilters) {
+        return HEADER_MAY_MATCH;
+    }
+
+    RequestInfo lRequest(pConfPath, "", pArgs);
+    bool lMatch;
+    try {
+        if (getLocationUrlCodec(lCommands) == APACHE_URL_CODEC) {
+            lMatch = argsMatchFilter<ApacheUrlCodec>(lRequest, lCommands);
+        } else {
+            lMatch = argsMatchFilter<DefaultUrlCodec>(lRequest, lCommands);
+        }
+    } catch (const RegexBudgetExceeded &e) {
+        onBudgetExceeded(e.pattern());
+        lMatch = false;
+    }
+    return lMatch ? HEADER_MATCH : HEADER_NO_MATCH;
+}
+
 /**
  * @brief Process a field. This includes filtering and executing substitutions
  * Substitutions are applied on individual fields whereas filters are applied on the whole parameter string.
@@ -323,35 +599,331 @@ RequestProcessor::substituteRequest(RequestInfo &pRequest, tRequestProcessorComm
  */
 bool
 RequestProcessor::processRequest(const std::string &pConfPath, RequestInfo &pRequest) {
-    std::map<std::string, tRequestProcessorCommands>::iterator it = mCommands.find(pConfPath);
+    std::map<std::string, tRequestProcessorCommands>::const_iterator it = mCommands.find(pConfPath);
     if (it == mCommands.end()) {
         // Filtering on paths is done by Apache, so if we don't know about this path,
         // it only means that no processing is needed - we can duplicate it straight away
         return true;
     }
 
-    tRequestProcessorCommands lCommands = (*it).second;
+    // The commands are only modified at configuration time: share them, no copy
+    const tRequestProcessorCommands &lCommands = it->second;
 
-    std::list<std::pair<std::string, std::string> > lParsedArgs;
-    parseArgs(lParsedArgs, pRequest.mArgs);
+    bool lDuplicated;
+    try {
+        // The whole processing is instantiated for each codec, so that the decoding and encoding loops are called directly
+        if (getLocationUrlCodec(lCommands) == APACHE_URL_CODEC) {
+            lDuplicated = filterAndSubstitute<ApacheUrlCodec>(pRequest, lCommands);
+        } else {
+            lDuplicated = filterAndSubstitute<DefaultUrlCodec>(pRequest, lCommands);
+        }
+    } catch (const RegexBudgetExceeded &e) {
+        // Neither filtered nor substituted reliably: not duplicated
+        onBudgetExceeded(e.pattern());
+        lDuplicated = false;
+    }
+    if (!lDuplicated && mRejectionListener) {
+        mRejectionListener(pConfPath);
+    }
+    return lDuplicated;
+}
+
+void
+RequestProcessor::setRejectionListener(const boost::function1<void, const std::string &> &pRejectionListener)
+{
+    mRejectionListener = pRejectionListener;
+}
 
-    // Tests if at least one acitve filter matches
-    if (!argsMatchFilter(pRequest, lCommands, lParsedArgs)) {
-		Log::debug("No args match filter");
+template <class Codec>
+bool
+RequestProcessor::filterAndSubstitute(RequestInfo &pRequest, const tRequestProcessorCommands &pCommands) {
+    // Tests if at least one acitve filter matches, unless its arguments did already before it was queued
+    if (!pRequest.mFiltered && !argsMatchFilter<Codec>(pRequest, pCommands)) {
+        Log::debug("No args match filter");
         return false;
     }
 
     Log::debug("Filter match");
 
     // We have a match, perform substitutions
-    substituteRequest(pRequest, lCommands, lParsedArgs);
+    substituteRequest<Codec>(pRequest, pCommands);
     return true;
 }
 
 void
 RequestProcessor::setUrlCodec(const std::string &pUrlCodec)
 {
-	mUrlCodec.reset(getUrlCodec(pUrlCodec));
+	mUrlCodec = getUrlCodecStyle(pUrlCodec);
+}
+
+void
+RequestProcessor::setUrlCodec(const std::string &pPath, const std::string &pUrlCodec)
+{
+	tRequestProcessorCommands &lCommands = mCommands[pPath];
+	lCommands.mUrlCodec = getUrlCodecStyle(pUrlCodec);
+	lCommands.mHasUrlCodec = true;
+}
+
+eUrlCodec
+RequestProcessor::getLocationUrlCodec(const tRequestProcessorCommands &pCommands) const
+{
+	return pCommands.mHasUrlCodec ? pCommands.mUrlCodec : mUrlCodec;
+}
+
+void
+RequestProcessor::setRegexEngine(eRegexEngine pEngine)
+{
+    recompile(pEngine, mRegexBudget);
+}
+
+void
+RequestProcessor::setRegexBudget(unsigned long pBudget)
+{
+    recompile(mRegexEngine, pBudget);
+}
+
+void
+RequestProcessor::recompile(eRegexEngine pEngine, unsigned long pBudget)
+{
+    // Compiled aside, so that an expression the engine rejects leaves the processor as it was
+    std::map<std::string, tRequestProcessorCommands> lCommands(mCommands);
+    typedef std::pair<const std::string, tRequestProcessorCommands> tPathCommands;
+    BOOST_FOREACH (tPathCommands &lPath, lCommands) {
+        tRequestProcessorCommands &lLocation = lPath.second;
+        for (std::multimap<std::string, tFilter>::iterator it = lLocation.mFilters.begin(); it != lLocation.mFilters.end(); ++it) {
+            it->second.mRegex.reset(compileRegex(it->second.mRegex->pattern(), pEngine, pBudget));
+        }
+        BOOST_FOREACH (tFilter &lRaw, lLocation.mRawFilters) {
+            lRaw.mRegex.reset(compileRegex(lRaw.mRegex->pattern(), pEngine, pBudget));
+        }
+        for (tFieldSubstitutionMap::iterator it = lLocation.mSubstitutions.begin(); it != lLocation.mSubstitutions.end(); ++it) {
+            BOOST_FOREACH (tSubstitute &lSubst, it->second) {
+                lSubst.mRegex.reset(compileRegex(lSubst.mRegex->pattern(), pEngine, pBudget));
+                lSubst.mReplacement = tReplacement(lSubst.mReplacement.mFormat, pEngine);
+            }
+        }
+        BOOST_FOREACH (tSubstitute &lSubst, lLocation.mRawSubstitutions) {
+            lSubst.mRegex.reset(compileRegex(lSubst.mRegex->pattern(), pEngine, pBudget));
+            lSubst.mReplacement = tReplacement(lSubst.mReplacement.mFormat, pEngine);
+        }
+        compileRawFilters(lLocation, pEngine, pBudget);
+        indexKeys(lLocation);
+    }
+    mCommands.swap(lCommands);
+    mRegexEngine = pEngine;
+    mRegexBudget = pBudget;
+}
+
+void
+RequestProcessor::onBudgetExceeded(const std::string &pPattern)
+{
+    boost::mutex::scoped_lock lLock(mBudgetMutex);
+    if (!mBudgetExceeded[pPattern]++) {
+        Log::warn(306, "Regex budget exceeded by %s, request skipped", pPattern.c_str());
+    }
+}
+
+const std::string
+RequestProcessor::getBudgetStats() {
+    std::map<std::string, unsigned long> lExceeded;
+    {
+        boost::mutex::scoped_lock lLock(mBudgetMutex);
+        lExceeded.swap(mBudgetExceeded);
+    }
+    std::string lStats;
+    typedef std::map<std::string, unsigned long>::value_type tExceededEntry;
+    BOOST_FOREACH(const tExceededEntry &lEntry, lExceeded) {
+        if (!lStats.empty()) {
+            lStats += ", ";
+        }
+        lStats += lEntry.first + ": " + boost::lexical_cast<std::string>(lEntry.second);
+    }
+    return lStats;
+}
+
+tResponseStats::tResponseStats() : mBytes(0) {
+    for (unsigned i = 0; i < sizeof(mStatus) / sizeof(*mStatus); ++i) {
+        mStatus[i] = 0;
+    }
+}
+
+unsigned long long
+RequestProcessor::getBusyTime() {
+    return __atomic_load_n(&mBusyTime, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Append the counters of a prefilter to the stats
+ */
+static void
+appendPrefilterStats(std::string &pStats, const std::string &pPath, const tFilter &pFilter) {
+    if (!pFilter.mPrefilter) {
+        return;
+    }
+    unsigned long lChecked, lRejected;
+    pFilter.mPrefilter->getCounters(lChecked, lRejected);
+    if (!pStats.empty()) {
+        pStats += ", ";
+    }
+    pStats += pPath + " " + pFilter.mRegex->pattern() + ": " + boost::lexical_cast<std::string>(lRejected) + "/" +
+        boost::lexical_cast<std::string>(lChecked);
+}
+
+const std::string
+RequestProcessor::getPrefilterStats() {
+    std::string lStats;
+    typedef std::map<std::string, tRequestProcessorCommands>::value_type tCommandsEntry;
+    BOOST_FOREACH(const tCommandsEntry &lEntry, mCommands) {
+        for (std::multimap<std::string, tFilter>::const_iterator it = lEntry.second.mFilters.begin(); it != lEntry.second.mFilters.end(); ++it) {
+            appendPrefilterStats(lStats, lEntry.first, it->second);
+        }
+        BOOST_FOREACH(const tFilter &lRaw, lEntry.second.mRawFilters) {
+            appendPrefilterStats(lStats, lEntry.first, lRaw);
+        }
+    }
+    return lStats;
+}
+
+const std::string
+RequestProcessor::getResponseStats() {
+    std::string lStats;
+    typedef std::map<std::string, tResponseStats>::value_type tStatsEntry;
+    BOOST_FOREACH(tStatsEntry &lEntry, mResponseStats) {
+        if (!lStats.empty()) {
+            lStats += ", ";
+        }
+        // Atomic read + reset
+        lStats += lEntry.first + ": " + boost::lexical_cast<std::string>(__sync_fetch_and_and(&lEntry.second.mBytes, 0));
+        for (unsigned i = 0; i < sizeof(lEntry.second.mStatus) / sizeof(*lEntry.second.mStatus); ++i) {
+            lStats += " " + boost::lexical_cast<std::string>(__sync_fetch_and_and(&lEntry.second.mStatus[i], 0));
+        }
+    }
+    return lStats;
+}
+
+void
+RequestProcessor::setResponseMode(const std::string &pPath, eResponseMode pMode) {
+    mResponseModes[pPath] = pMode;
+    if (pMode == COUNT_RESPONSE) {
+        mResponseStats[pPath];
+    } else {
+        mResponseStats.erase(pPath);
+    }
+}
+
+eResponseMode
+RequestProcessor::getResponseMode(const std::string &pPath) const {
+    std::map<std::string, eResponseMode>::const_iterator it = mResponseModes.find(pPath);
+    return it == mResponseModes.end() ? DISCARD_RESPONSE : it->second;
+}
+
+/**
+ * @brief curl write callback dropping the response body
+ * @param pStats the stats to count the bytes in, NULL if they are not counted
+ */
+static size_t
+discardBody(char *, size_t pSize, size_t pNmemb, void *pStats) {
+    size_t lSize = pSize * pNmemb;
+    if (pStats) {
+        __sync_fetch_and_add(&static_cast<tResponseStats *>(pStats)->mBytes, lSize);
+    }
+    return lSize;
+}
+
+/**
+ * @brief curl header callback aborting the transfer on the empty line ending the headers
+ */
+static size_t
+abortAfterHeaders(char *pData, size_t pSize, size_t pNmemb, void *) {
+    size_t lSize = pSize * pNmemb;
+    if (lSize <= 2 && (lSize == 0 || pData[0] == '\r' || pData[0] == '\n')) {
+        return 0;
+    }
+    return lSize;
+}
+
+void
+RequestProcessor::setSendMode(eSendMode pSendMode, unsigned pMaxInFlight)
+{
+    mSendMode = pSendMode;
+    mMaxInFlight = pMaxInFlight ? pMaxInFlight : 1;
+}
+
+CURL *
+RequestProcessor::initCurl()
+{
+    CURL * lCurl = curl_easy_init();
+    if (!lCurl) {
+        Log::error(402, "Could not init curl request object.");
+        return NULL;
+    }
+    curl_easy_setopt(lCurl, CURLOPT_USERAGENT, gUserAgent);
+    // Activer l'option provoque des timeouts sur des requests avec un fort payload
+    curl_easy_setopt(lCurl, CURLOPT_TIMEOUT_MS, mTimeout);
+    curl_easy_setopt(lCurl, CURLOPT_NOSIGNAL, 1);
+    return lCurl;
+}
+
+struct curl_slist *
+RequestProcessor::prepareCurl(CURL *pCurl, const RequestInfo &pRequest, std::string &pUrl)
+{
+    pUrl = mDestination + pRequest.mPath + "?" + pRequest.mArgs;
+    curl_easy_setopt(pCurl, CURLOPT_URL, pUrl.c_str());
+    struct curl_slist *slist = NULL;
+    if (pRequest.mStatus) {
+        // Forward what the original request gave
+        slist = curl_slist_append(slist, ("X-Dup-Status: " + boost::lexical_cast<std::string>(pRequest.mStatus)).c_str());
+        slist = curl_slist_append(slist, ("X-Dup-Duration: " + boost::lexical_cast<std::string>(pRequest.mDuration)).c_str());
+    }
+    if (pRequest.hasBody()) {
+        Log::debug("Before post: %s", boost::lexical_cast<std::string>(pRequest.mBody.size()).c_str());
+
+        slist = curl_slist_append(slist, "Content-Type: text/xml; charset=utf-8");
+        // Avoid Expect: 100 continue
+        slist = curl_slist_append(slist, "Expect:");
+        std::string contentLen = std::string("Content-Length: ") +
+            boost::lexical_cast<std::string>(pRequest.mBody.size());
+        curl_slist_append(slist, contentLen.c_str());
+        curl_easy_setopt(pCurl, CURLOPT_POST, 1);
+        curl_easy_setopt(pCurl, CURLOPT_POSTFIELDSIZE, pRequest.mBody.size());
+        curl_easy_setopt(pCurl, CURLOPT_POSTFIELDS, pRequest.mBody.c_str());
+    } else {
+        curl_easy_setopt(pCurl, CURLOPT_HTTPGET, 1);
+    }
+    curl_easy_setopt(pCurl, CURLOPT_HTTPHEADER, slist);
+
+    // Handles are reused: set the response handling of every request
+    eResponseMode lResponseMode = getResponseMode(pRequest.mConfPath);
+    std::map<std::string, tResponseStats>::iterator lStats = mResponseStats.find(pRequest.mConfPath);
+    curl_easy_setopt(pCurl, CURLOPT_WRITEFUNCTION, discardBody);
+    curl_easy_setopt(pCurl, CURLOPT_WRITEDATA, lStats == mResponseStats.end() ? NULL : &lStats->second);
+    curl_easy_setopt(pCurl, CURLOPT_HEADERFUNCTION, lResponseMode == ABORT_RESPONSE ? abortAfterHeaders : NULL);
+    curl_easy_setopt(pCurl, CURLOPT_HEADERDATA, NULL);
+
+    Log::debug("Duplicating: %s", pUrl.c_str());
+    return slist;
+}
+
+void
+RequestProcessor::onTransferDone(CURL *pCurl, CURLcode pResult, const RequestInfo &pRequest, const std::string &pUrl)
+{
+    std::map<std::string, tResponseStats>::iterator lStats = mResponseStats.find(pRequest.mConfPath);
+    if (lStats != mResponseStats.end()) {
+        long lStatus = 0;
+        if (pResult == CURLE_OK) {
+            curl_easy_getinfo(pCurl, CURLINFO_RESPONSE_CODE, &lStatus);
+        }
+        unsigned lClass = lStatus / 100;
+        __sync_fetch_and_add(&lStats->second.mStatus[lClass >= 1 && lClass <= 5 ? lClass : 0], 1);
+    }
+
+    if (pResult == CURLE_OPERATION_TIMEDOUT) {
+        __sync_fetch_and_add(&mTimeoutCount, 1);
+    } else if (pResult == CURLE_WRITE_ERROR && getResponseMode(pRequest.mConfPath) == ABORT_RESPONSE) {
+        // Closed on purpose by abortAfterHeaders
+    } else if (pResult) {
+        Log::error(403, "Sending request failed with curl error code: %d, request:%s", pResult, pUrl.c_str());
+    }
 }
 
 /**
@@ -368,15 +940,15 @@ RequestProcessor::run(MultiThreadQueue<RequestInfo> &pQueue)
         return;
     }
 
-    CURL * lCurl = curl_easy_init();
+    if (mSendMode == MULTI_SEND) {
+        runMulti(pQueue);
+        return;
+    }
+
+    CURL * lCurl = initCurl();
     if (!lCurl) {
-        Log::error(402, "Could not init curl request object.");
         return;
     }
-    curl_easy_setopt(lCurl, CURLOPT_USERAGENT, gUserAgent);
-    // Activer l'option provoque des timeouts sur des requests avec un fort payload
-    curl_easy_setopt(lCurl, CURLOPT_TIMEOUT_MS, mTimeout);
-    curl_easy_setopt(lCurl, CURLOPT_NOSIGNAL, 1);
 
     for (;;) {
         RequestInfo lQueueItem = pQueue.pop();
@@ -385,51 +957,183 @@ RequestProcessor::run(MultiThreadQueue<RequestInfo> &pQueue)
             Log::debug("Received poison pill. Exiting.");
             break;
         }
+        unsigned long long lStart = monotonicTime();
         if (processRequest(lQueueItem.mConfPath, lQueueItem)) {
             __sync_fetch_and_add(&mDuplicatedCount, 1);
-            std::string request = mDestination + lQueueItem.mPath + "?" + lQueueItem.mArgs;
-            curl_easy_setopt(lCurl, CURLOPT_URL, request.c_str());
-            struct curl_slist *slist = NULL;
-            if (lQueueItem.hasBody()) {
-                Log::debug("Before post: %s", boost::lexical_cast<std::string>(lQueueItem.mBody.size()).c_str());
-
-                slist = curl_slist_append(slist, "Content-Type: text/xml; charset=utf-8");
-                // Avoid Expect: 100 continue
-                slist = curl_slist_append(slist, "Expect:");
-                std::string contentLen = std::string("Content-Length: ") +
-                    boost::lexical_cast<std::string>(lQueueItem.mBody.size());
-                curl_slist_append(slist, contentLen.c_str());
-                curl_easy_setopt(lCurl, CURLOPT_POST, 1);
-                curl_easy_setopt(lCurl, CURLOPT_HTTPHEADER, slist);
-                curl_easy_setopt(lCurl, CURLOPT_POSTFIELDSIZE, lQueueItem.mBody.size());
-                curl_easy_setopt(lCurl, CURLOPT_POSTFIELDS, lQueueItem.mBody.c_str());
-            } else {
-                curl_easy_setopt(lCurl, CURLOPT_HTTPGET, 1);
-                curl_easy_setopt(lCurl, CURLOPT_HTTPHEADER, NULL);
-            }
-
-            Log::debug("Duplicating: %s", request.c_str());
+            std::string request;
+            struct curl_slist *slist = prepareCurl(lCurl, lQueueItem, request);
 
-            int err = curl_easy_perform(lCurl);
+            CURLcode err = curl_easy_perform(lCurl);
             if (slist)
                 curl_slist_free_all(slist);
-            if (err == CURLE_OPERATION_TIMEDOUT) {
-                __sync_fetch_and_add(&mTimeoutCount, 1);
-            } else if (err) {
-                Log::error(403, "Sending request failed with curl error code: %d, request:%s", err, request.c_str());
-            }
+            onTransferDone(lCurl, err, lQueueItem, request);
         }
+        __sync_fetch_and_add(&mBusyTime, monotonicTime() - lStart);
     }
     curl_easy_cleanup(lCurl);
 }
 
-tFilterBase::tFilterBase(const std::string &r, eFilterScope s)
+/**
+ * @brief A transfer driven by the curl multi handle, with everything which must outlive it
+ */
+struct tTransfer {
+    tTransfer() : mCurl(NULL), mHeaders(NULL) {}
+    /** @brief The easy handle, reused from one transfer to the next */
+    CURL *mCurl;
+    /** @brief The headers of the request */
+    struct curl_slist *mHeaders;
+    /** @brief The request, which owns the body curl sends from */
+    RequestInfo mRequest;
+    /** @brief The url of the request */
+    std::string mUrl;
+};
+
+/**
+ * @brief Sends the requests of the queue many at a time with a curl multi handle, until a poison pill is received
+ * Blocks on the queue only when no transfer is in flight. Otherwise, new requests are picked up between two
+ * rounds of socket activity, as long as there are less than mMaxInFlight transfers.
+ * Once poisoned, the transfers in flight are completed (or time out) before returning.
+ * @param pQueue the queue which gets filled with incoming requests
+ */
+void
+RequestProcessor::runMulti(MultiThreadQueue<RequestInfo> &pQueue)
+{
+    // Maximum time in ms spent waiting for socket activity before looking at the queue again
+    static const int lMaxWaitMs = 10;
+
+    CURLM *lMulti = curl_multi_init();
+    if (!lMulti) {
+        Log::error(402, "Could not init curl multi object.");
+        return;
+    }
+
+    std::vector<tTransfer *> lIdle;
+    unsigned lInFlight = 0;
+    bool lPoisoned = false;
+    while (!lPoisoned || lInFlight) {
+        // The time spent processing the requests and driving the transfers, not waiting for the queue
+        unsigned long long lBusy = 0;
+
+        // Start new transfers
+        while (!lPoisoned && lInFlight < mMaxInFlight) {
+            RequestInfo lQueueItem;
+            if (!lInFlight) {
+                // Nothing to drive, wait for work
+                lQueueItem = pQueue.pop();
+            } else if (!pQueue.tryPop(lQueueItem)) {
+                break;
+            }
+            if (lQueueItem.isPoison()) {
+                // Master tells us to stop
+                Log::debug("Received poison pill. Exiting once %u transfers are done.", lInFlight);
+                lPoisoned = true;
+                break;
+            }
+            unsigned long long lStart = monotonicTime();
+            if (processRequest(lQueueItem.mConfPath, lQueueItem)) {
+                tTransfer *lTransfer = NULL;
+                if (!lIdle.empty()) {
+                    lTransfer = lIdle.back();
+                    lIdle.pop_back();
+                } else if (CURL *lCurl = initCurl()) {
+                    lTransfer = new tTransfer();
+                    lTransfer->mCurl = lCurl;
+                    curl_easy_setopt(lCurl, CURLOPT_PRIVATE, lTransfer);
+                }
+                if (lTransfer) {
+                    lTransfer->mRequest = std::move(lQueueItem);
+                    lTransfer->mHeaders = prepareCurl(lTransfer->mCurl, lTransfer->mRequest, lTransfer->mUrl);
+                    CURLMcode lCode = curl_multi_add_handle(lMulti, lTransfer->mCurl);
+                    if (lCode == CURLM_OK) {
+                        __sync_fetch_and_add(&mDuplicatedCount, 1);
+                        ++lInFlight;
+                    } else {
+                        Log::error(407, "Could not add a transfer to the curl multi object, error code: %d", lCode);
+                        if (lTransfer->mHeaders) {
+                            curl_slist_free_all(lTransfer->mHeaders);
+                            lTransfer->mHeaders = NULL;
+                        }
+                        lQueueItem = std::move(lTransfer->mRequest);
+                        lTransfer->mRequest = RequestInfo();
+                        lIdle.push_back(lTransfer);
+                        lTransfer = NULL;
+                    }
+                }
+                // Not sent: given back to the rate limits, like the requests the filters reject
+                if (!lTransfer && mRejectionListener) {
+                    mRejectionListener(lQueueItem.mConfPath);
+                }
+            }
+            lBusy += monotonicTime() - lStart;
+        }
+
+        // Move the transfers forward
+        unsigned long long lStart = monotonicTime();
+        int lRunning;
+        curl_multi_perform(lMulti, &lRunning);
+
+        // Collect the finished ones
+        int lPending;
+        CURLMsg *lMsg;
+        while ((lMsg = curl_multi_info_read(lMulti, &lPending))) {
+            if (lMsg->msg != CURLMSG_DONE) {
+                continue;
+            }
+            tTransfer *lTransfer = NULL;
+            curl_easy_getinfo(lMsg->easy_handle, CURLINFO_PRIVATE, &lTransfer);
+            CURLcode lResult = lMsg->data.result;
+            curl_multi_remove_handle(lMulti, lTransfer->mCurl);
+            onTransferDone(lTransfer->mCurl, lResult, lTransfer->mRequest, lTransfer->mUrl);
+            if (lTransfer->mHeaders) {
+                curl_slist_free_all(lTransfer->mHeaders);
+                lTransfer->mHeaders = NULL;
+            }
+            // Release the body now rather than when the handle is reused
+            lTransfer->mRequest = RequestInfo();
+            lIdle.push_back(lTransfer);
+            --lInFlight;
+        }
+        lBusy += monotonicTime() - lStart;
+
+        if (lInFlight) {
+            lStart = monotonicTime();
+            int lFds = 0;
+            curl_multi_wait(lMulti, NULL, 0, lMaxWaitMs, &lFds);
+            if (!lFds) {
+                // No socket to wait on yet (name resolution...), avoid spinning
+                usleep(1000);
+            }
+            // Only waiting with every slot taken leaves no room for more requests: weighted by the slots taken
+            lBusy += (monotonicTime() - lStart) * lInFlight / mMaxInFlight;
+        }
+        __sync_fetch_and_add(&mBusyTime, lBusy);
+    }
+
+    BOOST_FOREACH(tTransfer *lTransfer, lIdle) {
+        curl_easy_cleanup(lTransfer->mCurl);
+        delete lTransfer;
+    }
+    curl_multi_cleanup(lMulti);
+}
+
+tRequestProcessorCommands::tRequestProcessorCommands()
+    : mHasHeaderKeyFilters(false)
+    , mHasBodyKeyFilters(false)
+    , mHasBodyRawFilters(false)
+    , mHasHeaderSubstitutions(false)
+    , mHasBodySubstitutions(false)
+    , mUrlCodec(DEFAULT_URL_CODEC)
+    , mHasUrlCodec(false) {
+}
+
+tFilterBase::tFilterBase(const std::string &r, eFilterScope s, eRegexEngine e, unsigned long b)
     : mScope(s)
-    , mRegex(r) {
+    , mRegex(compileRegex(r, e, b)) {
 }
 
-tFilter::tFilter(const std::string &regex, eFilterScope scope)
-    : tFilterBase(regex, scope) {
+tFilter::tFilter(const std::string &regex, eFilterScope scope, eRegexEngine engine, unsigned long budget)
+    : tFilterBase(regex, scope, engine, budget)
+    , mPrefilter(Prefilter::create(regex)) {
 }
 
 tFilterBase::eFilterScope tFilterBase::GetScopeFromString(const char *str) {
@@ -442,9 +1146,9 @@ tFilterBase::eFilterScope tFilterBase::GetScopeFromString(const char *str) {
     throw std::exception();
 }
 
-tSubstitute::tSubstitute(const std::string &regex, const std::string &replacement, eFilterScope scope)
-    : tFilterBase(regex, scope)
-    , mReplacement(replacement){
+tSubstitute::tSubstitute(const std::string &regex, const std::string &replacement, eFilterScope scope, eRegexEngine engine, unsigned long budget)
+    : tFilterBase(regex, scope, engine, budget)
+    , mReplacement(replacement, engine){
 }
 
 }
@@ -18,13 +18,19 @@
 
 #pragma once
 
-#include <boost/regex.hpp>
+#include <boost/function.hpp>
 #include <boost/scoped_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/shared_ptr.hpp>
 #include <string>
 #include <map>
 #include <apr_pools.h>
+#include <curl/curl.h>
 
+#include "KeyIndex.hh"
 #include "MultiThreadQueue.hh"
+#include "Prefilter.hh"
+#include "RegexEngine.hh"
 #include "RequestInfo.hh"
 #include "UrlCodec.hh"
 
@@ -49,7 +55,7 @@ namespace DupModule {
 
         typedef enum eFilterScope eFilterScope;
 
-        tFilterBase(const std::string &regex, eFilterScope scope);
+        tFilterBase(const std::string &regex, eFilterScope scope, eRegexEngine engine, unsigned long budget);
 
         /**
          * Translates the character value of a scope into it's enumerate value
@@ -59,7 +65,7 @@ namespace DupModule {
         static eFilterScope GetScopeFromString(const char*);
 
         eFilterScope mScope; /** The action of the filter */
-        boost::regex mRegex; /** The matching regular expression */
+        boost::shared_ptr<const IRegex> mRegex; /** The matching regular expression, compiled by the engine of the processor */
     };
 
     /**
@@ -67,9 +73,10 @@ namespace DupModule {
      */
     struct tFilter : public tFilterBase{
 
-        tFilter(const std::string &regex, eFilterScope scope);
+        tFilter(const std::string &regex, eFilterScope scope, eRegexEngine engine, unsigned long budget);
 
         std::string mField; /** The key or field the filter applies on */
+        boost::shared_ptr<Prefilter> mPrefilter; /** The literals searched before the regex, NULL if it has none */
     };
 
     /**
@@ -78,18 +85,29 @@ namespace DupModule {
     struct tSubstitute : public tFilterBase{
 
         tSubstitute(const std::string &regex,
-                      const std::string &replacement, eFilterScope scope);
+                      const std::string &replacement, eFilterScope scope, eRegexEngine engine, unsigned long budget);
 
-        std::string mReplacement; /** The replacement value regex */
+        tReplacement mReplacement; /** The replacement value regex */
     };
 
     /** @brief Maps a path to a substitution. Not a multimap because order matters. */
     typedef std::map<std::string, std::list<tSubstitute> > tFieldSubstitutionMap;
 
+    /** @brief The key filters by field, looked up in constant time with the keys of the requests as they are */
+    typedef KeyIndex<std::vector<tFilter> > tFilterIndex;
 
-    /** @brief A container for the filter and substituion commands */
+    /** @brief The key substitutions by field, looked up in constant time with the keys of the requests as they are */
+    typedef KeyIndex<std::list<tSubstitute> > tSubstitutionIndex;
+
+
+    /** @brief A container for the filter and substituion commands
+     * Built once at configuration time, it is then only read by the worker threads
+     * which share it without copying or locking.
+     */
     struct tRequestProcessorCommands {
 
+        tRequestProcessorCommands();
+
         /** @brief The list of filter commands
          * Indexed by the field on which they apply
          */
@@ -98,11 +116,105 @@ namespace DupModule {
         /** @brief The substition maps */
         tFieldSubstitutionMap mSubstitutions;
 
+        /** @brief The filters of mFilters, indexed for the requests */
+        tFilterIndex mFilterIndex;
+
+        /** @brief The substitutions of mSubstitutions, indexed for the requests */
+        tSubstitutionIndex mSubstitutionIndex;
+
         /** @brief The Raw filter list */
         std::list<tFilter> mRawFilters;
 
+        /** @brief The raw filters applying on the header, combined into one alternation searched in a single pass. NULL if none. */
+        boost::shared_ptr<const IRegex> mHeaderRawMatcher;
+
+        /** @brief The raw filters applying on the body, combined into one alternation searched in a single pass. NULL if none. */
+        boost::shared_ptr<const IRegex> mBodyRawMatcher;
+
+        /** @brief The raw filters in mHeaderRawMatcher, searched one by one when it exceeds its budget */
+        std::vector<tFilter> mHeaderRawMembers;
+
+        /** @brief The raw filters in mBodyRawMatcher, searched one by one when it exceeds its budget */
+        std::vector<tFilter> mBodyRawMembers;
+
+        /** @brief The prefilters of the raw filters in mHeaderRawMatcher, empty if one of them has none */
+        std::vector<boost::shared_ptr<Prefilter> > mHeaderRawPrefilters;
+
+        /** @brief The prefilters of the raw filters in mBodyRawMatcher, empty if one of them has none */
+        std::vector<boost::shared_ptr<Prefilter> > mBodyRawPrefilters;
+
+        /** @brief The raw filters left out of the alternations, depending on their own groups or layout */
+        std::list<tFilter> mSeparateRawFilters;
+
         /** @brief The Raw Substitution list */
         std::list<tSubstitute> mRawSubstitutions;
+
+        /** @brief True if at least one key filter applies on the header */
+        bool mHasHeaderKeyFilters;
+
+        /** @brief True if at least one key filter applies on the body */
+        bool mHasBodyKeyFilters;
+
+        /** @brief True if at least one raw filter applies on the body */
+        bool mHasBodyRawFilters;
+
+        /** @brief True if at least one key substitution applies on the header */
+        bool mHasHeaderSubstitutions;
+
+        /** @brief True if at least one key substitution applies on the body */
+        bool mHasBodySubstitutions;
+
+        /** @brief The url enc/decoding style of the location, if mHasUrlCodec */
+        eUrlCodec mUrlCodec;
+
+        /** @brief False if the location uses the url codec of the processor */
+        bool mHasUrlCodec;
+    };
+
+    /**
+     * @brief How the duplicated requests are sent
+     */
+    enum eSendMode {
+        /** One blocking transfer at a time per worker thread */
+        BLOCKING_SEND,
+        /** Many concurrent transfers per worker thread, driven by a curl multi handle */
+        MULTI_SEND,
+    };
+
+    /**
+     * @brief What the arguments of a request alone tell about the filters of its location
+     */
+    enum eHeaderMatch {
+        /** No filter can match, the request is not duplicated */
+        HEADER_NO_MATCH = 0,
+        /** A body filter may match, the worker applies the filters */
+        HEADER_MAY_MATCH,
+        /** The filters match already, the worker only applies the substitutions */
+        HEADER_MATCH,
+    };
+
+    /**
+     * @brief What to do with the responses of the duplicated requests
+     */
+    enum eResponseMode {
+        /** Read and drop the body */
+        DISCARD_RESPONSE,
+        /** Drop the body, counting its bytes and the status codes in the location stats */
+        COUNT_RESPONSE,
+        /** Close the connection as soon as the response headers are received */
+        ABORT_RESPONSE,
+    };
+
+    /**
+     * @brief Response statistics of a location, updated atomically by the worker threads
+     */
+    struct tResponseStats {
+        tResponseStats();
+
+        /** @brief The number of body bytes received */
+        volatile unsigned long mBytes;
+        /** @brief The number of responses per status class: 1xx to 5xx, index 0 counting the failed transfers */
+        volatile unsigned int mStatus[6];
     };
 
     /**
@@ -115,24 +227,47 @@ namespace DupModule {
     private:
 	/** @brief Maps paths to their corresponding processing (filter and substitution) directives */
 	std::map<std::string, tRequestProcessorCommands> mCommands;
+	/** @brief Maps paths to what should be done with their responses, DISCARD_RESPONSE if absent */
+	std::map<std::string, eResponseMode> mResponseModes;
+	/** @brief Maps the paths in COUNT_RESPONSE mode to their stats */
+	std::map<std::string, tResponseStats> mResponseStats;
 	/** @brief The destination string for the duplicated requests with the following format: <host>[:<port>] */
 	std::string mDestination;
 	/** @brief The timeout for outgoing requests in ms */
 	unsigned int mTimeout;
-	/** @brief The number of requests which timed out */
-	volatile unsigned int mTimeoutCount;
-        /** @brief The number of requests duplicated */
-        volatile unsigned int mDuplicatedCount;
-		/** @brief The url codec */
-		boost::scoped_ptr<const IUrlCodec> mUrlCodec;
+	/** @brief The number of requests which timed out since the start */
+	volatile unsigned long long mTimeoutCount;
+	/** @brief The value of mTimeoutCount at the last call to getTimeoutCount */
+	unsigned long long mTimeoutReported;
+        /** @brief The number of requests duplicated since the start */
+        volatile unsigned long long mDuplicatedCount;
+        /** @brief The value of mDuplicatedCount at the last call to getDuplicatedCount */
+        unsigned long long mDuplicatedReported;
+        /** @brief The time in micro sec the worker threads spent processing and sending requests */
+        volatile unsigned long long mBusyTime;
+		/** @brief The url codec of the locations without their own */
+		eUrlCodec mUrlCodec;
+        /** @brief The engine the filters and substitutions are compiled with */
+        eRegexEngine mRegexEngine;
+        /** @brief The number of steps each regex search or replacement may take, 0 for no limit */
+        unsigned long mRegexBudget;
+        /** @brief The number of requests skipped since the last call to getBudgetStats, by expression which exceeded its budget */
+        std::map<std::string, unsigned long> mBudgetExceeded;
+        /** @brief Protects mBudgetExceeded */
+        boost::mutex mBudgetMutex;
+        /** @brief How the requests are sent */
+        eSendMode mSendMode;
+        /** @brief The maximum number of concurrent transfers per worker thread in MULTI_SEND mode */
+        unsigned mMaxInFlight;
+        /** @brief Called with the configuration path of each request processRequest rejects, or which could not be sent */
+        boost::function1<void, const std::string &> mRejectionListener;
 		
 
     public:
 	/**
 	 * @brief Constructs a RequestProcessor
 	 */
-	RequestProcessor() : mTimeout(0), mTimeoutCount(0), mDuplicatedCount(0) {
-		setUrlCodec();
+	RequestProcessor() : mTimeout(0), mTimeoutCount(0), mTimeoutReported(0), mDuplicatedCount(0), mDuplicatedReported(0), mBusyTime(0), mUrlCodec(DEFAULT_URL_CODEC), mRegexEngine(BOOST_ENGINE), mRegexBudget(0), mSendMode(BLOCKING_SEND), mMaxInFlight(1) {
 	}
 
 	/**
@@ -163,13 +298,110 @@ namespace DupModule {
         const unsigned int
         getDuplicatedCount();
 
+        /**
+         * @brief Get the number of requests which timed out since the start
+         * @return The timeout count, never reset
+         */
+        unsigned long long
+        getTimeoutTotal() const;
+
+        /**
+         * @brief Get the number of requests duplicated since the start
+         * @return The duplicated count, never reset
+         */
+        unsigned long long
+        getDuplicatedTotal() const;
+
+        /**
+         * @brief Get the time the worker threads spent processing and sending requests since the start
+         * @return The busy time in micro sec, never reset
+         */
+        unsigned long long
+        getBusyTime();
+
+        /**
+         * @brief Get how many values each filter with a prefilter checked, and how many of them it rejected without regex search, since last call to this method
+         * @return The stats as "<path> <regex>: <rejected>/<checked>" separated with commas
+         */
+        const std::string
+        getPrefilterStats();
+
+        /**
+         * @brief Get how many requests were skipped because an expression exceeded its budget, since last call to this method
+         * @return The stats as "<regex>: <requests>" separated with commas
+         */
+        const std::string
+        getBudgetStats();
+
+        /**
+         * @brief Get the response stats of the locations in COUNT_RESPONSE mode since last call to this method
+         * @return The stats as "<path>: <bytes> <failed> <1xx> <2xx> <3xx> <4xx> <5xx>" separated with commas
+         */
+        const std::string
+        getResponseStats();
+
+        /**
+         * @brief Set what to do with the responses of the requests on a given path
+         * @param pPath the path of the request
+         * @param pMode the response mode
+         */
+        void
+        setResponseMode(const std::string &pPath, eResponseMode pMode);
+
+        /**
+         * @brief Get what to do with the responses of the requests on a given path
+         * @param pPath the path of the request
+         * @return the response mode
+         */
+        eResponseMode
+        getResponseMode(const std::string &pPath) const;
+
+        /**
+         * @brief Set how the requests are sent
+         * @param pSendMode the send mode
+         * @param pMaxInFlight the maximum number of concurrent transfers per worker thread in MULTI_SEND mode
+         */
+        void
+        setSendMode(eSendMode pSendMode, unsigned pMaxInFlight);
+
+        /**
+         * @brief Set the function called with the configuration path of each request processRequest rejects, or which could not be sent
+         * @param pRejectionListener the function, called by the worker threads, which must not block
+         */
+        void
+        setRejectionListener(const boost::function1<void, const std::string &> &pRejectionListener);
+
 		/**
-		 * @brief Set the url codec
+		 * @brief Set the url codec of the locations without their own
 		 * @param pUrlCodec the codec to use
 		 */
 		void
 		setUrlCodec(const std::string &pUrlCodec="default");
 
+		/**
+		 * @brief Set the url codec of the requests on a given path
+		 * @param pPath the path of the request
+		 * @param pUrlCodec the codec to use
+		 */
+		void
+		setUrlCodec(const std::string &pPath, const std::string &pUrlCodec);
+
+        /**
+         * @brief Set the engine the filters and substitutions are compiled with. Those already added are compiled again.
+         * @param pEngine the engine, which must be available
+         * @throw RegexError if an expression or a replacement uses a feature the engine lacks, in which case nothing changes
+         */
+        void
+        setRegexEngine(eRegexEngine pEngine);
+
+        /**
+         * @brief Set the number of steps each regex search or replacement may take. Those already added are compiled again.
+         * A request on which an expression exceeds it is skipped: neither duplicated nor substituted further.
+         * @param pBudget the number of steps, 0 for no limit
+         */
+        void
+        setRegexBudget(unsigned long pBudget);
+
         /**
          * @brief Add a filter for all requests on a given path
          * @param pPath the path of the request
@@ -211,21 +443,34 @@ namespace DupModule {
 
         /**
          * @brief Returns wether or not the arguments match any of the filters
-         * @param pParsedArgs the list with the argument key value pairs
-         * @param pFilters the filters which should be applied
+         * @param pRequest the request
+         * @param pCommands the filters which should be applied
          * @return true if there are no filters or at least one filter matches, false otherwhise
          */
+        template <class Codec>
         bool
-        argsMatchFilter(RequestInfo &pRequest, tRequestProcessorCommands &pCommands, std::list<tKeyVal> &pParsedArgs);
+        argsMatchFilter(RequestInfo &pRequest, const tRequestProcessorCommands &pCommands);
 
         /**
          * @brief Parses arguments into key valye pairs. Also url-decodes values and converts keys to upper case.
+         * The filters and substitutions rather walk the arguments with an ArgsParser, which copies and decodes nothing up front.
          * @param pParsedArgs the list which should be filled with the key value pairs
          * @param pArgs the parameters part of the query
          */
         void
         parseArgs(std::list<tKeyVal> &pParsedArgs, const std::string &pArgs);
 
+        /**
+         * @brief Decide from the arguments only whether a request may get duplicated, before its body is read.
+         * Only locations whose filters all apply on the header can reject a request at this stage.
+         * @param pConfPath the path of the configuration which is applied
+         * @param pArgs the HTTP arguments/parameters of the incoming request
+         * @return HEADER_NO_MATCH if the request can never match the filters, HEADER_MATCH if it does already,
+         * which the request then carries in its mFiltered flag, HEADER_MAY_MATCH if its body decides
+         */
+        eHeaderMatch
+        headerMayMatch(const std::string &pConfPath, const std::string &pArgs);
+
         /**
          * @brief Process a field. This includes filtering and executing substitutions
          * @param pConfPath the path of the configuration which is applied
@@ -245,15 +490,100 @@ namespace DupModule {
 
     private:
 
+        /**
+         * @brief Sends the requests of the queue many at a time with a curl multi handle, until a poison pill is received
+         * @param pQueue the queue which gets filled with incoming requests
+         */
+        void
+        runMulti(MultiThreadQueue<RequestInfo> &pQueue);
+
+        /**
+         * @brief Create a curl handle with the options common to all requests
+         * @return the handle, NULL on failure
+         */
+        CURL *
+        initCurl();
+
+        /**
+         * @brief Set the per request options of a curl handle
+         * @param pCurl the curl handle
+         * @param pRequest the request to send. Its body must outlive the transfer.
+         * @param pUrl receives the url of the request. Must outlive the transfer.
+         * @return the header list to free once the transfer is over
+         */
+        struct curl_slist *
+        prepareCurl(CURL *pCurl, const RequestInfo &pRequest, std::string &pUrl);
+
+        /**
+         * @brief Account for the result of a transfer
+         * @param pCurl the curl handle
+         * @param pResult the curl result code
+         * @param pRequest the request sent
+         * @param pUrl the url of the request
+         */
+        void
+        onTransferDone(CURL *pCurl, CURLcode pResult, const RequestInfo &pRequest, const std::string &pUrl);
+
+        template <class Codec>
+        bool
+        substituteRequest(RequestInfo &pRequest, const tRequestProcessorCommands &pCommands);
+
+        /**
+         * @brief Filter a request, then substitute it if it matches
+         * @return true if the request should get duplicated
+         */
+        template <class Codec>
         bool
-        substituteRequest(RequestInfo &pRequest, tRequestProcessorCommands &pCommands, std::list<tKeyVal> &pHeaderParsedArgs);
+        filterAndSubstitute(RequestInfo &pRequest, const tRequestProcessorCommands &pCommands);
+
+        /**
+         * @brief Returns the url codec of a location, its own or the one of the processor
+         */
+        eUrlCodec
+        getLocationUrlCodec(const tRequestProcessorCommands &pCommands) const;
 
+        /**
+         * @brief Returns true if a key filter matches one of the arguments. Only the values of the keys filtered are decoded.
+         */
+        template <class Codec>
         bool
-        keyFilterMatch(std::multimap<std::string, tFilter> &pFilters, std::list<tKeyVal> &pParsedArgs, tFilterBase::eFilterScope scope);
+        keyFilterMatch(const tFilterIndex &pFilters, const std::string &pArgs, tFilterBase::eFilterScope scope);
+
+        /**
+         * @brief Rebuild the alternations of the raw filters of a location after a change
+         * @param pCommands the commands of the location
+         * @param pEngine the engine to compile them with
+         */
+        static void
+        compileRawFilters(tRequestProcessorCommands &pCommands, eRegexEngine pEngine, unsigned long pBudget);
+
+        /**
+         * @brief Rebuild the indexes of the key filters and substitutions of a location after a change
+         * @param pCommands the commands of the location
+         */
+        static void
+        indexKeys(tRequestProcessorCommands &pCommands);
+
+        /**
+         * @brief Compile all the filters and substitutions again, after a change of engine or budget
+         * @param pEngine the engine to compile them with
+         * @param pBudget the budget of their searches and replacements
+         * @throw RegexError if an expression or a replacement uses a feature the engine lacks, in which case nothing changes
+         */
+        void
+        recompile(eRegexEngine pEngine, unsigned long pBudget);
+
+        /**
+         * @brief Count a request skipped because an expression exceeded its budget
+         * @param pPattern the expression
+         */
+        void
+        onBudgetExceeded(const std::string &pPattern);
 
+        template <class Codec>
         bool
-        keySubstitute(tFieldSubstitutionMap &pSubs,
-                      std::list<tKeyVal> &pParsedArgs,
+        keySubstitute(const tSubstitutionIndex &pSubs,
+                      const std::string &pArgs,
                       tFilterBase::eFilterScope scope,
                       std::string &result);
     };
@@ -0,0 +1,89 @@
+/*
+* mod_dup - duplicates apache requests
+*
+* Copyright (C) 2013 Orange
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include <strings.h>
+#include <string.h>
+
+#include "Sampler.hh"
+
+namespace DupModule {
+
+unsigned long long
+sampleHash(const char *pData, size_t pSize) {
+	unsigned long long lHash = 14695981039346656037ULL;
+	for (size_t i = 0; i < pSize; ++i) {
+		lHash ^= static_cast<unsigned char>(pData[i]);
+		lHash *= 1099511628211ULL;
+	}
+	return lHash;
+}
+
+bool
+findField(const char *pArgs, size_t pSize, const char *pField, const char *&pValue, size_t &pValueSize) {
+	size_t lFieldSize = strlen(pField);
+	const char *lEnd = pArgs + pSize;
+	for (const char *lPos = pArgs; lPos < lEnd; ) {
+		const char *lNext = static_cast<const char *>(memchr(lPos, '&', lEnd - lPos));
+		if (!lNext) {
+			lNext = lEnd;
+		}
+		if (static_cast<size_t>(lNext - lPos) > lFieldSize && lPos[lFieldSize] == '=' && !strncasecmp(lPos, pField, lFieldSize)) {
+			pValue = lPos + lFieldSize + 1;
+			pValueSize = lNext - pValue;
+			return true;
+		}
+		lPos = lNext + 1;
+	}
+	return false;
+}
+
+/**
+ * @brief Returns the decision for a hash
+ */
+static eSampling
+decide(unsigned pRate, const char *pData, size_t pSize) {
+	// Mix the high bits into the low ones first: the modulo only looks at the latter
+	unsigned long long lHash = sampleHash(pData, pSize);
+	lHash ^= lHash >> 33;
+	lHash *= 0xff51afd7ed558ccdULL;
+	lHash ^= lHash >> 33;
+	return lHash % SAMPLE_ALL < pRate ? SAMPLE_IN : SAMPLE_OUT;
+}
+
+eSampling
+sample(unsigned pRate, const char *pField, const char *pArgs, const char *pUri, const std::string *pBody) {
+	if (pRate >= SAMPLE_ALL) {
+		return SAMPLE_IN;
+	}
+	if (pField) {
+		const char *lValue;
+		size_t lValueSize;
+		if (pArgs && findField(pArgs, strlen(pArgs), pField, lValue, lValueSize)) {
+			return decide(pRate, lValue, lValueSize);
+		}
+		if (!pBody) {
+			return SAMPLE_LATER;
+		}
+		if (findField(pBody->data(), pBody->size(), pField, lValue, lValueSize)) {
+			return decide(pRate, lValue, lValueSize);
+		}
+	}
+	return decide(pRate, pUri, strlen(pUri));
+}
+
+}
@@ -0,0 +1,72 @@
+/*
+* mod_dup - duplicates apache requests
+*
+* Copyright (C) 2013 Orange
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+namespace DupModule {
+
+/** @brief The sample rate which keeps all the requests, in hundredths of a percent */
+static const unsigned SAMPLE_ALL = 10000;
+
+/**
+ * @brief The outcome of the sampling of a request
+ */
+enum eSampling {
+	/** The request is part of the sample */
+	SAMPLE_IN,
+	/** The request is not part of the sample */
+	SAMPLE_OUT,
+	/** The field may be in the body, which is not read yet */
+	SAMPLE_LATER,
+};
+
+/**
+ * @brief Returns the 64 bits FNV-1a hash of some bytes
+ */
+unsigned long long
+sampleHash(const char *pData, size_t pSize);
+
+/**
+ * @brief Find the value of a field in url encoded parameters, the name compared without case, the value left encoded
+ * @param pArgs the parameters, key=value pairs separated by '&'
+ * @param pSize the size of the parameters
+ * @param pField the name of the field
+ * @param pValue receives the start of the value
+ * @param pValueSize receives the size of the value
+ * @return false if the field is not there
+ */
+bool
+findField(const char *pArgs, size_t pSize, const char *pField, const char *&pValue, size_t &pValueSize);
+
+/**
+ * @brief Decide whether a request is part of the sample of its location.
+ * The decision only depends on the hash of the field, or of the uri without field: the same user is always in or out.
+ * @param pRate the sample rate, in hundredths of a percent
+ * @param pField the field identifying the user, NULL to hash the uri
+ * @param pArgs the query string
+ * @param pUri the uri, used if the field is nowhere
+ * @param pBody the body if read, NULL if it is not read yet but may hold the field
+ * @return SAMPLE_LATER if the field is not in the query and pBody is NULL, the decision otherwise
+ */
+eSampling
+sample(unsigned pRate, const char *pField, const char *pArgs, const char *pUri, const std::string *pBody);
+
+}
@@ -0,0 +1,130 @@
+/*
+* mod_dup - duplicates apache requests
+*
+* Copyright (C) 2013 Orange
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include <errno.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "Scoreboard.hh"
+
+namespace DupModule {
+
+Scoreboard::Scoreboard() : mShm(NULL), mSlots(NULL), mSlotCount(0), mSlot(NULL) {
+	memset(mPublished, 0, sizeof(mPublished));
+}
+
+apr_status_t
+Scoreboard::create(apr_pool_t *pPool, size_t pSlotCount) {
+	// One more than the size, to align the slots whatever the alignment of the segment
+	apr_status_t lStatus = apr_shm_create(&mShm, (pSlotCount + 1) * sizeof(tSlot), NULL, pPool);
+	if (lStatus != APR_SUCCESS) {
+		return lStatus;
+	}
+	size_t lBase = reinterpret_cast<size_t>(apr_shm_baseaddr_get(mShm));
+	mSlots = reinterpret_cast<tSlot *>((lBase + sizeof(tSlot) - 1) / sizeof(tSlot) * sizeof(tSlot));
+	memset(mSlots, 0, pSlotCount * sizeof(tSlot));
+	mSlotCount = pSlotCount;
+	mSlot = NULL;
+	return APR_SUCCESS;
+}
+
+/**
+ * @brief Returns true if the process exists
+ */
+static bool
+isAlive(pid_t pPid) {
+	return kill(pPid, 0) == 0 || errno != ESRCH;
+}
+
+bool
+Scoreboard::attach() {
+	pid_t lPid = getpid();
+	for (size_t i = 0; i < mSlotCount; ++i) {
+		pid_t lOwner = mSlots[i].mPid;
+		if (lOwner && isAlive(lOwner)) {
+			continue;
+		}
+		if (__sync_bool_compare_and_swap(&mSlots[i].mPid, lOwner, lPid)) {
+			mSlot = &mSlots[i];
+			// The totals of this process start from there
+			memset(mPublished, 0, sizeof(mPublished));
+			// Whatever the previous owner left
+			set(SB_QUEUED, 0);
+			set(SB_QUEUED_BYTES, 0);
+			set(SB_THREADS, 0);
+			return true;
+		}
+	}
+	return false;
+}
+
+void
+Scoreboard::detach() {
+	if (!mSlot) {
+		return;
+	}
+	set(SB_QUEUED, 0);
+	set(SB_QUEUED_BYTES, 0);
+	set(SB_THREADS, 0);
+	__sync_lock_release(&mSlot->mPid);
+	mSlot = NULL;
+}
+
+pid_t
+Scoreboard::read(size_t pSlot, unsigned long long pValues[SB_VALUE_COUNT]) const {
+	const tSlot &lSlot = mSlots[pSlot];
+	for (unsigned i = 0; i < SB_VALUE_COUNT; ++i) {
+		pValues[i] = __atomic_load_n(&lSlot.mValues[i], __ATOMIC_RELAXED);
+	}
+	pid_t lPid = lSlot.mPid;
+	if (lPid && !isAlive(lPid)) {
+		// Exited without detaching: only its counters still mean something
+		pValues[SB_QUEUED] = pValues[SB_QUEUED_BYTES] = pValues[SB_THREADS] = 0;
+		return 0;
+	}
+	return lPid;
+}
+
+unsigned
+Scoreboard::aggregate(unsigned long long pTotals[SB_VALUE_COUNT]) const {
+	unsigned lProcesses = 0;
+	unsigned long long lValues[SB_VALUE_COUNT];
+	for (unsigned i = 0; i < SB_VALUE_COUNT; ++i) {
+		pTotals[i] = 0;
+	}
+	for (size_t s = 0; s < mSlotCount; ++s) {
+		if (read(s, lValues)) {
+			++lProcesses;
+		}
+		for (unsigned i = 0; i < SB_VALUE_COUNT; ++i) {
+			pTotals[i] += lValues[i];
+		}
+	}
+	return lProcesses;
+}
+
+const char *
+Scoreboard::getName(eScoreboardValue pValue) {
+	static const char *lNames[SB_VALUE_COUNT] = {
+		"In", "Out", "Drop", "DroppedBytes", "TmOut", "DupReq", "SampleIn", "SampleOut", "ShmDrop", "Queued", "QueuedBytes", "Threads"
+	};
+	return lNames[pValue];
+}
+
+}
@@ -0,0 +1,183 @@
+/*
+* mod_dup - duplicates apache requests
+*
+* Copyright (C) 2013 Orange
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#pragma once
+
+#include <apr_pools.h>
+#include <apr_shm.h>
+#include <sys/types.h>
+
+namespace DupModule {
+
+/**
+ * @brief The values kept for each process in the Scoreboard
+ */
+enum eScoreboardValue {
+	/** Requests queued since the start */
+	SB_IN,
+	/** Requests taken off the queue since the start */
+	SB_OUT,
+	/** Requests dropped since the start */
+	SB_DROP,
+	/** Bytes held by the requests dropped since the start */
+	SB_DROPPED_BYTES,
+	/** Requests which timed out since the start */
+	SB_TIMEOUT,
+	/** Requests duplicated since the start */
+	SB_DUPLICATED,
+	/** Requests part of the sample of their location since the start */
+	SB_SAMPLE_IN,
+	/** Requests left out of the sample of their location since the start */
+	SB_SAMPLE_OUT,
+	/** Requests which did not fit in the ring to the dispatcher processes since the start */
+	SB_SHM_DROP,
+	/** Requests queued now */
+	SB_QUEUED,
+	/** Bytes held by the requests queued now */
+	SB_QUEUED_BYTES,
+	/** Threads running now */
+	SB_THREADS,
+	/** The number of values, not a value */
+	SB_VALUE_COUNT
+};
+
+/**
+ * @brief Counters of all the processes, in anonymous shared memory, shared by the processes forked after its creation.
+ * Each process attaches to a slot of its own, which only it writes to, with plain atomic stores and adds: no lock is ever taken.
+ * Readers sum the slots on demand, so the totals are consistent per value but not across values.
+ * The counters of a process which exited are kept, the next process taking its slot goes on from them:
+ * the totals cover the whole life of the server, whatever the turnover of the processes.
+ */
+class Scoreboard
+{
+private:
+	/** @brief The part of the shared memory describing a process */
+	struct tSlot {
+		/** @brief The process owning the slot, 0 if free */
+		volatile pid_t mPid;
+		/** @brief The values, indexed by eScoreboardValue */
+		unsigned long long mValues[SB_VALUE_COUNT];
+	} __attribute__((aligned(64)));
+
+	/** @brief The shared memory segment */
+	apr_shm_t *mShm;
+	/** @brief The slots, at the beginning of the segment */
+	tSlot *mSlots;
+	/** @brief The number of slots */
+	size_t mSlotCount;
+	/** @brief The slot of this process, NULL if not attached */
+	tSlot *mSlot;
+	/** @brief The totals of this process already added to its slot by addTotal, indexed by eScoreboardValue */
+	unsigned long long mPublished[SB_VALUE_COUNT];
+
+	Scoreboard(const Scoreboard &);
+	Scoreboard &operator=(const Scoreboard &);
+
+public:
+	/**
+	 * @brief Constructs a scoreboard without storage. Call create before use.
+	 */
+	Scoreboard();
+
+	/**
+	 * @brief Allocate the shared memory. The processes forked afterwards share the scoreboard.
+	 * @param pPool the pool the shared memory is released with
+	 * @param pSlotCount the maximum number of processes attached at once
+	 * @return APR_SUCCESS, or the error of apr_shm_create
+	 */
+	apr_status_t
+	create(apr_pool_t *pPool, size_t pSlotCount);
+
+	/**
+	 * @brief Take a slot for the current process: a free one, or the one of a process which exited without releasing it
+	 * @return false if all the slots are taken, in which case the updates of this process are ignored
+	 */
+	bool
+	attach();
+
+	/**
+	 * @brief Give the slot of the current process back, its current values reset
+	 */
+	void
+	detach();
+
+	/**
+	 * @brief Add to a value of the current process
+	 */
+	void
+	add(eScoreboardValue pValue, unsigned long long pDelta) {
+		if (mSlot) {
+			__atomic_fetch_add(&mSlot->mValues[pValue], pDelta, __ATOMIC_RELAXED);
+		}
+	}
+
+	/**
+	 * @brief Add to a value of the current process the increase of one of its own totals since the previous call.
+	 * Unlike set, it keeps what the previous owners of the slot counted.
+	 * @param pValue the value
+	 * @param pTotal the total counted by the current process since it started
+	 */
+	void
+	addTotal(eScoreboardValue pValue, unsigned long long pTotal) {
+		add(pValue, pTotal - mPublished[pValue]);
+		mPublished[pValue] = pTotal;
+	}
+
+	/**
+	 * @brief Set a value of the current process
+	 */
+	void
+	set(eScoreboardValue pValue, unsigned long long pNewValue) {
+		if (mSlot) {
+			__atomic_store_n(&mSlot->mValues[pValue], pNewValue, __ATOMIC_RELAXED);
+		}
+	}
+
+	/**
+	 * @brief Returns the number of slots
+	 */
+	size_t
+	getSlotCount() const {
+		return mSlotCount;
+	}
+
+	/**
+	 * @brief Read a slot
+	 * @param pSlot the index of the slot
+	 * @param pValues receives the values, indexed by eScoreboardValue
+	 * @return the process owning the slot, 0 if free or if its process exited
+	 */
+	pid_t
+	read(size_t pSlot, unsigned long long pValues[SB_VALUE_COUNT]) const;
+
+	/**
+	 * @brief Sum the values of all the slots
+	 * @param pTotals receives the totals, indexed by eScoreboardValue
+	 * @return the number of processes attached and still running
+	 */
+	unsigned
+	aggregate(unsigned long long pTotals[SB_VALUE_COUNT]) const;
+
+	/**
+	 * @brief Returns the name of a value, as displayed by the status handler
+	 */
+	static const char *
+	getName(eScoreboardValue pValue);
+};
+
+}
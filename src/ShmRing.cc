@@ -0,0 +1,293 @@
+/*
+* mod_dup - duplicates apache requests
+*
+* Copyright (C) 2013 Orange
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include <algorithm>
+#include <errno.h>
+#include <signal.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ShmRing.hh"
+
+namespace DupModule {
+
+/** @brief The states of a record, in the two high bits of its tag */
+enum eRecordState {
+	/** Read, its room can be reused */
+	RECORD_READ = 0,
+	/** Reserved, its writer is copying it */
+	RECORD_WRITING = 1,
+	/** Complete, waiting for a reader */
+	RECORD_READY = 2,
+	/** Claimed, its reader is copying it */
+	RECORD_READING = 3,
+};
+
+static const unsigned gStateShift = 62;
+static const unsigned gPidShift = 32;
+static const uint64_t gPidMask = (1ULL << (gStateShift - gPidShift)) - 1;
+
+static uint64_t
+makeTag(eRecordState pState, pid_t pPid, size_t pSize) {
+	return (static_cast<uint64_t>(pState) << gStateShift) | ((static_cast<uint64_t>(pPid) & gPidMask) << gPidShift) | pSize;
+}
+
+static eRecordState
+tagState(uint64_t pTag) {
+	return static_cast<eRecordState>(pTag >> gStateShift);
+}
+
+static size_t
+tagSize(uint64_t pTag) {
+	return static_cast<uint32_t>(pTag);
+}
+
+/**
+ * @brief Returns false if the process of a tag has exited. A recycled pid only delays the recovery until it exits too
+ */
+static bool
+tagProcessAlive(uint64_t pTag) {
+	return kill(static_cast<pid_t>((pTag >> gPidShift) & gPidMask), 0) == 0 || errno != ESRCH;
+}
+
+/** @brief Records take a whole number of tags, so that tags never wrap around the end of the data area */
+static size_t
+recordBytes(size_t pSize) {
+	return (sizeof(uint64_t) + pSize + sizeof(uint64_t) - 1) & ~(sizeof(uint64_t) - 1);
+}
+
+ShmRing::ShmRing() : mShm(NULL), mHeader(NULL), mData(NULL) {}
+
+apr_status_t
+ShmRing::create(apr_pool_t *pPool, size_t pCapacity) {
+	pCapacity &= ~(sizeof(tTag) - 1);
+	apr_status_t lStatus = apr_shm_create(&mShm, sizeof(tHeader) + pCapacity, NULL, pPool);
+	if (lStatus != APR_SUCCESS) {
+		return lStatus;
+	}
+	mHeader = static_cast<tHeader *>(apr_shm_baseaddr_get(mShm));
+	mData = reinterpret_cast<char *>(mHeader + 1);
+
+	pthread_mutexattr_t lMutexAttr;
+	pthread_mutexattr_init(&lMutexAttr);
+	pthread_mutexattr_setpshared(&lMutexAttr, PTHREAD_PROCESS_SHARED);
+	pthread_mutexattr_setrobust(&lMutexAttr, PTHREAD_MUTEX_ROBUST);
+	lStatus = pthread_mutex_init(&mHeader->mMutex, &lMutexAttr);
+	pthread_mutexattr_destroy(&lMutexAttr);
+	if (lStatus) {
+		return lStatus;
+	}
+	pthread_condattr_t lCondAttr;
+	pthread_condattr_init(&lCondAttr);
+	pthread_condattr_setpshared(&lCondAttr, PTHREAD_PROCESS_SHARED);
+	pthread_condattr_setclock(&lCondAttr, CLOCK_MONOTONIC);
+	lStatus = pthread_cond_init(&mHeader->mReady, &lCondAttr);
+	pthread_condattr_destroy(&lCondAttr);
+	if (lStatus) {
+		return lStatus;
+	}
+	mHeader->mWaiting = 0;
+	mHeader->mCapacity = pCapacity;
+	mHeader->mHead = mHeader->mTail = mHeader->mFree = 0;
+	mHeader->mDropCount = 0;
+	return APR_SUCCESS;
+}
+
+void
+ShmRing::lock() {
+	if (pthread_mutex_lock(&mHeader->mMutex) == EOWNERDEAD) {
+		// Its holder died. Each position is stored once, when the change it records is complete: they are consistent
+		pthread_mutex_consistent(&mHeader->mMutex);
+	}
+}
+
+void
+ShmRing::unlock() {
+	pthread_mutex_unlock(&mHeader->mMutex);
+}
+
+volatile ShmRing::tTag *
+ShmRing::tag(size_t pPos) const {
+	return reinterpret_cast<volatile tTag *>(mData + pPos % mHeader->mCapacity);
+}
+
+void
+ShmRing::write(size_t pPos, const char *pSrc, size_t pSize) {
+	size_t lOffset = pPos % mHeader->mCapacity;
+	size_t lFirst = std::min(pSize, mHeader->mCapacity - lOffset);
+	memcpy(mData + lOffset, pSrc, lFirst);
+	memcpy(mData, pSrc + lFirst, pSize - lFirst);
+}
+
+void
+ShmRing::read(size_t pPos, char *pDest, size_t pSize) const {
+	size_t lOffset = pPos % mHeader->mCapacity;
+	size_t lFirst = std::min(pSize, mHeader->mCapacity - lOffset);
+	memcpy(pDest, mData + lOffset, lFirst);
+	memcpy(pDest + lFirst, mData, pSize - lFirst);
+}
+
+void
+ShmRing::reclaim() {
+	// The records before mTail are being read, read, or were left by a reader which died
+	while (mHeader->mFree != mHeader->mTail) {
+		tTag lTag = *tag(mHeader->mFree);
+		if (tagState(lTag) == RECORD_READING && tagProcessAlive(lTag)) {
+			return;
+		}
+		mHeader->mFree += recordBytes(tagSize(lTag));
+	}
+}
+
+bool
+ShmRing::claim(size_t &pPos, size_t &pSize) {
+	while (mHeader->mTail != mHeader->mHead) {
+		volatile tTag *lTag = tag(mHeader->mTail);
+		tTag lValue = *lTag;
+		size_t lSize = tagSize(lValue);
+		if (tagState(lValue) == RECORD_WRITING) {
+			if (tagProcessAlive(lValue)) {
+				return false;
+			}
+			// Its writer died, the record is incomplete
+			mHeader->mTail += recordBytes(lSize);
+			__sync_fetch_and_add(&mHeader->mDropCount, 1);
+			continue;
+		}
+		// Read the content after the tag telling it is complete
+		__sync_synchronize();
+		*lTag = makeTag(RECORD_READING, getpid(), lSize);
+		pPos = mHeader->mTail + sizeof(tTag);
+		pSize = lSize;
+		mHeader->mTail += recordBytes(lSize);
+		return true;
+	}
+	return false;
+}
+
+bool
+ShmRing::push(const struct iovec *pParts, size_t pCount) {
+	size_t lSize = 0;
+	for (size_t i = 0; i < pCount; ++i) {
+		lSize += pParts[i].iov_len;
+	}
+	size_t lBytes = recordBytes(lSize);
+	if (static_cast<uint32_t>(lSize) != lSize || lBytes > mHeader->mCapacity) {
+		__sync_fetch_and_add(&mHeader->mDropCount, 1);
+		return false;
+	}
+
+	// Reserve the room of the record
+	lock();
+	if (mHeader->mCapacity - (mHeader->mHead - mHeader->mFree) < lBytes) {
+		reclaim();
+	}
+	if (mHeader->mCapacity - (mHeader->mHead - mHeader->mFree) < lBytes) {
+		unlock();
+		__sync_fetch_and_add(&mHeader->mDropCount, 1);
+		return false;
+	}
+	size_t lPos = mHeader->mHead;
+	volatile tTag *lTag = tag(lPos);
+	*lTag = makeTag(RECORD_WRITING, getpid(), lSize);
+	mHeader->mHead += lBytes;
+	unlock();
+
+	// Copy it without the mutex, then publish it
+	lPos += sizeof(tTag);
+	for (size_t i = 0; i < pCount; ++i) {
+		write(lPos, static_cast<const char *>(pParts[i].iov_base), pParts[i].iov_len);
+		lPos += pParts[i].iov_len;
+	}
+	__sync_synchronize();
+	*lTag = makeTag(RECORD_READY, 0, lSize);
+	__sync_synchronize();
+	if (mHeader->mWaiting) {
+		lock();
+		pthread_cond_signal(&mHeader->mReady);
+		unlock();
+	}
+	return true;
+}
+
+bool
+ShmRing::pop(std::string &pRecord, unsigned pTimeout) {
+	struct timespec lDeadline;
+	if (pTimeout) {
+		clock_gettime(CLOCK_MONOTONIC, &lDeadline);
+		lDeadline.tv_sec += pTimeout / 1000;
+		lDeadline.tv_nsec += (pTimeout % 1000) * 1000000L;
+		if (lDeadline.tv_nsec >= 1000000000L) {
+			++lDeadline.tv_sec;
+			lDeadline.tv_nsec -= 1000000000L;
+		}
+	}
+	size_t lPos, lSize;
+	lock();
+	reclaim();
+	bool lClaimed = claim(lPos, lSize);
+	while (!lClaimed && pTimeout) {
+		// Producers check mWaiting after publishing their record: count this consumer before checking again
+		++mHeader->mWaiting;
+		__sync_synchronize();
+		lClaimed = claim(lPos, lSize);
+		if (!lClaimed) {
+			int lStatus = pthread_cond_timedwait(&mHeader->mReady, &mHeader->mMutex, &lDeadline);
+			if (lStatus == EOWNERDEAD) {
+				pthread_mutex_consistent(&mHeader->mMutex);
+			} else if (lStatus == ETIMEDOUT) {
+				pTimeout = 0;
+			}
+			lClaimed = claim(lPos, lSize);
+		}
+		--mHeader->mWaiting;
+	}
+	unlock();
+	if (!lClaimed) {
+		return false;
+	}
+
+	// Copy it without the mutex, then release it
+	volatile tTag *lTag = tag(lPos - sizeof(tTag));
+	try {
+		pRecord.resize(lSize);
+	} catch (...) {
+		*lTag = makeTag(RECORD_READ, 0, lSize);
+		throw;
+	}
+	if (lSize) {
+		read(lPos, &pRecord[0], lSize);
+	}
+	__sync_synchronize();
+	*lTag = makeTag(RECORD_READ, 0, lSize);
+	return true;
+}
+
+unsigned
+ShmRing::getDropCount() {
+	// Atomic read + reset
+	return __sync_fetch_and_and(&mHeader->mDropCount, 0);
+}
+
+size_t
+ShmRing::used() const {
+	return mHeader->mHead - mHeader->mFree;
+}
+
+}
@@ -0,0 +1,153 @@
+/*
+* mod_dup - duplicates apache requests
+*
+* Copyright (C) 2013 Orange
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#pragma once
+
+#include <apr_pools.h>
+#include <apr_shm.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <string>
+
+namespace DupModule {
+
+/**
+ * @brief A bounded ring of variable size records in anonymous shared memory, shared by the processes forked after its creation.
+ * Any process can push and pop records. The positions are protected by a robust process shared mutex, only held
+ * to reserve or claim a record: the records are copied in and out without it, so producers never wait on a copy.
+ * Each record starts with a tag telling its size, its state and the process writing or reading it.
+ * The record of a process which died while writing it is skipped, the one of a process which died while reading it
+ * is released, and a process dying with the mutex leaves the positions consistent: the ring never gets stuck.
+ * A record which does not fit is dropped and counted, producers never wait.
+ */
+class ShmRing
+{
+private:
+	/** @brief The part of the shared memory describing the ring */
+	struct tHeader {
+		/** @brief Protects the positions and mWaiting */
+		pthread_mutex_t mMutex;
+		/** @brief Signaled when a record is ready while consumers wait */
+		pthread_cond_t mReady;
+		/** @brief Number of consumers waiting on mReady */
+		volatile unsigned mWaiting;
+		/** @brief Size of the data area in bytes, a multiple of the tag size */
+		size_t mCapacity;
+		/** @brief Position of the next record to reserve, only ever growing */
+		size_t mHead;
+		/** @brief Position of the next record to claim for reading, only ever growing */
+		size_t mTail;
+		/** @brief Position of the oldest record not released by its reader, only ever growing */
+		size_t mFree;
+		/** @brief Number of records dropped since the last call to getDropCount */
+		volatile unsigned mDropCount;
+	};
+
+	/** @brief The tag of a record: its size, its state and the process writing or reading it */
+	typedef uint64_t tTag;
+
+	/** @brief The shared memory segment */
+	apr_shm_t *mShm;
+	/** @brief The header, at the beginning of the segment */
+	tHeader *mHeader;
+	/** @brief The data area, right after the header */
+	char *mData;
+
+	void lock();
+	void unlock();
+
+	/**
+	 * @brief Returns the tag of the record at a position
+	 */
+	volatile tTag *tag(size_t pPos) const;
+
+	/**
+	 * @brief Advance mFree past the records read, or whose reader died. Called with the mutex held
+	 */
+	void reclaim();
+
+	/**
+	 * @brief Claim the oldest record ready for reading, skipping those whose writer died. Called with the mutex held
+	 * @param pPos receives the position of its content
+	 * @param pSize receives its size
+	 * @return false if the oldest record is still being written, or if there is none
+	 */
+	bool claim(size_t &pPos, size_t &pSize);
+
+	/**
+	 * @brief Copy bytes into the data area from a position, wrapping around its end
+	 */
+	void write(size_t pPos, const char *pSrc, size_t pSize);
+
+	/**
+	 * @brief Copy bytes out of the data area from a position, wrapping around its end
+	 */
+	void read(size_t pPos, char *pDest, size_t pSize) const;
+
+	ShmRing(const ShmRing &);
+	ShmRing &operator=(const ShmRing &);
+
+public:
+	/**
+	 * @brief Constructs a ring without storage. Call create before use.
+	 */
+	ShmRing();
+
+	/**
+	 * @brief Allocate the shared memory. The processes forked afterwards share the ring.
+	 * @param pPool the pool the shared memory is released with
+	 * @param pCapacity the size of the data area in bytes, rounded down to a multiple of 8
+	 * @return APR_SUCCESS, or the error of apr_shm_create or of the mutex initialization
+	 */
+	apr_status_t
+	create(apr_pool_t *pPool, size_t pCapacity);
+
+	/**
+	 * @brief Adds a record made of several parts, copied one after the other
+	 * @param pParts the parts of the record
+	 * @param pCount the number of parts
+	 * @return false if the record does not fit, in which case it is dropped and counted
+	 */
+	bool
+	push(const struct iovec *pParts, size_t pCount);
+
+	/**
+	 * @brief Removes the oldest record
+	 * @param pRecord receives the record
+	 * @param pTimeout how long to wait for a record in milliseconds, 0 to return at once
+	 * @return false if no record was ready in time
+	 */
+	bool
+	pop(std::string &pRecord, unsigned pTimeout = 0);
+
+	/**
+	 * @brief Returns the number of records dropped since the last call, then resets it
+	 */
+	unsigned
+	getDropCount();
+
+	/**
+	 * @brief Returns the number of bytes used by the queued records, tags and padding included
+	 */
+	size_t
+	used() const;
+};
+
+}
@@ -20,16 +20,40 @@
 
 #include <boost/date_time/posix_time/posix_time_types.hpp>
 #include <boost/function.hpp>
+#include <time.h>
 
 #include "MultiThreadQueue.hh"
+#include "PoolScaler.hh"
 
 using namespace boost::posix_time;
 
 namespace DupModule {
 
+/**
+ * @brief The counters of a pool, as reported to its counters listener
+ */
+struct tPoolCounters {
+	/** @brief Number of items pushed since the previous report */
+	unsigned mIn;
+	/** @brief Number of items popped since the previous report */
+	unsigned mOut;
+	/** @brief Number of items dropped since the previous report */
+	unsigned mDrop;
+	/** @brief Bytes held by the items dropped since the previous report */
+	size_t mDroppedBytes;
+	/** @brief Number of items queued now */
+	size_t mQueued;
+	/** @brief Bytes held by the items queued now */
+	size_t mQueuedBytes;
+	/** @brief Number of threads now */
+	size_t mThreads;
+};
+
 /**
  * @brief Manages a pool of threads depending on the size of its queue.
  * As its queue grows, it spawns new worker threads. If the queue shrinks again, it hands poison pills to a worker which should then exit.
+ * The manager thread wakes up as soon as a push makes the queue exceed what the threads can take, instead of waiting for its next periodic check.
+ * The PoolScaler decides how many threads to add or remove.
  * The class gets the queue item type as its template argument. This makes it independent of any business needs and therefore more easily reusable.
  */
 template <typename QueueT>
@@ -42,8 +66,14 @@ public:
 	/** @brief The type of the function object which returns a stat */
 	typedef boost::function0<const std::string> tStatProvider;
 
+	/** @brief The type of the function object which returns the time in micro sec the workers spent busy since the start */
+	typedef boost::function0<unsigned long long> tBusyTimeProvider;
+
+	/** @brief The type of the function object which receives the counters of the pool after each check of its threads */
+	typedef boost::function1<void, const tPoolCounters &> tCountersListener;
+
 private:
-	/** @brief The time in micro sec for which we wait before controlling the number of threads in the pool */
+	/** @brief The maximum time in micro sec for which we wait before controlling the number of threads in the pool */
 	static const unsigned mManageInterval = 100000;
 
 	/** @brief Contains the threads */
@@ -66,6 +96,12 @@ private:
 	tQueueWorker mWorker;
 	/** @brief The queue of items to be handled by the threads */
 	MultiThreadQueue<QueueT> mQueue;
+	/** @brief The storage the queue switches to when the pool starts */
+	eQueueBackend mQueueBackend;
+	/** @brief The maximum number of bytes held by the queued items, 0 if unbounded */
+	size_t mQueueMemory;
+	/** @brief What the queue drops when its memory budget runs out */
+	eAdmissionPolicy mAdmissionPolicy;
 	/** @brief The poison item which should be send to force a thread to exit */
 	const QueueT mPoisonItem;
 	/** @brief true if the pool should continue to run */
@@ -74,6 +110,56 @@ private:
     std::string mProgramName;
 	/** @brief Map containing additional stats providers */
 	std::map<std::string, tStatProvider> mAdditionalStats;
+	/** @brief The time in micro sec given to the workers to send the queued items when stopping, 0 to drop them straight away */
+	unsigned long long mDrainTimeout;
+	/** @brief Decides how many threads to add or remove */
+	PoolScaler mScaler;
+	/** @brief Reports the busy time of the workers to the scaler */
+	tBusyTimeProvider mBusyTimeProvider;
+	/** @brief Receives the counters of the pool, if set */
+	tCountersListener mCountersListener;
+	/** @brief The number of threads not being killed, as seen by push */
+	volatile size_t mAliveThreads;
+	/** @brief 1 if push asked the manager to check the number of threads */
+	volatile int mScaleRequested;
+	/** @brief Protects the wait of the manager on mManageCondition */
+	boost::mutex mManageMutex;
+	/** @brief Wakes the manager up when threads are needed */
+	boost::condition_variable mManageCondition;
+
+	/**
+	 * @brief Returns a monotonic time in micro sec
+	 */
+	static unsigned long long
+	now() {
+		struct timespec lNow;
+		clock_gettime(CLOCK_MONOTONIC, &lNow);
+		return static_cast<unsigned long long>(lNow.tv_sec) * 1000000 + lNow.tv_nsec / 1000;
+	}
+
+	/**
+	 * @brief Wake the manager up if the queue exceeds what the threads can take
+	 */
+	void
+	requestScaling() {
+		if (mRunning && mQueue.size() > mScaler.growThreshold(mAliveThreads) && !__sync_lock_test_and_set(&mScaleRequested, 1)) {
+			boost::lock_guard<boost::mutex> lLock(mManageMutex);
+			mManageCondition.notify_one();
+		}
+	}
+
+	/**
+	 * @brief Wait for a scaling request from push, or mManageInterval at most
+	 */
+	void
+	waitScalingRequest() {
+		boost::unique_lock<boost::mutex> lLock(mManageMutex);
+		if (!mScaleRequested && mRunning) {
+			const long lInterval = mManageInterval;
+			mManageCondition.timed_wait(lLock, boost::posix_time::microseconds(lInterval));
+		}
+		__sync_lock_release(&mScaleRequested);
+	}
 
 	/**
 	 * @brief Spawn a new worker thread
@@ -81,6 +167,7 @@ private:
 	void
 	newThread() {
 		mThreads.push_back(new boost::thread(mWorker, boost::ref(this->mQueue)));
+		mAliveThreads = mThreads.size() - mBeingKilled;
 	}
 
 	/**
@@ -90,6 +177,7 @@ private:
 		Log::debug("Dropping a poison pill.");
 		mQueue.push_front(mPoisonItem);
 		mBeingKilled++;
+		mAliveThreads = mThreads.size() - mBeingKilled;
 	}
 
 	/**
@@ -109,6 +197,7 @@ private:
 				++it;
 			}
 		}
+		mAliveThreads = mThreads.size() - mBeingKilled;
 	}
 
 	/**
@@ -118,23 +207,48 @@ private:
 	void
 	run() {
 		unsigned pid = getpid();
-		unsigned iterationsSinceStats = 0;
+		unsigned long long lLastStats = now();
+		// The counters since the last stats line
+		tPoolCounters lStats = tPoolCounters();
 
 		while (mRunning) {
 			size_t lQueued = mQueue.size();
-			float lQueuedPerThread = static_cast<float>(mQueue.size()) / mThreads.size();
 
 			collectKilled();
 
-			if (lQueuedPerThread > mMaxQueued && mThreads.size() < mMaxThreads) {
+			unsigned long long lNow = now();
+			int lChange = mScaler.decide(lNow, lQueued, mThreads.size(), mBeingKilled,
+			                             mBusyTimeProvider ? mBusyTimeProvider() : 0);
+			for (; lChange > 0; --lChange) {
 				newThread();
-			} else if (lQueuedPerThread < mMinQueued && mThreads.size() - mBeingKilled > mMinThreads) {
+			}
+			for (; lChange < 0; ++lChange) {
 				poisonThread();
 			}
 
-			if (++iterationsSinceStats * mManageInterval >= mStatsInterval) {
+			if (mCountersListener) {
+				tPoolCounters lCounters;
+				mQueue.getCounters(lCounters.mIn, lCounters.mOut, lCounters.mDrop);
+				mQueue.getByteCounters(lCounters.mQueuedBytes, lCounters.mDroppedBytes);
+				lCounters.mQueued = lQueued;
+				lCounters.mThreads = mThreads.size();
+				mCountersListener(lCounters);
+				lStats.mIn += lCounters.mIn;
+				lStats.mOut += lCounters.mOut;
+				lStats.mDrop += lCounters.mDrop;
+				lStats.mDroppedBytes += lCounters.mDroppedBytes;
+			}
+
+			if (lNow - lLastStats >= mStatsInterval) {
 				unsigned lInCount, lOutCount, lDropCount;
 				mQueue.getCounters(lInCount, lOutCount, lDropCount);
+				size_t lQueuedBytes, lDroppedBytes;
+				mQueue.getByteCounters(lQueuedBytes, lDroppedBytes);
+				lInCount += lStats.mIn;
+				lOutCount += lStats.mOut;
+				lDropCount += lStats.mDrop;
+				lDroppedBytes += lStats.mDroppedBytes;
+				lStats = tPoolCounters();
 
 				// FIXME: Hardcoding retrieval of only additional stats for now. This should become more generic.
 				std::map<std::string, tStatProvider>::const_iterator lStatsIter = mAdditionalStats.find("#TmOut");
@@ -142,27 +256,76 @@ private:
 				lStatsIter = mAdditionalStats.find("#DupReq");
                 const std::string lDuplicateCount = lStatsIter == mAdditionalStats.end() ? "??" : lStatsIter->second();
 				
-				Log::notice(201, "%s - %u - %zu - %zu - %u - %u - %u - %s - %s",
+				Log::notice(201, "%s - %u - %zu - %zu - %u - %u - %u - %s - %s - %zu - %zu",
 				        mProgramName.c_str(), pid, lQueued, mThreads.size(), lInCount, lOutCount,
-                        lDropCount, lTimeoutCount.c_str(), lDuplicateCount.c_str());
+                        lDropCount, lTimeoutCount.c_str(), lDuplicateCount.c_str(), lQueuedBytes, lDroppedBytes);
+				// Any other stat gets a line of its own
+				for (lStatsIter = mAdditionalStats.begin(); lStatsIter != mAdditionalStats.end(); ++lStatsIter) {
+					if (lStatsIter->first == "#TmOut" || lStatsIter->first == "#DupReq") {
+						continue;
+					}
+					const std::string lStat = lStatsIter->second();
+					if (!lStat.empty()) {
+						Log::notice(202, "%s - %u - %s - %s", mProgramName.c_str(), pid,
+						            lStatsIter->first.c_str(), lStat.c_str());
+					}
+				}
 				if (lDropCount > 0) {
 					Log::warn(301, "Pool %u dropped %d requests during last cycle!", pid, lDropCount);
 				}
-				iterationsSinceStats = 0;
+				lLastStats = lNow;
 			}
-			usleep(mManageInterval);
+			waitScalingRequest();
 		}
 
+		shutdown(pid);
+	}
+
+	/**
+	 * @brief Stop all the workers, letting them send the queued items within mDrainTimeout
+	 * @param pPid the process id, for the logs
+	 */
+	void
+	shutdown(unsigned pPid) {
 		unsigned lToBeKilled = mThreads.size() - mBeingKilled;
-		// Poison all remaining threads ... 
+		if (mDrainTimeout) {
+			// Poison all remaining threads behind the queued items, while the queue has room before the deadline ...
+			boost::system_time lDeadline = boost::get_system_time() + boost::posix_time::microseconds(mDrainTimeout);
+			for (unsigned i=0; i<lToBeKilled && mQueue.pushUnbounded(mPoisonItem, lDeadline); ++i) {
+				mBeingKilled++;
+			}
+			// ... and give them until the deadline to get there
+			std::list<boost::thread *>::iterator it = mThreads.begin();
+			while (it != mThreads.end() && (*it)->timed_join(lDeadline)) {
+				delete *it;
+				it = mThreads.erase(it);
+				mBeingKilled--;
+			}
+			if (mThreads.empty()) {
+				return;
+			}
+			// Too late: drop what is left, the pills of the threads still running included, and poison them again
+			collectKilled();
+			size_t lDropped = mQueue.clear(mPoisonItem);
+			if (lDropped) {
+				Log::warn(304, "Pool %u dropped %zu requests at shutdown!", pPid, lDropped);
+			}
+			mBeingKilled = 0;
+			lToBeKilled = mThreads.size();
+		}
+		// Poison all remaining threads ...
 		for (unsigned i=0; i<lToBeKilled; ++i) {
 			poisonThread();
 		}
 
-		// ... and collect them
-		while (mBeingKilled) {
-			collectKilled();
+		// ... and collect them, without spinning: each one exits once its current item is done
+		BOOST_FOREACH(boost::thread *lThread, mThreads) {
+			lThread->join();
+			delete lThread;
 		}
+		mThreads.clear();
+		mBeingKilled = 0;
+		mAliveThreads = 0;
 	}
 
 public:
@@ -178,9 +341,15 @@ public:
 									   mBeingKilled(0),
 									   mStatsInterval(10000000),
 									   mWorker(pWorker),
+									   mQueueBackend(LOCKED_DEQUE),
+									   mQueueMemory(0),
+									   mAdmissionPolicy(DROP_WHEN_FULL),
 									   mPoisonItem(pPoisonItem),
 									   mRunning(false),
-                                       mProgramName("ModDup") {
+                                       mProgramName("ModDup"),
+									   mDrainTimeout(0),
+									   mAliveThreads(0),
+									   mScaleRequested(0) {
 	}
 
 	/**
@@ -209,6 +378,35 @@ public:
 		mAdditionalStats[pStatName] = pStatProvider;
 	}
 
+	/**
+	 * @brief Set how the number of threads is decided
+	 * @param pPolicy the scaling policy. ADAPTIVE_SCALING requires a busy time provider.
+	 * @param pBusyTimeProvider the function returning the time the workers spent busy
+	 */
+	void
+	setScaling(eScalingPolicy pPolicy, tBusyTimeProvider pBusyTimeProvider = tBusyTimeProvider()) {
+		mScaler.setPolicy(pPolicy);
+		mBusyTimeProvider = pBusyTimeProvider;
+	}
+
+	/**
+	 * @brief Set the function receiving the counters of the pool after each check of its threads, that is every 100 ms at most
+	 * @param pCountersListener the function, which must not block
+	 */
+	void
+	setCountersListener(tCountersListener pCountersListener) {
+		mCountersListener = pCountersListener;
+	}
+
+	/**
+	 * @brief Set the time given to the workers to send the queued items when stopping
+	 * @param pDrainTimeout the time in micro sec, 0 to drop them straight away
+	 */
+	void
+	setDrainTimeout(const unsigned long long pDrainTimeout) {
+		mDrainTimeout = pDrainTimeout;
+	}
+
 	/**
 	 * @brief Set the program name to be used in the stats log message
 	 * @param pProgramName the name of the program
@@ -227,6 +425,7 @@ public:
 	setThreads(const size_t pMinThreads, const size_t pMaxThreads) {
 		mMinThreads = pMinThreads;
 		mMaxThreads = pMaxThreads;
+		mScaler.setThreads(pMinThreads, pMaxThreads);
 	}
 
 	/**
@@ -238,6 +437,27 @@ public:
 	setQueue(const size_t pMinQueued, const size_t pMaxQueued) {
 		mMinQueued = pMinQueued;
 		mMaxQueued = pMaxQueued;
+		mScaler.setQueue(pMinQueued, pMaxQueued);
+	}
+
+	/**
+	 * @brief Set the storage used by the queue once the pool is started
+	 * @param pQueueBackend the queue storage
+	 */
+	void
+	setQueueBackend(const eQueueBackend pQueueBackend) {
+		mQueueBackend = pQueueBackend;
+	}
+
+	/**
+	 * @brief Bound the bytes held by the queued items once the pool is started
+	 * @param pQueueMemory the maximum number of bytes, 0 means there's no maximum
+	 * @param pPolicy what to drop when the budget runs out
+	 */
+	void
+	setQueueMemory(const size_t pQueueMemory, const eAdmissionPolicy pPolicy) {
+		mQueueMemory = pQueueMemory;
+		mAdmissionPolicy = pPolicy;
 	}
 
 	/**
@@ -247,6 +467,8 @@ public:
 	start() {
 		mRunning = true;
 		mQueue.setDropSize(mMaxQueued * mMaxThreads);
+		mQueue.setMemoryBudget(mQueueMemory, mAdmissionPolicy);
+		mQueue.setBackend(mQueueBackend);
 
 		Log::debug("Started thread pool %p", this);
 		for (unsigned i=0; i<mMinThreads; ++i) {
@@ -262,6 +484,10 @@ public:
 	void
 	stop() {
 		mRunning = false;
+		{
+			boost::lock_guard<boost::mutex> lLock(mManageMutex);
+			mManageCondition.notify_one();
+		}
 		if (mManagerThread) {
 			mManagerThread->join();
 			delete mManagerThread;
@@ -276,6 +502,17 @@ public:
 	virtual void
 	push(const QueueT &pItem) {
 		mQueue.push(pItem);
+		requestScaling();
+	}
+
+	/**
+	 * @brief Queue an item without copying it
+	 * @param pItem the item to be queued, left empty
+	 */
+	virtual void
+	push(QueueT &&pItem) {
+		mQueue.push(std::move(pItem));
+		requestScaling();
 	}
 
 	/**
@@ -16,49 +16,222 @@
 * limitations under the License.
 */
 
-#include <httpd.h>
-#include <boost/algorithm/string/replace.hpp>
+#include <cstring>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "Log.hh"
 #include "UrlCodec.hh"
 
 namespace DupModule {
 
-class ApacheUrlCodec : public IUrlCodec
+/**
+ * @brief The bytes ap_escape_path_segment leaves as they are: the alphanumerics and $-_.+!*'(),:@&=~
+ */
+class PathSegmentTable
 {
+private:
+	bool mPlain[256];
+
 public:
-	/**
-	 * @brief Helper function to decode queries
-	 * @param pIn string to be decoded
-	 * @return decoded string
-	 */
-	const std::string
-	decode(const std::string &pIn) const {
-		char *lBuffer = new char[pIn.size()+1];
-		strncpy(lBuffer, pIn.c_str(), pIn.size()+1);
-		if (ap_unescape_url(lBuffer) == HTTP_BAD_REQUEST) {
-			Log::warn(302, "Bad escape values in request: %s", lBuffer);
+	PathSegmentTable() {
+		static const char lOthers[] = "$-_.+!*'(),:@&=~";
+		for (unsigned c = 0; c < 256; ++c) {
+			mPlain[c] = (c >= '0' && c <= '9') || (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') ||
+			            (c && memchr(lOthers, c, sizeof(lOthers) - 1));
 		}
-		std::string lOut(lBuffer);
-		delete[] lBuffer;
-
-		return lOut;
 	}
 
-	/**
-	 * @brief Helper function to encode queries
-	 * @param pIn string to be encoded
-	 * @return encoded string
-	 */
-	const std::string
-	encode(apr_pool_t *pPool, const std::string &pIn) const {
-		// ap_escape_path_segment returns a char * which is allocated in the apache pool
-		// No need to free it, as apache will destroy the whole pool
-		return std::string(ap_escape_path_segment(pPool, pIn.c_str()));
+	bool
+	isPlain(unsigned char pChar) const {
+		return mPlain[pChar];
 	}
 };
 
-class DefaultUrlCodec : public IUrlCodec
+static const PathSegmentTable gPathSegment;
+
+/**
+ * @brief Returns the value of an hexadecimal digit, -1 if it is not one
+ */
+static inline int
+hexValue(char pChar)
+{
+	if (pChar >= '0' && pChar <= '9') {
+		return pChar - '0';
+	}
+	pChar |= 0x20;
+	if (pChar >= 'a' && pChar <= 'f') {
+		return pChar - 'a' + 10;
+	}
+	return -1;
+}
+
+/**
+ * @brief Returns the first '%', NUL or, if PLUS_AS_SPACE, '+' character of a text, pEnd if there is none
+ */
+template <bool PLUS_AS_SPACE>
+static inline const char *
+findEscape(const char *pIn, const char *pEnd)
+{
+#ifdef __SSE2__
+	const __m128i lPercent = _mm_set1_epi8('%');
+	const __m128i lPlus = _mm_set1_epi8(PLUS_AS_SPACE ? '+' : '%');
+	const __m128i lZero = _mm_setzero_si128();
+	for (; pEnd - pIn >= 16; pIn += 16) {
+		__m128i lChunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pIn));
+		int lMask = _mm_movemask_epi8(_mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(lChunk, lPercent),
+		                                                        _mm_cmpeq_epi8(lChunk, lPlus)),
+		                                           _mm_cmpeq_epi8(lChunk, lZero)));
+		if (lMask) {
+			return pIn + __builtin_ctz(lMask);
+		}
+	}
+#endif
+	for (; pIn != pEnd; ++pIn) {
+		if (*pIn == '%' || *pIn == '\0' || (PLUS_AS_SPACE && *pIn == '+')) {
+			break;
+		}
+	}
+	return pIn;
+}
+
+/**
+ * @brief Returns true if a text has a bad escape before its first NUL character
+ */
+static bool
+hasBadEscape(const char *pIn, const char *pEnd)
+{
+	for (; pIn != pEnd && *pIn; ++pIn) {
+		if (*pIn == '%') {
+			if (pEnd - pIn < 3 || hexValue(pIn[1]) < 0 || hexValue(pIn[2]) < 0) {
+				return true;
+			}
+			pIn += 2;
+		}
+	}
+	return false;
+}
+
+template <bool PLUS_AS_SPACE>
+size_t
+unescapeUrl(const char *pIn, size_t pSize, char *pOut, bool &pBadEscape)
+{
+	const char *lEnd = pIn + pSize;
+	char *lOut = pOut;
+	pBadEscape = false;
+	while (pIn != lEnd) {
+		// Copy the run without escape at once
+		const char *lEscape = findEscape<PLUS_AS_SPACE>(pIn, lEnd);
+		memcpy(lOut, pIn, lEscape - pIn);
+		lOut += lEscape - pIn;
+		pIn = lEscape;
+		if (pIn == lEnd || *pIn == '\0') {
+			break;
+		}
+		if (*pIn == '+') {
+			*lOut++ = ' ';
+			++pIn;
+			continue;
+		}
+		int lHigh, lLow;
+		if (lEnd - pIn < 3 || (lHigh = hexValue(pIn[1])) < 0 || (lLow = hexValue(pIn[2])) < 0) {
+			// Kept as it is
+			pBadEscape = true;
+			*lOut++ = '%';
+			++pIn;
+			continue;
+		}
+		char lDecoded = static_cast<char>(lHigh * 16 + lLow);
+		if (lDecoded == '\0') {
+			// Ends the C string, the rest is only checked
+			pBadEscape |= hasBadEscape(pIn + 3, lEnd);
+			break;
+		}
+		*lOut++ = lDecoded;
+		pIn += 3;
+	}
+	return lOut - pOut;
+}
+
+#ifdef __SSE2__
+/**
+ * @brief Returns true if none of 16 bytes needs escaping, all being alphanumerics, '-', '_' or '.'
+ */
+static inline bool
+isPlainChunk(const char *pIn)
+{
+	__m128i lChunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pIn));
+	__m128i lDigit = _mm_and_si128(_mm_cmpgt_epi8(lChunk, _mm_set1_epi8('0' - 1)),
+	                               _mm_cmplt_epi8(lChunk, _mm_set1_epi8('9' + 1)));
+	// The upper case letters folded on the lower case ones, the bytes over 0x7f being negative
+	__m128i lFolded = _mm_or_si128(lChunk, _mm_set1_epi8(0x20));
+	__m128i lLetter = _mm_and_si128(_mm_cmpgt_epi8(lFolded, _mm_set1_epi8('a' - 1)),
+	                                _mm_cmplt_epi8(lFolded, _mm_set1_epi8('z' + 1)));
+	__m128i lOther = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(lChunk, _mm_set1_epi8('-')),
+	                                           _mm_cmpeq_epi8(lChunk, _mm_set1_epi8('_'))),
+	                              _mm_cmpeq_epi8(lChunk, _mm_set1_epi8('.')));
+	return _mm_movemask_epi8(_mm_or_si128(_mm_or_si128(lDigit, lLetter), lOther)) == 0xffff;
+}
+#endif
+
+template <bool ESCAPE_PLUS>
+size_t
+escapeUrl(const char *pIn, size_t pSize, char *pOut)
+{
+	static const char lHex[] = "0123456789abcdef";
+	const char *lEnd = pIn + pSize;
+	char *lOut = pOut;
+	while (pIn != lEnd) {
+#ifdef __SSE2__
+		// Copy the runs of the most common plain bytes 16 at a time
+		if (lEnd - pIn >= 16 && isPlainChunk(pIn)) {
+			memcpy(lOut, pIn, 16);
+			lOut += 16;
+			pIn += 16;
+			continue;
+		}
+#endif
+		unsigned char c = *pIn++;
+		if (!c) {
+			break;
+		}
+		if (gPathSegment.isPlain(c) && !(ESCAPE_PLUS && c == '+')) {
+			*lOut++ = c;
+		} else {
+			*lOut++ = '%';
+			*lOut++ = lHex[c >> 4];
+			*lOut++ = lHex[c & 0xf];
+		}
+	}
+	return lOut - pOut;
+}
+
+template size_t unescapeUrl<false>(const char *, size_t, char *, bool &);
+template size_t unescapeUrl<true>(const char *, size_t, char *, bool &);
+template size_t escapeUrl<false>(const char *, size_t, char *);
+template size_t escapeUrl<true>(const char *, size_t, char *);
+
+template <eUrlCodec STYLE>
+size_t
+tUrlCodec<STYLE>::decode(const char *pIn, size_t pSize, char *pOut)
+{
+	bool lBadEscape;
+	size_t lSize = unescapeUrl<STYLE == DEFAULT_URL_CODEC>(pIn, pSize, pOut, lBadEscape);
+	if (lBadEscape) {
+		Log::warn(302, "Bad escape values in request: %s", std::string(pOut, lSize).c_str());
+	}
+	return lSize;
+}
+
+template struct tUrlCodec<DEFAULT_URL_CODEC>;
+template struct tUrlCodec<APACHE_URL_CODEC>;
+
+/**
+ * @brief The interface of a codec style, for the callers which choose it at run time
+ */
+template <class Codec>
+class UrlCodec : public IUrlCodec
 {
 public:
 	/**
@@ -68,39 +241,48 @@ public:
 	 */
 	const std::string
 	decode(const std::string &pIn) const {
-		std::string preDecoded = boost::replace_all_copy(pIn, "+", " ");
-		char *lBuffer = new char[preDecoded.size()+1];
-		strncpy(lBuffer, preDecoded.c_str(), preDecoded.size()+1);
-		if (ap_unescape_url(lBuffer) == HTTP_BAD_REQUEST) {
-			Log::warn(302, "Bad escape values in request: %s", lBuffer);
-		}
-		std::string lOut(lBuffer);
-		delete[] lBuffer;
-
+		std::string lOut(pIn.size(), '\0');
+		lOut.resize(Codec::decode(pIn.data(), pIn.size(), &lOut[0]));
 		return lOut;
 	}
 
 	/**
 	 * @brief Helper function to encode queries
+	 * @param pPool not used any more
 	 * @param pIn string to be encoded
 	 * @return encoded string
 	 */
 	const std::string
 	encode(apr_pool_t *pPool, const std::string &pIn) const {
-		// ap_escape_path_segment returns a char * which is allocated in the apache pool
-		// No need to free it, as apache will destroy the whole pool
-		std::string encoded(ap_escape_path_segment(pPool, pIn.c_str()));
-		return boost::replace_all_copy(encoded, "+", "%2b");
+		std::string lOut(3 * pIn.size(), '\0');
+		lOut.resize(Codec::encode(pIn.data(), pIn.size(), &lOut[0]));
+		return lOut;
+	}
+
+	size_t
+	decode(const char *pIn, size_t pSize, char *pOut) const {
+		return Codec::decode(pIn, pSize, pOut);
+	}
+
+	size_t
+	encode(const char *pIn, size_t pSize, char *pOut) const {
+		return Codec::encode(pIn, pSize, pOut);
 	}
 };
 
+eUrlCodec
+getUrlCodecStyle(const std::string &pUrlCodec)
+{
+	return pUrlCodec == "apache" ? APACHE_URL_CODEC : DEFAULT_URL_CODEC;
+}
+
 const IUrlCodec *
 getUrlCodec(const std::string pUrlCodec)
 {
-	if (pUrlCodec == "apache") {
-		return new ApacheUrlCodec();
+	if (getUrlCodecStyle(pUrlCodec) == APACHE_URL_CODEC) {
+		return new UrlCodec<ApacheUrlCodec>();
 	} else {
-		return new DefaultUrlCodec();
+		return new UrlCodec<DefaultUrlCodec>();
 	}
 }
 
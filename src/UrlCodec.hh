@@ -18,6 +18,7 @@
 
 #pragma once
 
+#include <cstddef>
 #include <string>
 #include <apr_pools.h>
 
@@ -27,11 +28,99 @@ namespace DupModule {
 class IUrlCodec
 {
 public:
+	virtual ~IUrlCodec() {}
+
 	virtual const std::string decode(const std::string &pIn) const = 0;
 	virtual const std::string encode(apr_pool_t *pPool, const std::string &pIn) const = 0;
+
+	/**
+	 * @brief Decode into a buffer of the caller
+	 * @param pIn the text to decode
+	 * @param pSize its size
+	 * @param pOut the buffer, of pSize bytes at least
+	 * @return the size of the decoded text
+	 */
+	virtual size_t decode(const char *pIn, size_t pSize, char *pOut) const = 0;
+
+	/**
+	 * @brief Encode into a buffer of the caller
+	 * @param pIn the text to encode
+	 * @param pSize its size
+	 * @param pOut the buffer, of 3 * pSize bytes at least
+	 * @return the size of the encoded text
+	 */
+	virtual size_t encode(const char *pIn, size_t pSize, char *pOut) const = 0;
 };
 
+/**
+ * @brief The url enc/decoding styles
+ */
+enum eUrlCodec {
+	/** Like apache, but '+' is a space as in forms, and is escaped */
+	DEFAULT_URL_CODEC,
+	/** ap_unescape_url and ap_escape_path_segment */
+	APACHE_URL_CODEC,
+};
+
+/**
+ * @brief Returns the style of a name: apache, anything else being the default one
+ */
+eUrlCodec
+getUrlCodecStyle(const std::string &pUrlCodec);
+
 const IUrlCodec *
 getUrlCodec(const std::string pUrlCodec="default");
 
+/**
+ * @brief Decode a text in a single pass, byte for byte like ap_unescape_url on a C string:
+ * a bad escape is kept as it is, and the text ends at the first NUL character, decoded or not.
+ * Instantiated for both values of PLUS_AS_SPACE, whether '+' is decoded as a space, as in forms.
+ * @param pIn the text to decode
+ * @param pSize its size
+ * @param pOut the buffer, of pSize bytes at least
+ * @param pBadEscape set to true if the text has a bad escape
+ * @return the size of the decoded text
+ */
+template <bool PLUS_AS_SPACE>
+size_t
+unescapeUrl(const char *pIn, size_t pSize, char *pOut, bool &pBadEscape);
+
+/**
+ * @brief Encode a text in a single pass, byte for byte like ap_escape_path_segment on a C string:
+ * the text ends at the first NUL character.
+ * Instantiated for both values of ESCAPE_PLUS, whether '+' is escaped too, so that it is not decoded as a space.
+ * @param pIn the text to encode
+ * @param pSize its size
+ * @param pOut the buffer, of 3 * pSize bytes at least
+ * @return the size of the encoded text
+ */
+template <bool ESCAPE_PLUS>
+size_t
+escapeUrl(const char *pIn, size_t pSize, char *pOut);
+
+/**
+ * @brief A url enc/decoding style known at compile time, for the processing to be instantiated on without virtual calls
+ */
+template <eUrlCodec STYLE>
+struct tUrlCodec {
+	/**
+	 * @brief Decode into a buffer of pSize bytes at least, logging the bad escapes
+	 * @return the size of the decoded text
+	 */
+	static size_t
+	decode(const char *pIn, size_t pSize, char *pOut);
+
+	/**
+	 * @brief Encode into a buffer of 3 * pSize bytes at least
+	 * @return the size of the encoded text
+	 */
+	static size_t
+	encode(const char *pIn, size_t pSize, char *pOut) {
+		return escapeUrl<STYLE == DEFAULT_URL_CODEC>(pIn, pSize, pOut);
+	}
+};
+
+typedef tUrlCodec<DEFAULT_URL_CODEC> DefaultUrlCodec;
+typedef tUrlCodec<APACHE_URL_CODEC> ApacheUrlCodec;
+
 }
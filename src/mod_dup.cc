@@ -23,12 +23,20 @@
 #include <http_connection.h>
 #include <apr_pools.h>
 #include <apr_hooks.h>
+#include <apr_thread_proc.h>
+#include <ap_mpm.h>
 #include "apr_strings.h"
 #include <unistd.h>
 #include <curl/curl.h>
 #include <boost/lexical_cast.hpp>
 #include <boost/algorithm/string.hpp>
+#include <math.h>
+#include <algorithm>
+#include <new>
 #include <set>
+#include <signal.h>
+#include <stdint.h>
+#include <unixd.h>
 
 #include "mod_dup.hh"
 
@@ -44,13 +52,92 @@ const char *gName = "Dup";
 
 RequestProcessor *gProcessor;
 ThreadPool<RequestInfo> *gThreadPool;
+/** @brief The ring to the dispatcher processes, NULL if each process sends its requests itself */
+ShmRing *gShmRing;
+/** @brief The size in bytes of the ring to the dispatcher processes, 0 if there are none */
+size_t gDispatcherRingSize;
+/** @brief The number of dispatcher processes */
+unsigned gDispatcherCount = 1;
+/** @brief The limits of the rate of duplication */
+RateLimiter *gRateLimiter;
+/** @brief The counters of all the processes, NULL before the configuration is loaded */
+Scoreboard *gScoreboard;
+/** @brief The pool of the configuration the dispatcher processes run with, which they are restarted in */
+static apr_pool_t *gDispatcherPool;
+/** @brief Set by SIGTERM in a dispatcher process */
+static volatile sig_atomic_t gDispatcherStop;
 
 struct BodyHandler {
-    BodyHandler() : body(), sent(0) {}
+    BodyHandler() : body(), sent(0), pending(0), filtered(0) {}
     std::string body;
     int sent;
+    /** @brief 1 if the sampling needs the body, the rate limits then being checked after it */
+    int pending;
+    /** @brief 1 if the arguments alone matched the filters of the location */
+    int filtered;
 };
 
+/**
+ * @brief Pool cleanup releasing the body kept for the log_transaction hook
+ */
+static apr_status_t
+deleteBodyHandler(void *pBH) {
+    delete static_cast<BodyHandler *>(pBH);
+    return APR_SUCCESS;
+}
+
+/** @brief Marks the requests the input filter rejected for the log_transaction hook */
+static BodyHandler gRejected;
+
+/** @brief The body of the requests whose body is not read */
+static const std::string gNoBody;
+
+/** @brief The most a body is sized from its Content-Length before any of it is read, larger ones grow as they arrive */
+static const apr_off_t gMaxBodyReserve = 1024 * 1024;
+
+/**
+ * @brief Decide whether a request is duplicated, from the sample of its location and the rate limits, and count the sampling
+ * @param pConf the configuration of the location
+ * @param pRequest the request
+ * @param pBody the body, NULL if not read yet
+ * @return SAMPLE_IN if the request is duplicated, SAMPLE_LATER if the sampling needs the body, SAMPLE_OUT otherwise
+ */
+static eSampling
+admit(const DupConf &pConf, request_rec *pRequest, const std::string *pBody) {
+    eSampling lSampling = sample(pConf.sampleRate, pConf.sampleField, pRequest->args, pRequest->uri, pBody);
+    if (lSampling == SAMPLE_LATER) {
+        return lSampling;
+    }
+    if (pConf.sampleRate < SAMPLE_ALL && gScoreboard) {
+        gScoreboard->add(lSampling == SAMPLE_IN ? SB_SAMPLE_IN : SB_SAMPLE_OUT, 1);
+    }
+    if (lSampling == SAMPLE_OUT) {
+        Log::debug("Request not sampled, uri:%s", pRequest->uri);
+        return SAMPLE_OUT;
+    }
+    if (!gRateLimiter->allow(pConf.dirName)) {
+        Log::debug("Request over the rate limit, uri:%s", pRequest->uri);
+        return SAMPLE_OUT;
+    }
+    return SAMPLE_IN;
+}
+
+void
+pushRequest(RequestInfo &&pRequest) {
+    if (gShmRing) {
+        // Copied once, straight into the shared memory
+        tSerializedHeader lHeader;
+        struct iovec lParts[SERIALIZED_PARTS];
+        pRequest.serialize(lHeader, lParts);
+        // Counted by the Apache process, which runs whether the dispatchers do or not
+        if (!gShmRing->push(lParts, SERIALIZED_PARTS) && gScoreboard) {
+            gScoreboard->add(SB_SHM_DROP, 1);
+        }
+        return;
+    }
+    gThreadPool->push(std::move(pRequest));
+}
+
 #define GET_CONF_FROM_REQUEST(request) reinterpret_cast<DupConf **>(ap_get_module_config(request->per_dir_config, &dup_module))
 apr_status_t
 analyseRequest(ap_filter_t *pF, apr_bucket_brigade *pB ) {
@@ -62,7 +149,53 @@ analyseRequest(ap_filter_t *pF, apr_bucket_brigade *pB ) {
 	}
         // Do we have a context?
         if (!pF->ctx) {
-            pF->ctx = new BodyHandler();
+            // Without payload, duplicateWithoutBody takes care of the request
+            if (!(*tConf)->payload) {
+                pF->ctx = (void *)1;
+                return OK;
+            }
+            // Requests which can never match the filters of the location are neither buffered nor queued
+            eHeaderMatch lHeaderMatch = gProcessor->headerMayMatch((*tConf)->dirName, pRequest->args ? pRequest->args : "");
+            if (lHeaderMatch == HEADER_NO_MATCH) {
+                Log::debug("Request rejected from its header, uri:%s", pRequest->uri);
+                if ((*tConf)->capture == CAPTURE_TRANSACTION) {
+                    ap_set_module_config(pRequest->request_config, &dup_module, &gRejected);
+                }
+                pF->ctx = (void *)1;
+                return OK;
+            }
+            // Out of the sample or over the rate limit: neither buffered nor queued
+            eSampling lAdmission = admit(**tConf, pRequest, NULL);
+            if (lAdmission == SAMPLE_OUT) {
+                if ((*tConf)->capture == CAPTURE_TRANSACTION) {
+                    ap_set_module_config(pRequest->request_config, &dup_module, &gRejected);
+                }
+                pF->ctx = (void *)1;
+                return OK;
+            }
+            BodyHandler *pBH = new BodyHandler();
+            pBH->pending = lAdmission == SAMPLE_LATER;
+            pBH->filtered = lHeaderMatch == HEADER_MATCH;
+            // Size the body once, so that it is written exactly once. Content-Length is only trusted up to
+            // gMaxBodyReserve: a client claiming a huge body must not make the child allocate it upfront
+            const char *lContentLength = apr_table_get(pRequest->headers_in, "Content-Length");
+            if (lContentLength) {
+                apr_off_t lLength;
+                char *lEnd;
+                if (apr_strtoff(&lLength, lContentLength, &lEnd, 10) == APR_SUCCESS && !*lEnd && lLength > 0) {
+                    try {
+                        pBH->body.reserve(std::min(lLength, gMaxBodyReserve));
+                    } catch (const std::bad_alloc &) {
+                        // The body grows as it is read instead
+                    }
+                }
+            }
+            pF->ctx = pBH;
+            if ((*tConf)->capture == CAPTURE_TRANSACTION) {
+                // Kept until the log_transaction hook, released with the request
+                ap_set_module_config(pRequest->request_config, &dup_module, pBH);
+                apr_pool_cleanup_register(pRequest->pool, pBH, deleteBodyHandler, apr_pool_cleanup_null);
+            }
         } else if (pF->ctx == (void *)1) {
             return OK;
         }
@@ -76,10 +209,23 @@ analyseRequest(ap_filter_t *pF, apr_bucket_brigade *pB ) {
             if ( APR_BUCKET_IS_EOS(b) ) {
 #endif
                 pBH->sent = 1;
+                if ((*tConf)->capture == CAPTURE_TRANSACTION) {
+                    // The body is complete, duplicateAfterTransaction pushes it
+                    pF->ctx = (void *)1;
+                    break;
+                }
+                if (pBH->pending && admit(**tConf, pRequest, &pBH->body) != SAMPLE_IN) {
+                    delete pBH;
+                    pF->ctx = (void *)1;
+                    break;
+                }
 
                 Log::debug("Pushing a request, body size:%s", boost::lexical_cast<std::string>(pBH->body.size()).c_str());
                 Log::debug("Uri:%s, dir name:%s", pRequest->uri, (*tConf)->dirName);
-                gThreadPool->push(RequestInfo((*tConf)->dirName, pRequest->uri, pRequest->args ? pRequest->args : "", &pBH->body));
+                // Hand the body over to the worker threads, no copy
+                RequestInfo lInfo((*tConf)->dirName, pRequest->uri, pRequest->args ? pRequest->args : "", std::move(pBH->body));
+                lInfo.mFiltered = pBH->filtered;
+                pushRequest(std::move(lInfo));
                 delete pBH;
                 pF->ctx = (void *)1;
                 break;
@@ -92,12 +238,87 @@ analyseRequest(ap_filter_t *pF, apr_bucket_brigade *pB ) {
             if ((lStatus != APR_SUCCESS) || (lReqPart == NULL)) {
                 continue;
             }
-            pBH->body += std::string(lReqPart, lLength);
+            pBH->body.append(lReqPart, lLength);
         }
     }
     return OK;
 }
 
+/**
+ * @brief fixups hook duplicating the requests of the locations without payload, without reading their body
+ * @param pRequest the request
+ * @return Always DECLINED, so that the request goes on
+ */
+int
+duplicateWithoutBody(request_rec *pRequest) {
+    // Only duplicate the main request
+    if (pRequest->main) {
+        return DECLINED;
+    }
+    struct DupConf **tConf = GET_CONF_FROM_REQUEST(pRequest);
+    if (!tConf || !*tConf || (*tConf)->payload || (*tConf)->capture != CAPTURE_FILTER) {
+        return DECLINED;
+    }
+    const char *lArgs = pRequest->args ? pRequest->args : "";
+    eHeaderMatch lHeaderMatch = gProcessor->headerMayMatch((*tConf)->dirName, lArgs);
+    if (lHeaderMatch != HEADER_NO_MATCH && admit(**tConf, pRequest, &gNoBody) == SAMPLE_IN) {
+        Log::debug("Pushing a request without body, uri:%s, dir name:%s", pRequest->uri, (*tConf)->dirName);
+        RequestInfo lInfo((*tConf)->dirName, pRequest->uri, lArgs);
+        lInfo.mFiltered = lHeaderMatch == HEADER_MATCH;
+        pushRequest(std::move(lInfo));
+    }
+    return DECLINED;
+}
+
+/**
+ * @brief log_transaction hook duplicating the requests of the locations capturing once the response is sent
+ * @param pRequest the request
+ * @return Always DECLINED
+ */
+int
+duplicateAfterTransaction(request_rec *pRequest) {
+    // Only duplicate the main request
+    if (pRequest->main) {
+        return DECLINED;
+    }
+    struct DupConf **tConf = GET_CONF_FROM_REQUEST(pRequest);
+    if (!tConf || !*tConf || (*tConf)->capture != CAPTURE_TRANSACTION) {
+        return DECLINED;
+    }
+    const char *lArgs = pRequest->args ? pRequest->args : "";
+    // The body, if the input filter saw all of it
+    BodyHandler *lBH = NULL;
+    if ((*tConf)->payload && pRequest->request_config) {
+        lBH = static_cast<BodyHandler *>(ap_get_module_config(pRequest->request_config, &dup_module));
+    }
+    // The input filter decides for the requests it saw, unless it needed their body
+    if (lBH == &gRejected) {
+        return DECLINED;
+    }
+    bool lFiltered;
+    if (lBH) {
+        lFiltered = lBH->filtered;
+    } else {
+        eHeaderMatch lHeaderMatch = gProcessor->headerMayMatch((*tConf)->dirName, lArgs);
+        if (lHeaderMatch == HEADER_NO_MATCH) {
+            return DECLINED;
+        }
+        lFiltered = lHeaderMatch == HEADER_MATCH;
+    }
+    if ((!lBH || lBH->pending) && admit(**tConf, pRequest, lBH && lBH->sent ? &lBH->body : &gNoBody) != SAMPLE_IN) {
+        return DECLINED;
+    }
+    RequestInfo lInfo((*tConf)->dirName, pRequest->uri, lArgs, lBH && lBH->sent ? std::move(lBH->body) : std::string());
+    if ((*tConf)->forwardStatus) {
+        lInfo.mStatus = pRequest->status;
+        lInfo.mDuration = apr_time_now() - pRequest->request_time;
+    }
+    lInfo.mFiltered = lFiltered;
+    Log::debug("Pushing a request after its transaction, uri:%s, dir name:%s", pRequest->uri, (*tConf)->dirName);
+    pushRequest(std::move(lInfo));
+    return DECLINED;
+}
+
 /// @brief the output filter callback
 ///        Whenever a pns response is send to client, the filter looks at the
 ///        state of the context to transform the ISE to the good one
@@ -137,12 +358,19 @@ createDirConfig(apr_pool_t *pPool, char *pDirName)
 int
 preConfig(apr_pool_t * pPool, apr_pool_t * pLog, apr_pool_t * pTemp) {
     gProcessor = new RequestProcessor();
+    gRateLimiter = new RateLimiter();
     gThreadPool = new ThreadPool<RequestInfo>(boost::bind(&RequestProcessor::run, gProcessor, _1), POISON_REQUEST);
     // Add the request timeout stat provider. Compose the lexical_cast with getTimeoutCount so that the resulting stat provider returns a string
     gThreadPool->addStat("#TmOut", boost::bind(boost::lexical_cast<std::string, unsigned int>,
                                                boost::bind(&RequestProcessor::getTimeoutCount, gProcessor)));
     gThreadPool->addStat("#DupReq", boost::bind(boost::lexical_cast<std::string, unsigned int>,
                                                 boost::bind(&RequestProcessor::getDuplicatedCount, gProcessor)));
+    gThreadPool->addStat("#Resp", boost::bind(&RequestProcessor::getResponseStats, gProcessor));
+    gThreadPool->addStat("#Prefilter", boost::bind(&RequestProcessor::getPrefilterStats, gProcessor));
+    gThreadPool->addStat("#Budget", boost::bind(&RequestProcessor::getBudgetStats, gProcessor));
+    // The rate limits are applied before the filters: the requests they reject give their tokens back
+    gProcessor->setRejectionListener(boost::bind(static_cast<void (RateLimiter::*)(const std::string &)>(&RateLimiter::giveBack),
+                                                 gRateLimiter, _1));
     return OK;
 }
 
@@ -157,6 +385,260 @@ postConfig(apr_pool_t * pPool, apr_pool_t * pLog, apr_pool_t * pTemp, server_rec
 	Log::init();
 
     ap_add_version_component(pPool, "Dup/1.0") ;
+    int lStatus = createScoreboard(pPool);
+    if (lStatus == OK && gRateLimiter->create(pPool) != APR_SUCCESS) {
+        Log::error(406, "Could not create the shared memory of the rate limits.");
+        lStatus = HTTP_INTERNAL_SERVER_ERROR;
+    }
+    if (lStatus == OK && gDispatcherRingSize) {
+        return startDispatchers(pPool, pServer);
+    }
+    return lStatus;
+}
+
+static apr_status_t
+deleteScoreboard(void *) {
+    delete gScoreboard;
+    gScoreboard = NULL;
+    return APR_SUCCESS;
+}
+
+int
+createScoreboard(apr_pool_t *pPool) {
+    // A slot for each process Apache can run at once, and one for each dispatcher
+    int lProcesses = 0;
+    if (ap_mpm_query(AP_MPMQ_HARD_LIMIT_DAEMONS, &lProcesses) != APR_SUCCESS || lProcesses <= 0) {
+        lProcesses = 256;
+    }
+    gScoreboard = new Scoreboard();
+    apr_pool_cleanup_register(pPool, NULL, deleteScoreboard, apr_pool_cleanup_null);
+    if (gScoreboard->create(pPool, lProcesses + gDispatcherCount) != APR_SUCCESS) {
+        Log::error(405, "Could not create the shared memory scoreboard.");
+        return HTTP_INTERNAL_SERVER_ERROR;
+    }
+    return OK;
+}
+
+/**
+ * @brief Counters listener of the thread pool, copying them into the slot of the process
+ */
+static void
+publishCounters(const tPoolCounters &pCounters) {
+    gScoreboard->add(SB_IN, pCounters.mIn);
+    gScoreboard->add(SB_OUT, pCounters.mOut);
+    gScoreboard->add(SB_DROP, pCounters.mDrop);
+    gScoreboard->add(SB_DROPPED_BYTES, pCounters.mDroppedBytes);
+    gScoreboard->set(SB_QUEUED, pCounters.mQueued);
+    gScoreboard->set(SB_QUEUED_BYTES, pCounters.mQueuedBytes);
+    gScoreboard->set(SB_THREADS, pCounters.mThreads);
+    gScoreboard->addTotal(SB_TIMEOUT, gProcessor->getTimeoutTotal());
+    gScoreboard->addTotal(SB_DUPLICATED, gProcessor->getDuplicatedTotal());
+}
+
+/**
+ * @brief Attach the process to the scoreboard, and publish the counters of its thread pool there
+ */
+static void
+attachScoreboard(bool pRunsPool) {
+    if (!gScoreboard) {
+        return;
+    }
+    if (!gScoreboard->attach()) {
+        Log::warn(305, "No free slot in the scoreboard, the counters of process %u are not shared.", getpid());
+        return;
+    }
+    if (pRunsPool) {
+        gThreadPool->setCountersListener(publishCounters);
+    }
+}
+
+static apr_status_t
+detachScoreboard(void *) {
+    if (gScoreboard) {
+        gScoreboard->detach();
+    }
+    return APR_SUCCESS;
+}
+
+int
+statusHandler(request_rec *pRequest) {
+    if (!pRequest->handler || strcmp(pRequest->handler, "dup-status")) {
+        return DECLINED;
+    }
+    if (!gScoreboard) {
+        return HTTP_NOT_FOUND;
+    }
+    bool lAuto = pRequest->args && !strcmp(pRequest->args, "auto");
+    ap_set_content_type(pRequest, "text/plain; charset=ISO-8859-1");
+    if (pRequest->header_only) {
+        return OK;
+    }
+
+    unsigned long long lTotals[SB_VALUE_COUNT];
+    unsigned lProcesses = gScoreboard->aggregate(lTotals);
+    if (lAuto) {
+        // One "Name: value" line per total, as mod_status does
+        ap_rprintf(pRequest, "Processes: %u\n", lProcesses);
+        for (unsigned i = 0; i < SB_VALUE_COUNT; ++i) {
+            ap_rprintf(pRequest, "%s: %llu\n", Scoreboard::getName(static_cast<eScoreboardValue>(i)), lTotals[i]);
+        }
+        ap_rprintf(pRequest, "RateLimited: %llu\n", gRateLimiter->getRejectedCount());
+        return OK;
+    }
+
+    ap_rprintf(pRequest, "mod_dup status: %u processes\n\n%10s", lProcesses, "Pid");
+    for (unsigned i = 0; i < SB_VALUE_COUNT; ++i) {
+        ap_rprintf(pRequest, " %12s", Scoreboard::getName(static_cast<eScoreboardValue>(i)));
+    }
+    unsigned long long lValues[SB_VALUE_COUNT];
+    for (size_t s = 0; s < gScoreboard->getSlotCount(); ++s) {
+        pid_t lPid = gScoreboard->read(s, lValues);
+        if (!lPid) {
+            continue;
+        }
+        ap_rprintf(pRequest, "\n%10u", static_cast<unsigned>(lPid));
+        for (unsigned i = 0; i < SB_VALUE_COUNT; ++i) {
+            ap_rprintf(pRequest, " %12llu", lValues[i]);
+        }
+    }
+    // The totals include the processes which exited
+    ap_rprintf(pRequest, "\n%10s", "Total");
+    for (unsigned i = 0; i < SB_VALUE_COUNT; ++i) {
+        ap_rprintf(pRequest, " %12llu", lTotals[i]);
+    }
+    ap_rprintf(pRequest, "\n\nRejected by the rate limits: %llu\n", gRateLimiter->getRejectedCount());
+    return OK;
+}
+
+static void
+stopDispatcher(int) {
+    gDispatcherStop = 1;
+}
+
+static apr_status_t
+deleteShmRing(void *) {
+    delete gShmRing;
+    gShmRing = NULL;
+    return APR_SUCCESS;
+}
+
+/**
+ * @brief Main loop of a dispatcher process: feeds its thread pool with the requests the children write into the ring
+ */
+static void
+runDispatcher() {
+    // Do not run the handlers of the Apache parent process
+    signal(SIGTERM, stopDispatcher);
+    signal(SIGHUP, SIG_IGN);
+    signal(SIGUSR1, SIG_IGN);
+    signal(SIGWINCH, SIG_IGN);
+#if AP_MODULE_MAGIC_AT_LEAST(20081201, 0)
+    ap_unixd_setup_child();
+#else
+    unixd_setup_child();
+#endif
+    curl_global_init(CURL_GLOBAL_ALL);
+    attachScoreboard(true);
+    gThreadPool->addStat("#ShmDrop", boost::bind(boost::lexical_cast<std::string, unsigned int>,
+                                                 boost::bind(&ShmRing::getDropCount, gShmRing)));
+    gThreadPool->start();
+
+    pid_t lParent = getppid();
+    std::string lRecord;
+    while (!gDispatcherStop && getppid() == lParent) {
+        // Woken up by the producers, checking for the stop every 100 ms
+        if (!gShmRing->pop(lRecord, 100)) {
+            continue;
+        }
+        RequestInfo lInfo;
+        if (lInfo.deserialize(lRecord.data(), lRecord.size())) {
+            gThreadPool->push(std::move(lInfo));
+        }
+    }
+    gThreadPool->stop();
+    detachScoreboard(NULL);
+    exit(0);
+}
+
+static bool
+forkDispatcher(apr_pool_t *pPool, apr_proc_t *pProc);
+
+/**
+ * @brief Maintenance callback of a dispatcher process, called by the MPM of the Apache parent process: restarts it when it dies
+ * @param pReason the reason of the call, an APR_OC_REASON_* value
+ * @param pData the apr_proc_t of the dispatcher
+ */
+static void
+maintainDispatcher(int pReason, void *pData, apr_wait_t) {
+    apr_proc_t *lProc = static_cast<apr_proc_t *>(pData);
+    switch (pReason) {
+    case APR_OC_REASON_DEATH:
+    case APR_OC_REASON_LOST: {
+        apr_proc_other_child_unregister(pData);
+        // Unless Apache is stopping
+        int lState = AP_MPMQ_STOPPING;
+        if (ap_mpm_query(AP_MPMQ_MPM_STATE, &lState) == APR_SUCCESS && lState != AP_MPMQ_STOPPING) {
+            Log::warn(307, "Dispatcher process %u died, restarting it.", static_cast<unsigned>(lProc->pid));
+            if (!forkDispatcher(gDispatcherPool, lProc)) {
+                Log::error(404, "Could not fork a dispatcher process.");
+            }
+        }
+        break;
+    }
+    case APR_OC_REASON_RESTART:
+        // Stopped by the cleanup of the configuration pool, then started with the new configuration
+        apr_proc_other_child_unregister(pData);
+        break;
+    }
+}
+
+/**
+ * @brief Fork a dispatcher process, and have the Apache parent process restart it whenever it dies
+ * @param pPool the pool of the configuration
+ * @param pProc the process, reused by the restarts so that the pool stops the last one
+ * @return false if the fork failed
+ */
+static bool
+forkDispatcher(apr_pool_t *pPool, apr_proc_t *pProc) {
+    apr_status_t lStatus = apr_proc_fork(pProc, pPool);
+    if (lStatus == APR_INCHILD) {
+        runDispatcher();
+    } else if (lStatus != APR_INPARENT) {
+        return false;
+    }
+#if APR_HAS_OTHER_CHILD
+    apr_proc_other_child_register(pProc, maintainDispatcher, pProc, NULL, pPool);
+#endif
+    return true;
+}
+
+int
+startDispatchers(apr_pool_t *pPool, server_rec *pServer) {
+    // The configuration is loaded twice at startup, only start with the second one
+    const char *lKey = "mod_dup_dispatchers";
+    void *lData = NULL;
+    apr_pool_userdata_get(&lData, lKey, pServer->process->pool);
+    if (!lData) {
+        apr_pool_userdata_set((const void *)1, lKey, apr_pool_cleanup_null, pServer->process->pool);
+        return OK;
+    }
+
+    gShmRing = new ShmRing();
+    apr_pool_cleanup_register(pPool, NULL, deleteShmRing, apr_pool_cleanup_null);
+    if (gShmRing->create(pPool, gDispatcherRingSize) != APR_SUCCESS) {
+        Log::error(404, "Could not create the shared memory ring to the dispatchers.");
+        return HTTP_INTERNAL_SERVER_ERROR;
+    }
+    gDispatcherPool = pPool;
+    for (unsigned i = 0; i < gDispatcherCount; ++i) {
+        apr_proc_t *lProc = static_cast<apr_proc_t *>(apr_pcalloc(pPool, sizeof(apr_proc_t)));
+        if (!forkDispatcher(pPool, lProc)) {
+            Log::error(404, "Could not fork a dispatcher process.");
+            return HTTP_INTERNAL_SERVER_ERROR;
+        }
+        // Stopped with the configuration it was started for
+        apr_pool_note_subprocess(pPool, lProc, APR_KILL_AFTER_TIMEOUT);
+    }
     return OK;
 }
 
@@ -193,7 +675,7 @@ setName(cmd_parms* pParams, void* pCfg, const char* pName) {
 }
 
 /**
- * @brief Set the url enc/decoding style
+ * @brief Set the url enc/decoding style of the location or, outside of any, of the locations without their own
  * @param pParams miscellaneous data
  * @param pCfg user data for the directory/location
  * @param pUrlCodec the url enc/decoding style to use
@@ -204,18 +686,82 @@ setUrlCodec(cmd_parms* pParams, void* pCfg, const char* pUrlCodec) {
 	if (!pUrlCodec || strlen(pUrlCodec) == 0) {
 		return "Missing url codec style";
 	}
-	gProcessor->setUrlCodec(pUrlCodec);
+	if (pParams->path) {
+		gProcessor->setUrlCodec(pParams->path, pUrlCodec);
+	} else {
+		gProcessor->setUrlCodec(pUrlCodec);
+	}
 	return NULL;
 }
 
+/**
+ * @brief Set the regex engine the filters and substitutions of all the locations are compiled with
+ * @param pParams miscellaneous data
+ * @param pCfg user data for the directory/location
+ * @param pEngine boost, pcre2 or re2
+ * @return NULL if the engine is available and supports all the expressions, otherwise a string describing the error
+ */
+const char*
+setRegexEngine(cmd_parms* pParams, void* pCfg, const char* pEngine) {
+	eRegexEngine lEngine;
+	if (!getRegexEngine(pEngine, lEngine)) {
+		return "Invalid regex engine (boost, pcre2, re2).";
+	}
+	if (!isRegexEngineAvailable(lEngine)) {
+		return apr_pstrcat(pParams->pool, "mod_dup was built without the ", pEngine, " regex engine.", NULL);
+	}
+	try {
+		gProcessor->setRegexEngine(lEngine);
+	} catch (const RegexError &e) {
+		return apr_pstrcat(pParams->pool, "Expression not supported by the ", pEngine, " regex engine: ", e.what(), NULL);
+	}
+	return NULL;
+}
+
+/**
+ * @brief Set the number of steps each regex search or replacement may take
+ * @param pParams miscellaneous data
+ * @param pCfg user data for the directory/location
+ * @param pBudget the number of steps, 0 for no limit
+ * @return NULL if parameters are valid, otherwise a string describing the error
+ */
+const char*
+setRegexBudget(cmd_parms* pParams, void* pCfg, const char* pBudget) {
+	unsigned long lBudget;
+	// lexical_cast would wrap a negative value around
+	if (!pBudget || *pBudget == '-') {
+		return "Invalid value for the regex budget.";
+	}
+	try {
+		lBudget = boost::lexical_cast<unsigned long>(pBudget);
+	} catch (const boost::bad_lexical_cast &) {
+		return "Invalid value for the regex budget.";
+	}
+	gProcessor->setRegexBudget(lBudget);
+	return NULL;
+}
+
+/**
+ * @brief Set whether the body of the requests is duplicated
+ * @param pParams miscellaneous data
+ * @param pCfg user data for the directory/location
+ * @param pPayload True or False
+ * @return NULL if parameters are valid, otherwise a string describing the error
+ */
 const char*
-setPayload(cmd_parms* pParams, void* pCfg, const char* pDestination) {
+setPayload(cmd_parms* pParams, void* pCfg, const char* pPayload) {
 	const char *lErrorMsg = setActive(pParams, pCfg);
 	if (lErrorMsg) {
             return lErrorMsg;
 	}
     struct DupConf *tC = *reinterpret_cast<DupConf **>(pCfg);
-    tC->payload = 1;
+    if (!pPayload || !strcasecmp(pPayload, "true")) {
+        tC->payload = 1;
+    } else if (!strcasecmp(pPayload, "false")) {
+        tC->payload = 0;
+    } else {
+        return "Invalid payload value (True, False).";
+    }
     return NULL;
 }
 
@@ -230,8 +776,8 @@ setRawSubstitute(cmd_parms* pParams, void* pCfg,
     try {
         gProcessor->addRawSubstitution(pParams->path, pMatch, pReplace,
                                        tFilterBase::GetScopeFromString(pType));
-    } catch (boost::bad_expression) {
-        return "Invalid regular expression in substitution definition.";
+    } catch (const RegexError &e) {
+        return apr_pstrcat(pParams->pool, "Invalid regular expression in substitution definition: ", e.what(), NULL);
     }
     return NULL;
 }
@@ -282,6 +828,26 @@ setTimeout(cmd_parms* pParams, void* pCfg, const char* pTimeout) {
 	return NULL;
 }
 
+/**
+ * @brief Set the time given to the worker threads to send the queued requests when the process stops
+ * @param pParams miscellaneous data
+ * @param pCfg user data for the directory/location
+ * @param pDrainTimeout the time in ms, 0 to drop the queued requests straight away
+ * @return NULL if parameters are valid, otherwise a string describing the error
+ */
+const char*
+setDrainTimeout(cmd_parms* pParams, void* pCfg, const char* pDrainTimeout) {
+	unsigned int lDrainTimeout;
+	try {
+		lDrainTimeout = boost::lexical_cast<unsigned int>(pDrainTimeout);
+	} catch (const boost::bad_lexical_cast &) {
+		return "Invalid value for drain timeout.";
+	}
+
+	gThreadPool->setDrainTimeout(lDrainTimeout * 1000ULL);
+	return NULL;
+}
+
 /**
  * @brief Set the minimum and maximum queue size
  * @param pParams miscellaneous data
@@ -308,6 +874,296 @@ setQueue(cmd_parms* pParams, void* pCfg, const char* pMin, const char* pMax) {
 	return NULL;
 }
 
+/**
+ * @brief Set the storage of the queue between apache threads and the worker threads
+ * @param pParams miscellaneous data
+ * @param pCfg user data for the directory/location
+ * @param pBackend the storage to use (deque or ring)
+ * @return NULL if parameters are valid, otherwise a string describing the error
+ */
+const char*
+setQueueBackend(cmd_parms* pParams, void* pCfg, const char* pBackend) {
+	if (!pBackend || strlen(pBackend) == 0) {
+		return "Missing queue backend";
+	}
+	if (!strcasecmp(pBackend, "deque")) {
+		gThreadPool->setQueueBackend(LOCKED_DEQUE);
+	} else if (!strcasecmp(pBackend, "ring")) {
+		gThreadPool->setQueueBackend(LOCK_FREE_RING);
+	} else {
+		return "Invalid queue backend (deque, ring).";
+	}
+	return NULL;
+}
+
+/**
+ * @brief Set how the number of worker threads is decided
+ * @param pParams miscellaneous data
+ * @param pCfg user data for the directory/location
+ * @param pPolicy queue or adaptive
+ * @return NULL if parameters are valid, otherwise a string describing the error
+ */
+const char*
+setThreadScaling(cmd_parms* pParams, void* pCfg, const char* pPolicy) {
+	if (!pPolicy || strlen(pPolicy) == 0) {
+		return "Missing thread scaling policy";
+	}
+	if (!strcasecmp(pPolicy, "queue")) {
+		gThreadPool->setScaling(QUEUE_SCALING);
+	} else if (!strcasecmp(pPolicy, "adaptive")) {
+		gThreadPool->setScaling(ADAPTIVE_SCALING, boost::bind(&RequestProcessor::getBusyTime, gProcessor));
+	} else {
+		return "Invalid thread scaling policy (queue, adaptive).";
+	}
+	return NULL;
+}
+
+/**
+ * @brief Parse a size in bytes, optionally followed by K, M or G
+ * @param pValue the value to parse
+ * @param pSize receives the size in bytes
+ * @return false if the value is invalid
+ */
+static bool
+parseSize(const char *pValue, size_t &pSize) {
+	if (!pValue || !*pValue) {
+		return false;
+	}
+	std::string lValue(pValue);
+	size_t lUnit = 1;
+	switch (toupper(lValue[lValue.size() - 1])) {
+	case 'K': lUnit = 1024; break;
+	case 'M': lUnit = 1024 * 1024; break;
+	case 'G': lUnit = 1024 * 1024 * 1024; break;
+	}
+	if (lUnit > 1) {
+		lValue.resize(lValue.size() - 1);
+	}
+	// lexical_cast would wrap a negative value around
+	if (lValue.empty() || lValue[0] == '-') {
+		return false;
+	}
+	size_t lSize;
+	try {
+		lSize = boost::lexical_cast<size_t>(lValue);
+	} catch (const boost::bad_lexical_cast &) {
+		return false;
+	}
+	if (lSize > SIZE_MAX / lUnit) {
+		return false;
+	}
+	pSize = lSize * lUnit;
+	return true;
+}
+
+/**
+ * @brief Set the maximum number of bytes held by the queued requests of each process
+ * @param pParams miscellaneous data
+ * @param pCfg user data for the directory/location
+ * @param pMemory the number of bytes, optionally followed by K, M or G
+ * @param pPolicy LargeFirst to drop the large requests first, optional
+ * @return NULL if parameters are valid, otherwise a string describing the error
+ */
+const char*
+setQueueMemory(cmd_parms* pParams, void* pCfg, const char* pMemory, const char* pPolicy) {
+	if (!pMemory || strlen(pMemory) == 0) {
+		return "Missing queue memory";
+	}
+	size_t lBytes;
+	if (!parseSize(pMemory, lBytes)) {
+		return "Invalid value for the queue memory.";
+	}
+	eAdmissionPolicy lPolicy = DROP_WHEN_FULL;
+	if (pPolicy) {
+		if (strcasecmp(pPolicy, "LargeFirst")) {
+			return "Invalid queue admission policy (LargeFirst).";
+		}
+		lPolicy = DROP_LARGE_FIRST;
+	}
+	gThreadPool->setQueueMemory(lBytes, lPolicy);
+	return NULL;
+}
+
+/**
+ * @brief Send the requests from dedicated dispatcher processes, fed by the Apache processes through a shared memory ring
+ * @param pParams miscellaneous data
+ * @param pCfg user data for the directory/location
+ * @param pRingSize the size of the ring in bytes, optionally followed by K, M or G. 0 disables the dispatchers.
+ * @param pCount the number of dispatcher processes, optional
+ * @return NULL if parameters are valid, otherwise a string describing the error
+ */
+const char*
+setDispatcher(cmd_parms* pParams, void* pCfg, const char* pRingSize, const char* pCount) {
+	size_t lRingSize;
+	if (!parseSize(pRingSize, lRingSize)) {
+		return "Invalid value for the dispatcher ring size.";
+	}
+	unsigned lCount = 1;
+	if (pCount) {
+		try {
+			lCount = boost::lexical_cast<unsigned>(pCount);
+		} catch (const boost::bad_lexical_cast &) {
+			return "Invalid value for the number of dispatchers.";
+		}
+		if (!lCount) {
+			return "Invalid value for the number of dispatchers.";
+		}
+	}
+	gDispatcherRingSize = lRingSize;
+	gDispatcherCount = lCount;
+	return NULL;
+}
+
+/**
+ * @brief Set how the worker threads send the duplicated requests
+ * @param pParams miscellaneous data
+ * @param pCfg user data for the directory/location
+ * @param pMode the send mode (blocking or multi)
+ * @param pMaxInFlight the maximum number of concurrent transfers per worker thread in multi mode, optional
+ * @return NULL if parameters are valid, otherwise a string describing the error
+ */
+const char*
+setSendMode(cmd_parms* pParams, void* pCfg, const char* pMode, const char* pMaxInFlight) {
+	if (!pMode || strlen(pMode) == 0) {
+		return "Missing send mode";
+	}
+	unsigned lMaxInFlight = 256;
+	if (pMaxInFlight) {
+		try {
+			lMaxInFlight = boost::lexical_cast<unsigned>(pMaxInFlight);
+		} catch (const boost::bad_lexical_cast &) {
+			return "Invalid value for the maximum number of requests in flight.";
+		}
+		if (!lMaxInFlight) {
+			return "Invalid value for the maximum number of requests in flight.";
+		}
+	}
+	if (!strcasecmp(pMode, "blocking")) {
+		gProcessor->setSendMode(BLOCKING_SEND, 1);
+	} else if (!strcasecmp(pMode, "multi")) {
+		gProcessor->setSendMode(MULTI_SEND, lMaxInFlight);
+	} else {
+		return "Invalid send mode (blocking, multi).";
+	}
+	return NULL;
+}
+
+/**
+ * @brief Set where the requests of this location are captured
+ * @param pParams miscellaneous data
+ * @param pCfg user data for the directory/location
+ * @param pCapture filter or transaction
+ * @param pStatus "Status" to forward the status and duration of the original request, transaction only
+ * @return NULL if parameters are valid, otherwise a string describing the error
+ */
+const char*
+setCapture(cmd_parms* pParams, void* pCfg, const char* pCapture, const char* pStatus) {
+	const char *lErrorMsg = setActive(pParams, pCfg);
+	if (lErrorMsg) {
+		return lErrorMsg;
+	}
+	struct DupConf *tC = *reinterpret_cast<DupConf **>(pCfg);
+	if (!pCapture || !strcasecmp(pCapture, "filter")) {
+		if (pStatus) {
+			return "The status is only known with transaction capture.";
+		}
+		tC->capture = CAPTURE_FILTER;
+	} else if (!strcasecmp(pCapture, "transaction")) {
+		if (pStatus && strcasecmp(pStatus, "status")) {
+			return "Invalid capture option (Status).";
+		}
+		tC->capture = CAPTURE_TRANSACTION;
+		tC->forwardStatus = pStatus ? 1 : 0;
+		return NULL;
+	} else {
+		return "Invalid capture (filter, transaction).";
+	}
+	tC->forwardStatus = 0;
+	return NULL;
+}
+
+/**
+ * @brief Set what to do with the responses of the requests duplicated from this location
+ * @param pParams miscellaneous data
+ * @param pCfg user data for the directory/location
+ * @param pMode the response mode (discard, count or abort)
+ * @return NULL if parameters are valid, otherwise a string describing the error
+ */
+const char*
+setResponseMode(cmd_parms* pParams, void* pCfg, const char* pMode) {
+	if (!pMode || strlen(pMode) == 0) {
+		return "Missing response mode";
+	}
+	if (!strcasecmp(pMode, "discard")) {
+		gProcessor->setResponseMode(pParams->path, DISCARD_RESPONSE);
+	} else if (!strcasecmp(pMode, "count")) {
+		gProcessor->setResponseMode(pParams->path, COUNT_RESPONSE);
+	} else if (!strcasecmp(pMode, "abort")) {
+		gProcessor->setResponseMode(pParams->path, ABORT_RESPONSE);
+	} else {
+		return "Invalid response mode (discard, count, abort).";
+	}
+	return NULL;
+}
+
+/**
+ * @brief Limit the rate of the duplicated requests, of the location or, outside of any, of all of them
+ * @param pParams miscellaneous data
+ * @param pCfg user data for the directory/location
+ * @param pRate the maximum rate in requests per second
+ * @param pBurst the number of requests accepted at once after a pause, the rate rounded up by default
+ * @return NULL if parameters are valid, otherwise a string describing the error
+ */
+const char*
+setRateLimit(cmd_parms* pParams, void* pCfg, const char* pRate, const char* pBurst) {
+	double lRate;
+	unsigned lBurst;
+	try {
+		lRate = boost::lexical_cast<double>(pRate);
+		lBurst = pBurst ? boost::lexical_cast<unsigned>(pBurst) : static_cast<unsigned>(ceil(lRate));
+	} catch (const boost::bad_lexical_cast &) {
+		return "Invalid value(s) for the rate limit.";
+	}
+	if (!(lRate > 0) || !lBurst) {
+		return "Invalid value(s) for the rate limit.";
+	}
+	if (pParams->path) {
+		gRateLimiter->setLimit(pParams->path, lRate, lBurst);
+	} else {
+		gRateLimiter->setGlobalLimit(lRate, lBurst);
+	}
+	return NULL;
+}
+
+/**
+ * @brief Only duplicate a part of the requests of the location, always the same users
+ * @param pParams miscellaneous data
+ * @param pCfg user data for the directory/location
+ * @param pPercent the percentage of the requests duplicated
+ * @param pField the query or body field identifying the users, optional. The uri is used without it, or if the field is missing.
+ * @return NULL if parameters are valid, otherwise a string describing the error
+ */
+const char*
+setSample(cmd_parms* pParams, void* pCfg, const char* pPercent, const char* pField) {
+	const char *lErrorMsg = setActive(pParams, pCfg);
+	if (lErrorMsg) {
+		return lErrorMsg;
+	}
+	double lPercent;
+	try {
+		lPercent = boost::lexical_cast<double>(pPercent);
+	} catch (const boost::bad_lexical_cast &) {
+		return "Invalid value for the sample percentage.";
+	}
+	if (!(lPercent >= 0 && lPercent <= 100)) {
+		return "Invalid value for the sample percentage.";
+	}
+	struct DupConf *tC = *reinterpret_cast<DupConf **>(pCfg);
+	tC->sampleRate = static_cast<unsigned>(lPercent * SAMPLE_ALL / 100 + 0.5);
+	tC->sampleField = pField ? apr_pstrdup(pParams->pool, pField) : NULL;
+	return NULL;
+}
+
 /**
  * @brief Add a substitution definition
  * @param pParams miscellaneous data
@@ -326,8 +1182,8 @@ setSubstitution(cmd_parms* pParams, void* pCfg, tFilterBase::eFilterScope pScope
     }
     try {
         gProcessor->addSubstitution(pParams->path, pField, pMatch, pReplace, pScope);
-    } catch (boost::bad_expression) {
-        return "Invalid regular expression in substitution definition.";
+    } catch (const RegexError &e) {
+        return apr_pstrcat(pParams->pool, "Invalid regular expression in substitution definition: ", e.what(), NULL);
     }
     return NULL;
 }
@@ -361,6 +1217,9 @@ setActive(cmd_parms* pParams, void* pCfg) {
     // No dup conf struct initialized
     if (!*lConf) {
         *lConf = (DupConf *) apr_pcalloc(pParams->pool, sizeof(**lConf));
+        // Bodies are duplicated unless DupPayload False says otherwise
+        (*lConf)->payload = 1;
+        (*lConf)->sampleRate = SAMPLE_ALL;
     }
     // No dir name initialized
     if (!((*lConf)->dirName)) {
@@ -386,8 +1245,8 @@ setFilter(cmd_parms* pParams, void* pCfg, const char *pType, const char *pField,
 	}
 	try {
             gProcessor->addFilter(pParams->path, pField, pFilter, tFilterBase::GetScopeFromString(pType));
-	} catch (boost::bad_expression) {
-		return "Invalid regular expression in filter definition.";
+	} catch (const RegexError &e) {
+		return apr_pstrcat(pParams->pool, "Invalid regular expression in filter definition: ", e.what(), NULL);
 	} catch (std::exception) {
             return INVALID_SCOPE_VALUE;
         }
@@ -403,8 +1262,8 @@ setRawFilter(cmd_parms* pParams, void* pCfg, const char *pType, const char* pExp
     }
     try {
         gProcessor->addRawFilter(pParams->path, pExpression, tFilterBase::GetScopeFromString(pType));
-    } catch (boost::bad_expression) {
-        return "Invalid regular expression in filter definition.";
+    } catch (const RegexError &e) {
+        return apr_pstrcat(pParams->pool, "Invalid regular expression in filter definition: ", e.what(), NULL);
     }
     catch (std::exception) {
         return INVALID_SCOPE_VALUE;
@@ -420,6 +1279,7 @@ cleanUp(void *) {
 	gThreadPool->stop();
 	delete gThreadPool;
 	gThreadPool = NULL;
+	detachScoreboard(NULL);
 
 	delete gProcessor;
 	gProcessor = NULL;
@@ -433,7 +1293,14 @@ cleanUp(void *) {
  */
 void
 childInit(apr_pool_t *pPool, server_rec *pServer) {
+	// With dispatchers, the requests are only written into the ring
+	if (gShmRing) {
+		attachScoreboard(false);
+		apr_pool_cleanup_register(pPool, NULL, detachScoreboard, apr_pool_cleanup_null);
+		return;
+	}
 	curl_global_init(CURL_GLOBAL_ALL);
+	attachScoreboard(true);
 	gThreadPool->start();
 
 	apr_pool_cleanup_register(pPool, NULL, cleanUp, cleanUp);
@@ -462,11 +1329,26 @@ command_rec gCmds[] = {
 		0,
 		OR_ALL,
 		"Set the url enc/decoding style for url arguments (default or apache)"),
+	AP_INIT_TAKE1("DupRegexEngine",
+		reinterpret_cast<const char *(*)()>(&setRegexEngine),
+		0,
+		OR_ALL,
+		"Set the regex engine of the filters and substitutions (boost, pcre2 or re2)"),
+	AP_INIT_TAKE1("DupRegexBudget",
+		reinterpret_cast<const char *(*)()>(&setRegexBudget),
+		0,
+		OR_ALL,
+		"Set the number of steps each regex search or replacement may take, 0 for no limit"),
 	AP_INIT_TAKE1("DupTimeout",
 		reinterpret_cast<const char *(*)()>(&setTimeout),
 		0,
 		OR_ALL,
 		"Set the timeout for outgoing requests in milliseconds."),
+	AP_INIT_TAKE1("DupDrainTimeout",
+		reinterpret_cast<const char *(*)()>(&setDrainTimeout),
+		0,
+		OR_ALL,
+		"Set the time in milliseconds given to the threads to send the queued requests when stopping. 0 (default) drops them."),
 	AP_INIT_TAKE2("DupThreads",
 		reinterpret_cast<const char *(*)()>(&setThreads),
 		0,
@@ -477,6 +1359,55 @@ command_rec gCmds[] = {
 		0,
 		OR_ALL,
 		"Set the minimum and maximum queue size for each thread pool."),
+	AP_INIT_TAKE1("DupQueueBackend",
+		reinterpret_cast<const char *(*)()>(&setQueueBackend),
+		0,
+		OR_ALL,
+		"Set the storage of the request queue: deque (locked, default) or ring (lock-free, bounded)."),
+	AP_INIT_TAKE1("DupThreadScaling",
+		reinterpret_cast<const char *(*)()>(&setThreadScaling),
+		0,
+		OR_ALL,
+		"Set how the number of threads is decided within the DupThreads bounds: queue (queued requests per thread, default) or adaptive (observed load of the threads)."),
+	AP_INIT_TAKE12("DupDispatcher",
+		reinterpret_cast<const char *(*)()>(&setDispatcher),
+		0,
+		OR_ALL,
+		"Send the requests from dedicated processes instead of every Apache process: size of the shared memory ring to them (K, M or G suffix allowed), "
+		"optionally followed by the number of dispatcher processes (1 by default)."),
+	AP_INIT_TAKE12("DupRateLimit",
+		reinterpret_cast<const char *(*)()>(&setRateLimit),
+		0,
+		OR_ALL,
+		"Maximum rate of the duplicated requests in requests per second, optionally followed by the size of the bursts allowed. "
+		"Applies to the location, or outside of any to all the requests, across all the processes."),
+	AP_INIT_TAKE12("DupSample",
+		reinterpret_cast<const char *(*)()>(&setSample),
+		0,
+		ACCESS_CONF,
+		"Percentage of the requests of the location to duplicate, optionally followed by the query or body field identifying the users. "
+		"The same users are always duplicated. Without the field, or if it is missing, the uri is used."),
+	AP_INIT_TAKE12("DupQueueMemory",
+		reinterpret_cast<const char *(*)()>(&setQueueMemory),
+		0,
+		OR_ALL,
+		"Set the maximum number of bytes (K, M or G suffix allowed) held by the queued requests of each process, optionally followed by LargeFirst to drop the large requests first."),
+	AP_INIT_TAKE12("DupSendMode",
+		reinterpret_cast<const char *(*)()>(&setSendMode),
+		0,
+		OR_ALL,
+		"Set how requests are sent: blocking (one at a time per thread, default) or multi (many concurrent transfers per thread), followed by the maximum number of transfers in flight per thread in multi mode."),
+	AP_INIT_TAKE12("DupCapture",
+		reinterpret_cast<const char *(*)()>(&setCapture),
+		0,
+		ACCESS_CONF,
+		"Capture the requests in the input filter (filter, default) or once the response is sent (transaction). "
+		"With transaction, Status forwards the status and duration of the original request as X-Dup-Status and X-Dup-Duration headers."),
+	AP_INIT_TAKE1("DupResponse",
+		reinterpret_cast<const char *(*)()>(&setResponseMode),
+		0,
+		ACCESS_CONF,
+		"Set what to do with the responses of the duplicated requests: discard (default), count (bytes and status codes in the stats) or abort (close once the headers are received)."),
 	AP_INIT_TAKE3("DupSubstitute",
 		reinterpret_cast<const char *(*)()>(&setHeaderSubstitution),
 		0,
@@ -511,7 +1442,7 @@ command_rec gCmds[] = {
 		reinterpret_cast<const char *(*)()>(&setPayload),
 		0,
 		ACCESS_CONF,
-		"Store the body part of the request"),
+		"Duplicate the body of the requests (True, default) or not (False): the requests are then duplicated without reading their body."),
 	AP_INIT_NO_ARGS("Dup",
 		reinterpret_cast<const char *(*)()>(&setActive),
 		0,
@@ -532,6 +1463,9 @@ registerHooks(apr_pool_t *pPool) {
     ap_hook_post_config(postConfig, NULL, NULL, APR_HOOK_MIDDLE);
     ap_hook_child_init(&childInit, NULL, NULL, APR_HOOK_MIDDLE);
     ap_register_input_filter(gName, filterHandler, NULL, AP_FTYPE_CONTENT_SET);
+    ap_hook_fixups(&duplicateWithoutBody, NULL, NULL, APR_HOOK_MIDDLE);
+    ap_hook_log_transaction(&duplicateAfterTransaction, NULL, NULL, APR_HOOK_MIDDLE);
+    ap_hook_handler(&statusHandler, NULL, NULL, APR_HOOK_MIDDLE);
 #endif
 }
 
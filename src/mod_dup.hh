@@ -32,17 +32,40 @@
 
 #include "Log.hh"
 #include "RequestProcessor.hh"
+#include "RateLimiter.hh"
+#include "Sampler.hh"
+#include "Scoreboard.hh"
+#include "ShmRing.hh"
 #include "ThreadPool.hh"
 
 namespace DupModule {
 
 
+/**
+ * @brief Where the requests of a location are captured
+ */
+enum eCaptureMode {
+    /** In the input filter, as their body is read */
+    CAPTURE_FILTER = 0,
+    /** In the log_transaction hook, once the response is sent */
+    CAPTURE_TRANSACTION,
+};
+
 /**
  * A structure that holds the configuration specific to the location
  */
 struct DupConf {
     char        *dirName;
+    /** @brief 1 if the body is duplicated, 0 if the requests are duplicated without reading it */
     int         payload;
+    /** @brief Where the requests are captured */
+    eCaptureMode capture;
+    /** @brief 1 if the status and duration of the original request are forwarded, transaction capture only */
+    int         forwardStatus;
+    /** @brief The part of the requests duplicated, in hundredths of a percent */
+    unsigned    sampleRate;
+    /** @brief The field whose value decides if a request is part of the sample, NULL for the uri */
+    char        *sampleField;
 };
 
 /**
@@ -71,6 +94,30 @@ createDirConfig(apr_pool_t *pPool, char *pDirName);
 int
 postConfig(apr_pool_t * pPool, apr_pool_t * pLog, apr_pool_t * pTemp, server_rec * pServer);
 
+/**
+ * @brief Create the scoreboard the processes share their counters in
+ * @param pPool the configuration pool, the scoreboard is released with it
+ * @return OK, or an error if the shared memory could not be created
+ */
+int
+createScoreboard(apr_pool_t *pPool);
+
+/**
+ * @brief Start the dispatcher processes and the shared memory ring feeding them
+ * @param pPool the configuration pool, the dispatchers are stopped with it
+ * @param pServer the server
+ * @return OK, or an error if the ring or a process could not be created
+ */
+int
+startDispatchers(apr_pool_t *pPool, server_rec *pServer);
+
+/**
+ * @brief Hand a request over to the worker threads, or to the dispatcher processes if there are some
+ * @param pRequest the request, left empty
+ */
+void
+pushRequest(RequestInfo &&pRequest);
+
 /**
  * @brief Set the destination host and port
  * @param pParams miscellaneous data
@@ -81,6 +128,26 @@ postConfig(apr_pool_t * pPool, apr_pool_t * pLog, apr_pool_t * pTemp, server_rec
 const char*
 setDestination(cmd_parms* pParams, void* pCfg, const char* pDestination);
 
+/**
+ * @brief Set the regex engine the filters and substitutions of all the locations are compiled with
+ * @param pParams miscellaneous data
+ * @param pCfg user data for the directory/location
+ * @param pEngine boost, pcre2 or re2
+ * @return NULL if the engine is available and supports all the expressions, otherwise a string describing the error
+ */
+const char*
+setRegexEngine(cmd_parms* pParams, void* pCfg, const char* pEngine);
+
+/**
+ * @brief Set the number of steps each regex search or replacement may take
+ * @param pParams miscellaneous data
+ * @param pCfg user data for the directory/location
+ * @param pBudget the number of steps, 0 for no limit
+ * @return NULL if parameters are valid, otherwise a string describing the error
+ */
+const char*
+setRegexBudget(cmd_parms* pParams, void* pCfg, const char* pBudget);
+
 /**
  * @brief Set the minimum and maximum number of threads
  * @param pParams miscellaneous data
@@ -102,6 +169,16 @@ setThreads(cmd_parms* pParams, void* pCfg, const char* pMin, const char* pMax);
 const char*
 setTimeout(cmd_parms* pParams, void* pCfg, const char* pTimeout);
 
+/**
+ * @brief Set the time given to the worker threads to send the queued requests when the process stops
+ * @param pParams miscellaneous data
+ * @param pCfg user data for the directory/location
+ * @param pDrainTimeout the time in ms, 0 to drop the queued requests straight away
+ * @return NULL if parameters are valid, otherwise a string describing the error
+ */
+const char*
+setDrainTimeout(cmd_parms* pParams, void* pCfg, const char* pDrainTimeout);
+
 /**
  * @brief Set the minimum and maximum queue size
  * @param pParams miscellaneous data
@@ -113,6 +190,102 @@ setTimeout(cmd_parms* pParams, void* pCfg, const char* pTimeout);
 const char*
 setQueue(cmd_parms* pParams, void* pCfg, const char* pMin, const char* pMax);
 
+/**
+ * @brief Set the storage of the queue between apache threads and the worker threads
+ * @param pParams miscellaneous data
+ * @param pCfg user data for the directory/location
+ * @param pBackend the storage to use (deque or ring)
+ * @return NULL if parameters are valid, otherwise a string describing the error
+ */
+const char*
+setQueueBackend(cmd_parms* pParams, void* pCfg, const char* pBackend);
+
+/**
+ * @brief Set how the number of worker threads is decided
+ * @param pParams miscellaneous data
+ * @param pCfg user data for the directory/location
+ * @param pPolicy queue or adaptive
+ * @return NULL if parameters are valid, otherwise a string describing the error
+ */
+const char*
+setThreadScaling(cmd_parms* pParams, void* pCfg, const char* pPolicy);
+
+/**
+ * @brief Set the maximum number of bytes held by the queued requests of each process
+ * @param pParams miscellaneous data
+ * @param pCfg user data for the directory/location
+ * @param pMemory the number of bytes, optionally followed by K, M or G
+ * @param pPolicy LargeFirst to drop the large requests first, optional
+ * @return NULL if parameters are valid, otherwise a string describing the error
+ */
+const char*
+setQueueMemory(cmd_parms* pParams, void* pCfg, const char* pMemory, const char* pPolicy);
+
+/**
+ * @brief Send the requests from dedicated dispatcher processes, fed by the Apache processes through a shared memory ring
+ * @param pParams miscellaneous data
+ * @param pCfg user data for the directory/location
+ * @param pRingSize the size of the ring in bytes, optionally followed by K, M or G. 0 disables the dispatchers.
+ * @param pCount the number of dispatcher processes, optional
+ * @return NULL if parameters are valid, otherwise a string describing the error
+ */
+const char*
+setDispatcher(cmd_parms* pParams, void* pCfg, const char* pRingSize, const char* pCount);
+
+/**
+ * @brief Limit the rate of the duplicated requests, of the location or, outside of any, of all of them
+ * @param pParams miscellaneous data
+ * @param pCfg user data for the directory/location
+ * @param pRate the maximum rate in requests per second
+ * @param pBurst the number of requests accepted at once after a pause, the rate rounded up by default
+ * @return NULL if parameters are valid, otherwise a string describing the error
+ */
+const char*
+setRateLimit(cmd_parms* pParams, void* pCfg, const char* pRate, const char* pBurst);
+
+/**
+ * @brief Only duplicate a part of the requests of the location, always the same users
+ * @param pParams miscellaneous data
+ * @param pCfg user data for the directory/location
+ * @param pPercent the percentage of the requests duplicated
+ * @param pField the query or body field identifying the users, optional. The uri is used without it, or if the field is missing.
+ * @return NULL if parameters are valid, otherwise a string describing the error
+ */
+const char*
+setSample(cmd_parms* pParams, void* pCfg, const char* pPercent, const char* pField);
+
+/**
+ * @brief Set how the worker threads send the duplicated requests
+ * @param pParams miscellaneous data
+ * @param pCfg user data for the directory/location
+ * @param pMode the send mode (blocking or multi)
+ * @param pMaxInFlight the maximum number of concurrent transfers per worker thread in multi mode, optional
+ * @return NULL if parameters are valid, otherwise a string describing the error
+ */
+const char*
+setSendMode(cmd_parms* pParams, void* pCfg, const char* pMode, const char* pMaxInFlight);
+
+/**
+ * @brief Set where the requests of this location are captured
+ * @param pParams miscellaneous data
+ * @param pCfg user data for the directory/location
+ * @param pCapture filter or transaction
+ * @param pStatus "Status" to forward the status and duration of the original request, transaction only
+ * @return NULL if parameters are valid, otherwise a string describing the error
+ */
+const char*
+setCapture(cmd_parms* pParams, void* pCfg, const char* pCapture, const char* pStatus);
+
+/**
+ * @brief Set what to do with the responses of the requests duplicated from this location
+ * @param pParams miscellaneous data
+ * @param pCfg user data for the directory/location
+ * @param pMode the response mode (discard, count or abort)
+ * @return NULL if parameters are valid, otherwise a string describing the error
+ */
+const char*
+setResponseMode(cmd_parms* pParams, void* pCfg, const char* pMode);
+
 /**
  * @brief Add a substitution definition
  * @param pParams miscellaneous data
@@ -128,6 +301,16 @@ setSubstitution(cmd_parms* pParams, void* pCfg, tFilterBase::eFilterScope pScope
 const char*
 setHeaderSubstitution(cmd_parms* pParams, void* pCfg, const char *pField, const char* pMatch, const char* pReplace);
 
+/**
+ * @brief Set whether the body of the requests is duplicated
+ * @param pParams miscellaneous data
+ * @param pCfg user data for the directory/location
+ * @param pPayload True or False
+ * @return NULL if parameters are valid, otherwise a string describing the error
+ */
+const char*
+setPayload(cmd_parms* pParams, void* pCfg, const char* pPayload);
+
 /**
  * @brief Activate duplication
  * @param pParams miscellaneous data
@@ -168,4 +351,29 @@ childInit(apr_pool_t *pPool, server_rec *pServer);
  */
 void registerHooks(apr_pool_t *pPool);
 
+/**
+ * @brief fixups hook duplicating the requests of the locations without payload, without reading their body
+ * @param pRequest the request
+ * @return Always DECLINED, so that the request goes on
+ */
+int
+duplicateWithoutBody(request_rec *pRequest);
+
+/**
+ * @brief log_transaction hook duplicating the requests of the locations capturing once the response is sent
+ * @param pRequest the request
+ * @return Always DECLINED
+ */
+int
+duplicateAfterTransaction(request_rec *pRequest);
+
+/**
+ * @brief Handler of the dup-status handler, showing the counters of all the processes.
+ * With the "auto" query string, it only shows the totals, one "Name: value" per line, for scripts.
+ * @param pRequest the request
+ * @return OK, or DECLINED for the other handlers
+ */
+int
+statusHandler(request_rec *pRequest);
+
 }
@@ -0,0 +1,168 @@
+/*
+* mod_dup - duplicates apache requests
+*
+* Copyright (C) 2013 Orange
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+// Benchmark of the argument parsing of the key filters: RequestProcessor::parseArgs, which copies, upper cases
+// and decodes every argument, against the ArgsParser views, which only decode the values of the keys filtered.
+// Then of the lookup of the keys among the rules of a location with hundreds of them: an upper cased copy
+// searched in a std::multimap, against the KeyIndex hashing the key in place.
+// Usage: mod_dup_bench_args [iterations]
+
+#include <iostream>
+#include <map>
+#include <boost/foreach.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+#include "ArgsParser.hh"
+#include "KeyIndex.hh"
+#include "RequestProcessor.hh"
+
+using namespace DupModule;
+
+/** @brief Query strings as seen on a search and an ad serving front */
+static const char *gQueries[] = {
+	"q=blue+cotton+shirt&lang=fr&page=2&sort=price_asc&sid=5f2a9c01d3&ref=home",
+	"SID=5f2a9c01d3&type=xml&version=3.2&format=json&callback=jQuery1910_1374&_=1374054729",
+	"u=https%3A%2F%2Fwww.example.com%2Fproducts%2Fshirt%3Fcolor%3Dblue&w=728&h=90&cb=839204&tz=-120"
+	"&ua=Mozilla%2F5.0+%28X11%3B+Linux+x86_64%29&sid=99a1b2c3d4&campaign=summer_sale_2013&pos=top",
+	"id=12345&name=%C3%A9l%C3%A9ment&tags=a,b,c&debug",
+};
+
+/** @brief The keys filtered, upper case as in the rules */
+static const char *gFilteredKeys[] = {"SID", "DEBUG"};
+
+/**
+ * @brief Copy a key upper cased, to look it up in a std::multimap of upper case keys.
+ * Reusing the same buffer for all the keys of a request, short keys fit in it without allocation.
+ */
+static void
+upperKey(boost::string_ref pKey, std::string &pBuffer) {
+	pBuffer.assign(pKey.data(), pKey.size());
+	for (std::string::iterator it = pBuffer.begin(); it != pBuffer.end(); ++it) {
+		if (*it >= 'a' && *it <= 'z') {
+			*it -= 'a' - 'A';
+		}
+	}
+}
+
+static double
+seconds(const boost::posix_time::ptime &pStart)
+{
+	return (boost::posix_time::microsec_clock::universal_time() - pStart).total_microseconds() / 1e6;
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned lCount = argc > 1 ? boost::lexical_cast<unsigned>(argv[1]) : 200000;
+	const size_t lQueries = sizeof(gQueries) / sizeof(*gQueries);
+
+	std::multimap<std::string, int> lFilters;
+	for (size_t i = 0; i < sizeof(gFilteredKeys) / sizeof(*gFilteredKeys); ++i) {
+		lFilters.insert(std::make_pair(std::string(gFilteredKeys[i]), 0));
+	}
+	std::string lQueryStrings[lQueries];
+	size_t lBytes = 0;
+	for (size_t i = 0; i < lQueries; ++i) {
+		lQueryStrings[i] = gQueries[i];
+		lBytes += lQueryStrings[i].size();
+	}
+
+	// parseArgs, then a lookup per argument
+	RequestProcessor lProcessor;
+	size_t lFound = 0;
+	boost::posix_time::ptime lStart = boost::posix_time::microsec_clock::universal_time();
+	for (unsigned n = 0; n < lCount; ++n) {
+		for (size_t i = 0; i < lQueries; ++i) {
+			std::list<tKeyVal> lParsedArgs;
+			lProcessor.parseArgs(lParsedArgs, lQueryStrings[i]);
+			BOOST_FOREACH (const tKeyVal &lKeyVal, lParsedArgs) {
+				if (lFilters.find(lKeyVal.first) != lFilters.end()) {
+					lFound += lKeyVal.second.size();
+				}
+			}
+		}
+	}
+	double lListSeconds = seconds(lStart);
+
+	// ArgsParser, decoding only the values filtered
+	boost::scoped_ptr<const IUrlCodec> lCodec(getUrlCodec("default"));
+	size_t lViewFound = 0;
+	lStart = boost::posix_time::microsec_clock::universal_time();
+	for (unsigned n = 0; n < lCount; ++n) {
+		for (size_t i = 0; i < lQueries; ++i) {
+			ArgsParser lParser(lQueryStrings[i]);
+			tArgView lArg;
+			std::string lKey;
+			while (lParser.next(lArg)) {
+				upperKey(lArg.mKey, lKey);
+				if (lFilters.find(lKey) != lFilters.end()) {
+					lViewFound += lCodec->decode(lArg.mValue.to_string()).size();
+				}
+			}
+		}
+	}
+	double lViewSeconds = seconds(lStart);
+
+	double lMegaBytes = static_cast<double>(lBytes) * lCount / (1024 * 1024);
+	std::cout << lQueries * lCount << " query strings of " << lBytes / lQueries << " bytes on average" << std::endl;
+	std::cout << "parseArgs:  " << static_cast<long>(lQueries * lCount / lListSeconds) << " queries/s ("
+	          << static_cast<long>(lMegaBytes / lListSeconds) << " MB/s, " << lFound << " bytes found)" << std::endl;
+	std::cout << "ArgsParser: " << static_cast<long>(lQueries * lCount / lViewSeconds) << " queries/s ("
+	          << static_cast<long>(lMegaBytes / lViewSeconds) << " MB/s, " << lViewFound << " bytes found)" << std::endl;
+
+	// Lookups among many rules
+	std::multimap<std::string, int> lRules;
+	KeyIndex<int> lIndex;
+	std::string lManyKeys;
+	for (int i = 0; i < 300; ++i) {
+		std::string lField = "FIELD_" + boost::lexical_cast<std::string>(i);
+		lRules.insert(std::make_pair(lField, i));
+		lIndex.insert(lField, i);
+		// A third of the keys of the query have a rule
+		lManyKeys += std::string(i ? "&" : "") + (i % 3 ? "other_" : "field_") + boost::lexical_cast<std::string>(i) + "=v";
+	}
+	size_t lRuleHits = 0;
+	lStart = boost::posix_time::microsec_clock::universal_time();
+	for (unsigned n = 0; n < lCount / 100; ++n) {
+		ArgsParser lParser(lManyKeys);
+		tArgView lArg;
+		std::string lKey;
+		while (lParser.next(lArg)) {
+			upperKey(lArg.mKey, lKey);
+			lRuleHits += lRules.find(lKey) != lRules.end();
+		}
+	}
+	double lMapSeconds = seconds(lStart);
+	size_t lIndexHits = 0;
+	lStart = boost::posix_time::microsec_clock::universal_time();
+	for (unsigned n = 0; n < lCount / 100; ++n) {
+		ArgsParser lParser(lManyKeys);
+		tArgView lArg;
+		while (lParser.next(lArg)) {
+			lIndexHits += lIndex.find(lArg.mKey) != NULL;
+		}
+	}
+	double lIndexSeconds = seconds(lStart);
+	double lLookups = 300.0 * (lCount / 100);
+	std::cout << "300 rules, multimap: " << static_cast<long>(lLookups / lMapSeconds) << " lookups/s ("
+	          << lRuleHits << " found)" << std::endl;
+	std::cout << "300 rules, KeyIndex: " << static_cast<long>(lLookups / lIndexSeconds) << " lookups/s ("
+	          << lIndexHits << " found)" << std::endl;
+	return lFound == lViewFound && lRuleHits == lIndexHits ? 0 : 1;
+}
@@ -0,0 +1,83 @@
+/*
+* mod_dup - duplicates apache requests
+*
+* Copyright (C) 2013 Orange
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+// Contention benchmark of the MultiThreadQueue backends.
+// Many producers (the apache request threads) push while a few consumers (the workers) pop.
+// Usage: mod_dup_bench_queue [producers] [consumers] [items per producer]
+
+#include <iostream>
+#include <boost/lexical_cast.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+#include "MultiThreadQueue.hh"
+
+using namespace DupModule;
+
+static const int STOP = -1;
+
+static void producer(MultiThreadQueue<int> *pQueue, int pCount)
+{
+	for (int i = 0; i < pCount; ++i) {
+		pQueue->push(i);
+	}
+}
+
+static void consumer(MultiThreadQueue<int> *pQueue)
+{
+	while (pQueue->pop() != STOP) {
+	}
+}
+
+static void bench(const char *pName, eQueueBackend pBackend, int pProducers, int pConsumers, int pCount)
+{
+	MultiThreadQueue<int> lQueue;
+	lQueue.setDropSize(1024);
+	lQueue.setBackend(pBackend);
+
+	boost::posix_time::ptime lStart = boost::posix_time::microsec_clock::universal_time();
+	boost::thread_group lConsumers, lProducers;
+	for (int i = 0; i < pConsumers; ++i) {
+		lConsumers.create_thread(boost::bind(&consumer, &lQueue));
+	}
+	for (int i = 0; i < pProducers; ++i) {
+		lProducers.create_thread(boost::bind(&producer, &lQueue, pCount));
+	}
+	lProducers.join_all();
+	for (int i = 0; i < pConsumers; ++i) {
+		lQueue.push_front(STOP);
+	}
+	lConsumers.join_all();
+	double lSeconds = (boost::posix_time::microsec_clock::universal_time() - lStart).total_microseconds() / 1e6;
+
+	unsigned lInCount, lOutCount, lDropCount;
+	lQueue.getCounters(lInCount, lOutCount, lDropCount);
+	std::cout << pName << ": " << pProducers << " producers, " << pConsumers << " consumers, "
+	          << static_cast<long>(pProducers * pCount / lSeconds) << " push/s, "
+	          << lInCount << " in, " << lOutCount << " out, " << lDropCount << " dropped" << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+	int lProducers = argc > 1 ? boost::lexical_cast<int>(argv[1]) : 16;
+	int lConsumers = argc > 2 ? boost::lexical_cast<int>(argv[2]) : 4;
+	int lCount = argc > 3 ? boost::lexical_cast<int>(argv[3]) : 200000;
+
+	bench("deque", LOCKED_DEQUE, lProducers, lConsumers, lCount);
+	bench("ring ", LOCK_FREE_RING, lProducers, lConsumers, lCount);
+	return 0;
+}
@@ -0,0 +1,106 @@
+/*
+* mod_dup - duplicates apache requests
+*
+* Copyright (C) 2013 Orange
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+// Benchmark of the regex engines on the filters and substitutions of a location receiving long XML bodies.
+// Only the engines mod_dup was built with are run.
+// Usage: mod_dup_bench_regex [body size in KB] [requests]
+
+#include <iostream>
+#include <sstream>
+#include <boost/lexical_cast.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+#include "RequestProcessor.hh"
+
+using namespace DupModule;
+
+/**
+ * @brief An XML body of about the given size, none of the filters matching it
+ */
+static std::string
+makeBody(size_t pSize)
+{
+	std::ostringstream lBody;
+	lBody << "<?xml version=\"1.0\"?><request><header><user>u123456</user><session>5f2a9c</session></header><items>";
+	for (unsigned i = 0; lBody.tellp() < static_cast<std::streamoff>(pSize); ++i) {
+		lBody << "<item id=\"" << i << "\"><name>product " << i % 97 << "</name><price currency=\"EUR\">"
+		      << i % 1000 << ".99</price><tags>blue,large,cotton</tags></item>";
+	}
+	lBody << "</items></request>";
+	return lBody.str();
+}
+
+static void
+bench(const char *pName, eRegexEngine pEngine, const std::string &pBody, unsigned pCount)
+{
+	if (!isRegexEngineAvailable(pEngine)) {
+		std::cout << pName << ": not built in" << std::endl;
+		return;
+	}
+	RequestProcessor lFilters, lSubstitutions;
+	lFilters.setRegexEngine(pEngine);
+	lSubstitutions.setRegexEngine(pEngine);
+	// Typical raw filters: literals, alternations, classes and a case insensitive one
+	lFilters.addRawFilter("/bench", "<user>admin[0-9]+</user>", tFilterBase::BODY);
+	lFilters.addRawFilter("/bench", "<session>(deadbeef|cafebabe)</session>", tFilterBase::BODY);
+	lFilters.addRawFilter("/bench", "currency=\"(USD|GBP|JPY)\"", tFilterBase::BODY);
+	lFilters.addRawFilter("/bench", "(?i)<debug>true</debug>", tFilterBase::BODY);
+	lFilters.addRawFilter("/bench", "<price[^>]*>[0-9]+\\.00</price>", tFilterBase::BODY);
+	lFilters.addFilter("/bench", "TEST", "^(1|yes)$", tFilterBase::HEADER);
+	// Anonymization of the duplicated bodies
+	lSubstitutions.addRawSubstitution("/bench", "<user>[^<]*</user>", "<user>anonymous</user>", tFilterBase::BODY);
+	lSubstitutions.addRawSubstitution("/bench", "<price currency=\"([A-Z]+)\">[0-9.]+</price>", "<price currency=\"$1\">0</price>", tFilterBase::BODY);
+
+	boost::posix_time::ptime lStart = boost::posix_time::microsec_clock::universal_time();
+	unsigned lMatched = 0;
+	for (unsigned i = 0; i < pCount; ++i) {
+		std::string lBody(pBody);
+		RequestInfo lRequest("/bench", "/bench", "TEST=0", &lBody);
+		lMatched += lFilters.processRequest("/bench", lRequest);
+	}
+	double lFilterSeconds = (boost::posix_time::microsec_clock::universal_time() - lStart).total_microseconds() / 1e6;
+
+	lStart = boost::posix_time::microsec_clock::universal_time();
+	size_t lOutSize = 0;
+	for (unsigned i = 0; i < pCount; ++i) {
+		std::string lBody(pBody);
+		RequestInfo lRequest("/bench", "/bench", "TEST=0", &lBody);
+		lSubstitutions.processRequest("/bench", lRequest);
+		lOutSize += lRequest.mBody.size();
+	}
+	double lSubstituteSeconds = (boost::posix_time::microsec_clock::universal_time() - lStart).total_microseconds() / 1e6;
+
+	double lMegaBytes = static_cast<double>(pBody.size()) * pCount / (1024 * 1024);
+	std::cout << pName << ": filters " << static_cast<long>(pCount / lFilterSeconds) << " req/s ("
+	          << static_cast<long>(lMegaBytes / lFilterSeconds) << " MB/s, " << lMatched << " matched), substitutions "
+	          << static_cast<long>(pCount / lSubstituteSeconds) << " req/s (" << static_cast<long>(lMegaBytes / lSubstituteSeconds)
+	          << " MB/s, " << lOutSize / pCount << " bytes out)" << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+	size_t lSize = (argc > 1 ? boost::lexical_cast<size_t>(argv[1]) : 64) * 1024;
+	unsigned lCount = argc > 2 ? boost::lexical_cast<unsigned>(argv[2]) : 500;
+
+	std::string lBody = makeBody(lSize);
+	std::cout << lBody.size() << " bytes bodies, " << lCount << " requests" << std::endl;
+	bench("boost", BOOST_ENGINE, lBody, lCount);
+	bench("pcre2", PCRE2_ENGINE, lBody, lCount);
+	bench("re2  ", RE2_ENGINE, lBody, lCount);
+	return 0;
+}
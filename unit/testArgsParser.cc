@@ -0,0 +1,62 @@
+/*
+* mod_dup - duplicates apache requests
+* 
+* Copyright (C) 2013 Orange
+* 
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+#include "ArgsParser.hh"
+#include "testArgsParser.hh"
+
+// cppunit
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/ui/text/TestRunner.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+CPPUNIT_TEST_SUITE_REGISTRATION( TestArgsParser );
+
+using namespace DupModule;
+
+void TestArgsParser::next()
+{
+    // Same split as the boost::tokenizer of parseArgs: empty parameters are skipped
+    std::string lArgs("&titi=tAta1,2#&&tutu&=x&a=b=c&");
+    ArgsParser lParser(lArgs);
+    tArgView lArg;
+
+    CPPUNIT_ASSERT(lParser.next(lArg));
+    CPPUNIT_ASSERT_EQUAL(std::string("titi"), lArg.mKey.to_string());
+    CPPUNIT_ASSERT_EQUAL(std::string("tAta1,2#"), lArg.mValue.to_string());
+    CPPUNIT_ASSERT_EQUAL(std::string("titi=tAta1,2#"), lArg.mParam.to_string());
+    // Views into the text, not copies
+    CPPUNIT_ASSERT(lArg.mKey.data() == lArgs.data() + 1);
+
+    CPPUNIT_ASSERT(lParser.next(lArg));
+    CPPUNIT_ASSERT_EQUAL(std::string("tutu"), lArg.mKey.to_string());
+    CPPUNIT_ASSERT(lArg.mValue.empty());
+
+    CPPUNIT_ASSERT(lParser.next(lArg));
+    CPPUNIT_ASSERT(lArg.mKey.empty());
+    CPPUNIT_ASSERT_EQUAL(std::string("x"), lArg.mValue.to_string());
+
+    CPPUNIT_ASSERT(lParser.next(lArg));
+    CPPUNIT_ASSERT_EQUAL(std::string("a"), lArg.mKey.to_string());
+    CPPUNIT_ASSERT_EQUAL(std::string("b=c"), lArg.mValue.to_string());
+
+    CPPUNIT_ASSERT(!lParser.next(lArg));
+    CPPUNIT_ASSERT(!lParser.next(lArg));
+
+    std::string lEmpty;
+    ArgsParser lEmptyParser(lEmpty);
+    CPPUNIT_ASSERT(!lEmptyParser.next(lArg));
+}
@@ -0,0 +1,77 @@
+/*
+* mod_dup - duplicates apache requests
+* 
+* Copyright (C) 2013 Orange
+* 
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+#include "KeyIndex.hh"
+#include "testKeyIndex.hh"
+
+#include <boost/lexical_cast.hpp>
+
+// cppunit
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/ui/text/TestRunner.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+CPPUNIT_TEST_SUITE_REGISTRATION( TestKeyIndex );
+
+using namespace DupModule;
+
+void TestKeyIndex::find()
+{
+    KeyIndex<int> lIndex;
+    CPPUNIT_ASSERT(lIndex.empty());
+    CPPUNIT_ASSERT(!lIndex.find("SID"));
+
+    lIndex.insert("SID", 1);
+    lIndex.insert("SESSION_ID", 2);
+    lIndex.insert("", 3);
+    CPPUNIT_ASSERT(!lIndex.empty());
+
+    // Any case
+    CPPUNIT_ASSERT_EQUAL(1, *lIndex.find("SID"));
+    CPPUNIT_ASSERT_EQUAL(1, *lIndex.find("sId"));
+    CPPUNIT_ASSERT_EQUAL(2, *lIndex.find("session_id"));
+    CPPUNIT_ASSERT_EQUAL(3, *lIndex.find(""));
+    CPPUNIT_ASSERT(!lIndex.find("SI"));
+    CPPUNIT_ASSERT(!lIndex.find("SIDE"));
+    CPPUNIT_ASSERT(!lIndex.find("S1D"));
+    // Only the ascii letters are case insensitive
+    CPPUNIT_ASSERT(!lIndex.find("SESSION\x7fID"));
+
+    // A view in a longer text
+    std::string lArgs("sid=12&x");
+    CPPUNIT_ASSERT_EQUAL(1, *lIndex.find(boost::string_ref(lArgs.data(), 3)));
+    CPPUNIT_ASSERT_EQUAL(KeyIndex<int>::hash("SID"), KeyIndex<int>::hash("sid"));
+
+    lIndex.clear();
+    CPPUNIT_ASSERT(lIndex.empty());
+    CPPUNIT_ASSERT(!lIndex.find("SID"));
+}
+
+void TestKeyIndex::grow()
+{
+    // Hundreds of fields, all found after the table grew several times
+    KeyIndex<unsigned> lIndex;
+    for (unsigned i = 0; i < 500; ++i) {
+        lIndex.insert("FIELD_" + boost::lexical_cast<std::string>(i), i);
+    }
+    for (unsigned i = 0; i < 500; ++i) {
+        const unsigned *lValue = lIndex.find("field_" + boost::lexical_cast<std::string>(i));
+        CPPUNIT_ASSERT(lValue);
+        CPPUNIT_ASSERT_EQUAL(i, *lValue);
+    }
+    CPPUNIT_ASSERT(!lIndex.find("field_500"));
+}
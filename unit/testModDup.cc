@@ -21,6 +21,7 @@
 #include <http_config.h>
 #include <http_request.h>
 #include <http_protocol.h>
+#include <sstream>
 
 #include "MultiThreadQueue.hh"
 #include "testModDup.hh"
@@ -42,6 +43,10 @@ namespace DupModule {
 RequestProcessor *gProcessor;
 ThreadPool<RequestInfo> *gThreadPool;
 std::set<std::string> gActiveLocations;
+extern Scoreboard *gScoreboard;
+extern RateLimiter *gRateLimiter;
+extern ShmRing *gShmRing;
+apr_status_t analyseRequest(ap_filter_t *pF, apr_bucket_brigade *pB);
 
 
 template <typename QueueT>
@@ -59,6 +64,11 @@ public:
     push(const QueueT &pItem) {
         mDummyQueued.push_back(pItem);
     }
+
+    void
+    push(QueueT &&pItem) {
+        mDummyQueued.push_back(std::move(pItem));
+    }
 };
 
 }
@@ -86,6 +96,144 @@ void TestModDup::testInit()
     gThreadPool = new DummyThreadPool<RequestInfo>(boost::bind(&RequestProcessor::run, gProcessor, _1), POISON_REQUEST);
 }
 
+void TestModDup::testRateLimit()
+{
+    cmd_parms * lParms = getParms();
+    lParms->path = strdup("/spp/limited");
+    DummyThreadPool<RequestInfo> *lDummyThreadPool = dynamic_cast<DummyThreadPool<RequestInfo> *>(gThreadPool);
+    lDummyThreadPool->mDummyQueued.clear();
+
+    CPPUNIT_ASSERT(setRateLimit(lParms, NULL, "fast", NULL));
+    CPPUNIT_ASSERT(setRateLimit(lParms, NULL, "0", NULL));
+    CPPUNIT_ASSERT(setRateLimit(lParms, NULL, "1", "many"));
+    CPPUNIT_ASSERT(!setRateLimit(lParms, NULL, "0.5", "2"));
+    CPPUNIT_ASSERT_EQUAL(APR_SUCCESS, gRateLimiter->create(lParms->pool));
+
+    request_rec lReq;
+    memset(&lReq, 0, sizeof(request_rec));
+    lReq.per_dir_config = reinterpret_cast<ap_conf_vector_t *>(apr_pcalloc(lParms->pool, sizeof(void *) * 1000));
+    lReq.uri = strdup("/spp/limited/toto");
+    DupConf **lConf = reinterpret_cast<DupConf **>(createDirConfig(lParms->pool, lParms->path));
+    ap_set_module_config(lReq.per_dir_config, &dup_module, lConf);
+    CPPUNIT_ASSERT(!setActive(lParms, lConf));
+    CPPUNIT_ASSERT(!setPayload(lParms, lConf, "False"));
+
+    // Only the burst goes through
+    for (int i = 0; i < 5; ++i) {
+        CPPUNIT_ASSERT_EQUAL(DECLINED, duplicateWithoutBody(&lReq));
+    }
+    CPPUNIT_ASSERT_EQUAL(size_t(2), lDummyThreadPool->mDummyQueued.size());
+    CPPUNIT_ASSERT_EQUAL(3ULL, gRateLimiter->getRejectedCount());
+
+    // Rejected by the input filter before the body is buffered
+    CPPUNIT_ASSERT(!setPayload(lParms, lConf, "True"));
+    ap_filter_t *lFilter = new ap_filter_t();
+    memset(lFilter, 0, sizeof(ap_filter_t));
+    lFilter->r = &lReq;
+    CPPUNIT_ASSERT_EQUAL(APR_SUCCESS, analyseRequest(lFilter, NULL));
+    CPPUNIT_ASSERT_EQUAL((void *)1, lFilter->ctx);
+    CPPUNIT_ASSERT_EQUAL(size_t(2), lDummyThreadPool->mDummyQueued.size());
+
+    lDummyThreadPool->mDummyQueued.clear();
+    free(lReq.uri);
+    free(lParms->path);
+}
+
+void TestModDup::testSample()
+{
+    cmd_parms * lParms = getParms();
+    lParms->path = strdup("/spp/sample");
+    DummyThreadPool<RequestInfo> *lDummyThreadPool = dynamic_cast<DummyThreadPool<RequestInfo> *>(gThreadPool);
+    lDummyThreadPool->mDummyQueued.clear();
+
+    request_rec lReq;
+    memset(&lReq, 0, sizeof(request_rec));
+    lReq.per_dir_config = reinterpret_cast<ap_conf_vector_t *>(apr_pcalloc(lParms->pool, sizeof(void *) * 1000));
+    lReq.uri = strdup("/spp/sample/toto");
+    DupConf **lConf = reinterpret_cast<DupConf **>(createDirConfig(lParms->pool, lParms->path));
+    ap_set_module_config(lReq.per_dir_config, &dup_module, lConf);
+
+    CPPUNIT_ASSERT(setSample(lParms, lConf, "some", NULL));
+    CPPUNIT_ASSERT(setSample(lParms, lConf, "150", NULL));
+    CPPUNIT_ASSERT(!setSample(lParms, lConf, "12.5", "user"));
+    CPPUNIT_ASSERT_EQUAL(1250U, (*lConf)->sampleRate);
+    CPPUNIT_ASSERT_EQUAL(std::string("user"), std::string((*lConf)->sampleField));
+
+    // The same users as the sampler picks
+    CPPUNIT_ASSERT(!setPayload(lParms, lConf, "False"));
+    size_t lExpected = 0;
+    for (int i = 0; i < 200; ++i) {
+        std::string lArgs = "user=" + boost::lexical_cast<std::string>(i);
+        lReq.args = const_cast<char *>(lArgs.c_str());
+        lExpected += sample(1250, "user", lReq.args, lReq.uri, NULL) == SAMPLE_IN;
+        CPPUNIT_ASSERT_EQUAL(DECLINED, duplicateWithoutBody(&lReq));
+        CPPUNIT_ASSERT_EQUAL(lExpected, lDummyThreadPool->mDummyQueued.size());
+    }
+    CPPUNIT_ASSERT(lExpected > 0 && lExpected < 100);
+
+    // The input filter decides before reading the body when the field is in the query
+    CPPUNIT_ASSERT(!setPayload(lParms, lConf, "True"));
+    ap_filter_t lFilter;
+    memset(&lFilter, 0, sizeof(ap_filter_t));
+    lFilter.r = &lReq;
+    int i = 0;
+    std::string lArgs;
+    do {
+        lArgs = "user=" + boost::lexical_cast<std::string>(i++);
+        lReq.args = const_cast<char *>(lArgs.c_str());
+    } while (sample(1250, "user", lReq.args, lReq.uri, NULL) == SAMPLE_IN);
+    CPPUNIT_ASSERT_EQUAL(APR_SUCCESS, analyseRequest(&lFilter, NULL));
+    CPPUNIT_ASSERT_EQUAL((void *)1, lFilter.ctx);
+    CPPUNIT_ASSERT_EQUAL(lExpected, lDummyThreadPool->mDummyQueued.size());
+
+    lDummyThreadPool->mDummyQueued.clear();
+    free(lReq.uri);
+    free(lParms->path);
+}
+
+void TestModDup::testStatusHandler()
+{
+    cmd_parms * lParms = getParms();
+    CPPUNIT_ASSERT_EQUAL(OK, createScoreboard(lParms->pool));
+    CPPUNIT_ASSERT(gScoreboard->attach());
+    gScoreboard->add(SB_IN, 3);
+    gScoreboard->set(SB_THREADS, 2);
+
+    // A request which does not fit in the ring to the dispatchers is counted by the process which dropped it
+    gShmRing = new ShmRing();
+    CPPUNIT_ASSERT_EQUAL(APR_SUCCESS, gShmRing->create(lParms->pool, 256));
+    std::string lBody(1024, 'b');
+    pushRequest(RequestInfo("/spp/main", "/spp/main", "a=1", &lBody));
+    delete gShmRing;
+    gShmRing = NULL;
+
+    request_rec *lRequest = new request_rec();
+    lRequest->handler = "other";
+    CPPUNIT_ASSERT_EQUAL(DECLINED, statusHandler(lRequest));
+    CPPUNIT_ASSERT(!lRequest->filename);
+
+    // ap_rprintf writes in filename in the tests
+    lRequest->handler = "dup-status";
+    lRequest->args = strdup("auto");
+    CPPUNIT_ASSERT_EQUAL(OK, statusHandler(lRequest));
+    std::string lAuto(lRequest->filename);
+    CPPUNIT_ASSERT(lAuto.find("Processes: 1\n") != std::string::npos);
+    CPPUNIT_ASSERT(lAuto.find("In: 3\n") != std::string::npos);
+    CPPUNIT_ASSERT(lAuto.find("Threads: 2\n") != std::string::npos);
+    CPPUNIT_ASSERT(lAuto.find("ShmDrop: 1\n") != std::string::npos);
+
+    free(lRequest->filename);
+    lRequest->filename = NULL;
+    lRequest->args = NULL;
+    CPPUNIT_ASSERT_EQUAL(OK, statusHandler(lRequest));
+    std::string lText(lRequest->filename);
+    std::ostringstream lPid;
+    lPid << getpid();
+    CPPUNIT_ASSERT(lText.find(lPid.str()) != std::string::npos);
+    CPPUNIT_ASSERT(lText.find("Total") != std::string::npos);
+    gScoreboard->detach();
+}
+
 void TestModDup::testInitAndCleanUp()
 {
     cmd_parms * lParms = getParms();
@@ -97,6 +245,117 @@ void TestModDup::testInitAndCleanUp()
     CPPUNIT_ASSERT(!gThreadPool);
 }
 
+void TestModDup::testDuplicateWithoutBody()
+{
+    cmd_parms * lParms = getParms();
+    lParms->path = strdup("/spp/light");
+    DummyThreadPool<RequestInfo> *lDummyThreadPool = dynamic_cast<DummyThreadPool<RequestInfo> *>(gThreadPool);
+    lDummyThreadPool->mDummyQueued.clear();
+
+    request_rec lReq;
+    memset(&lReq, 0, sizeof(request_rec));
+    lReq.per_dir_config = reinterpret_cast<ap_conf_vector_t *>(apr_pcalloc(lParms->pool, sizeof(void *) * 1000));
+    lReq.uri = strdup("/spp/light/toto");
+    lReq.args = strdup("SID=ID");
+    DupConf **lConf = reinterpret_cast<DupConf **>(createDirConfig(lParms->pool, lParms->path));
+    ap_set_module_config(lReq.per_dir_config, &dup_module, lConf);
+
+    // Location not active
+    CPPUNIT_ASSERT_EQUAL(DECLINED, duplicateWithoutBody(&lReq));
+    CPPUNIT_ASSERT(lDummyThreadPool->mDummyQueued.empty());
+
+    // Payload by default: the input filter takes care of it
+    CPPUNIT_ASSERT(!setActive(lParms, lConf));
+    CPPUNIT_ASSERT_EQUAL(1, (*lConf)->payload);
+    CPPUNIT_ASSERT_EQUAL(DECLINED, duplicateWithoutBody(&lReq));
+    CPPUNIT_ASSERT(lDummyThreadPool->mDummyQueued.empty());
+
+    CPPUNIT_ASSERT(setPayload(lParms, lConf, "maybe"));
+    CPPUNIT_ASSERT(!setPayload(lParms, lConf, "False"));
+    CPPUNIT_ASSERT_EQUAL(0, (*lConf)->payload);
+    CPPUNIT_ASSERT_EQUAL(DECLINED, duplicateWithoutBody(&lReq));
+    CPPUNIT_ASSERT_EQUAL(size_t(1), lDummyThreadPool->mDummyQueued.size());
+    CPPUNIT_ASSERT_EQUAL(std::string("/spp/light"), lDummyThreadPool->mDummyQueued.front().mConfPath);
+    CPPUNIT_ASSERT_EQUAL(std::string("/spp/light/toto"), lDummyThreadPool->mDummyQueued.front().mPath);
+    CPPUNIT_ASSERT_EQUAL(std::string("SID=ID"), lDummyThreadPool->mDummyQueued.front().mArgs);
+    CPPUNIT_ASSERT(!lDummyThreadPool->mDummyQueued.front().hasBody());
+
+    // Sub requests are not duplicated
+    request_rec lSubReq = lReq;
+    lSubReq.main = &lReq;
+    CPPUNIT_ASSERT_EQUAL(DECLINED, duplicateWithoutBody(&lSubReq));
+    CPPUNIT_ASSERT_EQUAL(size_t(1), lDummyThreadPool->mDummyQueued.size());
+
+    // Header filters still apply
+    CPPUNIT_ASSERT(!setFilter(lParms, lConf, "HEADER", "SID", "^OTHER$"));
+    CPPUNIT_ASSERT_EQUAL(DECLINED, duplicateWithoutBody(&lReq));
+    CPPUNIT_ASSERT_EQUAL(size_t(1), lDummyThreadPool->mDummyQueued.size());
+
+    CPPUNIT_ASSERT(!setPayload(lParms, lConf, "True"));
+    CPPUNIT_ASSERT_EQUAL(1, (*lConf)->payload);
+    lDummyThreadPool->mDummyQueued.clear();
+    free(lReq.uri);
+    free(lReq.args);
+    free(lParms->path);
+}
+
+void TestModDup::testDuplicateAfterTransaction()
+{
+    cmd_parms * lParms = getParms();
+    lParms->path = strdup("/spp/transaction");
+    DummyThreadPool<RequestInfo> *lDummyThreadPool = dynamic_cast<DummyThreadPool<RequestInfo> *>(gThreadPool);
+    lDummyThreadPool->mDummyQueued.clear();
+
+    request_rec lReq;
+    memset(&lReq, 0, sizeof(request_rec));
+    lReq.per_dir_config = reinterpret_cast<ap_conf_vector_t *>(apr_pcalloc(lParms->pool, sizeof(void *) * 1000));
+    lReq.request_config = reinterpret_cast<ap_conf_vector_t *>(apr_pcalloc(lParms->pool, sizeof(void *) * 1000));
+    lReq.uri = strdup("/spp/transaction/toto");
+    lReq.args = strdup("SID=ID");
+    lReq.status = 404;
+    lReq.request_time = apr_time_now();
+    DupConf **lConf = reinterpret_cast<DupConf **>(createDirConfig(lParms->pool, lParms->path));
+    ap_set_module_config(lReq.per_dir_config, &dup_module, lConf);
+
+    CPPUNIT_ASSERT(setCapture(lParms, lConf, "nowhere", NULL));
+    CPPUNIT_ASSERT(setCapture(lParms, lConf, "filter", "Status"));
+    CPPUNIT_ASSERT(setCapture(lParms, lConf, "transaction", "Other"));
+
+    // Filter capture: nothing done once the response is sent
+    CPPUNIT_ASSERT(!setCapture(lParms, lConf, "filter", NULL));
+    CPPUNIT_ASSERT_EQUAL(DECLINED, duplicateAfterTransaction(&lReq));
+    CPPUNIT_ASSERT(lDummyThreadPool->mDummyQueued.empty());
+
+    // The input filter saw no body
+    CPPUNIT_ASSERT(!setCapture(lParms, lConf, "Transaction", NULL));
+    CPPUNIT_ASSERT_EQUAL(DECLINED, duplicateAfterTransaction(&lReq));
+    CPPUNIT_ASSERT_EQUAL(size_t(1), lDummyThreadPool->mDummyQueued.size());
+    CPPUNIT_ASSERT_EQUAL(std::string("/spp/transaction/toto"), lDummyThreadPool->mDummyQueued.back().mPath);
+    CPPUNIT_ASSERT(!lDummyThreadPool->mDummyQueued.back().hasBody());
+    CPPUNIT_ASSERT_EQUAL(0, lDummyThreadPool->mDummyQueued.back().mStatus);
+
+    // Without payload, the fixups hook leaves the request to the log_transaction hook
+    CPPUNIT_ASSERT(!setCapture(lParms, lConf, "transaction", "status"));
+    CPPUNIT_ASSERT(!setPayload(lParms, lConf, "False"));
+    CPPUNIT_ASSERT_EQUAL(DECLINED, duplicateWithoutBody(&lReq));
+    CPPUNIT_ASSERT_EQUAL(size_t(1), lDummyThreadPool->mDummyQueued.size());
+    CPPUNIT_ASSERT_EQUAL(DECLINED, duplicateAfterTransaction(&lReq));
+    CPPUNIT_ASSERT_EQUAL(size_t(2), lDummyThreadPool->mDummyQueued.size());
+    CPPUNIT_ASSERT_EQUAL(404, lDummyThreadPool->mDummyQueued.back().mStatus);
+    CPPUNIT_ASSERT(lDummyThreadPool->mDummyQueued.back().mDuration >= 0);
+
+    // Sub requests are not duplicated
+    request_rec lSubReq = lReq;
+    lSubReq.main = &lReq;
+    CPPUNIT_ASSERT_EQUAL(DECLINED, duplicateAfterTransaction(&lSubReq));
+    CPPUNIT_ASSERT_EQUAL(size_t(2), lDummyThreadPool->mDummyQueued.size());
+
+    lDummyThreadPool->mDummyQueued.clear();
+    free(lReq.uri);
+    free(lReq.args);
+    free(lParms->path);
+}
+
 void TestModDup::testRequestHandler()
 {
     // THIS TEST IS PRETTY MUCH INVALID AS THE CALLS RELY ON APACHE REQUEST FILTERING NOW
@@ -168,6 +427,12 @@ void TestModDup::testConfig()
         CPPUNIT_ASSERT(!setQueue(NULL, NULL, "0", "0"));
         CPPUNIT_ASSERT(setQueue(NULL, NULL, "-1", "2"));
 
+        // Negative sizes and sizes overflowing once multiplied by their unit are rejected
+        CPPUNIT_ASSERT(setQueueMemory(NULL, NULL, "-1", NULL));
+        CPPUNIT_ASSERT(setQueueMemory(NULL, NULL, "99999999999G", NULL));
+        CPPUNIT_ASSERT(setQueueMemory(NULL, NULL, "M", NULL));
+        CPPUNIT_ASSERT(setDispatcher(NULL, NULL, "-1K", NULL));
+
     cmd_parms * lParms = getParms();
         lParms->path = new char[10];
         strcpy(lParms->path, "/spp/main");
@@ -191,5 +456,10 @@ void TestModDup::testConfig()
         CPPUNIT_ASSERT(!setActive(lParms, lDoHandle));
         CPPUNIT_ASSERT(lDoHandle);
 
+        CPPUNIT_ASSERT(setResponseMode(lParms, lDoHandle, ""));
+        CPPUNIT_ASSERT(setResponseMode(lParms, lDoHandle, "keep"));
+        CPPUNIT_ASSERT(!setResponseMode(lParms, lDoHandle, "Abort"));
+        CPPUNIT_ASSERT(!setResponseMode(lParms, lDoHandle, "discard"));
+
         delete lParms->path;
 }
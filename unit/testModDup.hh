@@ -39,6 +39,11 @@ class TestModDup :
     CPPUNIT_TEST(testInit);
     CPPUNIT_TEST(testConfig);
     CPPUNIT_TEST(testRequestHandler);
+    CPPUNIT_TEST(testDuplicateWithoutBody);
+    CPPUNIT_TEST(testDuplicateAfterTransaction);
+    CPPUNIT_TEST(testRateLimit);
+    CPPUNIT_TEST(testSample);
+    CPPUNIT_TEST(testStatusHandler);
     CPPUNIT_TEST(testInitAndCleanUp);
     CPPUNIT_TEST_SUITE_END();
 
@@ -47,5 +52,10 @@ public:
 	void testInit();
 	void testConfig();
 	void testRequestHandler();
+	void testDuplicateWithoutBody();
+	void testDuplicateAfterTransaction();
+	void testRateLimit();
+	void testSample();
+	void testStatusHandler();
 	void testInitAndCleanUp();
 };
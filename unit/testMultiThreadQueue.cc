@@ -17,6 +17,7 @@
 */
 
 #include "MultiThreadQueue.hh"
+#include "RequestInfo.hh"
 #include "testMultiThreadQueue.hh"
 
 // cppunit
@@ -30,10 +31,12 @@ CPPUNIT_TEST_SUITE_REGISTRATION( TestMultiThreadQueue );
 
 using namespace DupModule;
 
-void TestMultiThreadQueue::run()
+static void checkQueue(eQueueBackend pBackend)
 {
 	unsigned lInCount, lOutCount, lDropCount;
 	MultiThreadQueue<int> queue;
+	queue.setBackend(pBackend);
+	CPPUNIT_ASSERT_EQUAL(pBackend, queue.getBackend());
 
 	queue.getCounters(lInCount, lOutCount, lDropCount);
 	CPPUNIT_ASSERT_EQUAL_UINT(0, lInCount);
@@ -95,6 +98,7 @@ void TestMultiThreadQueue::run()
 	// This works also with more complex types
 	typedef std::pair<std::string, std::string> complexType;
 	MultiThreadQueue<complexType > complexQueue;
+	complexQueue.setBackend(pBackend);
 	complexQueue.push(complexType(std::string("titi"), std::string("toto")));
 	complexType popped = complexQueue.pop();
 	CPPUNIT_ASSERT_EQUAL(popped.first, std::string("titi"));
@@ -104,3 +108,181 @@ void TestMultiThreadQueue::run()
 	CPPUNIT_ASSERT_EQUAL_UINT(0, lDropCount);
 	CPPUNIT_ASSERT_EQUAL_UINT(0, queue.size());
 }
+
+void TestMultiThreadQueue::run()
+{
+	checkQueue(LOCKED_DEQUE);
+}
+
+void TestMultiThreadQueue::runRing()
+{
+	checkQueue(LOCK_FREE_RING);
+
+	// Items queued before switching are kept
+	MultiThreadQueue<int> queue;
+	queue.push(1);
+	queue.push(2);
+	queue.setBackend(LOCK_FREE_RING);
+	CPPUNIT_ASSERT_EQUAL_UINT(2, queue.size());
+	CPPUNIT_ASSERT_EQUAL(1, queue.pop());
+	CPPUNIT_ASSERT_EQUAL(2, queue.pop());
+}
+
+static const int STOP = -1;
+
+static void producer(MultiThreadQueue<int> *queue, int count)
+{
+	for (int i = 1; i <= count; ++i) {
+		queue->push(i);
+	}
+}
+
+static void consumer(MultiThreadQueue<int> *queue, long *sum)
+{
+	for (;;) {
+		int item = queue->pop();
+		if (item == STOP) {
+			break;
+		}
+		*sum += item;
+	}
+}
+
+void TestMultiThreadQueue::concurrentRing()
+{
+	const int lThreads = 4, lCount = 10000;
+	MultiThreadQueue<int> queue;
+	queue.setBackend(LOCK_FREE_RING);
+
+	long lSums[lThreads] = {0};
+	boost::thread_group lConsumers, lProducers;
+	for (int i = 0; i < lThreads; ++i) {
+		lConsumers.create_thread(boost::bind(&consumer, &queue, &lSums[i]));
+		lProducers.create_thread(boost::bind(&producer, &queue, lCount));
+	}
+	lProducers.join_all();
+	for (int i = 0; i < lThreads; ++i) {
+		queue.push(STOP);
+	}
+	lConsumers.join_all();
+
+	// Nothing lost, nothing duplicated
+	long lTotal = 0;
+	for (int i = 0; i < lThreads; ++i) {
+		lTotal += lSums[i];
+	}
+	CPPUNIT_ASSERT_EQUAL(static_cast<long>(lThreads) * lCount * (lCount + 1) / 2, lTotal);
+
+	unsigned lInCount, lOutCount, lDropCount;
+	queue.getCounters(lInCount, lOutCount, lDropCount);
+	CPPUNIT_ASSERT_EQUAL_UINT(lThreads * lCount + lThreads, lInCount);
+	CPPUNIT_ASSERT_EQUAL_UINT(lThreads * lCount + lThreads, lOutCount);
+	CPPUNIT_ASSERT_EQUAL_UINT(0, lDropCount);
+}
+
+static void checkMove(eQueueBackend pBackend)
+{
+	MultiThreadQueue<RequestInfo> queue;
+	queue.setBackend(pBackend);
+
+	// The body buffer travels through the queue without being copied
+	std::string body(200000, 'x');
+	const char *data = body.data();
+	queue.push(RequestInfo("/spp", "/spp/main", "a=b", std::move(body)));
+	CPPUNIT_ASSERT(body.empty());
+
+	RequestInfo popped = queue.pop();
+	CPPUNIT_ASSERT(popped.mBody.data() == data);
+	CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(200000), popped.mBody.size());
+	CPPUNIT_ASSERT_EQUAL(std::string("a=b"), popped.mArgs);
+
+	// Copies are still possible, for the poison item for instance
+	queue.push_front(POISON_REQUEST);
+	CPPUNIT_ASSERT(queue.pop().isPoison());
+}
+
+void TestMultiThreadQueue::move()
+{
+	checkMove(LOCKED_DEQUE);
+	checkMove(LOCK_FREE_RING);
+}
+
+static void checkMemoryBudget(eQueueBackend pBackend)
+{
+	unsigned lInCount, lOutCount, lDropCount;
+	size_t lQueuedBytes, lDroppedBytes;
+	MultiThreadQueue<RequestInfo> queue;
+	queue.setBackend(pBackend);
+
+	const std::string lBody(1000, 'x');
+	RequestInfo lSmall("/spp", "/spp/main", "a=b");
+	RequestInfo lLarge("/spp", "/spp/main", "a=b", &lBody);
+	const size_t lSmallSize = queueItemSize(lSmall);
+	const size_t lLargeSize = queueItemSize(lLarge);
+	CPPUNIT_ASSERT(lLargeSize >= lSmallSize + 1000);
+
+	// Unbounded: only accounted for
+	queue.push(lLarge);
+	queue.getByteCounters(lQueuedBytes, lDroppedBytes);
+	CPPUNIT_ASSERT_EQUAL(lLargeSize, lQueuedBytes);
+	CPPUNIT_ASSERT_EQUAL(size_t(0), lDroppedBytes);
+	queue.pop();
+	queue.getByteCounters(lQueuedBytes, lDroppedBytes);
+	CPPUNIT_ASSERT_EQUAL(size_t(0), lQueuedBytes);
+	queue.getCounters(lInCount, lOutCount, lDropCount);
+
+	// Room for two large requests
+	queue.setMemoryBudget(2 * lLargeSize + lSmallSize);
+	queue.push(lLarge);
+	queue.push(lLarge);
+	queue.push(lLarge);
+	queue.push(lSmall);
+	queue.getByteCounters(lQueuedBytes, lDroppedBytes);
+	CPPUNIT_ASSERT_EQUAL(2 * lLargeSize + lSmallSize, lQueuedBytes);
+	CPPUNIT_ASSERT_EQUAL(lLargeSize, lDroppedBytes);
+	queue.getCounters(lInCount, lOutCount, lDropCount);
+	CPPUNIT_ASSERT_EQUAL_UINT(3, lInCount);
+	CPPUNIT_ASSERT_EQUAL_UINT(1, lDropCount);
+
+	// Priority items are never refused
+	queue.push_front(POISON_REQUEST);
+	CPPUNIT_ASSERT(queue.pop().isPoison());
+	for (unsigned i = 0; i < 3; ++i) {
+		queue.pop();
+	}
+	queue.getByteCounters(lQueuedBytes, lDroppedBytes);
+	CPPUNIT_ASSERT_EQUAL(size_t(0), lQueuedBytes);
+
+	// Large first: past half the budget, large requests go while small ones still get in
+	queue.setMemoryBudget(4 * lLargeSize - 1, DROP_LARGE_FIRST);
+	queue.push(lLarge);
+	queue.push(lLarge);
+	queue.push(lLarge);
+	queue.push(lSmall);
+	queue.getByteCounters(lQueuedBytes, lDroppedBytes);
+	CPPUNIT_ASSERT_EQUAL(2 * lLargeSize + lSmallSize, lQueuedBytes);
+	CPPUNIT_ASSERT_EQUAL(lLargeSize, lDroppedBytes);
+
+	// Whatever the budget
+	queue.pushUnbounded(lLarge);
+	queue.pushUnbounded(lLarge);
+	queue.getCounters(lInCount, lOutCount, lDropCount);
+	CPPUNIT_ASSERT_EQUAL_UINT(5, queue.size());
+
+	// Everything dropped and accounted for, but the poison pills
+	queue.pushUnbounded(RequestInfo());
+	CPPUNIT_ASSERT_EQUAL_UINT(5, queue.clear(RequestInfo()));
+	CPPUNIT_ASSERT_EQUAL_UINT(0, queue.size());
+	queue.getByteCounters(lQueuedBytes, lDroppedBytes);
+	CPPUNIT_ASSERT_EQUAL(size_t(0), lQueuedBytes);
+	CPPUNIT_ASSERT_EQUAL(4 * lLargeSize + lSmallSize, lDroppedBytes);
+	queue.getCounters(lInCount, lOutCount, lDropCount);
+	CPPUNIT_ASSERT_EQUAL_UINT(0, lOutCount);
+	CPPUNIT_ASSERT_EQUAL_UINT(5, lDropCount);
+}
+
+void TestMultiThreadQueue::memoryBudget()
+{
+	checkMemoryBudget(LOCKED_DEQUE);
+	checkMemoryBudget(LOCK_FREE_RING);
+}
@@ -31,8 +31,16 @@ class TestMultiThreadQueue :
 
     CPPUNIT_TEST_SUITE(TestMultiThreadQueue);
     CPPUNIT_TEST(run);
+    CPPUNIT_TEST(runRing);
+    CPPUNIT_TEST(concurrentRing);
+    CPPUNIT_TEST(move);
+    CPPUNIT_TEST(memoryBudget);
     CPPUNIT_TEST_SUITE_END();
 
 public:
     void run();
+    void runRing();
+    void concurrentRing();
+    void move();
+    void memoryBudget();
 };
@@ -0,0 +1,117 @@
+/*
+* mod_dup - duplicates apache requests
+* 
+* Copyright (C) 2013 Orange
+* 
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+#include "Prefilter.hh"
+#include "testPrefilter.hh"
+
+#include <boost/algorithm/string/join.hpp>
+#include <boost/regex.hpp>
+#include <boost/scoped_ptr.hpp>
+
+// cppunit
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/ui/text/TestRunner.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+CPPUNIT_TEST_SUITE_REGISTRATION( TestPrefilter );
+
+using namespace DupModule;
+
+static std::string literalsOf(const char *pPattern)
+{
+    return boost::algorithm::join(DupModule::extractLiterals(pPattern), "|");
+}
+
+void TestPrefilter::extractLiterals()
+{
+    CPPUNIT_ASSERT_EQUAL(std::string("Some secret sentence"), literalsOf("Some secret sentence"));
+    CPPUNIT_ASSERT_EQUAL(std::string("Something else|someword"), literalsOf("\\<(someword|Something else)\\>"));
+    // The longest run wins, escaped characters are literal
+    CPPUNIT_ASSERT_EQUAL(std::string(" <price>"), literalsOf("^[0-9]+ <price>\\d+\\.00"));
+    CPPUNIT_ASSERT_EQUAL(std::string("a.b(c"), literalsOf("a\\.b\\(c"));
+    // The digits of octal codes and back references are not literal
+    CPPUNIT_ASSERT_EQUAL(std::string("BCD"), literalsOf("\\0101BCD"));
+    CPPUNIT_ASSERT_EQUAL(std::string("-end"), literalsOf("(x)\\1-end"));
+    // Optional characters end the run without being part of it, repeated ones are part of it
+    CPPUNIT_ASSERT_EQUAL(std::string("world"), literalsOf("hello?world"));
+    CPPUNIT_ASSERT_EQUAL(std::string("ab"), literalsOf("ab{3}x*"));
+    CPPUNIT_ASSERT_EQUAL(std::string("abcd"), literalsOf("ab?abcd+e*"));
+    // Groups: each branch must have a literal, optional groups and lookarounds are not required
+    CPPUNIT_ASSERT_EQUAL(std::string(""), literalsOf("(foo|[0-9]+)"));
+    CPPUNIT_ASSERT_EQUAL(std::string("bar"), literalsOf("(?:foobar)?bar"));
+    CPPUNIT_ASSERT_EQUAL(std::string("xy"), literalsOf("(?=abcdef)xy"));
+    CPPUNIT_ASSERT_EQUAL(std::string("deux|one|three"), literalsOf("(?<n>one|(?:deux|three))"));
+    CPPUNIT_ASSERT_EQUAL(std::string("ab|cd"), literalsOf("ab|cd"));
+    CPPUNIT_ASSERT_EQUAL(std::string("bar"), literalsOf("(foo|[0-9]+)bar"));
+    // Exact groups are joined to the characters around them
+    CPPUNIT_ASSERT_EQUAL(std::string("<s>cafe</s>|<s>dead</s>"), literalsOf("<s>(dead|cafe)</s>"));
+    CPPUNIT_ASSERT_EQUAL(std::string("xay|xy"), literalsOf("x(a|)y"));
+    CPPUNIT_ASSERT_EQUAL(std::string("abab"), literalsOf("a(?:b(a))b+c?"));
+    CPPUNIT_ASSERT_EQUAL(std::string("key=a1|key=a2|key=b1|key=b2"), literalsOf("key=(a|b)(1|2)"));
+    CPPUNIT_ASSERT_EQUAL(std::string("[]x]"), literalsOf("[]x]\\[\\]x\\]"));
+    // Classes, comments and inline modifiers
+    CPPUNIT_ASSERT_EQUAL(std::string("end]"), literalsOf("[]a[:alpha:]]end]"));
+    CPPUNIT_ASSERT_EQUAL(std::string("abcd"), literalsOf("ab(?#comment)cd"));
+    CPPUNIT_ASSERT_EQUAL(std::string("dotall"), literalsOf("(?s)dotall"));
+    // Case insensitive and unknown constructs have no literal
+    CPPUNIT_ASSERT_EQUAL(std::string(""), literalsOf("(?i)gamma"));
+    CPPUNIT_ASSERT_EQUAL(std::string(""), literalsOf("(?x) g a m m a"));
+    CPPUNIT_ASSERT_EQUAL(std::string(""), literalsOf("\\Qgamma\\E"));
+    CPPUNIT_ASSERT_EQUAL(std::string(""), literalsOf("(unbalanced"));
+    // Nor those whose literals are too short or too many
+    CPPUNIT_ASSERT_EQUAL(std::string(""), literalsOf("a|bc"));
+    CPPUNIT_ASSERT_EQUAL(std::string(""), literalsOf("^[a-z]+$"));
+    CPPUNIT_ASSERT_EQUAL(std::string(""), literalsOf("aa|bb|cc|dd|ee|ff|gg|hh|ii"));
+}
+
+void TestPrefilter::mayMatch()
+{
+    {
+        boost::scoped_ptr<Prefilter> lPrefilter(Prefilter::create("\\<(someword|Something else)\\>"));
+        CPPUNIT_ASSERT(lPrefilter);
+        CPPUNIT_ASSERT(lPrefilter->mayMatch("a someword"));
+        CPPUNIT_ASSERT(lPrefilter->mayMatch("Something else"));
+        CPPUNIT_ASSERT(lPrefilter->mayMatch("Something elsewhere"));
+        CPPUNIT_ASSERT(!lPrefilter->mayMatch("Something els"));
+        CPPUNIT_ASSERT(!lPrefilter->mayMatch("omeword"));
+        CPPUNIT_ASSERT(!lPrefilter->mayMatch(""));
+        unsigned long lChecked, lRejected;
+        lPrefilter->getCounters(lChecked, lRejected);
+        CPPUNIT_ASSERT_EQUAL(6ul, lChecked);
+        CPPUNIT_ASSERT_EQUAL(3ul, lRejected);
+        lPrefilter->getCounters(lChecked, lRejected);
+        CPPUNIT_ASSERT_EQUAL(0ul, lChecked);
+        CPPUNIT_ASSERT_EQUAL(0ul, lRejected);
+    }
+    CPPUNIT_ASSERT(!Prefilter::create("[0-9]+"));
+
+    // Never rejects a text the regex matches, wherever the literal and its rare byte are
+    const char *lPatterns[] = {"Some secret", "<a>x", "(ab|XYZ)+[0-9]", "9z", "(?:\\n\\t)end$", "q(u|v)?ux", "\\0101BC"};
+    const char *lTexts[] = {"", "Some secret", "xxSome secretxx", "Some secre", "<a>x", "<a><a>x", "ababXYZ1", "XY1",
+                            "9z", "99", "z9z", "\n\tend", "\tend", "quux", "qux", "qvuxq", "q", "ABC"};
+    for (size_t p = 0; p < sizeof(lPatterns) / sizeof(*lPatterns); ++p) {
+        boost::scoped_ptr<Prefilter> lPrefilter(Prefilter::create(lPatterns[p]));
+        CPPUNIT_ASSERT(lPrefilter);
+        boost::regex lRegex(lPatterns[p]);
+        for (size_t t = 0; t < sizeof(lTexts) / sizeof(*lTexts); ++t) {
+            std::string lText(lTexts[t]);
+            if (boost::regex_search(lText, lRegex)) {
+                CPPUNIT_ASSERT(lPrefilter->mayMatch(lText));
+            }
+        }
+    }
+}
@@ -0,0 +1,150 @@
+/*
+* mod_dup - duplicates apache requests
+* 
+* Copyright (C) 2013 Orange
+* 
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include "RateLimiter.hh"
+#include "testRateLimiter.hh"
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+// cppunit
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/ui/text/TestRunner.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+CPPUNIT_TEST_SUITE_REGISTRATION( TestRateLimiter );
+
+#define CPPUNIT_ASSERT_EQUAL_ULL(a, b) CPPUNIT_ASSERT_EQUAL(static_cast<unsigned long long>(a), static_cast<unsigned long long>(b))
+
+using namespace DupModule;
+
+static const unsigned long long SECOND = 1000000000ULL;
+
+void TestRateLimiter::rateAndBurst()
+{
+    apr_pool_t *lPool;
+    apr_pool_create(&lPool, 0);
+    RateLimiter lLimiter;
+
+    // No limit, no shared memory
+    CPPUNIT_ASSERT_EQUAL(APR_SUCCESS, lLimiter.create(lPool));
+    CPPUNIT_ASSERT(lLimiter.allow("/loc", 0));
+
+    lLimiter.setLimit("/loc", 10, 3);
+    CPPUNIT_ASSERT_EQUAL(APR_SUCCESS, lLimiter.create(lPool));
+
+    // The burst goes through at once, then one request per 100 ms
+    unsigned long long lNow = 1000 * SECOND;
+    for (int i = 0; i < 3; ++i) {
+        CPPUNIT_ASSERT(lLimiter.allow("/loc", lNow));
+    }
+    CPPUNIT_ASSERT(!lLimiter.allow("/loc", lNow));
+    CPPUNIT_ASSERT(!lLimiter.allow("/loc", lNow + SECOND / 20));
+    CPPUNIT_ASSERT(lLimiter.allow("/loc", lNow + SECOND / 10));
+    CPPUNIT_ASSERT(!lLimiter.allow("/loc", lNow + SECOND / 10));
+    CPPUNIT_ASSERT_EQUAL_ULL(3, lLimiter.getRejectedCount());
+
+    // Other locations are not limited
+    CPPUNIT_ASSERT(lLimiter.allow("/other", lNow));
+
+    // After a pause, the burst is available again, not more
+    lNow += 10 * SECOND;
+    unsigned lAllowed = 0;
+    for (int i = 0; i < 10; ++i) {
+        lAllowed += lLimiter.allow("/loc", lNow);
+    }
+    CPPUNIT_ASSERT_EQUAL(3U, lAllowed);
+
+    // Sustained: 10 per second
+    lAllowed = 0;
+    for (unsigned long long t = 0; t < 5 * SECOND; t += SECOND / 100) {
+        lAllowed += lLimiter.allow("/loc", lNow + SECOND / 10 + t);
+    }
+    CPPUNIT_ASSERT_EQUAL(50U, lAllowed);
+    apr_pool_destroy(lPool);
+}
+
+void TestRateLimiter::locationAndGlobal()
+{
+    apr_pool_t *lPool;
+    apr_pool_create(&lPool, 0);
+    RateLimiter lLimiter;
+    lLimiter.setGlobalLimit(1, 3);
+    lLimiter.setLimit("/a", 1, 2);
+    // The last definition wins
+    lLimiter.setLimit("/a", 1, 1);
+    lLimiter.create(lPool);
+
+    unsigned long long lNow = 1000 * SECOND;
+    CPPUNIT_ASSERT(lLimiter.allow("/a", lNow));
+    CPPUNIT_ASSERT(!lLimiter.allow("/a", lNow));
+    CPPUNIT_ASSERT(lLimiter.allow("/b", lNow));
+    CPPUNIT_ASSERT(lLimiter.allow("/b", lNow));
+    // The global limit is reached: /b is rejected
+    CPPUNIT_ASSERT(!lLimiter.allow("/b", lNow));
+    CPPUNIT_ASSERT_EQUAL_ULL(2, lLimiter.getRejectedCount());
+
+    // Rejected by the global limit, a request does not use up the one of its location
+    lNow += SECOND;
+    CPPUNIT_ASSERT(lLimiter.allow("/b", lNow));
+    CPPUNIT_ASSERT(!lLimiter.allow("/a", lNow));
+    lNow += SECOND;
+    CPPUNIT_ASSERT(lLimiter.allow("/a", lNow));
+
+    // Not duplicated after all, a request gives its tokens back to both limits
+    CPPUNIT_ASSERT(!lLimiter.allow("/a", lNow));
+    lLimiter.giveBack("/a");
+    CPPUNIT_ASSERT(lLimiter.allow("/a", lNow));
+    apr_pool_destroy(lPool);
+}
+
+void TestRateLimiter::multiProcess()
+{
+    apr_pool_t *lPool;
+    apr_pool_create(&lPool, 0);
+    RateLimiter lLimiter;
+    lLimiter.setGlobalLimit(1, 1000);
+    lLimiter.create(lPool);
+
+    // The processes share the burst: exactly 1000 requests go through
+    static const unsigned lProcesses = 4;
+    int lPipe[2];
+    CPPUNIT_ASSERT_EQUAL(0, pipe(lPipe));
+    for (unsigned p = 0; p < lProcesses; ++p) {
+        if (!fork()) {
+            unsigned lAllowed = 0;
+            for (unsigned i = 0; i < 1000; ++i) {
+                lAllowed += lLimiter.allow("/", 1000 * SECOND);
+            }
+            write(lPipe[1], &lAllowed, sizeof(lAllowed));
+            _exit(0);
+        }
+    }
+    unsigned lTotal = 0;
+    for (unsigned p = 0; p < lProcesses; ++p) {
+        unsigned lAllowed;
+        CPPUNIT_ASSERT_EQUAL(static_cast<ssize_t>(sizeof(lAllowed)), read(lPipe[0], &lAllowed, sizeof(lAllowed)));
+        lTotal += lAllowed;
+        wait(NULL);
+    }
+    close(lPipe[0]);
+    close(lPipe[1]);
+    CPPUNIT_ASSERT_EQUAL(1000U, lTotal);
+    CPPUNIT_ASSERT_EQUAL_ULL(3000, lLimiter.getRejectedCount());
+    apr_pool_destroy(lPool);
+}
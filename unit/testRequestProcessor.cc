@@ -51,6 +51,92 @@ void TestRequestProcessor::testRun()
     // but this might be overkill for a unit test
 }
 
+void TestRequestProcessor::testRunMulti()
+{
+    RequestProcessor proc;
+    MultiThreadQueue<RequestInfo> queue;
+    proc.setSendMode(MULTI_SEND, 2);
+    proc.setDestination("localhost:8080");
+    proc.getDuplicatedCount();
+
+    // More requests than transfers allowed in flight, the pending ones must be picked up as others complete
+    for (int i = 0; i < 5; ++i) {
+        queue.push(RequestInfo("/spp/main", "/spp/main", "SID=ID_REQ&CREDENTIAL=1,toto&"));
+    }
+    queue.push(RequestInfo("/spp/main", "/spp/main", "SID=ID_REQ", std::string("<body/>")));
+    queue.push(POISON_REQUEST);
+
+    // Returns once the poison pill is received and every transfer in flight is over
+    proc.run(queue);
+    CPPUNIT_ASSERT_EQUAL(6U, proc.getDuplicatedCount());
+    CPPUNIT_ASSERT_EQUAL(0U, static_cast<unsigned>(queue.size()));
+}
+
+void TestRequestProcessor::testResponseStats()
+{
+    RequestProcessor proc;
+    MultiThreadQueue<RequestInfo> queue;
+    proc.setDestination("localhost:8080");
+
+    CPPUNIT_ASSERT_EQUAL(DISCARD_RESPONSE, proc.getResponseMode("/spp/main"));
+    CPPUNIT_ASSERT_EQUAL(std::string(""), proc.getResponseStats());
+
+    proc.setResponseMode("/spp/main", COUNT_RESPONSE);
+    proc.setResponseMode("/spp/other", ABORT_RESPONSE);
+    CPPUNIT_ASSERT_EQUAL(COUNT_RESPONSE, proc.getResponseMode("/spp/main"));
+    CPPUNIT_ASSERT_EQUAL(ABORT_RESPONSE, proc.getResponseMode("/spp/other"));
+    CPPUNIT_ASSERT_EQUAL(std::string("/spp/main: 0 0 0 0 0 0 0"), proc.getResponseStats());
+
+    // Nothing listens on the destination: the transfers fail and are counted as such on the counting location only
+    queue.push(RequestInfo("/spp/main", "/spp/main", "SID=ID_REQ"));
+    queue.push(RequestInfo("/spp/main", "/spp/main", "SID=ID_REQ"));
+    queue.push(RequestInfo("/spp/other", "/spp/other", "SID=ID_REQ"));
+    queue.push(POISON_REQUEST);
+    proc.run(queue);
+    CPPUNIT_ASSERT_EQUAL(std::string("/spp/main: 0 2 0 0 0 0 0"), proc.getResponseStats());
+    // Stats are reset once read
+    CPPUNIT_ASSERT_EQUAL(std::string("/spp/main: 0 0 0 0 0 0 0"), proc.getResponseStats());
+
+    proc.setResponseMode("/spp/main", DISCARD_RESPONSE);
+    CPPUNIT_ASSERT_EQUAL(std::string(""), proc.getResponseStats());
+}
+
+void TestRequestProcessor::testHeaderMayMatch()
+{
+    RequestProcessor proc;
+
+    // Unknown location or no filters: everything matches
+    CPPUNIT_ASSERT_EQUAL(HEADER_MATCH, proc.headerMayMatch("/toto", "INFO=nope"));
+    proc.addSubstitution("/toto", "INFO", "[i]", "f", tFilterBase::HEADER);
+    CPPUNIT_ASSERT_EQUAL(HEADER_MATCH, proc.headerMayMatch("/toto", "INFO=nope"));
+
+    // Header only filters decide
+    proc.addFilter("/toto", "INFO", "^my", tFilterBase::HEADER);
+    CPPUNIT_ASSERT_EQUAL(HEADER_MATCH, proc.headerMayMatch("/toto", "INFO=myinfo"));
+    CPPUNIT_ASSERT_EQUAL(HEADER_NO_MATCH, proc.headerMayMatch("/toto", "INFO=nope"));
+    CPPUNIT_ASSERT_EQUAL(HEADER_NO_MATCH, proc.headerMayMatch("/toto", ""));
+    proc.addRawFilter("/toto", "RAW", tFilterBase::HEADER);
+    CPPUNIT_ASSERT_EQUAL(HEADER_MATCH, proc.headerMayMatch("/toto", "INFO=nope&RAW"));
+    CPPUNIT_ASSERT_EQUAL(HEADER_NO_MATCH, proc.headerMayMatch("/toto", "INFO=nope"));
+
+    // A request matched from its header is only substituted by the worker
+    RequestInfo lMatched("/toto", "/toto", "INFO=nope");
+    lMatched.mFiltered = true;
+    CPPUNIT_ASSERT(proc.processRequest("/toto", lMatched));
+    CPPUNIT_ASSERT_EQUAL(std::string("INFO=nope"), lMatched.mArgs);
+    RequestInfo lSubstituted("/toto", "/toto", "INFO=myinfo");
+    lSubstituted.mFiltered = true;
+    CPPUNIT_ASSERT(proc.processRequest("/toto", lSubstituted));
+    CPPUNIT_ASSERT_EQUAL(std::string("INFO=myfnfo"), lSubstituted.mArgs);
+
+    // A body filter could still match
+    proc.addRawFilter("/titi", "RAW", tFilterBase::HEADER);
+    proc.addRawFilter("/titi", "BODY", tFilterBase::BODY);
+    CPPUNIT_ASSERT_EQUAL(HEADER_MAY_MATCH, proc.headerMayMatch("/titi", "INFO=nope"));
+    proc.addFilter("/tata", "INFO", "^my", tFilterBase::ALL);
+    CPPUNIT_ASSERT_EQUAL(HEADER_MAY_MATCH, proc.headerMayMatch("/tata", "INFO=nope"));
+}
+
 void TestRequestProcessor::testFilterAndSubstitution()
 {
     RequestProcessor proc;
@@ -80,53 +166,53 @@ void TestRequestProcessor::testSubstitution()
 
 
     CPPUNIT_ASSERT(proc.processRequest("/toto", ri));
-    CPPUNIT_ASSERT_EQUAL(std::string("TITI=t-t--&TUTU=tatae"), ri.mArgs);
+    CPPUNIT_ASSERT_EQUAL(std::string("titi=t-t--&tutu=tatae"), ri.mArgs);
 
     //  Empty fields are preserved
     query = "titi=tatae&tutu";
     ri = RequestInfo("/toto", "/toto", query);
     CPPUNIT_ASSERT(proc.processRequest("/toto", ri));
-    CPPUNIT_ASSERT_EQUAL(std::string("TITI=t-t--&TUTU"), ri.mArgs);
+    CPPUNIT_ASSERT_EQUAL(std::string("titi=t-t--&tutu"), ri.mArgs);
 
     //  Empty fields can be substituted
     proc.addSubstitution("/toto", "tutu", "^$", "titi", tFilterBase::eFilterScope::HEADER);
     query = "titi=tatae&tutu";
     ri = RequestInfo("/toto", "/toto", query);
     CPPUNIT_ASSERT(proc.processRequest("/toto", ri));
-    CPPUNIT_ASSERT_EQUAL(std::string("TITI=t-t--&TUTU=titi"), ri.mArgs);
+    CPPUNIT_ASSERT_EQUAL(std::string("titi=t-t--&tutu=titi"), ri.mArgs);
 
     // Substitutions are case-sensitive
     query = "titi=TATAE&tutu=TATAE";
     ri = RequestInfo("/toto", "/toto", query);
     CPPUNIT_ASSERT(proc.processRequest("/toto", ri));
-    CPPUNIT_ASSERT_EQUAL(std::string("TITI=TATAE&TUTU=TATAE"), ri.mArgs);
+    CPPUNIT_ASSERT_EQUAL(std::string("titi=TATAE&tutu=TATAE"), ri.mArgs);
 
     // Substitutions on the same path and field are executed in the order they are added
     proc.addSubstitution("/toto", "titi", "-(.*)-", "T\\1", tFilterBase::eFilterScope::HEADER);
     query = "titi=tatae&tutu=tatae";
     ri = RequestInfo("/toto", "/toto", query);
     CPPUNIT_ASSERT(proc.processRequest("/toto", ri));
-    CPPUNIT_ASSERT_EQUAL(std::string("TITI=tTt-&TUTU=tatae"), ri.mArgs);
+    CPPUNIT_ASSERT_EQUAL(std::string("titi=tTt-&tutu=tatae"), ri.mArgs);
 
     // Substituions in other field but same path
     proc.addSubstitution("/toto", "tutu", "ata", "W", tFilterBase::eFilterScope::HEADER);
     query = "titi=tatae&tutu=tatae";
     ri = RequestInfo("/toto", "/toto", query);
     CPPUNIT_ASSERT(proc.processRequest("/toto", ri));
-    CPPUNIT_ASSERT_EQUAL(std::string("TITI=tTt-&TUTU=tWe"), ri.mArgs);
+    CPPUNIT_ASSERT_EQUAL(std::string("titi=tTt-&tutu=tWe"), ri.mArgs);
 
     // Substitution on another path
     proc.addSubstitution("/x/y/z", "tutu", "ata", "W", tFilterBase::eFilterScope::HEADER);
     query = "titi=tatae&tutu=tatae";
     ri = RequestInfo("/x/y/z", "/x/y/z", query);
     CPPUNIT_ASSERT(proc.processRequest("/x/y/z", ri));
-    CPPUNIT_ASSERT_EQUAL(std::string("TITI=tatae&TUTU=tWe"), ri.mArgs);
+    CPPUNIT_ASSERT_EQUAL(std::string("titi=tatae&tutu=tWe"), ri.mArgs);
 
     // ... doesn't affect previous path
     query = "titi=tatae&tutu=tatae";
     ri = RequestInfo("/toto", "/toto", query);
     CPPUNIT_ASSERT(proc.processRequest("/toto", ri));
-    CPPUNIT_ASSERT_EQUAL(std::string("TITI=tTt-&TUTU=tWe"), ri.mArgs);
+    CPPUNIT_ASSERT_EQUAL(std::string("titi=tTt-&tutu=tWe"), ri.mArgs);
 
     // ... nor unknow path
     query = "titi=tatae&tutu=tatae";
@@ -139,13 +225,19 @@ void TestRequestProcessor::testSubstitution()
     query = "titi=1%2C2%2C3";
     ri = RequestInfo("/escaped", "/escaped", query);
     CPPUNIT_ASSERT(proc.processRequest("/escaped", ri));
-    CPPUNIT_ASSERT_EQUAL(ri.mArgs, std::string("TITI=1%2f2%2f3"));
+    CPPUNIT_ASSERT_EQUAL(ri.mArgs, std::string("titi=1%2f2%2f3"));
+
+    // Only the values substituted are encoded again, the other arguments are copied as they are
+    query = "tutu=%41+b%2c&&titi=1%2C2&x=";
+    ri = RequestInfo("/escaped", "/escaped", query);
+    CPPUNIT_ASSERT(proc.processRequest("/escaped", ri));
+    CPPUNIT_ASSERT_EQUAL(std::string("tutu=%41+b%2c&&titi=1%2f2&x="), ri.mArgs);
 
     // Keys should be compared case-insensitively
     query = "TiTI=1%2C2%2C3";
     ri = RequestInfo("/UNKNOWN", "/UNKNOWN", query);
     CPPUNIT_ASSERT(proc.processRequest("/escaped", ri));
-    CPPUNIT_ASSERT_EQUAL(ri.mArgs, std::string("TITI=1%2f2%2f3"));
+    CPPUNIT_ASSERT_EQUAL(ri.mArgs, std::string("TiTI=1%2f2%2f3"));
 }
 
 void TestRequestProcessor::init()
@@ -154,6 +246,11 @@ void TestRequestProcessor::init()
     Log::init(NULL);
 }
 
+static void addRejected(std::vector<std::string> *pRejected, const std::string &pConfPath)
+{
+    pRejected->push_back(pConfPath);
+}
+
 void TestRequestProcessor::testFilterBasic()
 {
     {
@@ -165,11 +262,17 @@ void TestRequestProcessor::testFilterBasic()
     }
 
     {
-        // Simple Filter NO MATCH
+        // Simple Filter NO MATCH, the rejection is notified
         RequestProcessor proc;
+        std::vector<std::string> lRejected;
+        proc.setRejectionListener(boost::bind(addRejected, &lRejected, _1));
         proc.addFilter("/toto", "INFO", "KIDO", tFilterBase::ALL);
         RequestInfo ri = RequestInfo("/toto", "/toto/pws/titi/", "INFO=myinfo");
         CPPUNIT_ASSERT(!proc.processRequest("/toto", ri));
+        ri = RequestInfo("/toto", "/toto/pws/titi/", "INFO=KIDO");
+        CPPUNIT_ASSERT(proc.processRequest("/toto", ri));
+        CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(1), lRejected.size());
+        CPPUNIT_ASSERT_EQUAL(std::string("/toto"), lRejected[0]);
     }
 
     {
@@ -387,3 +490,266 @@ void TestRequestProcessor::testRawSubstitution()
     }
 
 }
+
+void TestRequestProcessor::testRawFilterMatcher()
+{
+    // Many raw filters, combined into one pass per part, behave as if each was searched on its own
+    RequestProcessor proc;
+    proc.addRawFilter("/toto", "alpha|beta", tFilterBase::HEADER);
+    proc.addRawFilter("/toto", "^start", tFilterBase::BODY);
+    proc.addRawFilter("/toto", "(?i)gamma", tFilterBase::ALL);
+    proc.addRawFilter("/toto", "end$", tFilterBase::ALL);
+    proc.addRawFilter("/toto", "(x+)-\\1", tFilterBase::BODY);
+
+    const char *lMatching[][2] = {
+        {"a=alpha", ""},
+        {"a=1", "start=1"},
+        {"a=GAMMA", ""},
+        {"a=1", "x=Gamma"},
+        {"a=the end", ""},
+        {"a=1", "the end"},
+        {"a=1", "xx-xx"},
+    };
+    for (size_t i = 0; i < sizeof(lMatching) / sizeof(*lMatching); ++i) {
+        std::string lBody(lMatching[i][1]);
+        RequestInfo ri("/toto", "/toto", lMatching[i][0], &lBody);
+        CPPUNIT_ASSERT(proc.processRequest("/toto", ri));
+    }
+
+    const char *lNotMatching[][2] = {
+        // Wrong part
+        {"a=1", "alpha"},
+        {"start=1", ""},
+        {"a=xx-xx", ""},
+        // Anchors and modifiers stay within their filter
+        {"a=1", "x=start"},
+        {"a=end&b=1", "the end="},
+        {"a=1", "xx-yy"},
+    };
+    for (size_t i = 0; i < sizeof(lNotMatching) / sizeof(*lNotMatching); ++i) {
+        std::string lBody(lNotMatching[i][1]);
+        RequestInfo ri("/toto", "/toto", lNotMatching[i][0], &lBody);
+        CPPUNIT_ASSERT(!proc.processRequest("/toto", ri));
+    }
+
+    // Recursions, conditionals, named groups and the extended mode are not broken by the groups of the others
+    RequestProcessor lOwn;
+    lOwn.addRawFilter("/toto", "(z)", tFilterBase::BODY);
+    lOwn.addRawFilter("/toto", "^(a)(?1)$", tFilterBase::BODY);
+    lOwn.addRawFilter("/toto", "^(<)?b(?(1)>)$", tFilterBase::BODY);
+    lOwn.addRawFilter("/toto", "(?<w>foo)bar", tFilterBase::BODY);
+    lOwn.addRawFilter("/toto", "(?<w>baq)qux", tFilterBase::BODY);
+    lOwn.addRawFilter("/toto", "(?x) c d # the rest", tFilterBase::BODY);
+    lOwn.addRawFilter("/toto", "last", tFilterBase::BODY);
+
+    const char *lOwnMatching[] = {"aa", "<b>", "b", "foobar", "baqqux", "cd", "last"};
+    for (size_t i = 0; i < sizeof(lOwnMatching) / sizeof(*lOwnMatching); ++i) {
+        std::string lBody(lOwnMatching[i]);
+        RequestInfo ri("/toto", "/toto", "a=1", &lBody);
+        CPPUNIT_ASSERT_MESSAGE(lOwnMatching[i], lOwn.processRequest("/toto", ri));
+    }
+    const char *lOwnNotMatching[] = {"aq", "<b", "b>", "foo", "c d"};
+    for (size_t i = 0; i < sizeof(lOwnNotMatching) / sizeof(*lOwnNotMatching); ++i) {
+        std::string lBody(lOwnNotMatching[i]);
+        RequestInfo ri("/toto", "/toto", "a=1", &lBody);
+        CPPUNIT_ASSERT_MESSAGE(lOwnNotMatching[i], !lOwn.processRequest("/toto", ri));
+    }
+}
+
+void TestRequestProcessor::testRegexEngine()
+{
+    // Every engine built in filters and substitutes like boost
+    const eRegexEngine lEngines[] = {BOOST_ENGINE, PCRE2_ENGINE, RE2_ENGINE};
+    for (size_t e = 0; e < sizeof(lEngines) / sizeof(*lEngines); ++e) {
+        if (!isRegexEngineAvailable(lEngines[e])) {
+            continue;
+        }
+        RequestProcessor proc;
+        proc.setRegexEngine(lEngines[e]);
+        proc.addFilter("/toto", "INFO", "^my", tFilterBase::ALL);
+        proc.addRawFilter("/toto", "^line$", tFilterBase::BODY);
+        proc.addRawFilter("/toto", "a.b", tFilterBase::BODY);
+        proc.addSubstitution("/toto", "INFO", "-(.*)-", "T\\1$1${1}$&$$", tFilterBase::HEADER);
+        proc.addRawSubstitution("/toto", "x*", "-", tFilterBase::BODY);
+
+        {
+            std::string lBody;
+            RequestInfo ri("/toto", "/toto", "INFO=my-a-", &lBody);
+            CPPUNIT_ASSERT(proc.processRequest("/toto", ri));
+            CPPUNIT_ASSERT_EQUAL(std::string("INFO=myTaaa-a-$"), ri.mArgs);
+        }
+        {
+            // ^ and $ match at the line breaks, . matches them
+            std::string lBody("first\nline\nlast");
+            RequestInfo ri("/toto", "/toto", "INFO=no", &lBody);
+            CPPUNIT_ASSERT(proc.processRequest("/toto", ri));
+            lBody = "a\nb";
+            RequestInfo ri2("/toto", "/toto", "INFO=no", &lBody);
+            CPPUNIT_ASSERT(proc.processRequest("/toto", ri2));
+            lBody = "first line";
+            RequestInfo ri3("/toto", "/toto", "INFO=no", &lBody);
+            CPPUNIT_ASSERT(!proc.processRequest("/toto", ri3));
+        }
+        {
+            // Empty matches are replaced once at each position
+            std::string lBody("axb");
+            RequestInfo ri("/toto", "/toto", "INFO=my", &lBody);
+            CPPUNIT_ASSERT(proc.processRequest("/toto", ri));
+            CPPUNIT_ASSERT_EQUAL(std::string("-a--b-"), ri.mBody);
+        }
+    }
+
+    // Expressions the engine lacks a feature of are rejected when the filter is added
+    if (isRegexEngineAvailable(RE2_ENGINE)) {
+        RequestProcessor proc;
+        proc.setRegexEngine(RE2_ENGINE);
+        CPPUNIT_ASSERT_THROW(proc.addRawFilter("/toto", "(x+)-\\1", tFilterBase::BODY), RegexError);
+        CPPUNIT_ASSERT_THROW(proc.addFilter("/toto", "INFO", "a(?=b)", tFilterBase::ALL), RegexError);
+    }
+    if (isRegexEngineAvailable(PCRE2_ENGINE)) {
+        RequestProcessor proc;
+        proc.setRegexEngine(PCRE2_ENGINE);
+        CPPUNIT_ASSERT_THROW(proc.addRawFilter("/toto", "\\<word\\>", tFilterBase::BODY), RegexError);
+        CPPUNIT_ASSERT_THROW(proc.addRawSubstitution("/toto", "a", "(?1b:c)", tFilterBase::BODY), RegexError);
+        CPPUNIT_ASSERT_THROW(proc.addSubstitution("/toto", "INFO", "a", "\\U$0", tFilterBase::BODY), RegexError);
+    }
+
+    {
+        // or when the engine is changed afterwards, in which case nothing changes
+        RequestProcessor proc;
+        proc.addRawFilter("/toto", "(x+)-\\1", tFilterBase::BODY);
+        proc.addRawSubstitution("/toto", "x", "(y)", tFilterBase::BODY);
+        if (isRegexEngineAvailable(RE2_ENGINE)) {
+            CPPUNIT_ASSERT_THROW(proc.setRegexEngine(RE2_ENGINE), RegexError);
+        }
+        if (isRegexEngineAvailable(PCRE2_ENGINE)) {
+            CPPUNIT_ASSERT_THROW(proc.setRegexEngine(PCRE2_ENGINE), RegexError);
+        }
+        std::string lBody("xx-xx");
+        RequestInfo ri("/toto", "/toto", "", &lBody);
+        CPPUNIT_ASSERT(proc.processRequest("/toto", ri));
+        CPPUNIT_ASSERT_EQUAL(std::string("yy-yy"), ri.mBody);
+    }
+
+    eRegexEngine lEngine;
+    CPPUNIT_ASSERT(getRegexEngine("pcre2", lEngine));
+    CPPUNIT_ASSERT_EQUAL(PCRE2_ENGINE, lEngine);
+    CPPUNIT_ASSERT(!getRegexEngine("perl", lEngine));
+    CPPUNIT_ASSERT(isRegexEngineAvailable(BOOST_ENGINE));
+}
+
+void TestRequestProcessor::testPrefilterStats()
+{
+    RequestProcessor proc;
+    proc.addFilter("/toto", "INFO", "^(admin|root)$", tFilterBase::HEADER);
+    proc.addFilter("/toto", "ID", "[0-9]+", tFilterBase::HEADER);
+    proc.addRawFilter("/toto", "secret sentence", tFilterBase::BODY);
+    proc.addRawFilter("/toto", "<debug>(on|yes)</debug>", tFilterBase::BODY);
+
+    const char *lRequests[][2] = {
+        // Rejected by all the prefilters
+        {"INFO=user", "nothing"},
+        // The literal is there, but the regex does not match
+        {"INFO=administrator", "<debug>off</debug>"},
+        // The raw filters match
+        {"INFO=user", "a secret sentence"},
+        {"INFO=user", "<debug>yes</debug>"},
+    };
+    bool lMatches[] = {false, false, true, true};
+    for (size_t i = 0; i < sizeof(lRequests) / sizeof(*lRequests); ++i) {
+        std::string lBody(lRequests[i][1]);
+        RequestInfo ri("/toto", "/toto", lRequests[i][0], &lBody);
+        CPPUNIT_ASSERT_EQUAL(lMatches[i], proc.processRequest("/toto", ri));
+    }
+    // The raw filters are combined, their prefilters are checked until one finds its literal
+    CPPUNIT_ASSERT_EQUAL(std::string("/toto ^(admin|root)$: 3/4, "
+                                     "/toto secret sentence: 3/4, "
+                                     "/toto <debug>(on|yes)</debug>: 2/3"), proc.getPrefilterStats());
+    CPPUNIT_ASSERT_EQUAL(std::string("/toto ^(admin|root)$: 0/0, "
+                                     "/toto secret sentence: 0/0, "
+                                     "/toto <debug>(on|yes)</debug>: 0/0"), proc.getPrefilterStats());
+}
+
+void TestRequestProcessor::testRegexBudget()
+{
+    // Only the backtracking engines have a budget
+    const eRegexEngine lEngines[] = {BOOST_ENGINE, PCRE2_ENGINE};
+    for (size_t e = 0; e < sizeof(lEngines) / sizeof(*lEngines); ++e) {
+        if (!isRegexEngineAvailable(lEngines[e])) {
+            continue;
+        }
+        RequestProcessor proc;
+        proc.setRegexEngine(lEngines[e]);
+        proc.addRawFilter("/toto", "(a+)+b", tFilterBase::BODY);
+        proc.addRawFilter("/toto", "^go$", tFilterBase::BODY);
+        proc.addRawSubstitution("/toto", "(x+x+)+y", "z", tFilterBase::BODY);
+        // Set afterwards: the expressions already added get it
+        proc.setRegexBudget(100000);
+
+        {
+            std::string lBody("aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa!b\nno");
+            RequestInfo ri("/toto", "/toto", "", &lBody);
+            CPPUNIT_ASSERT(!proc.processRequest("/toto", ri));
+        }
+        {
+            // The other raw filter still matches, each being searched within its own budget
+            std::string lBody("aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa!b\ngo");
+            RequestInfo ri("/toto", "/toto", "", &lBody);
+            CPPUNIT_ASSERT(proc.processRequest("/toto", ri));
+        }
+        {
+            std::string lBody("xxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxx!y\ngo");
+            RequestInfo ri("/toto", "/toto", "", &lBody);
+            CPPUNIT_ASSERT(!proc.processRequest("/toto", ri));
+        }
+        {
+            // The requests within the budget are processed as usual
+            std::string lBody("go\naab xxy");
+            RequestInfo ri("/toto", "/toto", "", &lBody);
+            CPPUNIT_ASSERT(proc.processRequest("/toto", ri));
+            CPPUNIT_ASSERT_EQUAL(std::string("go\naab z"), ri.mBody);
+        }
+        // The filter exceeding its budget is reported, not the alternation it is searched in
+        CPPUNIT_ASSERT_EQUAL(std::string("(a+)+b: 1, (x+x+)+y: 1"), proc.getBudgetStats());
+        CPPUNIT_ASSERT_EQUAL(std::string(""), proc.getBudgetStats());
+
+        // Without budget, only the complexity bounds of the engine remain
+        proc.setRegexBudget(0);
+        std::string lBody("go\naab");
+        RequestInfo ri("/toto", "/toto", "", &lBody);
+        CPPUNIT_ASSERT(proc.processRequest("/toto", ri));
+    }
+}
+
+void TestRequestProcessor::testLocationUrlCodec()
+{
+    RequestProcessor proc;
+    const char *lPaths[] = {"/default", "/apache", "/own"};
+    for (size_t i = 0; i < sizeof(lPaths) / sizeof(*lPaths); ++i) {
+        proc.addFilter(lPaths[i], "Y", "^a b$", tFilterBase::HEADER);
+        proc.addFilter(lPaths[i], "Y", "^a\\+b$", tFilterBase::HEADER);
+        proc.addFilter(lPaths[i], "Z", "^ $", tFilterBase::HEADER);
+        proc.addSubstitution(lPaths[i], "X", " ", "+", tFilterBase::HEADER);
+    }
+    proc.setUrlCodec("/apache", "apache");
+
+    // '+' is a space for the default codec only, which escapes it
+    RequestInfo ri("/default", "/default", "x=a+b%20c&y=a+b");
+    CPPUNIT_ASSERT(proc.processRequest("/default", ri));
+    CPPUNIT_ASSERT_EQUAL(std::string("x=a%2bb%2bc&y=a+b"), ri.mArgs);
+    ri = RequestInfo("/apache", "/apache", "x=a+b%20c&y=a+b");
+    CPPUNIT_ASSERT(proc.processRequest("/apache", ri));
+    CPPUNIT_ASSERT_EQUAL(std::string("x=a+b+c&y=a+b"), ri.mArgs);
+    CPPUNIT_ASSERT(!proc.headerMayMatch("/apache", "z=+"));
+    CPPUNIT_ASSERT(proc.headerMayMatch("/default", "z=+"));
+
+    // The codec of the processor only applies to the locations without their own
+    proc.setUrlCodec("/own", "default");
+    proc.setUrlCodec("apache");
+    ri = RequestInfo("/default", "/default", "x=a+b%20c&y=a+b");
+    CPPUNIT_ASSERT(proc.processRequest("/default", ri));
+    CPPUNIT_ASSERT_EQUAL(std::string("x=a+b+c&y=a+b"), ri.mArgs);
+    ri = RequestInfo("/own", "/own", "x=a+b%20c&y=a+b");
+    CPPUNIT_ASSERT(proc.processRequest("/own", ri));
+    CPPUNIT_ASSERT_EQUAL(std::string("x=a%2bb%2bc&y=a+b"), ri.mArgs);
+}
@@ -35,8 +35,16 @@ class TestRequestProcessor :
     CPPUNIT_TEST(testSubstitution);
     CPPUNIT_TEST(testFilterAndSubstitution);
     CPPUNIT_TEST(testRun);
+    CPPUNIT_TEST(testRunMulti);
+    CPPUNIT_TEST(testResponseStats);
+    CPPUNIT_TEST(testHeaderMayMatch);
     CPPUNIT_TEST(testFilterBasic);
     CPPUNIT_TEST(testRawSubstitution);
+    CPPUNIT_TEST(testRawFilterMatcher);
+    CPPUNIT_TEST(testRegexEngine);
+    CPPUNIT_TEST(testPrefilterStats);
+    CPPUNIT_TEST(testRegexBudget);
+    CPPUNIT_TEST(testLocationUrlCodec);
     CPPUNIT_TEST_SUITE_END();
 
 public:
@@ -47,6 +55,14 @@ public:
     void testFilterAndSubstitution();
     void testParseArgs();
     void testRun();
+    void testRunMulti();
+    void testResponseStats();
+    void testHeaderMayMatch();
     void testFilterBasic();
     void testRawSubstitution();
+    void testRawFilterMatcher();
+    void testRegexEngine();
+    void testPrefilterStats();
+    void testRegexBudget();
+    void testLocationUrlCodec();
 };
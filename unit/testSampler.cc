@@ -0,0 +1,84 @@
+/*
+* mod_dup - duplicates apache requests
+* 
+* Copyright (C) 2013 Orange
+* 
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include "Sampler.hh"
+#include "testSampler.hh"
+
+#include <boost/lexical_cast.hpp>
+#include <string.h>
+
+// cppunit
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/ui/text/TestRunner.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+CPPUNIT_TEST_SUITE_REGISTRATION( TestSampler );
+
+using namespace DupModule;
+
+static std::string fieldOf(const char *pArgs, const char *pField)
+{
+    const char *lValue;
+    size_t lSize;
+    if (!DupModule::findField(pArgs, strlen(pArgs), pField, lValue, lSize)) {
+        return "<none>";
+    }
+    return std::string(lValue, lSize);
+}
+
+void TestSampler::findField()
+{
+    CPPUNIT_ASSERT_EQUAL(std::string("42"), fieldOf("user=42", "user"));
+    CPPUNIT_ASSERT_EQUAL(std::string("42"), fieldOf("a=1&USER=42&b=2", "user"));
+    CPPUNIT_ASSERT_EQUAL(std::string("a%20b"), fieldOf("a=1&user=a%20b", "user"));
+    CPPUNIT_ASSERT_EQUAL(std::string(""), fieldOf("user=&a=1", "user"));
+    // Names are compared whole
+    CPPUNIT_ASSERT_EQUAL(std::string("<none>"), fieldOf("username=42&myuser=1", "user"));
+    CPPUNIT_ASSERT_EQUAL(std::string("<none>"), fieldOf("user&a=1", "user"));
+    CPPUNIT_ASSERT_EQUAL(std::string("<none>"), fieldOf("", "user"));
+}
+
+void TestSampler::sample()
+{
+    // Everything is kept at 100%, nothing at 0%
+    CPPUNIT_ASSERT_EQUAL(SAMPLE_IN, DupModule::sample(SAMPLE_ALL, "user", "", "/uri", NULL));
+    CPPUNIT_ASSERT_EQUAL(SAMPLE_OUT, DupModule::sample(0, NULL, "", "/uri", NULL));
+
+    // The field decides, whatever the rest of the request
+    for (int i = 0; i < 100; ++i) {
+        std::string lUser = boost::lexical_cast<std::string>(i);
+        eSampling lSampling = DupModule::sample(5000, "user", ("user=" + lUser).c_str(), "/a", NULL);
+        CPPUNIT_ASSERT_EQUAL(lSampling, DupModule::sample(5000, "user", ("x=1&user=" + lUser).c_str(), "/b", NULL));
+        std::string lBody("user=" + lUser);
+        CPPUNIT_ASSERT_EQUAL(lSampling, DupModule::sample(5000, "user", "", "/c", &lBody));
+    }
+
+    // The body is needed if the field is not in the query
+    CPPUNIT_ASSERT_EQUAL(SAMPLE_LATER, DupModule::sample(5000, "user", "a=1", "/uri", NULL));
+    // Nowhere: the uri decides
+    std::string lBody("a=1");
+    CPPUNIT_ASSERT_EQUAL(DupModule::sample(5000, NULL, "", "/uri", NULL), DupModule::sample(5000, "user", "a=1", "/uri", &lBody));
+
+    // The proportion is respected
+    unsigned lIn = 0;
+    for (int i = 0; i < 100000; ++i) {
+        std::string lArgs = "user=" + boost::lexical_cast<std::string>(i);
+        lIn += DupModule::sample(500, "user", lArgs.c_str(), "/uri", NULL) == SAMPLE_IN;
+    }
+    CPPUNIT_ASSERT(lIn > 4700 && lIn < 5300);
+}
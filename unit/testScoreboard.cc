@@ -0,0 +1,151 @@
+/*
+* mod_dup - duplicates apache requests
+* 
+* Copyright (C) 2013 Orange
+* 
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include "Scoreboard.hh"
+#include "testScoreboard.hh"
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+// cppunit
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/ui/text/TestRunner.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+CPPUNIT_TEST_SUITE_REGISTRATION( TestScoreboard );
+
+#define CPPUNIT_ASSERT_EQUAL_ULL(a, b) CPPUNIT_ASSERT_EQUAL(static_cast<unsigned long long>(a), static_cast<unsigned long long>(b))
+
+using namespace DupModule;
+
+void TestScoreboard::attachUpdate()
+{
+    apr_pool_t *lPool;
+    apr_pool_create(&lPool, 0);
+    Scoreboard lScoreboard;
+    CPPUNIT_ASSERT_EQUAL(APR_SUCCESS, lScoreboard.create(lPool, 2));
+    CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(2), lScoreboard.getSlotCount());
+
+    // Not attached yet: updates are ignored
+    unsigned long long lTotals[SB_VALUE_COUNT];
+    lScoreboard.add(SB_IN, 5);
+    CPPUNIT_ASSERT_EQUAL(0U, lScoreboard.aggregate(lTotals));
+    CPPUNIT_ASSERT_EQUAL_ULL(0, lTotals[SB_IN]);
+
+    CPPUNIT_ASSERT(lScoreboard.attach());
+    lScoreboard.add(SB_IN, 5);
+    lScoreboard.add(SB_IN, 2);
+    lScoreboard.set(SB_THREADS, 3);
+    CPPUNIT_ASSERT_EQUAL(1U, lScoreboard.aggregate(lTotals));
+    CPPUNIT_ASSERT_EQUAL_ULL(7, lTotals[SB_IN]);
+    CPPUNIT_ASSERT_EQUAL_ULL(3, lTotals[SB_THREADS]);
+    CPPUNIT_ASSERT_EQUAL_ULL(0, lTotals[SB_DROP]);
+
+    unsigned long long lValues[SB_VALUE_COUNT];
+    CPPUNIT_ASSERT_EQUAL(getpid(), lScoreboard.read(0, lValues));
+    CPPUNIT_ASSERT_EQUAL_ULL(7, lValues[SB_IN]);
+    CPPUNIT_ASSERT_EQUAL(static_cast<pid_t>(0), lScoreboard.read(1, lValues));
+
+    // The counters outlive the process, not the current values
+    lScoreboard.detach();
+    CPPUNIT_ASSERT_EQUAL(0U, lScoreboard.aggregate(lTotals));
+    CPPUNIT_ASSERT_EQUAL_ULL(7, lTotals[SB_IN]);
+    CPPUNIT_ASSERT_EQUAL_ULL(0, lTotals[SB_THREADS]);
+
+    CPPUNIT_ASSERT_EQUAL(std::string("DupReq"), std::string(Scoreboard::getName(SB_DUPLICATED)));
+    apr_pool_destroy(lPool);
+}
+
+void TestScoreboard::multiProcess()
+{
+    apr_pool_t *lPool;
+    apr_pool_create(&lPool, 0);
+    Scoreboard lScoreboard;
+    lScoreboard.create(lPool, 3);
+
+    // Two processes count at once, each in its own slot
+    pid_t lPids[2];
+    for (unsigned p = 0; p < 2; ++p) {
+        lPids[p] = fork();
+        if (!lPids[p]) {
+            if (!lScoreboard.attach()) {
+                _exit(1);
+            }
+            for (unsigned i = 0; i < 10000; ++i) {
+                lScoreboard.add(SB_OUT, 1);
+            }
+            lScoreboard.set(SB_QUEUED, 4);
+            // Exits without detaching, as a crashed process would
+            _exit(0);
+        }
+    }
+    for (unsigned p = 0; p < 2; ++p) {
+        int lStatus;
+        waitpid(lPids[p], &lStatus, 0);
+        CPPUNIT_ASSERT_EQUAL(0, WEXITSTATUS(lStatus));
+    }
+    // Their counters are kept, not their current values
+    unsigned long long lTotals[SB_VALUE_COUNT];
+    CPPUNIT_ASSERT_EQUAL(0U, lScoreboard.aggregate(lTotals));
+    CPPUNIT_ASSERT_EQUAL_ULL(20000, lTotals[SB_OUT]);
+    CPPUNIT_ASSERT_EQUAL_ULL(0, lTotals[SB_QUEUED]);
+
+    // Their slots can be taken over
+    CPPUNIT_ASSERT(lScoreboard.attach());
+    lScoreboard.add(SB_OUT, 1);
+    CPPUNIT_ASSERT_EQUAL(1U, lScoreboard.aggregate(lTotals));
+    CPPUNIT_ASSERT_EQUAL_ULL(20001, lTotals[SB_OUT]);
+    lScoreboard.detach();
+    apr_pool_destroy(lPool);
+}
+
+void TestScoreboard::takeOverTotals()
+{
+    apr_pool_t *lPool;
+    apr_pool_create(&lPool, 0);
+    Scoreboard lScoreboard;
+    lScoreboard.create(lPool, 1);
+
+    // A process publishes its totals twice, then dies
+    pid_t lPid = fork();
+    if (!lPid) {
+        if (!lScoreboard.attach()) {
+            _exit(1);
+        }
+        lScoreboard.addTotal(SB_TIMEOUT, 5);
+        lScoreboard.addTotal(SB_TIMEOUT, 8);
+        _exit(0);
+    }
+    int lStatus;
+    waitpid(lPid, &lStatus, 0);
+    CPPUNIT_ASSERT_EQUAL(0, WEXITSTATUS(lStatus));
+    unsigned long long lTotals[SB_VALUE_COUNT];
+    lScoreboard.aggregate(lTotals);
+    CPPUNIT_ASSERT_EQUAL_ULL(8, lTotals[SB_TIMEOUT]);
+
+    // The next owner of its slot adds its own totals to it, the server total never goes down
+    CPPUNIT_ASSERT(lScoreboard.attach());
+    lScoreboard.addTotal(SB_TIMEOUT, 2);
+    lScoreboard.aggregate(lTotals);
+    CPPUNIT_ASSERT_EQUAL_ULL(10, lTotals[SB_TIMEOUT]);
+    lScoreboard.addTotal(SB_TIMEOUT, 3);
+    lScoreboard.aggregate(lTotals);
+    CPPUNIT_ASSERT_EQUAL_ULL(11, lTotals[SB_TIMEOUT]);
+    lScoreboard.detach();
+    apr_pool_destroy(lPool);
+}
@@ -0,0 +1,245 @@
+/*
+* mod_dup - duplicates apache requests
+* 
+* Copyright (C) 2013 Orange
+* 
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include "ShmRing.hh"
+#include "RequestInfo.hh"
+#include "testShmRing.hh"
+
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// cppunit
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/ui/text/TestRunner.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+CPPUNIT_TEST_SUITE_REGISTRATION( TestShmRing );
+
+#define CPPUNIT_ASSERT_EQUAL_UINT(a, b) CPPUNIT_ASSERT_EQUAL(static_cast<unsigned int>(a), static_cast<unsigned int>(b))
+
+using namespace DupModule;
+
+static bool pushString(ShmRing &pRing, const std::string &pValue)
+{
+    struct iovec lPart;
+    lPart.iov_base = const_cast<char *>(pValue.data());
+    lPart.iov_len = pValue.size();
+    return pRing.push(&lPart, 1);
+}
+
+void TestShmRing::pushPop()
+{
+    apr_pool_t *lPool;
+    apr_pool_create(&lPool, 0);
+    ShmRing lRing;
+    CPPUNIT_ASSERT_EQUAL(APR_SUCCESS, lRing.create(lPool, 64));
+
+    std::string lRecord;
+    CPPUNIT_ASSERT(!lRing.pop(lRecord));
+
+    // A record made of several parts comes out in one piece
+    struct iovec lParts[2];
+    lParts[0].iov_base = const_cast<char *>("abc");
+    lParts[0].iov_len = 3;
+    lParts[1].iov_base = const_cast<char *>("def");
+    lParts[1].iov_len = 3;
+    CPPUNIT_ASSERT(lRing.push(lParts, 2));
+    CPPUNIT_ASSERT(pushString(lRing, ""));
+    CPPUNIT_ASSERT(pushString(lRing, "ghi"));
+    CPPUNIT_ASSERT(lRing.pop(lRecord));
+    CPPUNIT_ASSERT_EQUAL(std::string("abcdef"), lRecord);
+    CPPUNIT_ASSERT(lRing.pop(lRecord));
+    CPPUNIT_ASSERT_EQUAL(std::string(), lRecord);
+    CPPUNIT_ASSERT(lRing.pop(lRecord));
+    CPPUNIT_ASSERT_EQUAL(std::string("ghi"), lRecord);
+    CPPUNIT_ASSERT(!lRing.pop(lRecord));
+    CPPUNIT_ASSERT_EQUAL_UINT(0, lRing.used());
+
+    // What does not fit is dropped and counted
+    // A record takes its 8 bytes tag, and is padded to 8 bytes
+    CPPUNIT_ASSERT(pushString(lRing, std::string(56, 'x')));
+    CPPUNIT_ASSERT(!pushString(lRing, "y"));
+    CPPUNIT_ASSERT(!pushString(lRing, std::string(100, 'z')));
+    CPPUNIT_ASSERT_EQUAL_UINT(2, lRing.getDropCount());
+    CPPUNIT_ASSERT_EQUAL_UINT(0, lRing.getDropCount());
+    CPPUNIT_ASSERT(lRing.pop(lRecord));
+    CPPUNIT_ASSERT_EQUAL(std::string(56, 'x'), lRecord);
+    apr_pool_destroy(lPool);
+}
+
+void TestShmRing::wrapAround()
+{
+    apr_pool_t *lPool;
+    apr_pool_create(&lPool, 0);
+    ShmRing lRing;
+    lRing.create(lPool, 50);
+
+    // Records of odd sizes end up split at every possible offset
+    std::string lRecord;
+    for (unsigned i = 0; i < 200; ++i) {
+        std::string lValue(i % 13 + 1, 'a' + i % 26);
+        CPPUNIT_ASSERT(pushString(lRing, lValue));
+        CPPUNIT_ASSERT(pushString(lRing, lValue + "!"));
+        CPPUNIT_ASSERT(lRing.pop(lRecord));
+        CPPUNIT_ASSERT_EQUAL(lValue, lRecord);
+        CPPUNIT_ASSERT(lRing.pop(lRecord));
+        CPPUNIT_ASSERT_EQUAL(lValue + "!", lRecord);
+    }
+    CPPUNIT_ASSERT_EQUAL_UINT(0, lRing.getDropCount());
+    apr_pool_destroy(lPool);
+}
+
+void TestShmRing::multiProcess()
+{
+    apr_pool_t *lPool;
+    apr_pool_create(&lPool, 0);
+    ShmRing lRing;
+    lRing.create(lPool, 1024 * 1024);
+
+    // Several processes write at once, each record must come out whole
+    static const unsigned lProcesses = 4;
+    static const unsigned lRecords = 1000;
+    pid_t lPids[lProcesses];
+    for (unsigned p = 0; p < lProcesses; ++p) {
+        lPids[p] = fork();
+        if (!lPids[p]) {
+            for (unsigned i = 0; i < lRecords; ++i) {
+                pushString(lRing, std::string(i % 50 + 1, 'a' + p));
+            }
+            _exit(0);
+        }
+    }
+    for (unsigned p = 0; p < lProcesses; ++p) {
+        waitpid(lPids[p], NULL, 0);
+    }
+
+    unsigned lCounts[lProcesses] = {0};
+    std::string lRecord;
+    while (lRing.pop(lRecord)) {
+        CPPUNIT_ASSERT(!lRecord.empty());
+        unsigned p = lRecord[0] - 'a';
+        CPPUNIT_ASSERT(p < lProcesses);
+        // Records of a process come out in order
+        CPPUNIT_ASSERT_EQUAL(std::string(lCounts[p] % 50 + 1, lRecord[0]), lRecord);
+        ++lCounts[p];
+    }
+    for (unsigned p = 0; p < lProcesses; ++p) {
+        CPPUNIT_ASSERT_EQUAL(lRecords, lCounts[p]);
+    }
+    CPPUNIT_ASSERT_EQUAL_UINT(0, lRing.getDropCount());
+    apr_pool_destroy(lPool);
+}
+
+void TestShmRing::waitForRecord()
+{
+    apr_pool_t *lPool;
+    apr_pool_create(&lPool, 0);
+    ShmRing lRing;
+    lRing.create(lPool, 4096);
+
+    std::string lRecord;
+    CPPUNIT_ASSERT(!lRing.pop(lRecord, 20));
+
+    // A consumer waiting is woken up by the record of another process
+    pid_t lPid = fork();
+    if (!lPid) {
+        usleep(50000);
+        pushString(lRing, "late");
+        _exit(0);
+    }
+    CPPUNIT_ASSERT(lRing.pop(lRecord, 10000));
+    CPPUNIT_ASSERT_EQUAL(std::string("late"), lRecord);
+    waitpid(lPid, NULL, 0);
+    apr_pool_destroy(lPool);
+}
+
+void TestShmRing::deadProcess()
+{
+    apr_pool_t *lPool;
+    apr_pool_create(&lPool, 0);
+    ShmRing lRing;
+    lRing.create(lPool, 4096);
+
+    CPPUNIT_ASSERT(pushString(lRing, "before"));
+    // A process crashes in the middle of the copy of its record, after reserving it
+    pid_t lPid = fork();
+    if (!lPid) {
+        signal(SIGSEGV, SIG_DFL);
+        struct iovec lParts[2];
+        lParts[0].iov_base = const_cast<char *>("abc");
+        lParts[0].iov_len = 3;
+        lParts[1].iov_base = NULL;
+        lParts[1].iov_len = 10;
+        lRing.push(lParts, 2);
+        _exit(0);
+    }
+    int lStatus;
+    waitpid(lPid, &lStatus, 0);
+    CPPUNIT_ASSERT(WIFSIGNALED(lStatus));
+    CPPUNIT_ASSERT(pushString(lRing, "after"));
+
+    // Its record is skipped and counted as dropped, the others go through
+    std::string lRecord;
+    CPPUNIT_ASSERT(lRing.pop(lRecord));
+    CPPUNIT_ASSERT_EQUAL(std::string("before"), lRecord);
+    CPPUNIT_ASSERT(lRing.pop(lRecord));
+    CPPUNIT_ASSERT_EQUAL(std::string("after"), lRecord);
+    CPPUNIT_ASSERT(!lRing.pop(lRecord));
+    CPPUNIT_ASSERT_EQUAL_UINT(1, lRing.getDropCount());
+    CPPUNIT_ASSERT_EQUAL_UINT(0, lRing.used());
+    apr_pool_destroy(lPool);
+}
+
+void TestShmRing::serialize()
+{
+    apr_pool_t *lPool;
+    apr_pool_create(&lPool, 0);
+    ShmRing lRing;
+    lRing.create(lPool, 4096);
+
+    std::string lBody("a body");
+    RequestInfo lInfo("/conf", "/path", "a=b&c=d", &lBody);
+    lInfo.mStatus = 503;
+    lInfo.mDuration = 1234567;
+    lInfo.mFiltered = true;
+    tSerializedHeader lHeader;
+    struct iovec lParts[SERIALIZED_PARTS];
+    lInfo.serialize(lHeader, lParts);
+    CPPUNIT_ASSERT(lRing.push(lParts, SERIALIZED_PARTS));
+
+    std::string lRecord;
+    CPPUNIT_ASSERT(lRing.pop(lRecord));
+    RequestInfo lCopy;
+    CPPUNIT_ASSERT(lCopy.deserialize(lRecord.data(), lRecord.size()));
+    CPPUNIT_ASSERT_EQUAL(std::string("/conf"), lCopy.mConfPath);
+    CPPUNIT_ASSERT_EQUAL(std::string("/path"), lCopy.mPath);
+    CPPUNIT_ASSERT_EQUAL(std::string("a=b&c=d"), lCopy.mArgs);
+    CPPUNIT_ASSERT_EQUAL(lBody, lCopy.mBody);
+    CPPUNIT_ASSERT_EQUAL(503, lCopy.mStatus);
+    CPPUNIT_ASSERT_EQUAL(1234567LL, lCopy.mDuration);
+    CPPUNIT_ASSERT(lCopy.mFiltered);
+    CPPUNIT_ASSERT(!lCopy.isPoison());
+
+    // Truncated or inconsistent records are rejected
+    RequestInfo lBad;
+    CPPUNIT_ASSERT(!lBad.deserialize(lRecord.data(), sizeof(tSerializedHeader) - 1));
+    CPPUNIT_ASSERT(!lBad.deserialize(lRecord.data(), lRecord.size() - 1));
+    CPPUNIT_ASSERT(lBad.mPath.empty());
+    apr_pool_destroy(lPool);
+}
@@ -19,6 +19,7 @@
 #include <httpd.h>
 
 #include "ThreadPool.hh"
+#include "PoolScaler.hh"
 #include "MultiThreadQueue.hh"
 #include "testThreadPool.hh"
 
@@ -84,3 +85,209 @@ void TestThreadPool::run()
 
 	pool.stop();
 }
+
+void TestThreadPool::scaler()
+{
+	// Simulated clock, in micro sec
+	unsigned long long lNow = 0;
+	PoolScaler lScaler;
+	lScaler.setThreads(1, 8);
+	lScaler.setQueue(1, 10);
+	lScaler.setShrink(200000, 100000);
+
+	// Nothing to do
+	CPPUNIT_ASSERT_EQUAL(0, lScaler.decide(lNow, 5, 1, 0));
+
+	// A burst gets all the threads it needs in one decision: the pool reacts within a single step
+	CPPUNIT_ASSERT_EQUAL(5, lScaler.decide(lNow, 55, 1, 0));
+	// Never beyond the maximum
+	CPPUNIT_ASSERT_EQUAL(7, lScaler.decide(lNow, 1000, 1, 0));
+	CPPUNIT_ASSERT_EQUAL(0, lScaler.decide(lNow, 1000, 8, 0));
+	// Threads being killed are replaced, but still count against the maximum
+	CPPUNIT_ASSERT_EQUAL(1, lScaler.decide(lNow, 1000, 8 - 1, 1));
+
+	// The queue empties: nothing happens before the shrink delay
+	CPPUNIT_ASSERT_EQUAL(0, lScaler.decide(lNow, 0, 8, 0));
+	lNow += 150000;
+	CPPUNIT_ASSERT_EQUAL(0, lScaler.decide(lNow, 0, 8, 0));
+	// A new item in between resets the delay
+	CPPUNIT_ASSERT_EQUAL(0, lScaler.decide(lNow, 8, 8, 0));
+	lNow += 100000;
+	CPPUNIT_ASSERT_EQUAL(0, lScaler.decide(lNow, 0, 8, 0));
+	lNow += 199999;
+	CPPUNIT_ASSERT_EQUAL(0, lScaler.decide(lNow, 0, 8, 0));
+	lNow += 1;
+	CPPUNIT_ASSERT_EQUAL(-1, lScaler.decide(lNow, 0, 8, 0));
+	// Then one thread per shrink interval
+	lNow += 50000;
+	CPPUNIT_ASSERT_EQUAL(0, lScaler.decide(lNow, 0, 8, 1));
+	lNow += 50000;
+	CPPUNIT_ASSERT_EQUAL(-1, lScaler.decide(lNow, 0, 7, 0));
+	lNow += 100000;
+	CPPUNIT_ASSERT_EQUAL(-1, lScaler.decide(lNow, 0, 6, 0));
+
+	// Down to the minimum only
+	lNow += 10000000;
+	CPPUNIT_ASSERT_EQUAL(0, lScaler.decide(lNow, 0, 1, 0));
+}
+
+void TestThreadPool::adaptiveScaler()
+{
+	// Simulated clock and busy time, in micro sec
+	unsigned long long lNow = 1000000;
+	unsigned long long lBusy = 0;
+	PoolScaler lScaler;
+	lScaler.setThreads(2, 16);
+	lScaler.setQueue(1, 100);
+	lScaler.setShrink(200000, 100000);
+	lScaler.setPolicy(ADAPTIVE_SCALING);
+
+	// First report: no estimate yet
+	CPPUNIT_ASSERT_EQUAL(0, lScaler.decide(lNow, 2, 2, 0, lBusy));
+	CPPUNIT_ASSERT(lScaler.getLoad() < 0);
+
+	// The destination slows down: 2 threads busy all the time, nothing queued yet beyond the queue threshold
+	lNow += 100000;
+	lBusy += 2 * 100000;
+	int lChange = lScaler.decide(lNow, 50, 2, 0, lBusy);
+	CPPUNIT_ASSERT_EQUAL(2.0, lScaler.getLoad());
+	// 2 busy threads at 80% utilization at most need 3 threads
+	CPPUNIT_ASSERT_EQUAL(1, lChange);
+
+	// Then 6 threads worth of work: the estimate follows within a few samples
+	unsigned lThreads = 3;
+	for (int i = 0; i < 6; ++i) {
+		lNow += 100000;
+		lBusy += 6 * 100000;
+		lThreads += lScaler.decide(lNow, 50, lThreads, 0, lBusy);
+	}
+	CPPUNIT_ASSERT(lScaler.getLoad() > 5.8);
+	CPPUNIT_ASSERT_EQUAL_UINT(8, lThreads);
+
+	// Fast destination: the surplus goes by halves once the delay is over
+	for (int i = 0; i < 10; ++i) {
+		lNow += 100000;
+		lBusy += 50000;
+		lThreads += lScaler.decide(lNow, 0, lThreads, 0, lBusy);
+	}
+	CPPUNIT_ASSERT(lScaler.getLoad() < 1);
+	CPPUNIT_ASSERT_EQUAL_UINT(2, lThreads);
+
+	// A burst still gets the queue threshold reaction
+	lNow += 1000;
+	CPPUNIT_ASSERT_EQUAL(3, lScaler.decide(lNow, 500, 2, 0, lBusy));
+}
+
+void TestThreadPool::reactToPush()
+{
+	count = 0;
+	ThreadPool<int> pool(&worker, POISON);
+	pool.setQueue(1, 10);
+	pool.setThreads(1, 4);
+	pool.start();
+	// Let the manager settle in its periodic wait
+	usleep(20000);
+	CPPUNIT_ASSERT_EQUAL_UINT(1, pool.getThreadCount());
+
+	for (int i=0; i<100; ++i)
+		pool.push(5000);
+
+	// Well before the next periodic check
+	usleep(30000);
+	CPPUNIT_ASSERT_EQUAL_UINT(4, pool.getThreadCount());
+
+	pool.stop();
+}
+
+void TestThreadPool::drain()
+{
+	// Every item gets sent within the deadline
+	count = 0;
+	{
+		ThreadPool<int> pool(&worker, POISON);
+		pool.setQueue(1000, 2000);
+		pool.setThreads(2, 2);
+		pool.setDrainTimeout(1000000);
+		pool.start();
+		for (int i=0; i<100; ++i)
+			pool.push(1000);
+		pool.stop();
+		CPPUNIT_ASSERT_EQUAL(100, count);
+		CPPUNIT_ASSERT_EQUAL_UINT(0, pool.getThreadCount());
+	}
+
+	// Deadline exceeded: the rest is dropped, the stop does not wait for it
+	count = 0;
+	{
+		ThreadPool<int> pool(&worker, POISON);
+		pool.setQueue(1000, 2000);
+		pool.setThreads(2, 2);
+		pool.setDrainTimeout(50000);
+		pool.start();
+		for (int i=0; i<100; ++i)
+			pool.push(20000);
+		boost::posix_time::ptime lStart = boost::posix_time::microsec_clock::universal_time();
+		pool.stop();
+		boost::posix_time::time_duration lElapsed = boost::posix_time::microsec_clock::universal_time() - lStart;
+		CPPUNIT_ASSERT(count < 100);
+		// Deadline, the item being processed by each thread and an error margin
+		CPPUNIT_ASSERT(lElapsed.total_milliseconds() < 50 + 20 + 100);
+		CPPUNIT_ASSERT_EQUAL_UINT(0, pool.getThreadCount());
+	}
+
+	// A full ring leaves no room for the pills: the deadline still holds
+	count = 0;
+	{
+		ThreadPool<int> pool(&worker, POISON);
+		pool.setQueue(1, 2);
+		pool.setThreads(2, 2);
+		pool.setQueueBackend(LOCK_FREE_RING);
+		pool.setDrainTimeout(50000);
+		pool.start();
+		// Each thread takes one, then the ring is filled up
+		pool.push(300000);
+		pool.push(300000);
+		usleep(20000);
+		for (int i=0; i<10; ++i)
+			pool.push(300000);
+		boost::posix_time::ptime lStart = boost::posix_time::microsec_clock::universal_time();
+		pool.stop();
+		boost::posix_time::time_duration lElapsed = boost::posix_time::microsec_clock::universal_time() - lStart;
+		// Deadline, the item being processed by each thread and an error margin, not the items queued
+		CPPUNIT_ASSERT(lElapsed.total_milliseconds() < 50 + 300 + 100);
+		CPPUNIT_ASSERT_EQUAL(2, count);
+		CPPUNIT_ASSERT_EQUAL_UINT(0, pool.getThreadCount());
+	}
+}
+
+static tPoolCounters gListened;
+
+static void listener(const tPoolCounters &pCounters)
+{
+	gListened.mIn += pCounters.mIn;
+	gListened.mOut += pCounters.mOut;
+	gListened.mThreads = pCounters.mThreads;
+	gListened.mQueued = pCounters.mQueued;
+}
+
+void TestThreadPool::countersListener()
+{
+	// The listener gets the increments of the counters, and the current sizes
+	count = 0;
+	gListened = tPoolCounters();
+	ThreadPool<int> pool(&worker, POISON);
+	pool.setQueue(1000, 2000);
+	pool.setThreads(2, 2);
+	pool.setCountersListener(&listener);
+	pool.start();
+	for (int i=0; i<50; ++i)
+		pool.push(100);
+	// A few checks of the threads after the items are sent
+	usleep(400000);
+	CPPUNIT_ASSERT_EQUAL(50, count);
+	CPPUNIT_ASSERT_EQUAL_UINT(50, gListened.mIn);
+	CPPUNIT_ASSERT_EQUAL_UINT(50, gListened.mOut);
+	CPPUNIT_ASSERT_EQUAL_UINT(2, gListened.mThreads);
+	CPPUNIT_ASSERT_EQUAL_UINT(0, gListened.mQueued);
+	pool.stop();
+}
@@ -30,8 +30,18 @@ class TestThreadPool :
 
     CPPUNIT_TEST_SUITE(TestThreadPool);
     CPPUNIT_TEST(run);
+    CPPUNIT_TEST(scaler);
+    CPPUNIT_TEST(adaptiveScaler);
+    CPPUNIT_TEST(reactToPush);
+    CPPUNIT_TEST(drain);
+    CPPUNIT_TEST(countersListener);
     CPPUNIT_TEST_SUITE_END();
 
 public:
     void run();
+    void scaler();
+    void adaptiveScaler();
+    void reactToPush();
+    void drain();
+    void countersListener();
 };
@@ -16,10 +16,14 @@
 * limitations under the License.
 */
 
+#include <boost/algorithm/string/replace.hpp>
 #include <boost/scoped_ptr.hpp>
+#include <httpd.h>
+#include <sstream>
 
 #include "UrlCodec.hh"
 #include "testUrlCodec.hh"
+#include "urlCodec.hh"
 
 // cppunit
 #include <cppunit/extensions/TestFactoryRegistry.h>
@@ -115,3 +119,65 @@ void TestUrlCodec::testDefaultCodec()
 	CPPUNIT_ASSERT_EQUAL(std::string("!#$&'()*+,/:;=?@[] \"%-.<>\\^_`{|}~"),
 			urlCodec->decode(urlCodec->encode(lPool, "!#$&'()*+,/:;=?@[] \"%-.<>\\^_`{|}~")));
 }
+
+/**
+ * @brief The decoding of the codecs before they were rewritten in a single pass, on Apache functions
+ */
+static std::string
+apacheDecode(const std::string &pIn, bool pPlusAsSpace)
+{
+	std::string lIn = pPlusAsSpace ? boost::replace_all_copy(pIn, "+", " ") : pIn;
+	std::vector<char> lBuffer(lIn.c_str(), lIn.c_str() + lIn.size() + 1);
+	ap_unescape_url(&lBuffer[0]);
+	return std::string(&lBuffer[0]);
+}
+
+/**
+ * @brief The encoding of the codecs before they were rewritten in a single pass, on Apache functions
+ */
+static std::string
+apacheEncode(apr_pool_t *pPool, const std::string &pIn, bool pEscapePlus)
+{
+	std::string lEncoded(ap_escape_path_segment(pPool, pIn.c_str()));
+	return pEscapePlus ? boost::replace_all_copy(lEncoded, "+", "%2b") : lEncoded;
+}
+
+void TestUrlCodec::testApacheCompatibility()
+{
+    apr_pool_t *lPool;
+    apr_pool_create(&lPool, 0);
+
+	boost::scoped_ptr<const IUrlCodec> lApache(getUrlCodec("apache"));
+	boost::scoped_ptr<const IUrlCodec> lDefault(getUrlCodec("default"));
+
+	// Bad escapes are kept, the text ends at the first NUL
+	CPPUNIT_ASSERT_EQUAL(std::string("%g1%2 %"), lDefault->decode("%g1%2+%"));
+	CPPUNIT_ASSERT_EQUAL(std::string("a"), lDefault->decode(std::string("a\0%41", 5)));
+	CPPUNIT_ASSERT_EQUAL(std::string("a"), lApache->decode("a%00b"));
+	CPPUNIT_ASSERT_EQUAL(std::string("a"), lApache->encode(lPool, std::string("a\0b", 3)));
+
+	// Random texts, long enough for the vectorized runs, made of the bytes each step handles differently
+	static const char lAlphabet[] = "%%%++aZ09-._~/ &=?#\xe9\x7f\x80\n\0fFgG2";
+	unsigned lSeed = 42;
+	for (unsigned i = 0; i < 20000; ++i) {
+		std::string lText;
+		size_t lSize = i % 80;
+		for (size_t j = 0; j < lSize; ++j) {
+			lSeed = lSeed * 1103515245 + 12345;
+			// Mostly plain letters, so that runs without escape get long
+			lText += (lSeed >> 16) % 4 ? char('a' + (lSeed >> 20) % 26) : lAlphabet[(lSeed >> 20) % (sizeof(lAlphabet) - 1)];
+		}
+		CPPUNIT_ASSERT_EQUAL(apacheDecode(lText, false), lApache->decode(lText));
+		CPPUNIT_ASSERT_EQUAL(apacheDecode(lText, true), lDefault->decode(lText));
+		CPPUNIT_ASSERT_EQUAL(apacheEncode(lPool, lText, false), lApache->encode(lPool, lText));
+		CPPUNIT_ASSERT_EQUAL(apacheEncode(lPool, lText, true), lDefault->encode(lPool, lText));
+
+		// The default codec decodes its own output, and any form encoding, like the reference of urlCodec.cc
+		std::string lPlain = lText.substr(0, lText.find('\0'));
+		CPPUNIT_ASSERT_EQUAL(lPlain, lDefault->decode(lDefault->encode(lPool, lText)));
+		std::istringstream lIn(lPlain);
+		std::ostringstream lFormEncoded;
+		urlEncode(lFormEncoded, lIn);
+		CPPUNIT_ASSERT_EQUAL(lPlain, lDefault->decode(lFormEncoded.str()));
+	}
+}
@@ -32,10 +32,12 @@ class TestUrlCodec :
     CPPUNIT_TEST(testUrlCodec);
     CPPUNIT_TEST(testApacheCodec);
     CPPUNIT_TEST(testDefaultCodec);
+    CPPUNIT_TEST(testApacheCompatibility);
     CPPUNIT_TEST_SUITE_END();
 
 public:
     void testUrlCodec();
 	void testApacheCodec();
 	void testDefaultCodec();
+	void testApacheCompatibility();
 };